@@ -25,6 +25,7 @@
 #define VENDOR_SPECIFIC                                         0xFFU
 
 #define CS_INTERFACE                                            0x24U
+#define CDC_UNION_TYPE                                          0x06U
 #define CDC_PAGE_SIZE_64                                        0x40U
 
 // Class-Specific Request Codes
@@ -77,6 +78,39 @@
 
 #define LINE_CODING_STRUCTURE_SIZE                              0x07U
 
+// stall_mask bits: data endpoints waiting for CLEAR_FEATURE(ENDPOINT_HALT)
+#define CDC_STALL_OUT                                           0x01U
+#define CDC_STALL_IN                                            0x02U
+#define CDC_STALL_NOTIF                                         0x04U
+
+// Notification codes (PSTN 6.5)
+#define CDC_NOTIFY_NETWORK_CONNECTION                           0x00U
+#define CDC_NOTIFY_RESPONSE_AVAILABLE                           0x01U
+#define CDC_NOTIFY_SERIAL_STATE                                 0x20U
+#define CDC_NOTIFY_HEADER_SIZE                                  0x08U
+#define CDC_NOTIF_BUFFER_SIZE                                   16U
+
+// SERIAL_STATE bitmap
+#define CDC_SERIAL_STATE_DCD                                    0x0001U // bRxCarrier
+#define CDC_SERIAL_STATE_DSR                                    0x0002U // bTxCarrier
+#define CDC_SERIAL_STATE_BREAK                                  0x0004U
+#define CDC_SERIAL_STATE_RING                                   0x0008U
+#define CDC_SERIAL_STATE_FRAMING                                0x0010U
+#define CDC_SERIAL_STATE_PARITY                                 0x0020U
+#define CDC_SERIAL_STATE_OVERRUN                                0x0040U
+
+// ACM functions bound by CDC_Class on one device (dual UARTs, modems, probes)
+#ifndef USBH_CDC_MAX_PORTS
+#define USBH_CDC_MAX_PORTS                                      4U
+#endif
+
+// stream mode: a packet which doesn't fit before the end of the rx ring is
+// received here & copied in. must be >= the IN endpoint size: the default
+// covers HS bulk, full speed only hosts may lower it to 64
+#ifndef CDC_STREAM_BOUNCE_SIZE
+#define CDC_STREAM_BOUNCE_SIZE                                  512U
+#endif
+
 // States for CDC State Machine
 typedef enum{
   CDC_IDLE = 0U,
@@ -84,16 +118,30 @@ typedef enum{
   CDC_SEND_DATA_WAIT,
   CDC_RECEIVE_DATA,
   CDC_RECEIVE_DATA_WAIT,
+  CDC_RECEIVE_DATA_HALT, // idle timeout: waiting for the IN channel to halt
 } CDC_DataStateTypeDef;
 
+typedef enum{
+  CDC_NOTIF_OFF = 0U, // no interrupt endpoint
+  CDC_NOTIF_GET,
+  CDC_NOTIF_WAIT,
+  CDC_NOTIF_POLL,
+} CDC_NotifStateTypeDef;
+
 typedef enum{
   CDC_IDLE_STATE = 0U,
-  CDC_SET_LINE_CODING_STATE,
-  CDC_GET_LAST_LINE_CODING_STATE,
   CDC_TRANSFER_DATA,
   CDC_ERROR_STATE,
 } CDC_StateTypeDef;
 
+// EP0 requests issued alongside the data path
+typedef enum{
+  CDC_CTL_IDLE = 0U,
+  CDC_CTL_SET_LINE_CODING,
+  CDC_CTL_GET_LINE_CODING,
+  CDC_CTL_SET_LINE_STATE,
+} CDC_CtlStateTypeDef;
+
 // Line coding structure
 typedef union _CDC_LineCodingStructure{
   uint8_t Array[LINE_CODING_STRUCTURE_SIZE];
@@ -243,12 +291,66 @@ typedef struct _USBH_CDCInterfaceDesc{
   CDC_UnionFuncDesc_TypeDef            CDC_UnionFuncDesc;
 } CDC_InterfaceDesc_Typedef;
 
+// single-producer single-consumer byte ring (stream mode)
+// indices run freely & are masked on access. size must be a power of 2
+typedef struct{
+  uint8_t*             buf;
+  uint32_t             size;
+  volatile uint32_t    head;  // written by the producer
+  volatile uint32_t    tail;  // written by the consumer
+} CDC_RingTypeDef;
+
+typedef enum{
+  CDC_TX_PENDING = 0U, // queued or on the wire
+  CDC_TX_DONE,
+  CDC_TX_ERROR,        // the OUT endpoint halted & could not be cleared
+  CDC_TX_ABORTED,      // USBH_CDC_Stop or device removal
+} CDC_TxStatusTypeDef;
+
+// queued transmit buffer. owned by the driver from USBH_CDC_TransmitQueue
+// until its callback runs. buffers are sent back to back, in order.
+struct _CDC_Process;
+typedef struct _CDC_TxDesc{
+  uint8_t*             pbuff;
+  uint32_t             length;
+  void(*callback)(USBH_HandleTypeDef* phost, struct _CDC_Process* hcdc, struct _CDC_TxDesc* desc);
+  void*                ctx;   // for the application
+  CDC_TxStatusTypeDef  status;
+  struct _CDC_TxDesc*  next;  // driver private
+} CDC_TxDescTypeDef;
+
+struct _CDC_Framer;
+
+// hooks for vendor serial bridges which reuse the CDC data path (see
+// usbh_cdc_vcp.h). SetLineCoding & SetControlLineState are polled until they
+// stop returning BUSY.
+// RxFilter strips any in-band status from one received packet in place &
+// returns the remaining payload length.
+typedef struct{
+  USBH_StatusTypeDef(*SetLineCoding)(USBH_HandleTypeDef* phost, struct _CDC_Process* hcdc, CDC_LineCodingTypeDef* linecoding);
+  USBH_StatusTypeDef(*SetControlLineState)(USBH_HandleTypeDef* phost, struct _CDC_Process* hcdc, uint16_t lines);
+  uint32_t(*RxFilter)(USBH_HandleTypeDef* phost, struct _CDC_Process* hcdc, uint8_t* pkt, uint32_t length);
+} CDC_VendorOpsTypeDef;
+
+// Line & connection state reported on the notification endpoint
+typedef struct{
+  uint16_t             serial_state;        // last SERIAL_STATE bitmap
+  uint8_t              network_connected;
+  uint32_t             responses_available;
+  uint32_t             breaks;
+  uint32_t             rings;
+  uint32_t             framing_errors;
+  uint32_t             parity_errors;
+  uint32_t             overruns;
+} CDC_LineStateTypeDef;
+
 // Structure for CDC process
 typedef struct{
   uint8_t              NotifPipe;
   uint8_t              NotifEp;
-  uint8_t              buff[8];
+  uint8_t              buff[CDC_NOTIF_BUFFER_SIZE];
   uint16_t             NotifEpSize;
+  uint16_t             NotifPoll;   // polling interval in (micro)frames
 } CDC_CommItfTypedef;
 
 typedef struct{
@@ -272,30 +374,109 @@ typedef struct _CDC_Process{
   CDC_InterfaceDesc_Typedef         CDC_Desc;
   CDC_LineCodingTypeDef             LineCoding;
   CDC_LineCodingTypeDef             *pUserLineCoding;
+  CDC_CtlStateTypeDef               ctl_state;
+  CDC_LineCodingTypeDef             LineCodingReq;   // latest requested
+  CDC_LineCodingTypeDef             LineCodingTx;    // data stage of the SET in flight
+  uint8_t                           line_pending;    // LineCodingReq waits for EP0
+  uint8_t                           line_verify;     // GET_LINE_CODING after each SET
+  uint16_t                          ctl_lines;       // DTR/RTS last applied
+  uint16_t                          ctl_lines_req;
+  uint8_t                           ctrl_valid;      // ctl_lines holds the device's setting
+  uint8_t                           ctrl_pending;    // ctl_lines_req waits for EP0
+  uint8_t                           ctl_hold;        // another port owns EP0
   CDC_StateTypeDef                  state;
   CDC_DataStateTypeDef              data_tx_state;
   CDC_DataStateTypeDef              data_rx_state;
   uint8_t                           Rx_Poll;
+  uint8_t                           itf_num;     // control interface: wIndex of class requests
+  uint8_t                           line_valid;  // LineCoding holds the device's setting
+  uint8_t                           ctl_active;  // mid control request on EP0
+  uint32_t                          rx_total;    // payload bytes, for throughput
+  uint32_t                          tx_total;
+  struct _CDC_Process*              next;        // next port of the same device
+  uint8_t                           port_rr;     // port 0 only: Process start port
+  CDC_NotifStateTypeDef             notif_state;
+  uint32_t                          notif_timer;
+  CDC_LineStateTypeDef              line;
+  uint8_t                           stall_mask;
+  uint32_t                          stall_count; // halts cleared & resumed
+
+  // receive delivery
+  uint32_t                          RxReceived;      // bytes accumulated by the current Receive
+  uint16_t                          rx_idle_frames;  // deliver after this many quiet frames (0 = off)
+  volatile uint16_t                 rx_idle_count;
+  volatile uint8_t                  rx_idle_expired;
+  uint32_t                          rx_halt_timer;   // phost->Timer when the IN pipe was closed
+  uint8_t                           rx_delim_enable;
+  uint8_t                           rx_delim;
+  uint8_t*                          pRxBase;         // start of the current Receive buffer
+  struct _CDC_Framer*               framer;          // see usbh_cdc_framing.h
+
+  // vendor serial bridge (NULL for CDC-ACM)
+  const CDC_VendorOpsTypeDef*       vendor;
+  uint8_t                           vendor_chip;
+  uint8_t                           vendor_port;     // interface / channel index
+  uint8_t                           vendor_step;     // control sequence in progress
+  uint8_t                           vendor_buf[8];   // control data stage
+
+  // transmit queue
+  CDC_TxDescTypeDef*                tx_head;
+  CDC_TxDescTypeDef*                tx_tail;
+  CDC_TxDescTypeDef*                tx_active;  // queued buffer currently on the wire
+  uint8_t                           tx_zlp;     // terminate with a zero length packet
+  uint8_t                           tx_abort;   // Stop/DeInit is completing the queue as ABORTED
+
+  // stream mode
+  uint8_t                           stream;
+  uint8_t                           rx_direct;  // URB in flight targets rx_ring memory
+  uint32_t                          tx_chunk;   // bytes of tx_ring covered by the URB in flight
+  CDC_RingTypeDef                   rx_ring;
+  CDC_RingTypeDef                   tx_ring;
+  uint8_t                           rx_bounce[CDC_STREAM_BOUNCE_SIZE];
 } CDC_HandleTypeDef;
 
 extern USBH_ClassTypeDef  CDC_Class;
 #define USBH_CDC_CLASS    &CDC_Class
 
+// multi-port devices: CDC_Class's pData is port 0, the rest chain from it.
+// no ports (0, NULL) unless CDC_Class is the active class
+uint8_t USBH_CDC_FindPorts(USBH_HandleTypeDef* phost, uint8_t* itf_ctrl, uint8_t* itf_data, uint8_t max);
+uint8_t USBH_CDC_GetPortCount(USBH_HandleTypeDef* phost);
+CDC_HandleTypeDef* USBH_CDC_GetPort(USBH_HandleTypeDef* phost, uint8_t port);
+
 USBH_StatusTypeDef USBH_CDC_SetLineCoding(USBH_HandleTypeDef *phost, CDC_HandleTypeDef* hcdc, CDC_LineCodingTypeDef *linecoding);
 USBH_StatusTypeDef USBH_CDC_GetLineCoding(USBH_HandleTypeDef *phost, CDC_HandleTypeDef* hcdc, CDC_LineCodingTypeDef *linecoding);
+void USBH_CDC_SetLineCodingVerify(CDC_HandleTypeDef* hcdc, uint8_t enable);
+USBH_StatusTypeDef USBH_CDC_SetControlLineState(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint16_t lines);
 USBH_StatusTypeDef USBH_CDC_Transmit(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t *pbuff, uint32_t length);
 USBH_StatusTypeDef USBH_CDC_Receive(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t *pbuff, uint32_t length);
+USBH_StatusTypeDef USBH_CDC_TransmitQueue(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, CDC_TxDescTypeDef* desc);
 uint16_t USBH_CDC_GetLastReceivedDataSize(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
+uint32_t USBH_CDC_GetReceivedDataSize(CDC_HandleTypeDef* hcdc);
+void USBH_CDC_SetRxIdleTimeout(CDC_HandleTypeDef* hcdc, uint16_t frames);
+void USBH_CDC_SetRxDelimiter(CDC_HandleTypeDef* hcdc, uint8_t delimiter, uint8_t enable);
 USBH_StatusTypeDef USBH_CDC_Stop(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
 void USBH_CDC_LineCodingChanged(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
 void USBH_CDC_TransmitCallback(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
 void USBH_CDC_ReceiveCallback(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
+void USBH_CDC_NotificationCallback(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t notification);
+const CDC_LineStateTypeDef* USBH_CDC_GetLineState(CDC_HandleTypeDef* hcdc);
+
+// stream mode: UART-like byte API over rings. the IN pipe stays armed while
+// there is room, & written bytes drain in max-packet batches
+USBH_StatusTypeDef USBH_CDC_StreamStart(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t* rx_buf, uint32_t rx_size, uint8_t* tx_buf, uint32_t tx_size);
+void USBH_CDC_StreamStop(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
+uint32_t USBH_CDC_Read(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t* dst, uint32_t length);
+uint32_t USBH_CDC_Write(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, const uint8_t* src, uint32_t length);
+uint32_t USBH_CDC_Available(CDC_HandleTypeDef* hcdc);
+uint32_t USBH_CDC_WriteSpace(CDC_HandleTypeDef* hcdc);
 
 // SubDriver interface (for Composite Host)
 typedef struct{
   USBH_StatusTypeDef(*Init)(USBH_HandleTypeDef* phost, uint8_t itf_ctrl, uint8_t itf_data, void** hcdc);
   USBH_StatusTypeDef(*DeInit)(USBH_HandleTypeDef* phost, void* hcdc);
   USBH_StatusTypeDef(*Process)(USBH_HandleTypeDef* phost, void* hcdc);
+  USBH_StatusTypeDef(*SOFProcess)(USBH_HandleTypeDef* phost, void* hcdc);
 } USBH_CDC_SubDriverTypeDef;
 
 extern const USBH_CDC_SubDriverTypeDef USBH_CDC_SubDriver;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "usbh_cdc.h"
+
+// Packet framing over the CDC receive/transmit path
+//
+// Attach a framer with USBH_CDC_SetFramer & each completed Receive buffer is
+// decoded in place before USBH_CDC_ReceiveCallback runs. Complete frames are
+// handed to USBH_CDC_FrameCallback:
+//  - a frame lying within one receive buffer points straight into it
+//  - a frame spanning receives is gathered into the framer's buffer
+// Either way the pointer is only valid for the duration of the callback.
+// The receive buffer holds decoded (partial) data afterwards.
+//
+// Stream mode isn't decoded automatically: USBH_CDC_Read into a scratch
+// buffer & pass it to USBH_CDC_FramerFeed.
+
+typedef enum{
+  CDC_FRAMING_COBS = 0U,   // 0x00 terminated, consistent overhead byte stuffing
+  CDC_FRAMING_SLIP,        // RFC 1055. 0xC0 terminated
+  CDC_FRAMING_LENGTH,      // 16bit little-endian length, then payload
+} CDC_FramingTypeDef;
+
+#define CDC_SLIP_END                                            0xC0U
+#define CDC_SLIP_ESC                                            0xDBU
+#define CDC_SLIP_ESC_END                                        0xDCU
+#define CDC_SLIP_ESC_ESC                                        0xDDU
+
+// worst case encoded size of a length byte frame, including terminator
+#define CDC_COBS_BOUND(len)                                     ((len) + ((len) / 254U) + 2U)
+#define CDC_SLIP_BOUND(len)                                     (2U * (len) + 2U)
+#define CDC_LENGTH_BOUND(len)                                   ((len) + 2U)
+
+typedef struct _CDC_Framer{
+  CDC_FramingTypeDef   mode;
+  uint8_t*             buf;        // gathers frames spanning receives
+  uint32_t             size;       // & limits the decoded frame length
+  uint8_t*             txbuf;      // encode target for USBH_CDC_TransmitFrame
+  uint32_t             txsize;
+
+  // decoder state
+  uint32_t             len;        // decoded bytes of the current frame
+  uint8_t              gather;     // current frame lives in buf
+  uint8_t              discard;    // skip to the end of a bad frame
+  uint8_t              esc;        // SLIP: previous byte was ESC
+  uint8_t              code;       // COBS: bytes left in the block
+  uint8_t              zero;       // COBS: block ends in an implied zero
+  uint8_t              hdr;        // LENGTH: header bytes seen
+  uint16_t             remaining;  // LENGTH: payload bytes to come
+
+  uint32_t             frames;
+  uint32_t             errors;     // malformed or oversize frames dropped
+} CDC_FramerTypeDef;
+
+void USBH_CDC_FramerInit(CDC_FramerTypeDef* f, CDC_FramingTypeDef mode,
+                         uint8_t* buf, uint32_t size,
+                         uint8_t* txbuf, uint32_t txsize);
+void USBH_CDC_FramerReset(CDC_FramerTypeDef* f);
+
+// attach (or detach with NULL) a framer to the Receive path
+void USBH_CDC_SetFramer(CDC_HandleTypeDef* hcdc, CDC_FramerTypeDef* f);
+
+// decode length bytes of data in place, emitting frames as they complete
+void USBH_CDC_FramerFeed(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                         CDC_FramerTypeDef* f, uint8_t* data, uint32_t length);
+
+// encode a single frame. returns the encoded length, or 0 if it doesn't fit
+uint32_t USBH_CDC_FrameEncode(CDC_FramingTypeDef mode,
+                              const uint8_t* src, uint32_t length,
+                              uint8_t* dst, uint32_t max_length);
+
+// encode into the framer's txbuf & USBH_CDC_Transmit it
+USBH_StatusTypeDef USBH_CDC_TransmitFrame(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                          CDC_FramerTypeDef* f,
+                                          const uint8_t* src, uint32_t length);
+
+void USBH_CDC_FrameCallback(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                            uint8_t* frame, uint32_t length);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "usbh_cdc.h"
+
+// Vendor USB-serial bridges (FTDI, CP210x, CH34x, PL2303)
+//
+// Matched by VID/PID & driven through the CDC SubDriver, so pData is a plain
+// CDC_HandleTypeDef & the usual USBH_CDC_* calls (Transmit, Receive, stream
+// mode, framing, SetLineCoding) work unchanged. Only the first port of
+// multi-port parts is used.
+
+extern USBH_ClassTypeDef  CDC_VCP_Class;
+#define USBH_CDC_VCP_CLASS    &CDC_VCP_Class
+
+// applied during enumeration, before HOST_USER_CLASS_ACTIVE
+#ifndef CDC_VCP_DEFAULT_BAUD
+#define CDC_VCP_DEFAULT_BAUD                                    115200U
+#endif
+
+// FTDI parts hold back a short IN packet for up to this many ms (1..255).
+// the chip default of 16 caps small-message round trips at ~60Hz
+#ifndef CDC_VCP_FTDI_LATENCY
+#define CDC_VCP_FTDI_LATENCY                                    1U
+#endif
+
+typedef enum{
+  CDC_VCP_NONE = 0U,
+  CDC_VCP_FTDI,      // FT232R, FT2232C/D: 48MHz baud generator
+  CDC_VCP_FTDI_H,    // FT232H, FT2232H, FT4232H: 120MHz baud generator
+  CDC_VCP_FTDI_X,    // FT-X series: 48MHz, baud requests laid out as the FT232R
+  CDC_VCP_CP210X,
+  CDC_VCP_CH34X,
+  CDC_VCP_PL2303,
+} CDC_VCP_ChipTypeDef;
+
+CDC_VCP_ChipTypeDef USBH_CDC_VCP_GetChip(CDC_HandleTypeDef* hcdc);
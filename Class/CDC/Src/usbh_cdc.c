@@ -1,6 +1,10 @@
 #include "usbh_cdc.h"
+#include "usbh_cdc_framing.h"
 
 #define USBH_CDC_BUFFER_SIZE                 1024
+// (micro)frames after USBH_ClosePipe by which the channel has halted: the
+// halt takes effect at the end of the transaction in progress
+#define CDC_HALT_FRAMES                      2U
 
 static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost);
 static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef* phost);
@@ -8,13 +12,16 @@ static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost);
 static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost);
 static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef *phost);
 
-static USBH_StatusTypeDef GetLineCoding(USBH_HandleTypeDef* phost,
+static USBH_StatusTypeDef GetLineCoding(USBH_HandleTypeDef* phost, uint8_t itf,
                                         CDC_LineCodingTypeDef* linecoding);
-static USBH_StatusTypeDef SetLineCoding(USBH_HandleTypeDef* phost,
+static USBH_StatusTypeDef SetLineCoding(USBH_HandleTypeDef* phost, uint8_t itf,
                                         CDC_LineCodingTypeDef* linecoding);
 
 static void CDC_ProcessTransmission(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
 static void CDC_ProcessReception(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
+static void CDC_ProcessError(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
+static void CDC_ProcessNotification(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
+static void CDC_ProcessControl(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
 
 USBH_ClassTypeDef CDC_Class = {
   "CDC",
@@ -31,48 +38,72 @@ USBH_ClassTypeDef CDC_Class = {
 static USBH_StatusTypeDef SubInit(USBH_HandleTypeDef* phost, uint8_t itf_ctrl, uint8_t itf_data, void** hcdc);
 static USBH_StatusTypeDef SubDeInit(USBH_HandleTypeDef* phost, void* hcdc);
 static USBH_StatusTypeDef SubProcess(USBH_HandleTypeDef* phost, void* hcdc);
+static USBH_StatusTypeDef SubSOFProcess(USBH_HandleTypeDef* phost, void* hcdc);
 
 // SubDriver for inclusion in Composite interface
 const USBH_CDC_SubDriverTypeDef USBH_CDC_SubDriver = {
   .Init = SubInit,
   .DeInit = SubDeInit,
   .Process = SubProcess,
+  .SOFProcess = SubSOFProcess,
 };
 
-static void _Init(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc
-                                           , uint8_t itf_ctrl
-                                           , uint8_t itf_data){
-  // Collect the notification endpoint address and length
-  if((phost->device.CfgDesc.Itf_Desc[itf_ctrl].Ep_Desc[0].bEndpointAddress & 0x80U) != 0U){
-    hcdc->CommItf.NotifEp = phost->device.CfgDesc.Itf_Desc[itf_ctrl].Ep_Desc[0].bEndpointAddress;
-    hcdc->CommItf.NotifEpSize  = phost->device.CfgDesc.Itf_Desc[itf_ctrl].Ep_Desc[0].wMaxPacketSize;
+// FAIL if the host has no channels left for the data endpoints; _DeInit
+// releases what was taken
+static USBH_StatusTypeDef _Init(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc
+                                                         , uint8_t itf_ctrl
+                                                         , uint8_t itf_data){
+  hcdc->itf_num = phost->device.CfgDesc.Itf_Desc[itf_ctrl].bInterfaceNumber;
+
+  // Collect the notification endpoint address, length & interval
+  uint8_t num_ep = phost->device.CfgDesc.Itf_Desc[itf_ctrl].bNumEndpoints;
+  if(num_ep > USBH_MAX_NUM_ENDPOINTS) num_ep = USBH_MAX_NUM_ENDPOINTS;
+  for(uint8_t i=0; i<num_ep; i++){
+    USBH_EpDescTypeDef* ep = &phost->device.CfgDesc.Itf_Desc[itf_ctrl].Ep_Desc[i];
+    if(((ep->bEndpointAddress & 0x80U) != 0U) && ((ep->bmAttributes & 0x03U) == USB_EP_TYPE_INTR)){
+      hcdc->CommItf.NotifEp = ep->bEndpointAddress;
+      hcdc->CommItf.NotifEpSize = ep->wMaxPacketSize;
+      if(phost->device.speed == USBH_SPEED_HIGH){ // bInterval is 2^(n-1) microframes
+        uint8_t n = (ep->bInterval < 1U) ? 1U : ((ep->bInterval > 16U) ? 16U : ep->bInterval);
+        hcdc->CommItf.NotifPoll = (uint16_t)(1U << (n - 1U));
+      } else {
+        hcdc->CommItf.NotifPoll = (ep->bInterval < 1U) ? 1U : ep->bInterval;
+      }
+      break;
+    }
   }
 
-  // Allocate the length for host channel number in
-  hcdc->CommItf.NotifPipe = USBH_AllocPipe(phost, hcdc->CommItf.NotifEp);
-
-  // Open pipe for Notification endpoint
-  (void)USBH_OpenPipe(phost, hcdc->CommItf.NotifPipe, hcdc->CommItf.NotifEp,
-                      phost->device.address, phost->device.speed, USB_EP_TYPE_INTR,
-                      hcdc->CommItf.NotifEpSize);
-
-  (void)USBH_LL_SetToggle(phost, hcdc->CommItf.NotifPipe, 0U);
-
-  // Collect the class specific endpoint address and length
-  if((phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[0].bEndpointAddress & 0x80U) != 0U){
-    hcdc->DataItf.InEp = phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[0].bEndpointAddress;
-    hcdc->DataItf.InEpSize  = phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[0].wMaxPacketSize;
-  } else {
-    hcdc->DataItf.OutEp = phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[0].bEndpointAddress;
-    hcdc->DataItf.OutEpSize  = phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[0].wMaxPacketSize;
+  if(hcdc->CommItf.NotifEp != 0U){
+    // Allocate the length for host channel number in
+    hcdc->CommItf.NotifPipe = USBH_AllocPipe(phost, hcdc->CommItf.NotifEp);
+    if(hcdc->CommItf.NotifPipe == 0xFFU){ // notifications are optional: carry on without
+      USBH_ErrLog("CDC: no pipe for the notification endpoint");
+      hcdc->CommItf.NotifPipe = 0U;
+    } else {
+      // Open pipe for Notification endpoint
+      (void)USBH_OpenPipe(phost, hcdc->CommItf.NotifPipe, hcdc->CommItf.NotifEp,
+                          phost->device.address, phost->device.speed, USB_EP_TYPE_INTR,
+                          hcdc->CommItf.NotifEpSize);
+
+      (void)USBH_LL_SetToggle(phost, hcdc->CommItf.NotifPipe, 0U);
+      hcdc->notif_state = CDC_NOTIF_GET;
+    }
   }
 
-  if((phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[1].bEndpointAddress & 0x80U) != 0U){
-    hcdc->DataItf.InEp = phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[1].bEndpointAddress;
-    hcdc->DataItf.InEpSize  = phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[1].wMaxPacketSize;
-  } else {
-    hcdc->DataItf.OutEp = phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[1].bEndpointAddress;
-    hcdc->DataItf.OutEpSize = phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[1].wMaxPacketSize;
+  // Collect the bulk endpoint addresses and lengths. vendor bridges put these
+  // alongside the interrupt endpoint, in any order
+  num_ep = phost->device.CfgDesc.Itf_Desc[itf_data].bNumEndpoints;
+  if(num_ep > USBH_MAX_NUM_ENDPOINTS) num_ep = USBH_MAX_NUM_ENDPOINTS;
+  for(uint8_t i=0; i<num_ep; i++){
+    USBH_EpDescTypeDef* ep = &phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[i];
+    if((ep->bmAttributes & 0x03U) != USB_EP_TYPE_BULK) continue;
+    if((ep->bEndpointAddress & 0x80U) != 0U){
+      hcdc->DataItf.InEp = ep->bEndpointAddress;
+      hcdc->DataItf.InEpSize  = ep->wMaxPacketSize;
+    } else {
+      hcdc->DataItf.OutEp = ep->bEndpointAddress;
+      hcdc->DataItf.OutEpSize = ep->wMaxPacketSize;
+    }
   }
 
   // Allocate the length for host channel number out
@@ -81,6 +112,13 @@ static void _Init(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc
   // Allocate the length for host channel number in
   hcdc->DataItf.InPipe = USBH_AllocPipe(phost, hcdc->DataItf.InEp);
 
+  if((hcdc->DataItf.OutPipe == 0xFFU) || (hcdc->DataItf.InPipe == 0xFFU)){
+    USBH_ErrLog("CDC: no pipes left for the data interface");
+    if(hcdc->DataItf.OutPipe == 0xFFU) hcdc->DataItf.OutPipe = 0U;
+    if(hcdc->DataItf.InPipe == 0xFFU) hcdc->DataItf.InPipe = 0U;
+    return USBH_FAIL;
+  }
+
   // Open channel for OUT endpoint
   (void)USBH_OpenPipe(phost, hcdc->DataItf.OutPipe, hcdc->DataItf.OutEp,
                       phost->device.address, phost->device.speed, USB_EP_TYPE_BULK,
@@ -95,8 +133,12 @@ static void _Init(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc
 
   (void)USBH_LL_SetToggle(phost, hcdc->DataItf.OutPipe, 0U);
   (void)USBH_LL_SetToggle(phost, hcdc->DataItf.InPipe, 0U);
+  return USBH_OK;
 }
 
+static void _DeInit(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
+static void CDC_TxAbort(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc);
+
 static USBH_StatusTypeDef SubInit(USBH_HandleTypeDef* phost, uint8_t itf_ctrl, uint8_t itf_data, void** phcdc){
   *phcdc = (CDC_HandleTypeDef*)USBH_malloc(sizeof(CDC_HandleTypeDef));
   if(*phcdc == NULL){
@@ -104,47 +146,103 @@ static USBH_StatusTypeDef SubInit(USBH_HandleTypeDef* phost, uint8_t itf_ctrl, u
     return USBH_FAIL;
   }
   (void)USBH_memset(*phcdc, 0, sizeof(CDC_HandleTypeDef));
-  _Init(phost, *phcdc, itf_ctrl, itf_data);
+  if(_Init(phost, *phcdc, itf_ctrl, itf_data) != USBH_OK){
+    _DeInit(phost, *phcdc);
+    USBH_free(*phcdc);
+    *phcdc = NULL;
+    return USBH_FAIL;
+  }
   return USBH_OK;
 }
 
-static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost){
-
-  uint8_t itf_ctrl = USBH_FindInterface(phost, COMMUNICATION_INTERFACE_CLASS_CODE,
-                                   ABSTRACT_CONTROL_MODEL, 0xFF); // any protocol will do
-                                   // ABSTRACT_CONTROL_MODEL, NO_CLASS_SPECIFIC_PROTOCOL_CODE);
-                                   // ABSTRACT_CONTROL_MODEL, COMMON_AT_COMMAND);
-  if((itf_ctrl == 0xFFU) || (itf_ctrl >= USBH_MAX_NUM_INTERFACES)){ // No Valid Interface
-    USBH_DbgLog("Cannot Find the interface for Communication Interface Class.");
-    return USBH_FAIL;
+// pair each ACM control interface with its data interface (Itf_Desc indexes).
+// pairs come from union functional descriptors; without any, the first
+// control & data interfaces are taken as before
+uint8_t USBH_CDC_FindPorts(USBH_HandleTypeDef* phost, uint8_t* itf_ctrl, uint8_t* itf_data, uint8_t max){
+  uint8_t* raw = phost->device.CfgDesc_Raw;
+  uint16_t total = phost->device.CfgDesc.wTotalLength;
+  uint16_t ptr;
+  uint8_t in_acm = 0;
+  uint8_t count = 0;
+
+  if(total > USBH_MAX_SIZE_CONFIGURATION) total = USBH_MAX_SIZE_CONFIGURATION;
+  if(total >= USB_CONFIGURATION_DESC_SIZE){
+    ptr = raw[0]; // skip configuration descriptor
+    while((ptr + 2U <= total) && (count < max)){
+      uint8_t* d = &raw[ptr];
+      if(d[0] < 2U || ptr + d[0] > total) break; // malformed
+      if(d[1] == USB_DESC_TYPE_INTERFACE && d[0] >= 7U){
+        in_acm = (d[3] == 0U) // alt setting
+              && (d[5] == COMMUNICATION_INTERFACE_CLASS_CODE)
+              && (d[6] == ABSTRACT_CONTROL_MODEL);
+      } else if(in_acm && d[0] >= 5U && d[1] == CS_INTERFACE && d[2] == CDC_UNION_TYPE){
+        uint8_t ctrl = USBH_FindInterfaceIndex(phost, d[3], 0U);
+        uint8_t data = USBH_FindInterfaceIndex(phost, d[4], 0U);
+        if((ctrl < USBH_MAX_NUM_INTERFACES) && (data < USBH_MAX_NUM_INTERFACES) &&
+           (phost->device.CfgDesc.Itf_Desc[data].bInterfaceClass == DATA_INTERFACE_CLASS_CODE)){
+          itf_ctrl[count] = ctrl;
+          itf_data[count] = data;
+          count++;
+        }
+        in_acm = 0;
+      }
+      ptr += d[0];
+    }
   }
 
-  USBH_StatusTypeDef status = USBH_SelectInterface(phost, itf_ctrl);
-  if(status != USBH_OK){
-    return USBH_FAIL;
+  if((count == 0U) && (max > 0U)){
+    uint8_t ctrl = USBH_FindInterface(phost, COMMUNICATION_INTERFACE_CLASS_CODE,
+                                      ABSTRACT_CONTROL_MODEL, 0xFF); // any protocol will do
+    uint8_t data = USBH_FindInterface(phost, DATA_INTERFACE_CLASS_CODE,
+                                      RESERVED, NO_CLASS_SPECIFIC_PROTOCOL_CODE);
+    if((ctrl < USBH_MAX_NUM_INTERFACES) && (data < USBH_MAX_NUM_INTERFACES)){
+      itf_ctrl[0] = ctrl;
+      itf_data[0] = data;
+      count = 1U;
+    }
   }
+  return count;
+}
 
-  uint8_t itf_data = USBH_FindInterface(phost, DATA_INTERFACE_CLASS_CODE,
-                                   RESERVED, NO_CLASS_SPECIFIC_PROTOCOL_CODE);
-  if ((itf_data == 0xFFU) || (itf_data >= USBH_MAX_NUM_INTERFACES)){ // No Valid Interface
-    USBH_DbgLog("Cannot Find the interface for Data Interface Class.");
+static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost){
+  uint8_t itf_ctrl[USBH_CDC_MAX_PORTS];
+  uint8_t itf_data[USBH_CDC_MAX_PORTS];
+  uint8_t ports = USBH_CDC_FindPorts(phost, itf_ctrl, itf_data, USBH_CDC_MAX_PORTS);
+  if(ports == 0U){ // No Valid Interface
+    USBH_DbgLog("Cannot Find the interfaces for Communication & Data Interface Class.");
     return USBH_FAIL;
   }
 
-  CDC_HandleTypeDef* hcdc = (CDC_HandleTypeDef*)USBH_malloc(sizeof(CDC_HandleTypeDef));
-  if(!hcdc){
-    USBH_DbgLog("Cannot allocate memory for CDC Handle");
+  USBH_StatusTypeDef status = USBH_SelectInterface(phost, itf_ctrl[0]);
+  if(status != USBH_OK){
     return USBH_FAIL;
   }
-  (void)USBH_memset(hcdc, 0, sizeof(CDC_HandleTypeDef));
-  phost->pActiveClass->pData = hcdc;
-
-  _Init(phost, hcdc, itf_ctrl, itf_data);
 
+  // port 0 is pData, so single port applications are unchanged
+  CDC_HandleTypeDef** link = (CDC_HandleTypeDef**)&phost->pActiveClass->pData;
+  for(uint8_t i=0; i<ports; i++){
+    CDC_HandleTypeDef* hcdc = (CDC_HandleTypeDef*)USBH_malloc(sizeof(CDC_HandleTypeDef));
+    if(!hcdc){
+      USBH_DbgLog("Cannot allocate memory for CDC Handle");
+      if(i == 0U) return USBH_FAIL;
+      break; // carry on with the ports we have
+    }
+    (void)USBH_memset(hcdc, 0, sizeof(CDC_HandleTypeDef));
+    if(_Init(phost, hcdc, itf_ctrl[i], itf_data[i]) != USBH_OK){
+      _DeInit(phost, hcdc);
+      USBH_free(hcdc);
+      if(i == 0U) return USBH_FAIL;
+      break; // out of host channels: carry on with the ports we have
+    }
+    *link = hcdc;
+    link = &hcdc->next;
+  }
   return USBH_OK;
 }
 
 static void _DeInit(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
+  CDC_TxAbort(phost, hcdc); // hand queued buffers back before the handle goes
+
   if((hcdc->CommItf.NotifPipe) != 0U){
     (void)USBH_ClosePipe(phost, hcdc->CommItf.NotifPipe);
     (void)USBH_FreePipe(phost, hcdc->CommItf.NotifPipe);
@@ -174,35 +272,91 @@ static USBH_StatusTypeDef SubDeInit(USBH_HandleTypeDef* phost, void* hcdc){
 
 static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef* phost){
   CDC_HandleTypeDef* hcdc = (CDC_HandleTypeDef*)phost->pActiveClass->pData;
-  _DeInit(phost, hcdc);
-  if(hcdc != NULL){
+  while(hcdc != NULL){
+    CDC_HandleTypeDef* next = hcdc->next;
+    _DeInit(phost, hcdc);
     USBH_free(hcdc);
-    phost->pActiveClass->pData = 0U;
+    hcdc = next;
   }
+  phost->pActiveClass->pData = 0U;
   return USBH_OK;
 }
 
 // FIXME: needs to be SubDriver capable (unless runtime requests work)
+// read back each port's line coding in turn
 static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost){
   USBH_StatusTypeDef status;
   CDC_HandleTypeDef* hcdc = (CDC_HandleTypeDef*)phost->pActiveClass->pData;
-  status = GetLineCoding(phost, &hcdc->LineCoding);
-  if(status == USBH_OK){
+  while((hcdc != NULL) && hcdc->line_valid){
+    hcdc = hcdc->next;
+  }
+  if(hcdc == NULL){
     phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
+    return USBH_OK;
+  }
+  status = GetLineCoding(phost, hcdc->itf_num, &hcdc->LineCoding);
+  if(status == USBH_OK){
+    hcdc->line_valid = 1U;
+    status = USBH_BUSY; // next port
   } else if (status == USBH_NOT_SUPPORTED){
     USBH_ErrLog("Control error: CDC: Device Get Line Coding configuration failed");
   }
   return status;
 }
 
+// count quiet frames while a partially filled receive is outstanding, &
+// re-arm the notification poll once its interval is up. runs from the SOF
+// interrupt, so only flags these for _Process
+static USBH_StatusTypeDef _SOFProcess(USBH_HandleTypeDef *phost, CDC_HandleTypeDef* hcdc){
+  if((hcdc->notif_state == CDC_NOTIF_POLL) &&
+     ((phost->Timer - hcdc->notif_timer) >= hcdc->CommItf.NotifPoll)){
+    hcdc->notif_state = CDC_NOTIF_GET;
+#if (USBH_USE_OS == 1U)
+    USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+  }
+  if((hcdc->rx_idle_frames != 0U) && !hcdc->stream &&
+     (hcdc->data_rx_state == CDC_RECEIVE_DATA_WAIT) &&
+     (hcdc->RxReceived > 0U) && !hcdc->rx_idle_expired){
+    if(++hcdc->rx_idle_count >= hcdc->rx_idle_frames){
+      hcdc->rx_idle_expired = 1U;
+#if (USBH_USE_OS == 1U)
+      USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+    }
+  }
+  if((hcdc->data_rx_state == CDC_RECEIVE_DATA_HALT) &&
+     ((phost->Timer - hcdc->rx_halt_timer) == CDC_HALT_FRAMES)){
+#if (USBH_USE_OS == 1U)
+    USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+  }
+  return USBH_OK;
+}
+
+static USBH_StatusTypeDef SubSOFProcess(USBH_HandleTypeDef* phost, void* hcdc){
+  return _SOFProcess(phost, hcdc);
+}
+
 static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef *phost){
-  UNUSED(phost);  
+  CDC_HandleTypeDef* hcdc = (CDC_HandleTypeDef*)phost->pActiveClass->pData;
+  for(; hcdc != NULL; hcdc = hcdc->next){
+    (void)_SOFProcess(phost, hcdc);
+  }
   return USBH_OK;
 }
 
+// mid request on EP0
+static uint8_t CDC_WantsControl(CDC_HandleTypeDef* hcdc){
+  return (hcdc->ctl_state != CDC_CTL_IDLE) ||
+         (hcdc->state == CDC_ERROR_STATE);
+}
+
 static USBH_StatusTypeDef _Process(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
   USBH_StatusTypeDef status = USBH_BUSY;
-  USBH_StatusTypeDef req_status = USBH_OK;
+
+  CDC_ProcessNotification(phost, hcdc);
+  CDC_ProcessControl(phost, hcdc);
 
   switch (hcdc->state){
 
@@ -210,50 +364,22 @@ static USBH_StatusTypeDef _Process(USBH_HandleTypeDef* phost, CDC_HandleTypeDef*
       status = USBH_OK;
       break;
 
-    case CDC_SET_LINE_CODING_STATE:
-      req_status = SetLineCoding(phost, hcdc->pUserLineCoding);
-
-      if(req_status == USBH_OK){
-        hcdc->state = CDC_GET_LAST_LINE_CODING_STATE;
-      } else {
-        if(req_status != USBH_BUSY){
-          hcdc->state = CDC_ERROR_STATE;
-        }
-      }
-      break;
-
-    case CDC_GET_LAST_LINE_CODING_STATE:
-      req_status = GetLineCoding(phost, &(hcdc->LineCoding));
-
-      if(req_status == USBH_OK){
-        hcdc->state = CDC_IDLE_STATE;
-        if((hcdc->LineCoding.b.bCharFormat == hcdc->pUserLineCoding->b.bCharFormat) &&
-           (hcdc->LineCoding.b.bDataBits == hcdc->pUserLineCoding->b.bDataBits) &&
-           (hcdc->LineCoding.b.bParityType == hcdc->pUserLineCoding->b.bParityType) &&
-           (hcdc->LineCoding.b.dwDTERate == hcdc->pUserLineCoding->b.dwDTERate)){
-          USBH_CDC_LineCodingChanged(phost, hcdc);
-        }
-      } else {
-        if(req_status != USBH_BUSY){
-          hcdc->state = CDC_ERROR_STATE;
-        }
-      }
-      break;
-
     case CDC_TRANSFER_DATA:
       CDC_ProcessTransmission(phost, hcdc);
       CDC_ProcessReception(phost, hcdc);
       break;
 
     case CDC_ERROR_STATE:
-      if(USBH_ClrFeature(phost, 0x00U) == USBH_OK){
-        hcdc->state = CDC_IDLE_STATE;
+      // EP0 may be carrying this port's (or another port's) request
+      if(!hcdc->ctl_hold && (hcdc->ctl_state == CDC_CTL_IDLE)){
+        CDC_ProcessError(phost, hcdc);
       }
       break;
 
     default:
       break;
   }
+  hcdc->ctl_active = CDC_WantsControl(hcdc);
   return status;
 }
 
@@ -261,50 +387,204 @@ static USBH_StatusTypeDef SubProcess(USBH_HandleTypeDef* phost, void* hcdc){
   return _Process(phost, hcdc);
 }
 
+// run every port once per call, starting one further along each time. EP0 is
+// shared, so a port's control requests wait while another port's is in
+// flight (its data path keeps running)
 static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost){
-  CDC_HandleTypeDef* hcdc = (CDC_HandleTypeDef*)phost->pActiveClass->pData;
-  return _Process(phost, hcdc);
+  CDC_HandleTypeDef* head = (CDC_HandleTypeDef*)phost->pActiveClass->pData;
+  if(head == NULL) return USBH_OK;
+
+  uint8_t ports = 0U;
+  CDC_HandleTypeDef* owner = NULL;
+  for(CDC_HandleTypeDef* p = head; p != NULL; p = p->next){
+    if(p->ctl_active) owner = p;
+    ports++;
+  }
+  if(head->port_rr >= ports) head->port_rr = 0U;
+
+  CDC_HandleTypeDef* hcdc = USBH_CDC_GetPort(phost, head->port_rr);
+  for(uint8_t i=0; i<ports; i++){
+    hcdc->ctl_hold = (owner != NULL) && (owner != hcdc);
+    (void)_Process(phost, hcdc);
+    if(hcdc->ctl_active) owner = hcdc;
+    else if(owner == hcdc) owner = NULL;
+    hcdc = (hcdc->next != NULL) ? hcdc->next : head;
+  }
+  head->port_rr++;
+  return USBH_OK;
+}
+
+// the ports chain from pData only while CDC_Class is the active class
+static CDC_HandleTypeDef* CDC_FirstPort(USBH_HandleTypeDef* phost){
+  if(phost->pActiveClass != &CDC_Class){
+    return NULL;
+  }
+  return (CDC_HandleTypeDef*)phost->pActiveClass->pData;
+}
+
+uint8_t USBH_CDC_GetPortCount(USBH_HandleTypeDef* phost){
+  uint8_t ports = 0U;
+  for(CDC_HandleTypeDef* p = CDC_FirstPort(phost); p != NULL; p = p->next){
+    ports++;
+  }
+  return ports;
+}
+
+CDC_HandleTypeDef* USBH_CDC_GetPort(USBH_HandleTypeDef* phost, uint8_t port){
+  CDC_HandleTypeDef* p = CDC_FirstPort(phost);
+  while((p != NULL) && port--){
+    p = p->next;
+  }
+  return p;
 }
 
 USBH_StatusTypeDef USBH_CDC_Stop(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
   if(phost->gState == HOST_CLASS){
     hcdc->state = CDC_IDLE_STATE;
+    hcdc->notif_state = CDC_NOTIF_OFF;
     (void)USBH_ClosePipe(phost, hcdc->CommItf.NotifPipe);
     (void)USBH_ClosePipe(phost, hcdc->DataItf.InPipe);
     (void)USBH_ClosePipe(phost, hcdc->DataItf.OutPipe);
+    hcdc->data_tx_state = CDC_IDLE;
+    CDC_TxAbort(phost, hcdc);
   }
   return USBH_OK;
 }
 
 // This request allows the host to find out the currently configured line coding.
-static USBH_StatusTypeDef GetLineCoding(USBH_HandleTypeDef* phost, CDC_LineCodingTypeDef* linecoding){
+static USBH_StatusTypeDef GetLineCoding(USBH_HandleTypeDef* phost, uint8_t itf, CDC_LineCodingTypeDef* linecoding){
   phost->Control.setup.b.bmRequestType = USB_D2H | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
   phost->Control.setup.b.bRequest = CDC_GET_LINE_CODING;
   phost->Control.setup.b.wValue.w = 0U;
-  phost->Control.setup.b.wIndex.w = 0U;
+  phost->Control.setup.b.wIndex.w = itf;
   phost->Control.setup.b.wLength.w = LINE_CODING_STRUCTURE_SIZE;
   return USBH_CtlReq(phost, linecoding->Array, LINE_CODING_STRUCTURE_SIZE);
 }
 
 // This request allows the host to specify typical asynchronous
 // line-character formatting properties
-static USBH_StatusTypeDef SetLineCoding(USBH_HandleTypeDef* phost,
+static USBH_StatusTypeDef SetLineCoding(USBH_HandleTypeDef* phost, uint8_t itf,
                                         CDC_LineCodingTypeDef* linecoding){
   phost->Control.setup.b.bmRequestType = USB_H2D | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
   phost->Control.setup.b.bRequest = CDC_SET_LINE_CODING;
   phost->Control.setup.b.wValue.w = 0U;
-  phost->Control.setup.b.wIndex.w = 0U;
+  phost->Control.setup.b.wIndex.w = itf;
   phost->Control.setup.b.wLength.w = LINE_CODING_STRUCTURE_SIZE;
   return USBH_CtlReq(phost, linecoding->Array, LINE_CODING_STRUCTURE_SIZE);
 }
 
-// This function prepares the state before issuing the class specific commands
+static USBH_StatusTypeDef SetControlLineState(USBH_HandleTypeDef* phost, uint8_t itf, uint16_t lines){
+  phost->Control.setup.b.bmRequestType = USB_H2D | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
+  phost->Control.setup.b.bRequest = CDC_SET_CONTROL_LINE_STATE;
+  phost->Control.setup.b.wValue.w = lines;
+  phost->Control.setup.b.wIndex.w = itf;
+  phost->Control.setup.b.wLength.w = 0U;
+  return USBH_CtlReq(phost, NULL, 0U);
+}
+
+static uint8_t CDC_LineCodingEqual(CDC_LineCodingTypeDef* a, CDC_LineCodingTypeDef* b){
+  return (a->b.dwDTERate == b->b.dwDTERate) &&
+         (a->b.bCharFormat == b->b.bCharFormat) &&
+         (a->b.bParityType == b->b.bParityType) &&
+         (a->b.bDataBits == b->b.bDataBits);
+}
+
+// runs beside the data path so a rate switch doesn't stall streaming. the
+// latest request wins: repeats made while one is in flight collapse into one
+static void CDC_ProcessControl(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
+  USBH_StatusTypeDef req_status;
+
+  switch(hcdc->ctl_state){
+    case CDC_CTL_IDLE:
+      if(hcdc->ctl_hold || (hcdc->state == CDC_ERROR_STATE)){
+        break; // EP0 is busy
+      }
+      if(hcdc->line_pending){
+        hcdc->line_pending = 0U;
+        if(hcdc->line_valid && CDC_LineCodingEqual(&hcdc->LineCodingReq, &hcdc->LineCoding)){
+          USBH_CDC_LineCodingChanged(phost, hcdc); // already applied
+        } else {
+          hcdc->LineCodingTx = hcdc->LineCodingReq;
+          hcdc->ctl_state = CDC_CTL_SET_LINE_CODING;
+        }
+      } else if(hcdc->ctrl_pending){
+        hcdc->ctrl_pending = 0U;
+        if(!hcdc->ctrl_valid || (hcdc->ctl_lines != hcdc->ctl_lines_req)){
+          hcdc->ctl_state = CDC_CTL_SET_LINE_STATE;
+        }
+      }
+      break;
+
+    case CDC_CTL_SET_LINE_CODING:
+      if(hcdc->vendor != NULL){
+        req_status = hcdc->vendor->SetLineCoding(phost, hcdc, &hcdc->LineCodingTx);
+      } else {
+        req_status = SetLineCoding(phost, hcdc->itf_num, &hcdc->LineCodingTx);
+      }
+      if(req_status == USBH_OK){
+        if(hcdc->line_verify && (hcdc->vendor == NULL)){ // bridges have no GET
+          hcdc->ctl_state = CDC_CTL_GET_LINE_CODING;
+        } else {
+          hcdc->LineCoding = hcdc->LineCodingTx;
+          hcdc->line_valid = 1U;
+          hcdc->ctl_state = CDC_CTL_IDLE;
+          USBH_CDC_LineCodingChanged(phost, hcdc);
+        }
+      } else if(req_status != USBH_BUSY){
+        hcdc->line_valid = 0U;
+        hcdc->ctl_state = CDC_CTL_IDLE;
+        hcdc->state = CDC_ERROR_STATE;
+      }
+      break;
+
+    case CDC_CTL_GET_LINE_CODING:
+      req_status = GetLineCoding(phost, hcdc->itf_num, &hcdc->LineCoding);
+      if(req_status == USBH_OK){
+        hcdc->line_valid = 1U;
+        hcdc->ctl_state = CDC_CTL_IDLE;
+        if(CDC_LineCodingEqual(&hcdc->LineCoding, &hcdc->LineCodingTx)){
+          USBH_CDC_LineCodingChanged(phost, hcdc);
+        }
+      } else if(req_status != USBH_BUSY){
+        hcdc->line_valid = 0U;
+        hcdc->ctl_state = CDC_CTL_IDLE;
+        hcdc->state = CDC_ERROR_STATE;
+      }
+      break;
+
+    case CDC_CTL_SET_LINE_STATE:
+      if(hcdc->vendor != NULL){
+        req_status = (hcdc->vendor->SetControlLineState != NULL)
+                   ? hcdc->vendor->SetControlLineState(phost, hcdc, hcdc->ctl_lines_req)
+                   : USBH_OK;
+      } else {
+        req_status = SetControlLineState(phost, hcdc->itf_num, hcdc->ctl_lines_req);
+      }
+      if(req_status == USBH_OK){
+        hcdc->ctl_lines = hcdc->ctl_lines_req;
+        hcdc->ctrl_valid = 1U;
+        hcdc->ctl_state = CDC_CTL_IDLE;
+      } else if(req_status != USBH_BUSY){
+        hcdc->ctrl_valid = 0U;
+        hcdc->ctl_state = CDC_CTL_IDLE;
+        hcdc->state = CDC_ERROR_STATE;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// queue a line coding change. it is skipped (LineCodingChanged still fires)
+// when the device already has this coding, & doesn't interrupt transfers
 USBH_StatusTypeDef USBH_CDC_SetLineCoding(USBH_HandleTypeDef* phost,
                                           CDC_HandleTypeDef* hcdc,
                                           CDC_LineCodingTypeDef* linecoding){
   if(phost->gState == HOST_CLASS){
-    hcdc->state = CDC_SET_LINE_CODING_STATE;
     hcdc->pUserLineCoding = linecoding;
+    hcdc->LineCodingReq = *linecoding;
+    hcdc->line_pending = 1U;
 #if (USBH_USE_OS == 1U)
     USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
 #endif /* (USBH_USE_OS == 1U) */
@@ -312,6 +592,24 @@ USBH_StatusTypeDef USBH_CDC_SetLineCoding(USBH_HandleTypeDef* phost,
   return USBH_OK;
 }
 
+// read the coding back after each SET & only report it if it matches
+void USBH_CDC_SetLineCodingVerify(CDC_HandleTypeDef* hcdc, uint8_t enable){
+  hcdc->line_verify = enable;
+}
+
+// DTR / RTS (CDC_ACTIVATE_SIGNAL_DTR | CDC_ACTIVATE_CARRIER_SIGNAL_RTS)
+USBH_StatusTypeDef USBH_CDC_SetControlLineState(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint16_t lines){
+  if(phost->gState != HOST_CLASS){
+    return USBH_FAIL;
+  }
+  hcdc->ctl_lines_req = lines;
+  hcdc->ctrl_pending = 1U;
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+  return USBH_OK;
+}
+
 // This function prepares the state before issuing the class specific commands
 USBH_StatusTypeDef USBH_CDC_GetLineCoding(USBH_HandleTypeDef* phost,
                                           CDC_HandleTypeDef* hcdc,
@@ -324,6 +622,25 @@ USBH_StatusTypeDef USBH_CDC_GetLineCoding(USBH_HandleTypeDef* phost,
   }
 }
 
+// bytes placed in the Receive buffer so far. valid in ReceiveCallback
+uint32_t USBH_CDC_GetReceivedDataSize(CDC_HandleTypeDef* hcdc){
+  return hcdc->RxReceived;
+}
+
+// deliver a partial receive once no packet has arrived for the given number of
+// frames (microframes on high speed). 0 disables. the pending IN transfer is
+// halted to hand the buffer back.
+void USBH_CDC_SetRxIdleTimeout(CDC_HandleTypeDef* hcdc, uint16_t frames){
+  hcdc->rx_idle_frames = frames;
+  hcdc->rx_idle_count = 0U;
+}
+
+// deliver as soon as a packet containing delimiter arrives (eg. '\n')
+void USBH_CDC_SetRxDelimiter(CDC_HandleTypeDef* hcdc, uint8_t delimiter, uint8_t enable){
+  hcdc->rx_delim = delimiter;
+  hcdc->rx_delim_enable = enable;
+}
+
 uint16_t USBH_CDC_GetLastReceivedDataSize(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
   uint32_t dataSize;
   if(phost->gState == HOST_CLASS){
@@ -336,9 +653,13 @@ uint16_t USBH_CDC_GetLastReceivedDataSize(USBH_HandleTypeDef* phost, CDC_HandleT
 
 USBH_StatusTypeDef USBH_CDC_Transmit(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t *pbuff, uint32_t length){
   USBH_StatusTypeDef Status = USBH_BUSY;
+  if(hcdc->DataItf.OutEpSize == 0U) return USBH_FAIL; // no OUT endpoint
+  if(hcdc->stream) return Status; // use USBH_CDC_Write
+  if(hcdc->tx_head != NULL) return Status; // queue owns the pipe
   if((hcdc->state == CDC_IDLE_STATE) || (hcdc->state == CDC_TRANSFER_DATA)){
     hcdc->pTxData = pbuff;
     hcdc->TxDataLength = length;
+    hcdc->tx_zlp = (length > 0U) && ((length % hcdc->DataItf.OutEpSize) == 0U);
     hcdc->state = CDC_TRANSFER_DATA;
     hcdc->data_tx_state = CDC_SEND_DATA;
     Status = USBH_OK;
@@ -351,9 +672,15 @@ USBH_StatusTypeDef USBH_CDC_Transmit(USBH_HandleTypeDef* phost, CDC_HandleTypeDe
 
 USBH_StatusTypeDef USBH_CDC_Receive(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t *pbuff, uint32_t length){
   USBH_StatusTypeDef Status = USBH_BUSY;
+  if(hcdc->stream) return Status; // use USBH_CDC_Read
+  if(hcdc->data_rx_state == CDC_RECEIVE_DATA_HALT) return Status; // last buffer not handed back yet
   if((hcdc->state == CDC_IDLE_STATE) || (hcdc->state == CDC_TRANSFER_DATA)){
     hcdc->pRxData = pbuff;
+    hcdc->pRxBase = pbuff;
     hcdc->RxDataLength = length;
+    hcdc->RxReceived = 0U;
+    hcdc->rx_idle_count = 0U;
+    hcdc->rx_idle_expired = 0U;
     hcdc->state = CDC_TRANSFER_DATA;
     hcdc->data_rx_state = CDC_RECEIVE_DATA;
     Status = USBH_OK;
@@ -364,11 +691,252 @@ USBH_StatusTypeDef USBH_CDC_Receive(USBH_HandleTypeDef* phost, CDC_HandleTypeDef
   return Status;
 }
 
+///////////////////////////////////
+// stream mode
+
+// where the next IN packet should land: straight into the ring if a whole
+// packet fits before the wrap, else the bounce buffer. NULL if no room.
+static uint8_t* CDC_StreamRxTarget(CDC_HandleTypeDef* hcdc){
+  CDC_RingTypeDef* r = &hcdc->rx_ring;
+  uint32_t mps = hcdc->DataItf.InEpSize;
+  uint32_t head = r->head;
+  if((r->size - (head - r->tail)) < mps){
+    return NULL;
+  }
+  uint32_t idx = head & (r->size - 1U);
+  hcdc->rx_direct = (r->size - idx) >= mps;
+  return hcdc->rx_direct ? &r->buf[idx] : hcdc->rx_bounce;
+}
+
+// payload length of a received packet, after any vendor status is stripped
+static uint32_t CDC_RxFilter(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                             uint8_t* pkt, uint32_t length){
+  if((hcdc->vendor != NULL) && (hcdc->vendor->RxFilter != NULL)){
+    return hcdc->vendor->RxFilter(phost, hcdc, pkt, length);
+  }
+  return length;
+}
+
+static uint32_t CDC_StreamRxCommit(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint32_t length){
+  CDC_RingTypeDef* r = &hcdc->rx_ring;
+  uint32_t head = r->head;
+  uint32_t idx = head & (r->size - 1U);
+  length = CDC_RxFilter(phost, hcdc, hcdc->rx_direct ? &r->buf[idx] : hcdc->rx_bounce, length);
+  if(!hcdc->rx_direct){
+    uint32_t first = r->size - idx;
+    if(first > length) first = length;
+    (void)USBH_memcpy(&r->buf[idx], hcdc->rx_bounce, first);
+    (void)USBH_memcpy(r->buf, &hcdc->rx_bounce[first], length - first);
+  }
+  r->head = head + length; // publish after the data is in place
+  return length;
+}
+
+// send the next contiguous run of tx_ring, at most one packet
+static void CDC_StreamSend(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
+  CDC_RingTypeDef* r = &hcdc->tx_ring;
+  uint32_t tail = r->tail;
+  uint32_t idx = tail & (r->size - 1U);
+  uint32_t n = r->head - tail;
+  if(n > (r->size - idx)) n = r->size - idx;
+  if(n > hcdc->DataItf.OutEpSize) n = hcdc->DataItf.OutEpSize;
+  hcdc->tx_chunk = n;
+  (void)USBH_BulkSendData(phost,
+                          &r->buf[idx],
+                          (uint16_t)n,
+                          hcdc->DataItf.OutPipe,
+                          1U);
+}
+
+USBH_StatusTypeDef USBH_CDC_StreamStart(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                        uint8_t* rx_buf, uint32_t rx_size,
+                                        uint8_t* tx_buf, uint32_t tx_size){
+  if((rx_size == 0U) || (rx_size & (rx_size - 1U)) ||
+     (tx_size == 0U) || (tx_size & (tx_size - 1U)) ||
+     (rx_size < hcdc->DataItf.InEpSize) ||
+     (hcdc->DataItf.InEpSize > CDC_STREAM_BOUNCE_SIZE)){
+    USBH_ErrLog("CDC: invalid stream buffers");
+    return USBH_FAIL;
+  }
+  if((hcdc->state != CDC_IDLE_STATE) && (hcdc->state != CDC_TRANSFER_DATA)){
+    return USBH_BUSY;
+  }
+  hcdc->rx_ring.buf = rx_buf;
+  hcdc->rx_ring.size = rx_size;
+  hcdc->rx_ring.head = 0U;
+  hcdc->rx_ring.tail = 0U;
+  hcdc->tx_ring.buf = tx_buf;
+  hcdc->tx_ring.size = tx_size;
+  hcdc->tx_ring.head = 0U;
+  hcdc->tx_ring.tail = 0U;
+  hcdc->stream = 1U;
+  hcdc->state = CDC_TRANSFER_DATA;
+  hcdc->data_tx_state = CDC_IDLE;
+  hcdc->data_rx_state = CDC_RECEIVE_DATA;
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+  return USBH_OK;
+}
+
+// note an IN transfer may still be pending into the rx ring. call
+// USBH_CDC_Stop first if the buffers are about to be reused.
+void USBH_CDC_StreamStop(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
+  UNUSED(phost);
+  hcdc->stream = 0U;
+  hcdc->data_tx_state = CDC_IDLE;
+  hcdc->data_rx_state = CDC_IDLE;
+  if(hcdc->state == CDC_TRANSFER_DATA){
+    hcdc->state = CDC_IDLE_STATE;
+  }
+}
+
+uint32_t USBH_CDC_Available(CDC_HandleTypeDef* hcdc){
+  return hcdc->rx_ring.head - hcdc->rx_ring.tail;
+}
+
+uint32_t USBH_CDC_WriteSpace(CDC_HandleTypeDef* hcdc){
+  return hcdc->tx_ring.size - (hcdc->tx_ring.head - hcdc->tx_ring.tail);
+}
+
+// consumer side of rx_ring. safe against the host task filling it
+uint32_t USBH_CDC_Read(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t* dst, uint32_t length){
+  CDC_RingTypeDef* r = &hcdc->rx_ring;
+  uint32_t tail = r->tail;
+  uint32_t avail = r->head - tail;
+  if(!hcdc->stream) return 0U;
+  if(length > avail) length = avail;
+  uint32_t idx = tail & (r->size - 1U);
+  uint32_t first = r->size - idx;
+  if(first > length) first = length;
+  (void)USBH_memcpy(dst, &r->buf[idx], first);
+  (void)USBH_memcpy(&dst[first], r->buf, length - first);
+  r->tail = tail + length;
+#if (USBH_USE_OS == 1U)
+  if(length > 0U){ // room was made: the IN pipe may be waiting to re-arm
+    USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+  }
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+  return length;
+}
+
+// producer side of tx_ring. returns bytes accepted, which may be short
+uint32_t USBH_CDC_Write(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, const uint8_t* src, uint32_t length){
+  CDC_RingTypeDef* r = &hcdc->tx_ring;
+  uint32_t head = r->head;
+  uint32_t space = r->size - (head - r->tail);
+  if(!hcdc->stream) return 0U;
+  if(length > space) length = space;
+  uint32_t idx = head & (r->size - 1U);
+  uint32_t first = r->size - idx;
+  if(first > length) first = length;
+  (void)USBH_memcpy(&r->buf[idx], src, first);
+  (void)USBH_memcpy(r->buf, &src[first], length - first);
+  r->head = head + length;
+#if (USBH_USE_OS == 1U)
+  if(length > 0U){
+    USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+  }
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+  return length;
+}
+
+// append desc to the transmit queue. not re-entrant against USBH_Process:
+// call from the host task or from a descriptor callback.
+USBH_StatusTypeDef USBH_CDC_TransmitQueue(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, CDC_TxDescTypeDef* desc){
+  if(hcdc->DataItf.OutEpSize == 0U) return USBH_FAIL; // no OUT endpoint
+  if(hcdc->tx_abort) return USBH_FAIL; // called from an ABORTED callback
+  if(hcdc->stream) return USBH_BUSY;
+  if((hcdc->state != CDC_IDLE_STATE) && (hcdc->state != CDC_TRANSFER_DATA)){
+    return USBH_BUSY;
+  }
+  desc->status = CDC_TX_PENDING;
+  desc->next = NULL;
+  if(hcdc->tx_tail != NULL){
+    hcdc->tx_tail->next = desc;
+  } else {
+    hcdc->tx_head = desc;
+  }
+  hcdc->tx_tail = desc;
+  hcdc->state = CDC_TRANSFER_DATA;
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+  return USBH_OK;
+}
+
+static void CDC_TxLoad(CDC_HandleTypeDef* hcdc, CDC_TxDescTypeDef* desc){
+  hcdc->tx_active = desc;
+  hcdc->pTxData = desc->pbuff;
+  hcdc->TxDataLength = desc->length;
+  hcdc->tx_zlp = (desc->length > 0U) && ((desc->length % hcdc->DataItf.OutEpSize) == 0U);
+  hcdc->data_tx_state = CDC_SEND_DATA;
+}
+
+// retire the head descriptor & chain the next one without an idle pass
+static void CDC_TxComplete(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, CDC_TxStatusTypeDef status){
+  CDC_TxDescTypeDef* desc = hcdc->tx_active; // always the head
+  hcdc->tx_active = NULL;
+  hcdc->tx_head = desc->next;
+  if(hcdc->tx_head == NULL){
+    hcdc->tx_tail = NULL;
+  }
+  desc->next = NULL;
+  desc->status = status;
+  if(desc->callback != NULL){
+    desc->callback(phost, hcdc, desc); // may queue more
+  }
+  if(hcdc->tx_head != NULL){
+    CDC_TxLoad(hcdc, hcdc->tx_head);
+  }
+}
+
+// complete every queued descriptor as ABORTED. TransmitQueue refuses new
+// ones meanwhile, so a callback can't keep the queue alive
+static void CDC_TxAbort(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
+  CDC_TxDescTypeDef* desc = hcdc->tx_head;
+  hcdc->tx_head = NULL;
+  hcdc->tx_tail = NULL;
+  hcdc->tx_active = NULL;
+  hcdc->tx_abort = 1U;
+  while(desc != NULL){
+    CDC_TxDescTypeDef* next = desc->next;
+    desc->next = NULL;
+    desc->status = CDC_TX_ABORTED;
+    if(desc->callback != NULL){
+      desc->callback(phost, hcdc, desc);
+    }
+    desc = next;
+  }
+  hcdc->tx_abort = 0U;
+}
+
 static void CDC_ProcessTransmission(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
   USBH_URBStateTypeDef URB_Status = USBH_URB_IDLE;
+  if(hcdc->DataItf.OutEpSize == 0U){
+    return; // receive only: stream writes stay in tx_ring
+  }
   switch(hcdc->data_tx_state){
+    case CDC_IDLE:
+      if(hcdc->stream && (hcdc->tx_ring.head != hcdc->tx_ring.tail)){
+        hcdc->data_tx_state = CDC_SEND_DATA;
+      } else if(hcdc->tx_head != NULL){
+        CDC_TxLoad(hcdc, hcdc->tx_head);
+      }
+      break;
+
     case CDC_SEND_DATA:
-      if(hcdc->TxDataLength > hcdc->DataItf.OutEpSize){
+      if(hcdc->stream){
+        CDC_StreamSend(phost, hcdc);
+      } else if(hcdc->TxDataLength > hcdc->DataItf.OutEpSize){
         (void)USBH_BulkSendData(phost,
                                 hcdc->pTxData,
                                 hcdc->DataItf.OutEpSize,
@@ -388,19 +956,37 @@ static void CDC_ProcessTransmission(USBH_HandleTypeDef* phost, CDC_HandleTypeDef
       URB_Status = USBH_LL_GetURBState(phost, hcdc->DataItf.OutPipe);
 
       /* Check the status done for transmission */
-      if(URB_Status == USBH_URB_DONE){
+      if(URB_Status == USBH_URB_DONE && hcdc->stream){
+        hcdc->tx_ring.tail += hcdc->tx_chunk;
+        hcdc->tx_total += hcdc->tx_chunk;
+        hcdc->data_tx_state = (hcdc->tx_ring.head != hcdc->tx_ring.tail) ? CDC_SEND_DATA
+                                                                         : CDC_IDLE;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      } else if(URB_Status == USBH_URB_DONE){
         if(hcdc->TxDataLength > hcdc->DataItf.OutEpSize){
           hcdc->TxDataLength -= hcdc->DataItf.OutEpSize;
           hcdc->pTxData += hcdc->DataItf.OutEpSize;
+          hcdc->tx_total += hcdc->DataItf.OutEpSize;
         } else {
+          hcdc->tx_total += hcdc->TxDataLength;
           hcdc->TxDataLength = 0U;
         }
 
         if(hcdc->TxDataLength > 0U){
           hcdc->data_tx_state = CDC_SEND_DATA;
+        } else if(hcdc->tx_zlp){
+          // last packet was full size: a ZLP tells the device the transfer ended
+          hcdc->tx_zlp = 0U;
+          hcdc->data_tx_state = CDC_SEND_DATA;
         } else {
           hcdc->data_tx_state = CDC_IDLE;
-          USBH_CDC_TransmitCallback(phost, hcdc);
+          if(hcdc->tx_active != NULL){
+            CDC_TxComplete(phost, hcdc, CDC_TX_DONE);
+          } else {
+            USBH_CDC_TransmitCallback(phost, hcdc);
+          }
         }
 #if (USBH_USE_OS == 1U)
         USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
@@ -409,6 +995,15 @@ static void CDC_ProcessTransmission(USBH_HandleTypeDef* phost, CDC_HandleTypeDef
         if(URB_Status == USBH_URB_NOTREADY){
           hcdc->data_tx_state = CDC_SEND_DATA;
 
+#if (USBH_USE_OS == 1U)
+          USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+        } else if(URB_Status == USBH_URB_STALL){
+          // resend the same chunk once the halt is cleared
+          hcdc->stall_mask |= CDC_STALL_OUT;
+          hcdc->data_tx_state = CDC_SEND_DATA;
+          hcdc->state = CDC_ERROR_STATE;
+
 #if (USBH_USE_OS == 1U)
           USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
 #endif /* (USBH_USE_OS == 1U) */
@@ -421,6 +1016,22 @@ static void CDC_ProcessTransmission(USBH_HandleTypeDef* phost, CDC_HandleTypeDef
   }
 }
 
+static uint8_t CDC_HasDelimiter(CDC_HandleTypeDef* hcdc, uint8_t* data, uint32_t length){
+  if(!hcdc->rx_delim_enable) return 0U;
+  for(uint32_t i=0; i<length; i++){
+    if(data[i] == hcdc->rx_delim) return 1U;
+  }
+  return 0U;
+}
+
+// hand a completed Receive buffer to the framer (if attached), then the app
+static void CDC_Deliver(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
+  if(hcdc->framer != NULL){
+    USBH_CDC_FramerFeed(phost, hcdc, hcdc->framer, hcdc->pRxBase, hcdc->RxReceived);
+  }
+  USBH_CDC_ReceiveCallback(phost, hcdc);
+}
+
 static void CDC_ProcessReception(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
   USBH_URBStateTypeDef URB_Status = USBH_URB_IDLE;
   uint32_t length;
@@ -428,10 +1039,21 @@ static void CDC_ProcessReception(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* h
   switch (hcdc->data_rx_state){
 
     case CDC_RECEIVE_DATA:
-      (void)USBH_BulkReceiveData(phost,
-                                 hcdc->pRxData,
-                                 hcdc->DataItf.InEpSize,
-                                 hcdc->DataItf.InPipe);
+      if(hcdc->stream){
+        uint8_t* dst = CDC_StreamRxTarget(hcdc);
+        if(dst == NULL){
+          break; // ring full: leave the device NAKing until the reader catches up
+        }
+        (void)USBH_BulkReceiveData(phost,
+                                   dst,
+                                   hcdc->DataItf.InEpSize,
+                                   hcdc->DataItf.InPipe);
+      } else {
+        (void)USBH_BulkReceiveData(phost,
+                                   hcdc->pRxData,
+                                   hcdc->DataItf.InEpSize,
+                                   hcdc->DataItf.InPipe);
+      }
 #if defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U)
       phost->NakTimer = phost->Timer;
 #endif  /* defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U) */
@@ -441,20 +1063,59 @@ static void CDC_ProcessReception(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* h
     case CDC_RECEIVE_DATA_WAIT:
       URB_Status = USBH_LL_GetURBState(phost, hcdc->DataItf.InPipe);
       /*Check the status done for reception*/
-      if(URB_Status == USBH_URB_DONE){
+      if(URB_Status == USBH_URB_DONE && hcdc->stream){
         length = USBH_LL_GetLastXferSize(phost, hcdc->DataItf.InPipe);
-        if(((hcdc->RxDataLength - length) > 0U) && (length == hcdc->DataItf.InEpSize)){
-          hcdc->RxDataLength -= length;
-          hcdc->pRxData += length;
+        length = CDC_StreamRxCommit(phost, hcdc, length);
+        hcdc->rx_total += length;
+        hcdc->data_rx_state = CDC_RECEIVE_DATA; // re-arm straight away
+        if(length > 0U){
+          USBH_CDC_ReceiveCallback(phost, hcdc);
+        }
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      } else if(URB_Status == USBH_URB_DONE){
+        uint32_t raw = USBH_LL_GetLastXferSize(phost, hcdc->DataItf.InPipe);
+        length = CDC_RxFilter(phost, hcdc, hcdc->pRxData, raw);
+        if((raw > 0U) && (length == 0U)){
+          // status only (FTDI sends one per latency period): keep listening
           hcdc->data_rx_state = CDC_RECEIVE_DATA;
         } else {
-          hcdc->data_rx_state = CDC_IDLE;
-          USBH_CDC_ReceiveCallback(phost, hcdc);
+          hcdc->RxReceived += length;
+          hcdc->rx_total += length;
+          hcdc->rx_idle_count = 0U;
+          hcdc->rx_idle_expired = 0U;
+          if(((hcdc->RxDataLength - length) > 0U) && (raw == hcdc->DataItf.InEpSize)
+             && !CDC_HasDelimiter(hcdc, hcdc->pRxData, length)){
+            hcdc->RxDataLength -= length;
+            hcdc->pRxData += length;
+            hcdc->data_rx_state = CDC_RECEIVE_DATA;
+          } else {
+            hcdc->data_rx_state = CDC_IDLE;
+            CDC_Deliver(phost, hcdc);
+          }
         }
 #if (USBH_USE_OS == 1U)
         USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
 #endif /* (USBH_USE_OS == 1U) */
       }
+      else if(URB_Status == USBH_URB_STALL){
+        // re-arm at the same offset once the halt is cleared
+        hcdc->stall_mask |= CDC_STALL_IN;
+        hcdc->data_rx_state = CDC_RECEIVE_DATA;
+        hcdc->state = CDC_ERROR_STATE;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      }
+      else if(hcdc->rx_idle_expired){
+        // line went quiet mid-buffer: halt the IN transfer. ClosePipe only
+        // requests the halt, so the buffer is handed over once it took effect
+        hcdc->rx_idle_expired = 0U;
+        (void)USBH_ClosePipe(phost, hcdc->DataItf.InPipe);
+        hcdc->rx_halt_timer = phost->Timer;
+        hcdc->data_rx_state = CDC_RECEIVE_DATA_HALT;
+      }
 #if defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U)
       else if(URB_Status == USBH_URB_NAK_WAIT){
         hcdc->data_rx_state = CDC_RECEIVE_DATA_WAIT;
@@ -469,11 +1130,182 @@ static void CDC_ProcessReception(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* h
 #endif /* defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U) */
       break;
 
+    case CDC_RECEIVE_DATA_HALT:
+      if((phost->Timer - hcdc->rx_halt_timer) < CDC_HALT_FRAMES){
+        break; // SOFProcess wakes us once the channel is halted
+      }
+      // keep a packet which completed before the halt took effect
+      if(USBH_LL_GetURBState(phost, hcdc->DataItf.InPipe) == USBH_URB_DONE){
+        length = CDC_RxFilter(phost, hcdc, hcdc->pRxData,
+                              USBH_LL_GetLastXferSize(phost, hcdc->DataItf.InPipe));
+        hcdc->RxReceived += length;
+        hcdc->rx_total += length;
+      }
+      hcdc->data_rx_state = CDC_IDLE;
+      CDC_Deliver(phost, hcdc);
+#if (USBH_USE_OS == 1U)
+      USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      break;
+
+    default:
+      break;
+  }
+}
+
+// clear each halted data endpoint in turn, reset its data toggle & resume
+// whichever transfers were pending. a failed control request (no stall bits)
+// keeps the old behaviour of clearing endpoint 0.
+static void CDC_ProcessError(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
+  uint8_t ep = 0x00U;
+  uint8_t pipe = 0U;
+  uint8_t bit = 0U;
+  if(hcdc->stall_mask & CDC_STALL_IN){
+    ep = hcdc->DataItf.InEp;
+    pipe = hcdc->DataItf.InPipe;
+    bit = CDC_STALL_IN;
+  } else if(hcdc->stall_mask & CDC_STALL_OUT){
+    ep = hcdc->DataItf.OutEp;
+    pipe = hcdc->DataItf.OutPipe;
+    bit = CDC_STALL_OUT;
+  } else if(hcdc->stall_mask & CDC_STALL_NOTIF){
+    ep = hcdc->CommItf.NotifEp;
+    pipe = hcdc->CommItf.NotifPipe;
+    bit = CDC_STALL_NOTIF;
+  }
+
+  USBH_StatusTypeDef req_status = USBH_ClrFeature(phost, ep);
+  if(req_status == USBH_BUSY){
+    return;
+  }
+  if(bit != 0U){
+    if(req_status == USBH_OK){
+      (void)USBH_LL_SetToggle(phost, pipe, 0U);
+      hcdc->stall_mask &= (uint8_t)~bit;
+      hcdc->stall_count++;
+      if(bit == CDC_STALL_NOTIF){
+        hcdc->notif_state = CDC_NOTIF_GET;
+      }
+      if(hcdc->stall_mask != 0U){
+        return; // clear the other endpoint next
+      }
+    } else { // endpoint can't be recovered: abandon the transfers
+      USBH_ErrLog("CDC: failed to clear halt on endpoint 0x%02x", ep);
+      if(hcdc->stall_mask & CDC_STALL_NOTIF){
+        hcdc->notif_state = CDC_NOTIF_OFF;
+      }
+      hcdc->stall_mask = 0U;
+      hcdc->data_tx_state = CDC_IDLE;
+      hcdc->data_rx_state = CDC_IDLE;
+      if(hcdc->tx_active != NULL){ // don't resend it from CDC_IDLE
+        CDC_TxComplete(phost, hcdc, CDC_TX_ERROR);
+      }
+    }
+  }
+  if((hcdc->data_tx_state != CDC_IDLE) || (hcdc->data_rx_state != CDC_IDLE)){
+    hcdc->state = CDC_TRANSFER_DATA;
+  } else {
+    hcdc->state = CDC_IDLE_STATE;
+  }
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+static void CDC_DecodeNotification(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                   uint8_t* buf, uint32_t length){
+  CDC_LineStateTypeDef* line = &hcdc->line;
+  uint8_t notification = buf[1];
+  uint16_t value = LE16(&buf[2]);
+
+  switch(notification){
+    case CDC_NOTIFY_NETWORK_CONNECTION:
+      line->network_connected = (value != 0U);
+      break;
+
+    case CDC_NOTIFY_RESPONSE_AVAILABLE:
+      line->responses_available++;
+      break;
+
+    case CDC_NOTIFY_SERIAL_STATE:
+      if(length < (CDC_NOTIFY_HEADER_SIZE + 2U)){
+        return;
+      }
+      line->serial_state = LE16(&buf[CDC_NOTIFY_HEADER_SIZE]);
+      // the irregular bits are one-shot events: count each report
+      if(line->serial_state & CDC_SERIAL_STATE_BREAK) line->breaks++;
+      if(line->serial_state & CDC_SERIAL_STATE_RING) line->rings++;
+      if(line->serial_state & CDC_SERIAL_STATE_FRAMING) line->framing_errors++;
+      if(line->serial_state & CDC_SERIAL_STATE_PARITY) line->parity_errors++;
+      if(line->serial_state & CDC_SERIAL_STATE_OVERRUN) line->overruns++;
+      break;
+
+    default:
+      break;
+  }
+  USBH_CDC_NotificationCallback(phost, hcdc, notification);
+}
+
+// poll the interrupt IN endpoint of the communication interface once per
+// bInterval, independent of the data state machine
+static void CDC_ProcessNotification(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
+  USBH_URBStateTypeDef URB_Status;
+  uint32_t length;
+
+  switch(hcdc->notif_state){
+    case CDC_NOTIF_GET:
+      length = hcdc->CommItf.NotifEpSize;
+      if(length > CDC_NOTIF_BUFFER_SIZE) length = CDC_NOTIF_BUFFER_SIZE;
+      (void)USBH_InterruptReceiveData(phost, hcdc->CommItf.buff,
+                                      (uint8_t)length,
+                                      hcdc->CommItf.NotifPipe);
+      hcdc->notif_timer = phost->Timer;
+      hcdc->notif_state = CDC_NOTIF_WAIT;
+      break;
+
+    case CDC_NOTIF_WAIT:
+      URB_Status = USBH_LL_GetURBState(phost, hcdc->CommItf.NotifPipe);
+      if(URB_Status == USBH_URB_DONE){
+        length = USBH_LL_GetLastXferSize(phost, hcdc->CommItf.NotifPipe);
+        if(length >= CDC_NOTIFY_HEADER_SIZE){
+          CDC_DecodeNotification(phost, hcdc, hcdc->CommItf.buff, length);
+        }
+        hcdc->notif_state = CDC_NOTIF_POLL;
+      } else if(URB_Status == USBH_URB_NOTREADY){
+        hcdc->notif_state = CDC_NOTIF_POLL; // NAKed: the channel halted, ask again next interval
+      } else if(URB_Status == USBH_URB_STALL){
+        // recovery shares EP0, so only take it over when it is free
+        if((hcdc->state == CDC_IDLE_STATE) || (hcdc->state == CDC_TRANSFER_DATA)){
+          hcdc->stall_mask |= CDC_STALL_NOTIF;
+          hcdc->state = CDC_ERROR_STATE;
+          hcdc->notif_state = CDC_NOTIF_OFF; // re-enabled once cleared
+        } else {
+          hcdc->notif_state = CDC_NOTIF_POLL; // retried at the next interval
+        }
+      }
+      if(hcdc->notif_state != CDC_NOTIF_POLL){
+        break;
+      }
+      /* FALLTHROUGH */
+    case CDC_NOTIF_POLL:
+      // SOFProcess re-arms once the interval is up. already due: wake now
+      if((phost->Timer - hcdc->notif_timer) >= hcdc->CommItf.NotifPoll){
+        hcdc->notif_state = CDC_NOTIF_GET;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      }
+      break;
+
     default:
       break;
   }
 }
 
+const CDC_LineStateTypeDef* USBH_CDC_GetLineState(CDC_HandleTypeDef* hcdc){
+  return &hcdc->line;
+}
+
 __weak void USBH_CDC_TransmitCallback(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc){
   UNUSED(phost);
   UNUSED(hcdc);
@@ -487,3 +1319,9 @@ __weak void USBH_CDC_LineCodingChanged(USBH_HandleTypeDef* phost, CDC_HandleType
   UNUSED(phost);
   UNUSED(hcdc);
 }
+
+__weak void USBH_CDC_NotificationCallback(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc, uint8_t notification){
+  UNUSED(phost);
+  UNUSED(hcdc);
+  UNUSED(notification);
+}
@@ -0,0 +1,233 @@
+#include "usbh_cdc_framing.h"
+
+static void _FrameReset(CDC_FramerTypeDef* f){
+  f->len = 0U;
+  f->gather = 0U;
+  f->discard = 0U;
+  f->esc = 0U;
+  f->code = 0U;
+  f->zero = 0U;
+  f->hdr = 0U;
+  f->remaining = 0U;
+}
+
+void USBH_CDC_FramerInit(CDC_FramerTypeDef* f, CDC_FramingTypeDef mode,
+                         uint8_t* buf, uint32_t size,
+                         uint8_t* txbuf, uint32_t txsize){
+  (void)USBH_memset(f, 0, sizeof(CDC_FramerTypeDef));
+  f->mode = mode;
+  f->buf = buf;
+  f->size = size;
+  f->txbuf = txbuf;
+  f->txsize = txsize;
+}
+
+void USBH_CDC_FramerReset(CDC_FramerTypeDef* f){
+  _FrameReset(f);
+}
+
+void USBH_CDC_SetFramer(CDC_HandleTypeDef* hcdc, CDC_FramerTypeDef* f){
+  if(f != NULL){
+    _FrameReset(f);
+  }
+  hcdc->framer = f;
+}
+
+static void _Drop(CDC_FramerTypeDef* f){
+  if(!f->discard){
+    f->discard = 1U;
+    f->errors++;
+  }
+}
+
+// decoded output never outruns the input (every byte yields at most one), so
+// a frame which starts in this buffer is written over its own encoding.
+void USBH_CDC_FramerFeed(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                         CDC_FramerTypeDef* f, uint8_t* data, uint32_t length){
+  uint8_t* start = data; // in place frame
+  uint8_t* w = data;
+
+  for(uint32_t i=0; i<length; i++){
+    uint8_t b = data[i];
+    int16_t out = -1;
+    uint8_t end = 0U;
+
+    switch(f->mode){
+      case CDC_FRAMING_COBS:
+        if(b == 0x00U){
+          end = 1U;
+          if(f->code != 0U){ // truncated block
+            _Drop(f);
+          }
+        } else if(f->code == 0U){ // code byte
+          if(f->zero){
+            out = 0x00;
+          }
+          f->code = (uint8_t)(b - 1U);
+          f->zero = (b != 0xFFU);
+        } else {
+          out = b;
+          f->code--;
+        }
+        break;
+
+      case CDC_FRAMING_SLIP:
+        if(b == CDC_SLIP_END){
+          end = 1U;
+          if(f->esc){
+            _Drop(f);
+          }
+        } else if(f->esc){
+          f->esc = 0U;
+          if(b == CDC_SLIP_ESC_END){
+            out = CDC_SLIP_END;
+          } else if(b == CDC_SLIP_ESC_ESC){
+            out = CDC_SLIP_ESC;
+          } else {
+            _Drop(f);
+          }
+        } else if(b == CDC_SLIP_ESC){
+          f->esc = 1U;
+        } else {
+          out = b;
+        }
+        break;
+
+      case CDC_FRAMING_LENGTH:
+        if(f->hdr < 2U){
+          f->remaining |= (uint16_t)(b << (8U * f->hdr));
+          f->hdr++;
+          if(f->hdr == 2U){
+            if(f->remaining == 0U){
+              end = 1U;
+            } else if(f->remaining > f->size){
+              _Drop(f); // payload is still counted off
+            }
+          }
+        } else {
+          out = b;
+          if(--f->remaining == 0U){
+            end = 1U;
+          }
+        }
+        break;
+
+      default:
+        break;
+    }
+
+    if((out >= 0) && !f->discard){
+      if(f->len >= f->size){
+        _Drop(f);
+      } else if(f->gather){
+        f->buf[f->len++] = (uint8_t)out;
+      } else {
+        if(f->len == 0U){
+          start = w = &data[i];
+        }
+        *w++ = (uint8_t)out;
+        f->len++;
+      }
+    }
+
+    if(end){
+      if(!f->discard && (f->len > 0U)){
+        f->frames++;
+        USBH_CDC_FrameCallback(phost, hcdc, f->gather ? f->buf : start, f->len);
+      }
+      _FrameReset(f);
+    }
+  }
+
+  // frame continues in the next receive: keep what we have
+  if(!f->gather && !f->discard && (f->len > 0U)){
+    (void)USBH_memcpy(f->buf, start, f->len);
+    f->gather = 1U;
+  }
+}
+
+static uint32_t _EncodeCOBS(const uint8_t* src, uint32_t length, uint8_t* dst){
+  uint32_t n = 1U;
+  uint32_t code_at = 0U;
+  uint8_t code = 1U;
+  for(uint32_t i=0; i<length; i++){
+    if(src[i] == 0x00U){
+      dst[code_at] = code;
+      code_at = n++;
+      code = 1U;
+    } else {
+      dst[n++] = src[i];
+      if(++code == 0xFFU){
+        dst[code_at] = code;
+        code_at = n++;
+        code = 1U;
+      }
+    }
+  }
+  dst[code_at] = code;
+  dst[n++] = 0x00U;
+  return n;
+}
+
+static uint32_t _EncodeSLIP(const uint8_t* src, uint32_t length, uint8_t* dst){
+  uint32_t n = 0U;
+  dst[n++] = CDC_SLIP_END; // flush any line noise at the receiver
+  for(uint32_t i=0; i<length; i++){
+    if(src[i] == CDC_SLIP_END){
+      dst[n++] = CDC_SLIP_ESC;
+      dst[n++] = CDC_SLIP_ESC_END;
+    } else if(src[i] == CDC_SLIP_ESC){
+      dst[n++] = CDC_SLIP_ESC;
+      dst[n++] = CDC_SLIP_ESC_ESC;
+    } else {
+      dst[n++] = src[i];
+    }
+  }
+  dst[n++] = CDC_SLIP_END;
+  return n;
+}
+
+uint32_t USBH_CDC_FrameEncode(CDC_FramingTypeDef mode,
+                              const uint8_t* src, uint32_t length,
+                              uint8_t* dst, uint32_t max_length){
+  switch(mode){
+    case CDC_FRAMING_COBS:
+      if(max_length < CDC_COBS_BOUND(length)) return 0U;
+      return _EncodeCOBS(src, length, dst);
+
+    case CDC_FRAMING_SLIP:
+      if(max_length < CDC_SLIP_BOUND(length)) return 0U;
+      return _EncodeSLIP(src, length, dst);
+
+    case CDC_FRAMING_LENGTH:
+      if((length > 0xFFFFU) || (max_length < CDC_LENGTH_BOUND(length))) return 0U;
+      dst[0] = (uint8_t)length;
+      dst[1] = (uint8_t)(length >> 8);
+      (void)USBH_memcpy(&dst[2], src, length);
+      return length + 2U;
+
+    default:
+      return 0U;
+  }
+}
+
+USBH_StatusTypeDef USBH_CDC_TransmitFrame(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                          CDC_FramerTypeDef* f,
+                                          const uint8_t* src, uint32_t length){
+  if(hcdc->data_tx_state != CDC_IDLE){
+    return USBH_BUSY; // txbuf is still on the wire
+  }
+  uint32_t n = USBH_CDC_FrameEncode(f->mode, src, length, f->txbuf, f->txsize);
+  if(n == 0U){
+    return USBH_FAIL;
+  }
+  return USBH_CDC_Transmit(phost, hcdc, f->txbuf, n);
+}
+
+__weak void USBH_CDC_FrameCallback(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                   uint8_t* frame, uint32_t length){
+  UNUSED(phost);
+  UNUSED(hcdc);
+  UNUSED(frame);
+  UNUSED(length);
+}
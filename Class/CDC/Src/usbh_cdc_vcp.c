@@ -0,0 +1,521 @@
+#include "usbh_cdc_vcp.h"
+
+static USBH_StatusTypeDef MatchInterface(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost);
+
+USBH_ClassTypeDef CDC_VCP_Class = {
+  .Name         = "VCP",
+  .ClassCode    = 0xFFU, // vendor specific
+  .Match        = MatchInterface,
+  .Init         = Init,
+  .DeInit       = DeInit,
+  .Requests     = ClassRequest,
+  .BgndProcess  = Process,
+  .SOFProcess   = SOFProcess,
+  .pData        = NULL,
+};
+
+// bmRequestType
+#define VCP_OUT_DEVICE        (USB_H2D | USB_REQ_TYPE_VENDOR | USB_REQ_RECIPIENT_DEVICE)
+#define VCP_IN_DEVICE         (USB_D2H | USB_REQ_TYPE_VENDOR | USB_REQ_RECIPIENT_DEVICE)
+#define VCP_OUT_INTERFACE     (USB_H2D | USB_REQ_TYPE_VENDOR | USB_REQ_RECIPIENT_INTERFACE)
+#define VCP_OUT_CLASS         (USB_H2D | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE)
+
+// FTDI
+#define FTDI_SIO_RESET              0x00U
+#define FTDI_SIO_MODEM_CTRL         0x01U
+#define FTDI_SIO_SET_FLOW_CTRL      0x02U
+#define FTDI_SIO_SET_BAUDRATE       0x03U
+#define FTDI_SIO_SET_DATA           0x04U
+#define FTDI_SIO_SET_LATENCY_TIMER  0x09U
+#define FTDI_MODEM_DTR_RTS          0x0303U // values & write enables
+#define FTDI_STATUS_SIZE            2U
+
+// CP210x
+#define CP210X_IFC_ENABLE           0x00U
+#define CP210X_SET_LINE_CTL         0x03U
+#define CP210X_SET_MHS              0x07U
+#define CP210X_SET_BAUDRATE         0x1EU
+
+// CH34x
+#define CH34X_WRITE_REG             0x9AU
+#define CH34X_SERIAL_INIT           0xA1U
+#define CH34X_MODEM_CTRL            0xA4U
+#define CH34X_REG_BAUD              0x1312U
+#define CH34X_REG_LCR               0x2518U
+#define CH34X_LCR_ENABLE            0xC0U   // rx & tx
+#define CH34X_LCR_MARK_SPACE        0x20U
+#define CH34X_LCR_PAR_EVEN          0x10U
+#define CH34X_LCR_ENABLE_PAR        0x08U
+#define CH34X_LCR_STOP_2            0x04U
+#define CH34X_DTR_RTS               0x60U   // sent inverted
+
+// PL2303
+#define PL2303_VENDOR               0x01U
+
+typedef struct{
+  uint16_t            vid;
+  uint16_t            pid;
+  CDC_VCP_ChipTypeDef chip;
+} VCP_DeviceTypeDef;
+
+static const VCP_DeviceTypeDef vcp_devices[] = {
+  { 0x0403U, 0x6001U, CDC_VCP_FTDI },   // FT232R / FT232BM
+  { 0x0403U, 0x6010U, CDC_VCP_FTDI },   // FT2232C/D/H (H detected by bcdDevice)
+  { 0x0403U, 0x6011U, CDC_VCP_FTDI_H }, // FT4232H
+  { 0x0403U, 0x6014U, CDC_VCP_FTDI_H }, // FT232H
+  { 0x0403U, 0x6015U, CDC_VCP_FTDI_X }, // FT-X series
+  { 0x10C4U, 0xEA60U, CDC_VCP_CP210X }, // CP2102/3/4
+  { 0x10C4U, 0xEA70U, CDC_VCP_CP210X }, // CP2105
+  { 0x10C4U, 0xEA71U, CDC_VCP_CP210X }, // CP2108
+  { 0x1A86U, 0x7523U, CDC_VCP_CH34X },  // CH340
+  { 0x1A86U, 0x5523U, CDC_VCP_CH34X },  // CH341
+  { 0x067BU, 0x2303U, CDC_VCP_PL2303 }, // PL2303 / HX
+};
+#define VCP_NUM_DEVICES  (sizeof(vcp_devices) / sizeof(vcp_devices[0]))
+
+typedef struct{
+  uint8_t   bmRequestType;
+  uint8_t   bRequest;
+  uint16_t  wValue;
+  uint16_t  wIndex;
+  uint16_t  wLength;
+} VCP_ReqTypeDef;
+
+static void _Req(VCP_ReqTypeDef* r, uint8_t type, uint8_t request,
+                 uint16_t value, uint16_t index, uint16_t length){
+  r->bmRequestType = type;
+  r->bRequest = request;
+  r->wValue = value;
+  r->wIndex = index;
+  r->wLength = length;
+}
+
+static CDC_VCP_ChipTypeDef _Lookup(USBH_HandleTypeDef* phost){
+  for(uint32_t i=0; i<VCP_NUM_DEVICES; i++){
+    if((vcp_devices[i].vid == phost->device.DevDesc.idVendor) &&
+       (vcp_devices[i].pid == phost->device.DevDesc.idProduct)){
+      return vcp_devices[i].chip;
+    }
+  }
+  return CDC_VCP_NONE;
+}
+
+///////////////////////////////////
+// FTDI
+
+// 3MHz UART clock divided by n + frac/8. the fraction is sent in a
+// scrambled 3 bit code spread over wValue bit 14..15 & wIndex bit 0
+static uint32_t _FtdiDivisor(uint32_t divisor3){
+  static const uint8_t frac_code[8] = {0, 3, 2, 4, 1, 5, 6, 7};
+  uint32_t divisor = (divisor3 >> 3) | ((uint32_t)frac_code[divisor3 & 0x7U] << 14);
+  if(divisor == 1U){
+    divisor = 0U; // 3Mbaud (12Mbaud on H parts)
+  } else if(divisor == 0x4001U){
+    divisor = 1U; // 2Mbaud (8Mbaud on H parts)
+  }
+  return divisor;
+}
+
+static uint32_t _FtdiBaud(CDC_HandleTypeDef* hcdc, uint32_t baud){
+  if(baud == 0U) baud = 9600U;
+  if((hcdc->vendor_chip == CDC_VCP_FTDI_H) && (baud >= 1200U)){
+    // 120MHz / 10 = 12MHz clock, selected by bit 17
+    return _FtdiDivisor((8U * 120000000U / 10U + baud / 2U) / baud) | 0x00020000U;
+  }
+  return _FtdiDivisor((48000000U / 2U + baud / 2U) / baud);
+}
+
+static uint8_t _FtdiLine(CDC_HandleTypeDef* hcdc, const CDC_LineCodingTypeDef* lc,
+                         uint8_t step, VCP_ReqTypeDef* r){
+  uint16_t port = hcdc->vendor_port;
+  switch(step){
+    case 0:{
+      uint32_t divisor = _FtdiBaud(hcdc, lc->b.dwDTERate);
+      uint16_t index = (uint16_t)(divisor >> 16);
+      // the H parts & the FT2232C/D take the divisor's top bits in the high
+      // byte of wIndex & the channel in the low byte, 0 on the FT232H. the
+      // FT232R/BM & FT-X keep them in the low byte
+      if((hcdc->vendor_chip == CDC_VCP_FTDI_H) || (port != 0U)){
+        index = (uint16_t)((index << 8) | port);
+      }
+      _Req(r, VCP_OUT_DEVICE, FTDI_SIO_SET_BAUDRATE, (uint16_t)divisor, index, 0U);
+      return 1U;
+    }
+    case 1:
+      // parity & stop encodings match CDC's
+      _Req(r, VCP_OUT_DEVICE, FTDI_SIO_SET_DATA,
+           (uint16_t)(lc->b.bDataBits | (lc->b.bParityType << 8) | (lc->b.bCharFormat << 11)),
+           port, 0U);
+      return 1U;
+    default:
+      return 0U;
+  }
+}
+
+static uint8_t _FtdiInit(CDC_HandleTypeDef* hcdc, uint8_t step, VCP_ReqTypeDef* r){
+  static const uint16_t seq[][2] = {
+    { FTDI_SIO_RESET,             0U },
+    { FTDI_SIO_SET_LATENCY_TIMER, CDC_VCP_FTDI_LATENCY },
+    { FTDI_SIO_SET_FLOW_CTRL,     0U },
+    { FTDI_SIO_MODEM_CTRL,        FTDI_MODEM_DTR_RTS },
+  };
+  if(step < 4U){
+    _Req(r, VCP_OUT_DEVICE, (uint8_t)seq[step][0], seq[step][1], hcdc->vendor_port, 0U);
+    return 1U;
+  }
+  return _FtdiLine(hcdc, &hcdc->LineCoding, (uint8_t)(step - 4U), r);
+}
+
+// DTR & RTS sit in bit 0 & 1 as in CDC, with write enables in the high byte
+static void _FtdiLines(CDC_HandleTypeDef* hcdc, uint16_t lines, VCP_ReqTypeDef* r){
+  _Req(r, VCP_OUT_DEVICE, FTDI_SIO_MODEM_CTRL, (uint16_t)(0x0300U | (lines & 0x03U)), hcdc->vendor_port, 0U);
+}
+
+// every IN packet leads with modem & line status. record it, then slide the
+// payload down over it within the receive buffer
+static uint32_t _FtdiRxFilter(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                              uint8_t* pkt, uint32_t length){
+  if(length < FTDI_STATUS_SIZE){
+    return 0U;
+  }
+  CDC_LineStateTypeDef* line = &hcdc->line;
+  uint8_t modem = pkt[0];
+  uint8_t lsr = pkt[1];
+  uint16_t state = 0U;
+  if(modem & 0x80U) state |= CDC_SERIAL_STATE_DCD;
+  if(modem & 0x20U) state |= CDC_SERIAL_STATE_DSR;
+  if(modem & 0x40U) state |= CDC_SERIAL_STATE_RING;
+  if(lsr & 0x02U){ state |= CDC_SERIAL_STATE_OVERRUN; line->overruns++; }
+  if(lsr & 0x04U){ state |= CDC_SERIAL_STATE_PARITY; line->parity_errors++; }
+  if(lsr & 0x08U){ state |= CDC_SERIAL_STATE_FRAMING; line->framing_errors++; }
+  if(lsr & 0x10U){ state |= CDC_SERIAL_STATE_BREAK; line->breaks++; }
+  if(state != line->serial_state){
+    line->serial_state = state;
+    USBH_CDC_NotificationCallback(phost, hcdc, CDC_NOTIFY_SERIAL_STATE);
+  }
+
+  length -= FTDI_STATUS_SIZE;
+  for(uint32_t i=0; i<length; i++){
+    pkt[i] = pkt[i + FTDI_STATUS_SIZE];
+  }
+  return length;
+}
+
+///////////////////////////////////
+// CP210x
+
+static uint8_t _Cp210xLine(CDC_HandleTypeDef* hcdc, const CDC_LineCodingTypeDef* lc,
+                           uint8_t step, VCP_ReqTypeDef* r){
+  switch(step){
+    case 0:{
+      uint32_t baud = lc->b.dwDTERate;
+      hcdc->vendor_buf[0] = (uint8_t)baud;
+      hcdc->vendor_buf[1] = (uint8_t)(baud >> 8);
+      hcdc->vendor_buf[2] = (uint8_t)(baud >> 16);
+      hcdc->vendor_buf[3] = (uint8_t)(baud >> 24);
+      _Req(r, VCP_OUT_INTERFACE, CP210X_SET_BAUDRATE, 0U, hcdc->vendor_port, 4U);
+      return 1U;
+    }
+    case 1:
+      // parity & stop encodings match CDC's
+      _Req(r, VCP_OUT_INTERFACE, CP210X_SET_LINE_CTL,
+           (uint16_t)((lc->b.bDataBits << 8) | (lc->b.bParityType << 4) | lc->b.bCharFormat),
+           hcdc->vendor_port, 0U);
+      return 1U;
+    default:
+      return 0U;
+  }
+}
+
+// same layout as FTDI
+static void _Cp210xLines(CDC_HandleTypeDef* hcdc, uint16_t lines, VCP_ReqTypeDef* r){
+  _Req(r, VCP_OUT_INTERFACE, CP210X_SET_MHS, (uint16_t)(0x0300U | (lines & 0x03U)), hcdc->vendor_port, 0U);
+}
+
+static uint8_t _Cp210xInit(CDC_HandleTypeDef* hcdc, uint8_t step, VCP_ReqTypeDef* r){
+  switch(step){
+    case 0:
+      _Req(r, VCP_OUT_INTERFACE, CP210X_IFC_ENABLE, 1U, hcdc->vendor_port, 0U);
+      return 1U;
+    case 1:
+      _Req(r, VCP_OUT_INTERFACE, CP210X_SET_MHS, 0x0303U, hcdc->vendor_port, 0U);
+      return 1U;
+    default:
+      return _Cp210xLine(hcdc, &hcdc->LineCoding, (uint8_t)(step - 2U), r);
+  }
+}
+
+///////////////////////////////////
+// CH34x
+
+static uint8_t _Ch34xLine(CDC_HandleTypeDef* hcdc, const CDC_LineCodingTypeDef* lc,
+                          uint8_t step, VCP_ReqTypeDef* r){
+  UNUSED(hcdc);
+  switch(step){
+    case 0:{
+      uint32_t baud = (lc->b.dwDTERate != 0U) ? lc->b.dwDTERate : 9600U;
+      uint32_t factor = 1532620800U / baud;
+      uint16_t divisor = 3U;
+      while((factor > 0xFFF0U) && divisor){
+        factor >>= 3;
+        divisor--;
+      }
+      factor = 0x10000U - factor;
+      // bit 7: don't hold rx data back until a full packet has arrived
+      _Req(r, VCP_OUT_DEVICE, CH34X_WRITE_REG, CH34X_REG_BAUD,
+           (uint16_t)((factor & 0xFF00U) | divisor | 0x80U), 0U);
+      return 1U;
+    }
+    case 1:{
+      uint16_t lcr = CH34X_LCR_ENABLE;
+      if((lc->b.bDataBits >= 5U) && (lc->b.bDataBits <= 8U)){
+        lcr |= (uint16_t)(lc->b.bDataBits - 5U);
+      } else {
+        lcr |= 0x03U;
+      }
+      switch(lc->b.bParityType){
+        case 1U: lcr |= CH34X_LCR_ENABLE_PAR; break;
+        case 2U: lcr |= CH34X_LCR_ENABLE_PAR | CH34X_LCR_PAR_EVEN; break;
+        case 3U: lcr |= CH34X_LCR_ENABLE_PAR | CH34X_LCR_MARK_SPACE; break;
+        case 4U: lcr |= CH34X_LCR_ENABLE_PAR | CH34X_LCR_MARK_SPACE | CH34X_LCR_PAR_EVEN; break;
+        default: break;
+      }
+      if(lc->b.bCharFormat == 2U){
+        lcr |= CH34X_LCR_STOP_2;
+      }
+      _Req(r, VCP_OUT_DEVICE, CH34X_WRITE_REG, CH34X_REG_LCR, lcr, 0U);
+      return 1U;
+    }
+    default:
+      return 0U;
+  }
+}
+
+static void _Ch34xLines(CDC_HandleTypeDef* hcdc, uint16_t lines, VCP_ReqTypeDef* r){
+  UNUSED(hcdc);
+  uint8_t bits = 0U;
+  if(lines & CDC_ACTIVATE_SIGNAL_DTR) bits |= 0x20U;
+  if(lines & CDC_ACTIVATE_CARRIER_SIGNAL_RTS) bits |= 0x40U;
+  _Req(r, VCP_OUT_DEVICE, CH34X_MODEM_CTRL, (uint8_t)~bits, 0U, 0U);
+}
+
+static uint8_t _Ch34xInit(CDC_HandleTypeDef* hcdc, uint8_t step, VCP_ReqTypeDef* r){
+  switch(step){
+    case 0:
+      _Req(r, VCP_OUT_DEVICE, CH34X_SERIAL_INIT, 0U, 0U, 0U);
+      return 1U;
+    case 1:
+      _Req(r, VCP_OUT_DEVICE, CH34X_MODEM_CTRL, (uint8_t)~CH34X_DTR_RTS, 0U, 0U);
+      return 1U;
+    default:
+      return _Ch34xLine(hcdc, &hcdc->LineCoding, (uint8_t)(step - 2U), r);
+  }
+}
+
+///////////////////////////////////
+// PL2303
+
+// line coding & control lines use the standard CDC requests
+static uint8_t _Pl2303Line(CDC_HandleTypeDef* hcdc, const CDC_LineCodingTypeDef* lc,
+                           uint8_t step, VCP_ReqTypeDef* r){
+  if(step != 0U){
+    return 0U;
+  }
+  (void)USBH_memcpy(hcdc->vendor_buf, lc->Array, LINE_CODING_STRUCTURE_SIZE);
+  _Req(r, VCP_OUT_CLASS, CDC_SET_LINE_CODING, 0U, hcdc->vendor_port, LINE_CODING_STRUCTURE_SIZE);
+  return 1U;
+}
+
+static void _Pl2303Lines(CDC_HandleTypeDef* hcdc, uint16_t lines, VCP_ReqTypeDef* r){
+  _Req(r, VCP_OUT_CLASS, CDC_SET_CONTROL_LINE_STATE, lines, hcdc->vendor_port, 0U);
+}
+
+static uint8_t _Pl2303Init(CDC_HandleTypeDef* hcdc, uint8_t step, VCP_ReqTypeDef* r){
+  // vendor register sequence from the HX startup. reads are 1 byte
+  static const struct{ uint8_t read; uint16_t value; uint16_t index; } seq[] = {
+    { 1U, 0x8484U, 0U }, { 0U, 0x0404U, 0U }, { 1U, 0x8484U, 0U },
+    { 1U, 0x8383U, 0U }, { 1U, 0x8484U, 0U }, { 0U, 0x0404U, 1U },
+    { 1U, 0x8484U, 0U }, { 1U, 0x8383U, 0U }, { 0U, 0x0000U, 1U },
+    { 0U, 0x0001U, 0U }, { 0U, 0x0002U, 0x44U },
+    { 0U, 0x0000U, 0U }, // no flow control
+  };
+  const uint8_t n = (uint8_t)(sizeof(seq) / sizeof(seq[0]));
+  if(step < n){
+    _Req(r, seq[step].read ? VCP_IN_DEVICE : VCP_OUT_DEVICE, PL2303_VENDOR,
+         seq[step].value, seq[step].index, seq[step].read);
+    return 1U;
+  }
+  if(step == n){
+    _Req(r, VCP_OUT_CLASS, CDC_SET_CONTROL_LINE_STATE,
+         CDC_ACTIVATE_SIGNAL_DTR | CDC_ACTIVATE_CARRIER_SIGNAL_RTS, hcdc->vendor_port, 0U);
+    return 1U;
+  }
+  return _Pl2303Line(hcdc, &hcdc->LineCoding, (uint8_t)(step - n - 1U), r);
+}
+
+///////////////////////////////////
+// request sequencing
+
+static USBH_StatusTypeDef _SetLineCoding(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                         CDC_LineCodingTypeDef* linecoding);
+
+static USBH_StatusTypeDef _SetControlLineState(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                               uint16_t lines);
+
+static const CDC_VendorOpsTypeDef vcp_ops = {
+  .SetLineCoding       = _SetLineCoding,
+  .SetControlLineState = _SetControlLineState,
+  .RxFilter            = NULL,
+};
+
+static const CDC_VendorOpsTypeDef ftdi_ops = {
+  .SetLineCoding       = _SetLineCoding,
+  .SetControlLineState = _SetControlLineState,
+  .RxFilter            = _FtdiRxFilter,
+};
+
+typedef struct{
+  uint8_t(*InitStep)(CDC_HandleTypeDef* hcdc, uint8_t step, VCP_ReqTypeDef* r);
+  uint8_t(*LineStep)(CDC_HandleTypeDef* hcdc, const CDC_LineCodingTypeDef* lc, uint8_t step, VCP_ReqTypeDef* r);
+  void(*Lines)(CDC_HandleTypeDef* hcdc, uint16_t lines, VCP_ReqTypeDef* r);
+  const CDC_VendorOpsTypeDef* ops;
+} VCP_DriverTypeDef;
+
+// indexed by CDC_VCP_ChipTypeDef
+static const VCP_DriverTypeDef vcp_drivers[] = {
+  { NULL,        NULL,        NULL,          NULL },
+  { _FtdiInit,   _FtdiLine,   _FtdiLines,    &ftdi_ops },
+  { _FtdiInit,   _FtdiLine,   _FtdiLines,    &ftdi_ops },
+  { _FtdiInit,   _FtdiLine,   _FtdiLines,    &ftdi_ops },
+  { _Cp210xInit, _Cp210xLine, _Cp210xLines,  &vcp_ops },
+  { _Ch34xInit,  _Ch34xLine,  _Ch34xLines,   &vcp_ops },
+  { _Pl2303Init, _Pl2303Line, _Pl2303Lines,  &vcp_ops },
+};
+
+static USBH_StatusTypeDef _Issue(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                 const VCP_ReqTypeDef* r){
+  phost->Control.setup.b.bmRequestType = r->bmRequestType;
+  phost->Control.setup.b.bRequest = r->bRequest;
+  phost->Control.setup.b.wValue.w = r->wValue;
+  phost->Control.setup.b.wIndex.w = r->wIndex;
+  phost->Control.setup.b.wLength.w = r->wLength;
+  return USBH_CtlReq(phost, (r->wLength != 0U) ? hcdc->vendor_buf : NULL, r->wLength);
+}
+
+// issue the current step of a request sequence. BUSY until the builder runs
+// out of steps
+static USBH_StatusTypeDef _Run(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                               const CDC_LineCodingTypeDef* lc){
+  const VCP_DriverTypeDef* drv = &vcp_drivers[hcdc->vendor_chip];
+  VCP_ReqTypeDef r;
+  uint8_t more = (lc == NULL) ? drv->InitStep(hcdc, hcdc->vendor_step, &r)
+                              : drv->LineStep(hcdc, lc, hcdc->vendor_step, &r);
+  if(!more){
+    hcdc->vendor_step = 0U;
+    return USBH_OK;
+  }
+
+  USBH_StatusTypeDef status = _Issue(phost, hcdc, &r);
+  if(status == USBH_OK){
+    hcdc->vendor_step++;
+    return USBH_BUSY;
+  }
+  if(status != USBH_BUSY){
+    hcdc->vendor_step = 0U;
+  }
+  return status;
+}
+
+static USBH_StatusTypeDef _SetLineCoding(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                         CDC_LineCodingTypeDef* linecoding){
+  return _Run(phost, hcdc, linecoding);
+}
+
+static USBH_StatusTypeDef _SetControlLineState(USBH_HandleTypeDef* phost, CDC_HandleTypeDef* hcdc,
+                                               uint16_t lines){
+  VCP_ReqTypeDef r;
+  vcp_drivers[hcdc->vendor_chip].Lines(hcdc, lines, &r);
+  return _Issue(phost, hcdc, &r);
+}
+
+CDC_VCP_ChipTypeDef USBH_CDC_VCP_GetChip(CDC_HandleTypeDef* hcdc){
+  return (CDC_VCP_ChipTypeDef)hcdc->vendor_chip;
+}
+
+///////////////////////////////////
+// class interface
+
+static USBH_StatusTypeDef MatchInterface(USBH_HandleTypeDef* phost){
+  return (_Lookup(phost) != CDC_VCP_NONE) ? USBH_OK : USBH_FAIL;
+}
+
+static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost){
+  CDC_VCP_ChipTypeDef chip = _Lookup(phost);
+  if(chip == CDC_VCP_NONE){
+    USBH_DbgLog("Cannot Find a supported USB serial bridge");
+    return USBH_FAIL;
+  }
+  if((chip == CDC_VCP_FTDI) && (phost->device.DevDesc.bcdDevice == 0x0700U)){
+    chip = CDC_VCP_FTDI_H; // FT2232H shares its PID with the FT2232C/D
+  }
+
+  // bridges expose bulk in/out (& perhaps interrupt) on a single interface
+  if(USBH_SelectInterface(phost, 0U) != USBH_OK){
+    return USBH_FAIL;
+  }
+  if(USBH_CDC_SubDriver.Init(phost, 0U, 0U, &phost->pActiveClass->pData) != USBH_OK){
+    USBH_DbgLog("VCP subdriver for CDC failed to Init");
+    return USBH_FAIL;
+  }
+
+  CDC_HandleTypeDef* hcdc = (CDC_HandleTypeDef*)phost->pActiveClass->pData;
+  hcdc->vendor = vcp_drivers[chip].ops;
+  hcdc->vendor_chip = (uint8_t)chip;
+  // FTDI multi-port parts address channel A as 1, single port parts as 0
+  if((chip == CDC_VCP_FTDI || chip == CDC_VCP_FTDI_H || chip == CDC_VCP_FTDI_X)
+     && (phost->device.CfgDesc.bNumInterfaces > 1U)){
+    hcdc->vendor_port = 1U;
+  }
+  hcdc->LineCoding.b.dwDTERate = CDC_VCP_DEFAULT_BAUD;
+  hcdc->LineCoding.b.bCharFormat = 0U;
+  hcdc->LineCoding.b.bParityType = 0U;
+  hcdc->LineCoding.b.bDataBits = 8U;
+  return USBH_OK;
+}
+
+static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef* phost){
+  if(phost->pActiveClass->pData != NULL){
+    USBH_CDC_SubDriver.DeInit(phost, phost->pActiveClass->pData);
+    phost->pActiveClass->pData = 0U;
+  }
+  return USBH_OK;
+}
+
+// reset the bridge, open its control lines & apply the default line coding
+static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost){
+  CDC_HandleTypeDef* hcdc = (CDC_HandleTypeDef*)phost->pActiveClass->pData;
+  USBH_StatusTypeDef status = _Run(phost, hcdc, NULL);
+  if(status == USBH_OK){
+    hcdc->line_valid = 1U;
+    hcdc->ctl_lines = CDC_ACTIVATE_SIGNAL_DTR | CDC_ACTIVATE_CARRIER_SIGNAL_RTS; // raised by the init sequences
+    hcdc->ctrl_valid = 1U;
+    phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
+  } else if(status == USBH_NOT_SUPPORTED){
+    USBH_ErrLog("Control error: VCP: bridge configuration failed");
+  }
+  return status;
+}
+
+static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost){
+  return USBH_CDC_SubDriver.Process(phost, phost->pActiveClass->pData);
+}
+
+static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef* phost){
+  if(phost->pActiveClass->pData == NULL) return USBH_OK;
+  return USBH_CDC_SubDriver.SOFProcess(phost, phost->pActiveClass->pData);
+}
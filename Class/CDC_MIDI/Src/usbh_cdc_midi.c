@@ -36,19 +36,19 @@ USBH_ClassTypeDef CDC_MIDI_Class = {
 static USBH_StatusTypeDef MatchInterface(USBH_HandleTypeDef* phost){
 
   // FIXME support IAD (if found, ignore cdc & data searching)
-  uint8_t cdc_ctrl = USBH_FindInterface(phost, USB_CLASS_CDC, USB_SUBCLASS_CDC_ACM, 0xFF);
-  uint8_t cdc_data = USBH_FindInterface(phost, USB_CLASS_DATA, USB_SUBCLASS_CDC_DATA, 0x00); // use 0xFF to match *any*
+  uint8_t cdc_ctrl, cdc_data;
   uint8_t has_midi = USBH_FindInterface(phost, USB_CLASS_AUDIO, USB_SUBCLASS_MIDI, 0xFF);
 
   // require both ctrl+data to satisfy CDC
-  uint8_t has_cdc = (cdc_ctrl!=0xFF) && (cdc_data!=0xFF);
+  uint8_t has_cdc = USBH_CDC_FindPorts(phost, &cdc_ctrl, &cdc_data, 1U) != 0U;
 
   return (has_cdc && (has_midi!=0xFF)) ? USBH_OK : USBH_FAIL;
 }
 
 static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost){
-  uint8_t itf_cdc_ctrl = USBH_FindInterface(phost, USB_CLASS_CDC, USB_SUBCLASS_CDC_ACM, 0xFF);
-  uint8_t itf_cdc_data = USBH_FindInterface(phost, USB_CLASS_DATA, USB_SUBCLASS_CDC_DATA, 0x00);
+  // the first ACM port, paired by its union descriptor
+  uint8_t itf_cdc_ctrl = 0xFF, itf_cdc_data = 0xFF;
+  (void)USBH_CDC_FindPorts(phost, &itf_cdc_ctrl, &itf_cdc_data, 1U);
   uint8_t itf_midi = USBH_FindInterface(phost, USB_CLASS_AUDIO, USB_SUBCLASS_MIDI, 0xFF);
   if(itf_cdc_ctrl == 0xFF || itf_cdc_data == 0xFF || itf_midi == 0xFF){
     USBH_DbgLog("Cannot Find the interfaces for CDC+MIDI Class");
@@ -120,11 +120,17 @@ static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost){
 }
 
 static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef* phost){
-  UNUSED(phost);
-  return USBH_OK;
+  CDC_MIDI_HandleTypeDef* hCdcMidi = (CDC_MIDI_HandleTypeDef*)phost->pActiveClass->pData;
+  if(hCdcMidi == NULL) return USBH_OK;
+  (void)USBH_MIDI_SubDriver.SOFProcess(phost, hCdcMidi->handle_midi);
+  return USBH_CDC_SubDriver.SOFProcess(phost, hCdcMidi->handle_cdc);
 }
 
 static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost){
-  phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
-  return USBH_OK;
+  CDC_MIDI_HandleTypeDef* hCdcMidi = (CDC_MIDI_HandleTypeDef*)phost->pActiveClass->pData;
+  USBH_StatusTypeDef status = USBH_MIDI_SubDriver.ClassRequest(phost, hCdcMidi->handle_midi);
+  if(status == USBH_OK){
+    phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
+  }
+  return status;
 }
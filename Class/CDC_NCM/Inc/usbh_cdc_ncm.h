@@ -0,0 +1,218 @@
+#pragma once
+
+#include "usbh_core.h"
+#include "usbh_cdc.h"
+
+// CDC Ethernet: ECM (a frame per transfer) & NCM (NTB16, frames aggregated)
+//
+// CDC_Class matches on the class code alone, so register CDC_NCM_Class first.
+//
+// Received frames are handed to USBH_NCM_ReceiveCallback in place: the pointer
+// is into the receive NTB & only valid for the duration of the callback. The
+// next transfer isn't issued until every frame of the current one is out.
+//
+// USBH_NCM_Transmit gathers a frame from a segment list (eg. the pieces of an
+// lwIP pbuf chain) straight into the outgoing NTB, so each frame is copied
+// exactly once. Frames queue into one NTB while the other is on the wire:
+// under load several share a transfer, while a lone frame goes out at once.
+// Each NTB goes out as a single multi-packet URB & received NTBs come in up
+// to the negotiated size per URB.
+//
+// USBH_NCM_Transmit shares the filling NTB with USBH_Process without a lock,
+// so call it from the host thread only: the NCM callbacks or
+// USBH_UserProcess. Other threads hand their frames to one of those.
+
+extern USBH_ClassTypeDef  CDC_NCM_Class;
+#define USBH_CDC_NCM_CLASS    &CDC_NCM_Class
+
+#define USB_CDC_ECM_SUBCLASS                                    ETHERNET_NETWORKING_CONTROL_MODEL
+#define USB_CDC_NCM_SUBCLASS                                    0x0DU
+
+// functional descriptors
+#define CDC_ETHERNET_TYPE                                       0x0FU
+#define CDC_NCM_TYPE                                            0x1AU
+
+// NCM class requests
+#define NCM_GET_NTB_PARAMETERS                                  0x80U
+#define NCM_SET_NTB_INPUT_SIZE                                  0x86U
+#define NCM_NTB_PARAMETERS_SIZE                                 28U
+
+#define CDC_NOTIFY_CONNECTION_SPEED_CHANGE                      0x2AU
+
+// SET_ETHERNET_PACKET_FILTER bits
+#define NCM_PACKET_TYPE_PROMISCUOUS                             0x0001U
+#define NCM_PACKET_TYPE_ALL_MULTICAST                           0x0002U
+#define NCM_PACKET_TYPE_DIRECTED                                0x0004U
+#define NCM_PACKET_TYPE_BROADCAST                               0x0008U
+#define NCM_PACKET_TYPE_MULTICAST                               0x0010U
+
+#ifndef USBH_NCM_PACKET_FILTER
+#define USBH_NCM_PACKET_FILTER                                  (NCM_PACKET_TYPE_DIRECTED | \
+                                                                 NCM_PACKET_TYPE_BROADCAST | \
+                                                                 NCM_PACKET_TYPE_ALL_MULTICAST)
+#endif
+
+// NTB16 structures (NCM 3.2 & 3.3)
+#define NCM_NTH16_SIGNATURE                                     0x484D434EU // "NCMH"
+#define NCM_NDP16_SIGNATURE                                     0x304D434EU // "NCM0", no CRC
+#define NCM_NTH16_SIZE                                          12U
+#define NCM_NDP16_SIZE                                          8U  // before the datagram pointers
+#define NCM_NTB16_MIN_SIZE                                      2048U // smallest NTB an NCM function must take
+
+// receive NTB (or ECM frame) buffer. NCM requires hosts accept at least 2048.
+// high speed devices fill up to 16K & should be given at least that
+#ifndef USBH_NCM_NTB_IN_SIZE
+#define USBH_NCM_NTB_IN_SIZE                                    2048U
+#endif
+
+// each of the two transmit NTBs
+#ifndef USBH_NCM_NTB_OUT_SIZE
+#define USBH_NCM_NTB_OUT_SIZE                                   2048U
+#endif
+
+// frames aggregated into one transmit NTB
+#ifndef USBH_NCM_MAX_DATAGRAMS
+#define USBH_NCM_MAX_DATAGRAMS                                  16U
+#endif
+
+#define USBH_NCM_MAX_FRAME                                      1514U // without FCS
+
+typedef enum{
+  NCM_MODE_ECM = 0U,
+  NCM_MODE_NCM,
+} NCM_ModeTypeDef;
+
+typedef enum{
+  NCM_IDLE_STATE = 0U,
+  NCM_TRANSFER_DATA,
+  NCM_ERROR_STATE,
+} NCM_StateTypeDef;
+
+typedef enum{
+  NCM_IDLE = 0U,
+  NCM_SEND_DATA,
+  NCM_SEND_DATA_WAIT,
+  NCM_RECEIVE_DATA,
+  NCM_RECEIVE_DATA_WAIT,
+} NCM_DataStateTypeDef;
+
+typedef enum{
+  NCM_REQ_GET_MAC = 0U,
+  NCM_REQ_GET_NTB_PARAMETERS,
+  NCM_REQ_SET_NTB_INPUT_SIZE,
+  NCM_REQ_SET_ALT,
+  NCM_REQ_SET_FILTER,
+  NCM_REQ_DONE,
+} NCM_ReqStateTypeDef;
+
+// one piece of an outgoing frame
+typedef struct{
+  const uint8_t* data;
+  uint16_t       length;
+} NCM_SegTypeDef;
+
+// GET_NTB_PARAMETERS (NCM 6.2.1)
+typedef struct{
+  uint16_t formats;           // bit 0: NTB16, bit 1: NTB32
+  uint32_t in_max;
+  uint16_t in_divisor;
+  uint16_t in_remainder;
+  uint16_t in_align;
+  uint32_t out_max;
+  uint16_t out_divisor;
+  uint16_t out_remainder;
+  uint16_t out_align;
+  uint16_t out_max_datagrams; // 0 = no limit
+} NCM_NtbParamsTypeDef;
+
+typedef struct{
+  uint32_t buf[USBH_NCM_NTB_OUT_SIZE / 4U]; // word aligned for DMA
+  uint16_t length;                          // bytes used, NTH16 included
+  uint16_t count;                           // datagrams
+  uint16_t index[USBH_NCM_MAX_DATAGRAMS];
+  uint16_t dlength[USBH_NCM_MAX_DATAGRAMS];
+} NCM_NtbTypeDef;
+
+typedef struct{
+  uint32_t rx_frames;
+  uint32_t rx_bytes;
+  uint32_t rx_transfers;
+  uint32_t rx_errors;     // malformed NTBs or datagram pointers
+  uint32_t tx_frames;
+  uint32_t tx_bytes;
+  uint32_t tx_transfers;
+  uint32_t tx_busy;       // Transmit refused as both NTBs were full
+} NCM_StatsTypeDef;
+
+typedef struct _NCM_Process{
+  NCM_ModeTypeDef      mode;
+  NCM_StateTypeDef     state;
+  NCM_ReqStateTypeDef  req_state;
+  uint8_t              itf_ctrl;      // bInterfaceNumber of the communication interface
+  uint8_t              itf_data;      // bInterfaceNumber of the data interface
+  uint8_t              data_alt;      // alt setting carrying the endpoints
+
+  // from the Ethernet networking functional descriptor
+  uint8_t              mac_index;     // iMACAddress
+  uint8_t              mac[6];
+  uint8_t              mac_valid;
+  uint16_t             max_segment;   // wMaxSegmentSize
+
+  // notifications
+  uint8_t              NotifPipe;
+  uint8_t              NotifEp;
+  uint16_t             NotifEpSize;
+  uint16_t             NotifPoll;
+  CDC_NotifStateTypeDef notif_state;
+  uint32_t             notif_timer;
+  uint8_t              notif_buf[CDC_NOTIF_BUFFER_SIZE];
+  uint8_t              notif_have;    // bytes of a notification split over polls
+  uint8_t              link;          // NETWORK_CONNECTION
+  uint32_t             speed_down;    // bits/s, from CONNECTION_SPEED_CHANGE
+  uint32_t             speed_up;
+
+  // data interface, alt setting 1
+  uint8_t              InPipe;
+  uint8_t              OutPipe;
+  uint8_t              InEp;
+  uint8_t              OutEp;
+  uint16_t             InEpSize;
+  uint16_t             OutEpSize;
+  NCM_DataStateTypeDef data_tx_state;
+  NCM_DataStateTypeDef data_rx_state;
+  uint8_t              stall_mask;    // CDC_STALL_* bits
+  uint32_t             stall_count;
+
+  NCM_NtbParamsTypeDef ntb;
+  uint16_t             tx_max;        // NTB size limit, min of ours & the device's
+  uint16_t             tx_max_datagrams;
+  uint16_t             tx_seq;        // wSequence
+  uint8_t              tx_fill;       // NTB accepting frames
+  uint8_t              tx_wire;       // NTB on the wire, while data_tx_state != NCM_IDLE
+  uint16_t             tx_sent;       // bytes of tx_wire acknowledged
+  uint8_t              tx_zlp;
+  NCM_NtbTypeDef       tx[2];
+
+  uint32_t             rx_length;     // bytes of the NTB received so far
+  uint32_t             rx_limit;      // negotiated NTB size: a transfer this long needs no short packet
+  uint32_t             rx_chunk;      // bytes asked for by the URB on the wire
+  uint8_t              rx_discard;    // NTB overran rx_ntb: drop it up to the short packet
+  uint32_t             rx_ntb[USBH_NCM_NTB_IN_SIZE / 4U];
+
+  NCM_StatsTypeDef     stats;
+} NCM_HandleTypeDef;
+
+// queue a frame built from count segments. BUSY while both NTBs are full,
+// FAIL if the frame can never fit. host thread only, see above
+USBH_StatusTypeDef USBH_NCM_Transmit(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm,
+                                     const NCM_SegTypeDef* seg, uint8_t count);
+
+NCM_ModeTypeDef USBH_NCM_GetMode(NCM_HandleTypeDef* hncm);
+const uint8_t* USBH_NCM_GetMAC(NCM_HandleTypeDef* hncm);   // NULL if the device didn't report one
+uint8_t USBH_NCM_GetLink(NCM_HandleTypeDef* hncm);
+const NCM_StatsTypeDef* USBH_NCM_GetStats(NCM_HandleTypeDef* hncm);
+
+void USBH_NCM_ReceiveCallback(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm,
+                              uint8_t* frame, uint16_t length);
+void USBH_NCM_TransmitCallback(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm); // an NTB went out: room for more
+void USBH_NCM_LinkCallback(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm);     // link or speed changed
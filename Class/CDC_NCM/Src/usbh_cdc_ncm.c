@@ -0,0 +1,908 @@
+#include "usbh_cdc_ncm.h"
+
+static USBH_StatusTypeDef Match(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef* phost);
+
+static void NCM_ProcessTransmission(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm);
+static void NCM_ProcessReception(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm);
+static void NCM_ProcessNotification(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm);
+static void NCM_ProcessError(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm);
+
+USBH_ClassTypeDef CDC_NCM_Class = {
+  "CDC_NCM",
+  USB_CDC_CLASS,
+  Match,
+  Init,
+  DeInit,
+  ClassRequest,
+  Process,
+  SOFProcess,
+  NULL,
+};
+
+static void _Put16(uint8_t* p, uint16_t v){
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void _Put32(uint8_t* p, uint32_t v){
+  _Put16(p, (uint16_t)v);
+  _Put16(&p[2], (uint16_t)(v >> 16));
+}
+
+///////////////////////////////////
+// enumeration
+
+// find the first ECM or NCM communication interface & its data interface.
+// ctrl is an Itf_Desc index, data the index of the alt setting with endpoints.
+// hncm (optional) collects the Ethernet functional descriptor
+static uint8_t NCM_FindFunction(USBH_HandleTypeDef* phost, uint8_t* ctrl, uint8_t* data,
+                                NCM_HandleTypeDef* hncm){
+  uint8_t* raw = phost->device.CfgDesc_Raw;
+  uint16_t total = phost->device.CfgDesc.wTotalLength;
+  uint16_t ptr;
+  uint8_t in_ctrl = 0U;
+  uint8_t ctrl_num = 0U;
+  uint8_t subclass = 0U;
+  uint8_t data_num = 0xFFU;
+  uint8_t mac_index = 0U;
+  uint16_t max_segment = USBH_NCM_MAX_FRAME;
+
+  if(total > USBH_MAX_SIZE_CONFIGURATION) total = USBH_MAX_SIZE_CONFIGURATION;
+  if(total < USB_CONFIGURATION_DESC_SIZE) return 0U;
+
+  ptr = raw[0]; // skip configuration descriptor
+  while(ptr + 2U <= total){
+    uint8_t* d = &raw[ptr];
+    if(d[0] < 2U || ptr + d[0] > total) break; // malformed
+    if(d[1] == USB_DESC_TYPE_INTERFACE && d[0] >= 7U){
+      if(in_ctrl && (data_num != 0xFFU)) break; // functional descriptors end here
+      in_ctrl = (d[3] == 0U) // alt setting
+             && (d[5] == COMMUNICATION_INTERFACE_CLASS_CODE)
+             && ((d[6] == USB_CDC_ECM_SUBCLASS) || (d[6] == USB_CDC_NCM_SUBCLASS));
+      if(in_ctrl){
+        ctrl_num = d[2];
+        subclass = d[6];
+        data_num = 0xFFU;
+        mac_index = 0U;
+        max_segment = USBH_NCM_MAX_FRAME;
+      }
+    } else if(in_ctrl && d[1] == CS_INTERFACE && d[0] >= 5U && d[2] == CDC_UNION_TYPE){
+      data_num = d[4];
+    } else if(in_ctrl && d[1] == CS_INTERFACE && d[0] >= 13U && d[2] == CDC_ETHERNET_TYPE){
+      mac_index = d[3];
+      max_segment = LE16(&d[8]);
+    }
+    ptr += d[0];
+  }
+  if(!in_ctrl || (data_num == 0xFFU)) return 0U;
+
+  // the endpoints live on alt setting 1; alt 0 keeps the function quiet
+  uint8_t alt = 1U;
+  *ctrl = USBH_FindInterfaceIndex(phost, ctrl_num, 0U);
+  *data = USBH_FindInterfaceIndex(phost, data_num, alt);
+  if(*data == 0xFFU){
+    alt = 0U;
+    *data = USBH_FindInterfaceIndex(phost, data_num, alt);
+  }
+  if((*ctrl == 0xFFU) || (*data == 0xFFU)) return 0U;
+
+  if(hncm != NULL){
+    hncm->mode = (subclass == USB_CDC_NCM_SUBCLASS) ? NCM_MODE_NCM : NCM_MODE_ECM;
+    hncm->itf_ctrl = ctrl_num;
+    hncm->itf_data = data_num;
+    hncm->data_alt = alt;
+    hncm->mac_index = mac_index;
+    hncm->max_segment = ((max_segment == 0U) || (max_segment > USBH_NCM_MAX_FRAME)) ? USBH_NCM_MAX_FRAME
+                                                                                    : max_segment;
+  }
+  return 1U;
+}
+
+static USBH_StatusTypeDef Match(USBH_HandleTypeDef* phost){
+  uint8_t ctrl;
+  uint8_t data;
+  return NCM_FindFunction(phost, &ctrl, &data, NULL) ? USBH_OK : USBH_FAIL;
+}
+
+static void NCM_ResetNtb(NCM_HandleTypeDef* hncm, NCM_NtbTypeDef* ntb){
+  ntb->length = (hncm->mode == NCM_MODE_NCM) ? NCM_NTH16_SIZE : 0U;
+  ntb->count = 0U;
+}
+
+static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost){
+  uint8_t itf_ctrl;
+  uint8_t itf_data;
+
+  NCM_HandleTypeDef* hncm = (NCM_HandleTypeDef*)USBH_malloc(sizeof(NCM_HandleTypeDef));
+  if(!hncm){
+    USBH_DbgLog("Cannot allocate memory for NCM Handle");
+    return USBH_FAIL;
+  }
+  (void)USBH_memset(hncm, 0, sizeof(NCM_HandleTypeDef));
+  phost->pActiveClass->pData = (void*)hncm;
+
+  if(!NCM_FindFunction(phost, &itf_ctrl, &itf_data, hncm)){
+    USBH_DbgLog("Cannot Find the interfaces for %s class.", phost->pActiveClass->Name);
+    return USBH_FAIL;
+  }
+  if(USBH_SelectInterface(phost, itf_ctrl) != USBH_OK){
+    return USBH_FAIL;
+  }
+
+  // Collect the notification endpoint address, length & interval
+  uint8_t num_ep = phost->device.CfgDesc.Itf_Desc[itf_ctrl].bNumEndpoints;
+  if(num_ep > USBH_MAX_NUM_ENDPOINTS) num_ep = USBH_MAX_NUM_ENDPOINTS;
+  for(uint8_t i=0; i<num_ep; i++){
+    USBH_EpDescTypeDef* ep = &phost->device.CfgDesc.Itf_Desc[itf_ctrl].Ep_Desc[i];
+    if(((ep->bEndpointAddress & 0x80U) != 0U) && ((ep->bmAttributes & 0x03U) == USB_EP_TYPE_INTR)){
+      hncm->NotifEp = ep->bEndpointAddress;
+      hncm->NotifEpSize = ep->wMaxPacketSize;
+      if(phost->device.speed == USBH_SPEED_HIGH){ // bInterval is 2^(n-1) microframes
+        uint8_t n = (ep->bInterval < 1U) ? 1U : ((ep->bInterval > 16U) ? 16U : ep->bInterval);
+        hncm->NotifPoll = (uint16_t)(1U << (n - 1U));
+      } else {
+        hncm->NotifPoll = (ep->bInterval < 1U) ? 1U : ep->bInterval;
+      }
+      break;
+    }
+  }
+
+  if(hncm->NotifEp != 0U){
+    hncm->NotifPipe = USBH_AllocPipe(phost, hncm->NotifEp);
+    if(hncm->NotifPipe == 0xFFU){ // notifications are optional: carry on without
+      USBH_ErrLog("NCM: no pipe for the notification endpoint");
+      hncm->NotifPipe = 0U;
+    } else {
+      (void)USBH_OpenPipe(phost, hncm->NotifPipe, hncm->NotifEp,
+                          phost->device.address, phost->device.speed, USB_EP_TYPE_INTR,
+                          hncm->NotifEpSize);
+      (void)USBH_LL_SetToggle(phost, hncm->NotifPipe, 0U);
+    }
+  }
+
+  num_ep = phost->device.CfgDesc.Itf_Desc[itf_data].bNumEndpoints;
+  if(num_ep > USBH_MAX_NUM_ENDPOINTS) num_ep = USBH_MAX_NUM_ENDPOINTS;
+  for(uint8_t i=0; i<num_ep; i++){
+    USBH_EpDescTypeDef* ep = &phost->device.CfgDesc.Itf_Desc[itf_data].Ep_Desc[i];
+    if((ep->bmAttributes & 0x03U) != USB_EP_TYPE_BULK) continue;
+    if((ep->bEndpointAddress & 0x80U) != 0U){
+      hncm->InEp = ep->bEndpointAddress;
+      hncm->InEpSize = ep->wMaxPacketSize;
+    } else {
+      hncm->OutEp = ep->bEndpointAddress;
+      hncm->OutEpSize = ep->wMaxPacketSize;
+    }
+  }
+  if((hncm->InEpSize == 0U) || (hncm->OutEpSize == 0U)){
+    USBH_DbgLog("NCM: data interface has no bulk endpoints");
+    return USBH_FAIL;
+  }
+
+  hncm->OutPipe = USBH_AllocPipe(phost, hncm->OutEp);
+  hncm->InPipe = USBH_AllocPipe(phost, hncm->InEp);
+  if((hncm->OutPipe == 0xFFU) || (hncm->InPipe == 0xFFU)){ // DeInit frees whichever was had
+    USBH_ErrLog("NCM: no pipes left for the data interface");
+    if(hncm->OutPipe == 0xFFU) hncm->OutPipe = 0U;
+    if(hncm->InPipe == 0xFFU) hncm->InPipe = 0U;
+    return USBH_FAIL;
+  }
+  (void)USBH_OpenPipe(phost, hncm->OutPipe, hncm->OutEp,
+                      phost->device.address, phost->device.speed, USB_EP_TYPE_BULK,
+                      hncm->OutEpSize);
+  (void)USBH_OpenPipe(phost, hncm->InPipe, hncm->InEp,
+                      phost->device.address, phost->device.speed, USB_EP_TYPE_BULK,
+                      hncm->InEpSize);
+  (void)USBH_LL_SetToggle(phost, hncm->OutPipe, 0U);
+  (void)USBH_LL_SetToggle(phost, hncm->InPipe, 0U);
+
+  // ECM: one frame per transfer, no framing
+  hncm->tx_max = USBH_NCM_NTB_OUT_SIZE;
+  hncm->tx_max_datagrams = 1U;
+  hncm->rx_limit = sizeof(hncm->rx_ntb);
+  NCM_ResetNtb(hncm, &hncm->tx[0]);
+  NCM_ResetNtb(hncm, &hncm->tx[1]);
+
+  hncm->state = NCM_IDLE_STATE;
+  hncm->req_state = NCM_REQ_GET_MAC;
+  return USBH_OK;
+}
+
+static void _FreePipe(USBH_HandleTypeDef* phost, uint8_t* pipe){
+  if(*pipe){
+    (void)USBH_ClosePipe(phost, *pipe);
+    (void)USBH_FreePipe(phost, *pipe);
+    *pipe = 0U;
+  }
+}
+
+static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef* phost){
+  NCM_HandleTypeDef* hncm = (NCM_HandleTypeDef*)phost->pActiveClass->pData;
+  if(hncm){
+    _FreePipe(phost, &hncm->NotifPipe);
+    _FreePipe(phost, &hncm->InPipe);
+    _FreePipe(phost, &hncm->OutPipe);
+    USBH_free(hncm);
+    phost->pActiveClass->pData = 0U;
+  }
+  return USBH_OK;
+}
+
+///////////////////////////////////
+// class requests
+
+// iMACAddress is 12 hex digits, most significant first
+static uint8_t NCM_ParseMAC(const uint8_t* str, uint8_t* mac){
+  for(uint8_t i=0; i<12U; i++){
+    uint8_t c = str[i];
+    uint8_t v;
+    if(c >= '0' && c <= '9') v = (uint8_t)(c - '0');
+    else if(c >= 'A' && c <= 'F') v = (uint8_t)(c - 'A' + 10U);
+    else if(c >= 'a' && c <= 'f') v = (uint8_t)(c - 'a' + 10U);
+    else return 0U;
+    mac[i >> 1] = (i & 1U) ? (uint8_t)(mac[i >> 1] | v) : (uint8_t)(v << 4);
+  }
+  return 1U;
+}
+
+static void NCM_ParseNtbParameters(NCM_HandleTypeDef* hncm, uint8_t* buf){
+  NCM_NtbParamsTypeDef* p = &hncm->ntb;
+  p->formats = LE16(&buf[2]);
+  p->in_max = LE32(&buf[4]);
+  p->in_divisor = LE16(&buf[8]);
+  p->in_remainder = LE16(&buf[10]);
+  p->in_align = LE16(&buf[12]);
+  p->out_max = LE32(&buf[16]);
+  p->out_divisor = LE16(&buf[20]);
+  p->out_remainder = LE16(&buf[22]);
+  p->out_align = LE16(&buf[24]);
+  p->out_max_datagrams = LE16(&buf[26]);
+
+  // keep the transmit layout sane whatever the device says
+  if(p->out_divisor == 0U) p->out_divisor = 4U;
+  p->out_remainder %= p->out_divisor;
+  if((p->out_align < 4U) || (p->out_align & (p->out_align - 1U))) p->out_align = 4U;
+
+  // a device reporting no limit gets the NTB16 minimum rather than nothing
+  if(p->out_max == 0U) p->out_max = NCM_NTB16_MIN_SIZE;
+  if(p->in_max == 0U) p->in_max = NCM_NTB16_MIN_SIZE;
+
+  hncm->tx_max = (p->out_max < USBH_NCM_NTB_OUT_SIZE) ? (uint16_t)p->out_max : USBH_NCM_NTB_OUT_SIZE;
+  hncm->tx_max_datagrams = USBH_NCM_MAX_DATAGRAMS;
+  if((p->out_max_datagrams != 0U) && (p->out_max_datagrams < hncm->tx_max_datagrams)){
+    hncm->tx_max_datagrams = p->out_max_datagrams;
+  }
+  hncm->rx_limit = (p->in_max < sizeof(hncm->rx_ntb)) ? p->in_max : sizeof(hncm->rx_ntb);
+}
+
+static USBH_StatusTypeDef NCM_GetNtbParameters(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm){
+  phost->Control.setup.b.bmRequestType = USB_D2H | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
+  phost->Control.setup.b.bRequest = NCM_GET_NTB_PARAMETERS;
+  phost->Control.setup.b.wValue.w = 0U;
+  phost->Control.setup.b.wIndex.w = hncm->itf_ctrl;
+  phost->Control.setup.b.wLength.w = NCM_NTB_PARAMETERS_SIZE;
+  return USBH_CtlReq(phost, phost->device.Data, NCM_NTB_PARAMETERS_SIZE);
+}
+
+static USBH_StatusTypeDef NCM_SetNtbInputSize(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm){
+  phost->Control.setup.b.bmRequestType = USB_H2D | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
+  phost->Control.setup.b.bRequest = NCM_SET_NTB_INPUT_SIZE;
+  phost->Control.setup.b.wValue.w = 0U;
+  phost->Control.setup.b.wIndex.w = hncm->itf_ctrl;
+  phost->Control.setup.b.wLength.w = 4U;
+  _Put32(phost->device.Data, sizeof(hncm->rx_ntb));
+  return USBH_CtlReq(phost, phost->device.Data, 4U);
+}
+
+static USBH_StatusTypeDef NCM_SetPacketFilter(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm,
+                                              uint16_t filter){
+  phost->Control.setup.b.bmRequestType = USB_H2D | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
+  phost->Control.setup.b.bRequest = CDC_SET_ETHERNET_PACKET_FILTER;
+  phost->Control.setup.b.wValue.w = filter;
+  phost->Control.setup.b.wIndex.w = hncm->itf_ctrl;
+  phost->Control.setup.b.wLength.w = 0U;
+  return USBH_CtlReq(phost, NULL, 0U);
+}
+
+// NTB parameters must be read & sized while the data interface is on alt 0:
+// selecting alt 1 is what starts the function
+static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost){
+  NCM_HandleTypeDef* hncm = (NCM_HandleTypeDef*)phost->pActiveClass->pData;
+  USBH_StatusTypeDef status = USBH_BUSY;
+  USBH_StatusTypeDef req_status;
+  uint8_t str[14];
+
+  switch(hncm->req_state){
+    case NCM_REQ_GET_MAC:
+      if(hncm->mac_index == 0U){
+        req_status = USBH_FAIL;
+      } else {
+        req_status = USBH_Get_StringDesc(phost, hncm->mac_index, str, 26U);
+        if(req_status == USBH_OK){
+          hncm->mac_valid = NCM_ParseMAC(str, hncm->mac);
+        }
+      }
+      if(req_status != USBH_BUSY){ // the address is only informative
+        hncm->req_state = (hncm->mode == NCM_MODE_NCM) ? NCM_REQ_GET_NTB_PARAMETERS
+                                                       : NCM_REQ_SET_ALT;
+      }
+      break;
+
+    case NCM_REQ_GET_NTB_PARAMETERS:
+      req_status = NCM_GetNtbParameters(phost, hncm);
+      if(req_status == USBH_OK){
+        NCM_ParseNtbParameters(hncm, phost->device.Data);
+        hncm->req_state = (hncm->ntb.in_max > sizeof(hncm->rx_ntb)) ? NCM_REQ_SET_NTB_INPUT_SIZE
+                                                                    : NCM_REQ_SET_ALT;
+        NCM_ResetNtb(hncm, &hncm->tx[0]);
+        NCM_ResetNtb(hncm, &hncm->tx[1]);
+      } else if(req_status != USBH_BUSY){
+        USBH_ErrLog("NCM: GET_NTB_PARAMETERS failed");
+        status = USBH_FAIL;
+      }
+      break;
+
+    case NCM_REQ_SET_NTB_INPUT_SIZE:
+      req_status = NCM_SetNtbInputSize(phost, hncm);
+      if(req_status != USBH_BUSY){
+        if(req_status != USBH_OK){ // oversize NTBs are dropped & counted
+          USBH_ErrLog("NCM: SET_NTB_INPUT_SIZE failed");
+        }
+        hncm->req_state = NCM_REQ_SET_ALT;
+      }
+      break;
+
+    case NCM_REQ_SET_ALT:
+      if(hncm->data_alt == 0U){
+        req_status = USBH_OK;
+      } else {
+        req_status = USBH_SetInterface(phost, hncm->itf_data, hncm->data_alt);
+      }
+      if(req_status == USBH_OK){
+        hncm->req_state = NCM_REQ_SET_FILTER;
+      } else if(req_status != USBH_BUSY){
+        USBH_ErrLog("NCM: failed to select the data interface");
+        status = USBH_FAIL;
+      }
+      break;
+
+    case NCM_REQ_SET_FILTER:
+      req_status = NCM_SetPacketFilter(phost, hncm, USBH_NCM_PACKET_FILTER);
+      if(req_status != USBH_BUSY){ // optional: plenty of devices stall it
+        hncm->req_state = NCM_REQ_DONE;
+      }
+      break;
+
+    case NCM_REQ_DONE:
+      hncm->state = NCM_TRANSFER_DATA;
+      hncm->data_rx_state = NCM_RECEIVE_DATA;
+      if(hncm->NotifPipe != 0U){
+        hncm->notif_state = CDC_NOTIF_GET;
+      }
+      phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
+      status = USBH_OK;
+      break;
+
+    default:
+      break;
+  }
+  return status;
+}
+
+///////////////////////////////////
+// process
+
+static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost){
+  NCM_HandleTypeDef* hncm = (NCM_HandleTypeDef*)phost->pActiveClass->pData;
+  USBH_StatusTypeDef status = USBH_BUSY;
+
+  NCM_ProcessNotification(phost, hncm);
+  switch(hncm->state){
+    case NCM_IDLE_STATE:
+      status = USBH_OK;
+      break;
+
+    case NCM_TRANSFER_DATA:
+      NCM_ProcessTransmission(phost, hncm);
+      NCM_ProcessReception(phost, hncm);
+      break;
+
+    case NCM_ERROR_STATE:
+      NCM_ProcessError(phost, hncm);
+      break;
+
+    default:
+      break;
+  }
+  return status;
+}
+
+// wake the host thread once the notification interval is up, rather than
+// spinning on the interrupt pipe
+static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef* phost){
+  NCM_HandleTypeDef* hncm = (NCM_HandleTypeDef*)phost->pActiveClass->pData;
+  if((hncm != NULL) && (hncm->notif_state == CDC_NOTIF_POLL)
+  && ((phost->Timer - hncm->notif_timer) >= hncm->NotifPoll)){
+    hncm->notif_state = CDC_NOTIF_GET;
+#if (USBH_USE_OS == 1U)
+    USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+  }
+  return USBH_OK;
+}
+
+///////////////////////////////////
+// transmit
+
+// where the next datagram of length bytes would go. it must leave room for
+// the NDP16 closing the NTB, with a pointer for it & the terminator
+static uint8_t NCM_Fit(NCM_HandleTypeDef* hncm, NCM_NtbTypeDef* ntb, uint32_t length, uint32_t* at){
+  if(ntb->count >= hncm->tx_max_datagrams) return 0U;
+  if(hncm->mode == NCM_MODE_ECM){
+    *at = 0U;
+    return length <= hncm->tx_max;
+  }
+  NCM_NtbParamsTypeDef* p = &hncm->ntb;
+  uint32_t pos = ntb->length;
+  pos += (p->out_remainder + p->out_divisor - (pos % p->out_divisor)) % p->out_divisor;
+  uint32_t ndp = (pos + length + p->out_align - 1U) & ~(uint32_t)(p->out_align - 1U);
+  ndp += NCM_NDP16_SIZE + 4U * (ntb->count + 2U);
+  *at = pos;
+  return ndp <= hncm->tx_max;
+}
+
+// write the NTH16 & the NDP16 around the queued datagrams
+static void NCM_CloseNtb(NCM_HandleTypeDef* hncm, NCM_NtbTypeDef* ntb){
+  if(hncm->mode != NCM_MODE_NCM) return;
+  uint8_t* p = (uint8_t*)ntb->buf;
+  uint16_t ndp = (uint16_t)((ntb->length + hncm->ntb.out_align - 1U) & ~(uint32_t)(hncm->ntb.out_align - 1U));
+  uint16_t ndp_len = (uint16_t)(NCM_NDP16_SIZE + 4U * (ntb->count + 1U));
+
+  _Put32(&p[ndp], NCM_NDP16_SIGNATURE);
+  _Put16(&p[ndp + 4U], ndp_len);
+  _Put16(&p[ndp + 6U], 0U); // wNextNdpIndex
+  uint8_t* e = &p[ndp + NCM_NDP16_SIZE];
+  for(uint16_t i=0; i<ntb->count; i++){
+    _Put16(e, ntb->index[i]);
+    _Put16(&e[2], ntb->dlength[i]);
+    e += 4;
+  }
+  _Put32(e, 0U);
+  ntb->length = ndp + ndp_len;
+
+  _Put32(p, NCM_NTH16_SIGNATURE);
+  _Put16(&p[4], NCM_NTH16_SIZE);
+  _Put16(&p[6], hncm->tx_seq++);
+  _Put16(&p[8], ntb->length);
+  _Put16(&p[10], ndp);
+}
+
+USBH_StatusTypeDef USBH_NCM_Transmit(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm,
+                                     const NCM_SegTypeDef* seg, uint8_t count){
+  uint32_t length = 0U;
+  uint32_t at;
+
+  if(hncm->req_state != NCM_REQ_DONE){
+    return USBH_BUSY;
+  }
+  for(uint8_t i=0; i<count; i++){
+    length += seg[i].length;
+  }
+  if((length == 0U) || (length > hncm->max_segment)){
+    return USBH_FAIL;
+  }
+
+  NCM_NtbTypeDef* ntb = &hncm->tx[hncm->tx_fill];
+  if(!NCM_Fit(hncm, ntb, length, &at)){
+    if(ntb->count == 0U){
+      return USBH_FAIL; // wouldn't fit an empty NTB either
+    }
+    hncm->stats.tx_busy++;
+    return USBH_BUSY;
+  }
+
+  uint8_t* dst = (uint8_t*)ntb->buf + at;
+  for(uint8_t i=0; i<count; i++){
+    (void)USBH_memcpy(dst, seg[i].data, seg[i].length);
+    dst += seg[i].length;
+  }
+  ntb->index[ntb->count] = (uint16_t)at;
+  ntb->dlength[ntb->count] = (uint16_t)length;
+  ntb->count++;
+  ntb->length = (uint16_t)(at + length);
+
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+  return USBH_OK;
+}
+
+static void NCM_ProcessTransmission(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm){
+  NCM_NtbTypeDef* ntb = &hncm->tx[hncm->tx_wire];
+  USBH_URBStateTypeDef URB_Status;
+
+  switch(hncm->data_tx_state){
+    case NCM_IDLE:
+      if(hncm->tx[hncm->tx_fill].count == 0U){
+        break;
+      }
+      // send what has gathered & let Transmit fill the other NTB meanwhile
+      hncm->tx_wire = hncm->tx_fill;
+      hncm->tx_fill ^= 1U;
+      ntb = &hncm->tx[hncm->tx_wire];
+      NCM_CloseNtb(hncm, ntb);
+      hncm->tx_sent = 0U;
+      // a transfer ending on a full packet needs a ZLP, unless it's max size
+      hncm->tx_zlp = ((ntb->length % hncm->OutEpSize) == 0U)
+                  && !((hncm->mode == NCM_MODE_NCM) && (ntb->length == hncm->ntb.out_max));
+      hncm->data_tx_state = NCM_SEND_DATA;
+      /* FALLTHROUGH */
+    case NCM_SEND_DATA:
+      // the whole NTB in one URB, split into packets by the HCD. then the ZLP
+      (void)USBH_BulkSendData(phost,
+                              (uint8_t*)ntb->buf + hncm->tx_sent,
+                              (uint16_t)(ntb->length - hncm->tx_sent),
+                              hncm->OutPipe,
+                              1U);
+      hncm->data_tx_state = NCM_SEND_DATA_WAIT;
+      break;
+
+    case NCM_SEND_DATA_WAIT:
+      URB_Status = USBH_LL_GetURBState(phost, hncm->OutPipe);
+      if(URB_Status == USBH_URB_DONE){
+        hncm->tx_sent = ntb->length;
+        if(hncm->tx_zlp){
+          hncm->tx_zlp = 0U;
+          hncm->data_tx_state = NCM_SEND_DATA;
+        } else {
+          hncm->stats.tx_transfers++;
+          hncm->stats.tx_frames += ntb->count;
+          for(uint16_t i=0; i<ntb->count; i++){
+            hncm->stats.tx_bytes += ntb->dlength[i];
+          }
+          NCM_ResetNtb(hncm, ntb);
+          hncm->data_tx_state = NCM_IDLE;
+          USBH_NCM_TransmitCallback(phost, hncm);
+        }
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      } else if(URB_Status == USBH_URB_NOTREADY){
+        hncm->data_tx_state = NCM_SEND_DATA;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      } else if(URB_Status == USBH_URB_STALL){
+        // resend the NTB once the halt is cleared
+        hncm->stall_mask |= CDC_STALL_OUT;
+        hncm->data_tx_state = NCM_SEND_DATA;
+        hncm->state = NCM_ERROR_STATE;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+///////////////////////////////////
+// receive
+
+static void NCM_Deliver(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm,
+                        uint8_t* frame, uint16_t length){
+  hncm->stats.rx_frames++;
+  hncm->stats.rx_bytes += length;
+  USBH_NCM_ReceiveCallback(phost, hncm, frame, length);
+}
+
+// walk the NDP16 chain, handing each datagram over in place
+static void NCM_ParseNtb(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm,
+                         uint8_t* p, uint32_t length){
+  hncm->stats.rx_transfers++;
+  if(hncm->mode == NCM_MODE_ECM){
+    if(length > 0U){
+      NCM_Deliver(phost, hncm, p, (uint16_t)length);
+    }
+    return;
+  }
+
+  if((length < NCM_NTH16_SIZE) || (LE32(p) != NCM_NTH16_SIGNATURE)){
+    hncm->stats.rx_errors++;
+    return;
+  }
+  uint32_t block = LE16(&p[8]);
+  if((block == 0U) || (block > length)){
+    hncm->stats.rx_errors++;
+    return;
+  }
+
+  uint32_t ndp = LE16(&p[10]);
+  for(uint8_t n=0; (ndp != 0U) && (n < 8U); n++){ // bound the chain against loops
+    if((ndp & 3U) || (ndp + NCM_NDP16_SIZE > block) || (LE32(&p[ndp]) != NCM_NDP16_SIGNATURE)){
+      hncm->stats.rx_errors++;
+      return;
+    }
+    uint32_t end = ndp + LE16(&p[ndp + 4U]);
+    if(end > block) end = block;
+    for(uint32_t e = ndp + NCM_NDP16_SIZE; e + 4U <= end; e += 4U){
+      uint32_t at = LE16(&p[e]);
+      uint32_t dl = LE16(&p[e + 2U]);
+      if((at == 0U) || (dl == 0U)) break; // terminator
+      if(at + dl > block){
+        hncm->stats.rx_errors++;
+        continue;
+      }
+      NCM_Deliver(phost, hncm, &p[at], (uint16_t)dl);
+    }
+    ndp = LE16(&p[ndp + 6U]);
+  }
+}
+
+static void NCM_ProcessReception(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm){
+  uint8_t* buf = (uint8_t*)hncm->rx_ntb;
+  USBH_URBStateTypeDef URB_Status;
+  uint32_t length;
+
+  switch(hncm->data_rx_state){
+    case NCM_RECEIVE_DATA:
+      if(hncm->rx_length + hncm->InEpSize > sizeof(hncm->rx_ntb)){
+        // bigger than we asked for: drop the rest of the transfer
+        hncm->rx_discard = 1U;
+        hncm->rx_length = 0U;
+      }
+      // the rest of the NTB in one URB. the HCD writes whole packets, so it's
+      // rounded to them within the buffer; a short packet or ZLP ends it early
+      length = (hncm->rx_limit > hncm->rx_length) ? (hncm->rx_limit - hncm->rx_length) : 1U;
+      length = ((length + hncm->InEpSize - 1U) / hncm->InEpSize) * hncm->InEpSize;
+      if(length > sizeof(hncm->rx_ntb) - hncm->rx_length){
+        length = sizeof(hncm->rx_ntb) - hncm->rx_length;
+        length -= length % hncm->InEpSize;
+      }
+      if(length > 0xFFFFU){
+        length = 0xFFFFU - (0xFFFFU % hncm->InEpSize);
+      }
+      hncm->rx_chunk = length;
+      (void)USBH_BulkReceiveData(phost,
+                                 &buf[hncm->rx_length],
+                                 (uint16_t)length,
+                                 hncm->InPipe);
+#if defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U)
+      phost->NakTimer = phost->Timer;
+#endif  /* defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U) */
+      hncm->data_rx_state = NCM_RECEIVE_DATA_WAIT;
+      break;
+
+    case NCM_RECEIVE_DATA_WAIT:
+      URB_Status = USBH_LL_GetURBState(phost, hncm->InPipe);
+      if(URB_Status == USBH_URB_DONE){
+        length = USBH_LL_GetLastXferSize(phost, hncm->InPipe);
+        hncm->rx_length += length;
+        // a short packet ends the transfer, as does reaching the negotiated size
+        if((length < hncm->rx_chunk) || (hncm->rx_length >= hncm->rx_limit)){
+          if(hncm->rx_discard){
+            hncm->stats.rx_errors++;
+          } else {
+            NCM_ParseNtb(phost, hncm, buf, hncm->rx_length);
+          }
+          hncm->rx_discard = 0U;
+          hncm->rx_length = 0U;
+        }
+        hncm->data_rx_state = NCM_RECEIVE_DATA;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      }
+      else if(URB_Status == USBH_URB_STALL){
+        // re-arm at the same offset once the halt is cleared
+        hncm->stall_mask |= CDC_STALL_IN;
+        hncm->data_rx_state = NCM_RECEIVE_DATA;
+        hncm->state = NCM_ERROR_STATE;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      }
+#if defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U)
+      else if(URB_Status == USBH_URB_NAK_WAIT){
+        hncm->data_rx_state = NCM_RECEIVE_DATA_WAIT;
+        if((phost->Timer - phost->NakTimer) > phost->NakTimeout){
+          phost->NakTimer = phost->Timer;
+          USBH_ActivatePipe(phost, hncm->InPipe);
+        }
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      }
+#endif /* defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U) */
+      break;
+
+    default:
+      break;
+  }
+}
+
+///////////////////////////////////
+// notifications & errors
+
+static void NCM_DecodeNotification(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm,
+                                   uint8_t* buf, uint32_t length){
+  switch(buf[1]){
+    case CDC_NOTIFY_NETWORK_CONNECTION:
+      hncm->link = (LE16(&buf[2]) != 0U);
+      USBH_NCM_LinkCallback(phost, hncm);
+      break;
+
+    case CDC_NOTIFY_CONNECTION_SPEED_CHANGE:
+      if(length >= (CDC_NOTIFY_HEADER_SIZE + 8U)){
+        hncm->speed_down = LE32(&buf[CDC_NOTIFY_HEADER_SIZE]);
+        hncm->speed_up = LE32(&buf[CDC_NOTIFY_HEADER_SIZE + 4U]);
+        USBH_NCM_LinkCallback(phost, hncm);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// as CDC, but a notification's data may follow its header in later packets
+// when the endpoint is only 8 bytes
+static void NCM_ProcessNotification(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm){
+  USBH_URBStateTypeDef URB_Status;
+  uint32_t length;
+
+  switch(hncm->notif_state){
+    case CDC_NOTIF_GET:
+      length = sizeof(hncm->notif_buf) - hncm->notif_have;
+      if(length > hncm->NotifEpSize) length = hncm->NotifEpSize;
+      (void)USBH_InterruptReceiveData(phost, &hncm->notif_buf[hncm->notif_have],
+                                      (uint8_t)length,
+                                      hncm->NotifPipe);
+      hncm->notif_timer = phost->Timer;
+      hncm->notif_state = CDC_NOTIF_WAIT;
+      break;
+
+    case CDC_NOTIF_WAIT:
+      URB_Status = USBH_LL_GetURBState(phost, hncm->NotifPipe);
+      if(URB_Status == USBH_URB_DONE){
+        hncm->notif_have += (uint8_t)USBH_LL_GetLastXferSize(phost, hncm->NotifPipe);
+        if(hncm->notif_have < CDC_NOTIFY_HEADER_SIZE){
+          hncm->notif_have = 0U; // runt
+        } else {
+          uint32_t want = CDC_NOTIFY_HEADER_SIZE + LE16(&hncm->notif_buf[6]);
+          if(want > sizeof(hncm->notif_buf)) want = sizeof(hncm->notif_buf);
+          if(hncm->notif_have >= want){
+            NCM_DecodeNotification(phost, hncm, hncm->notif_buf, hncm->notif_have);
+            hncm->notif_have = 0U;
+          }
+        }
+        hncm->notif_state = CDC_NOTIF_POLL;
+      } else if(URB_Status == USBH_URB_NOTREADY){
+        hncm->notif_state = CDC_NOTIF_POLL; // NAKed: the channel halted, ask again next interval
+      } else if(URB_Status == USBH_URB_STALL){
+        if(hncm->state == NCM_TRANSFER_DATA){
+          hncm->stall_mask |= CDC_STALL_NOTIF;
+          hncm->state = NCM_ERROR_STATE;
+          hncm->notif_state = CDC_NOTIF_OFF; // re-enabled once cleared
+        } else {
+          hncm->notif_state = CDC_NOTIF_POLL; // retried once the other halt is cleared
+        }
+      }
+      if(hncm->notif_state != CDC_NOTIF_POLL){
+        break;
+      }
+      /* FALLTHROUGH */
+    case CDC_NOTIF_POLL:
+      // SOFProcess moves on once the interval is up. already due: wake now
+      if((phost->Timer - hncm->notif_timer) >= hncm->NotifPoll){
+        hncm->notif_state = CDC_NOTIF_GET;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// clear each halted endpoint in turn, reset its data toggle & resume
+static void NCM_ProcessError(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm){
+  uint8_t ep = 0x00U;
+  uint8_t pipe = 0U;
+  uint8_t bit = 0U;
+  if(hncm->stall_mask & CDC_STALL_IN){
+    ep = hncm->InEp;
+    pipe = hncm->InPipe;
+    bit = CDC_STALL_IN;
+  } else if(hncm->stall_mask & CDC_STALL_OUT){
+    ep = hncm->OutEp;
+    pipe = hncm->OutPipe;
+    bit = CDC_STALL_OUT;
+  } else if(hncm->stall_mask & CDC_STALL_NOTIF){
+    ep = hncm->NotifEp;
+    pipe = hncm->NotifPipe;
+    bit = CDC_STALL_NOTIF;
+  }
+
+  USBH_StatusTypeDef req_status = USBH_ClrFeature(phost, ep);
+  if(req_status == USBH_BUSY){
+    return;
+  }
+  if(bit != 0U){
+    if(req_status == USBH_OK){
+      (void)USBH_LL_SetToggle(phost, pipe, 0U);
+      hncm->stall_mask &= (uint8_t)~bit;
+      hncm->stall_count++;
+      if(bit == CDC_STALL_NOTIF){
+        hncm->notif_state = CDC_NOTIF_GET;
+      }
+      if(hncm->stall_mask != 0U){
+        return; // clear the other endpoint next
+      }
+    } else { // endpoint can't be recovered: stop using it
+      USBH_ErrLog("NCM: failed to clear halt on endpoint 0x%02x", ep);
+      if(hncm->stall_mask & CDC_STALL_NOTIF){
+        hncm->notif_state = CDC_NOTIF_OFF;
+      }
+      if(hncm->stall_mask & CDC_STALL_IN){
+        hncm->data_rx_state = NCM_IDLE;
+      }
+      if(hncm->stall_mask & CDC_STALL_OUT){
+        NCM_ResetNtb(hncm, &hncm->tx[hncm->tx_wire]);
+        hncm->data_tx_state = NCM_IDLE;
+      }
+      hncm->stall_mask = 0U;
+    }
+  }
+  hncm->state = NCM_TRANSFER_DATA;
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+///////////////////////////////////
+// public
+
+NCM_ModeTypeDef USBH_NCM_GetMode(NCM_HandleTypeDef* hncm){
+  return hncm->mode;
+}
+
+const uint8_t* USBH_NCM_GetMAC(NCM_HandleTypeDef* hncm){
+  return hncm->mac_valid ? hncm->mac : NULL;
+}
+
+uint8_t USBH_NCM_GetLink(NCM_HandleTypeDef* hncm){
+  return hncm->link;
+}
+
+const NCM_StatsTypeDef* USBH_NCM_GetStats(NCM_HandleTypeDef* hncm){
+  return &hncm->stats;
+}
+
+__weak void USBH_NCM_ReceiveCallback(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm,
+                                     uint8_t* frame, uint16_t length){
+  UNUSED(phost);
+  UNUSED(hncm);
+  UNUSED(frame);
+  UNUSED(length);
+}
+
+__weak void USBH_NCM_TransmitCallback(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm){
+  UNUSED(phost);
+  UNUSED(hncm);
+}
+
+__weak void USBH_NCM_LinkCallback(USBH_HandleTypeDef* phost, NCM_HandleTypeDef* hncm){
+  UNUSED(phost);
+  UNUSED(hncm);
+}
@@ -52,11 +52,77 @@ extern "C" {
   * @{
   */
 
-#define HID_MIN_POLL                                10U
-#define HID_REPORT_SIZE                             16U
+/* Shortest poll interval, in phost->Timer ticks (frames, or microframes on
+   high speed). The endpoint's bInterval is honoured above it. */
+#ifndef HID_MIN_POLL
+#define HID_MIN_POLL                                1U
+#endif /* HID_MIN_POLL */
 #define HID_MAX_USAGE                               10U
 #define HID_MAX_NBR_REPORT_FMT                      10U
-#define HID_QUEUE_SIZE                              10U
+
+/* Interrupt IN buffer of an interface. An interface whose IN endpoint has a
+   larger wMaxPacketSize is left unused, as the HCD writes whole packets.
+   At most 255: the interrupt transfer length is 8 bit */
+#ifndef HID_RX_BUFFER_SIZE
+#define HID_RX_BUFFER_SIZE                          64U
+#endif /* HID_RX_BUFFER_SIZE */
+
+/* Largest report kept by the report queue, longer ones are truncated. By
+   default a slot holds whatever the IN buffer received */
+#ifndef HID_REPORT_SIZE
+#define HID_REPORT_SIZE                             HID_RX_BUFFER_SIZE
+#endif /* HID_REPORT_SIZE */
+
+/* Reports queued, power of 2 */
+#ifndef HID_QUEUE_SIZE
+#define HID_QUEUE_SIZE                              16U
+#endif /* HID_QUEUE_SIZE */
+
+/* What a full report queue does with a new report, see HID_QueuePolicyTypeDef */
+#ifndef HID_QUEUE_POLICY
+#define HID_QUEUE_POLICY                            HID_QUEUE_DROP_NEWEST
+#endif /* HID_QUEUE_POLICY */
+
+/* How input reports reach the application, see HID_DeliveryTypeDef */
+#ifndef HID_DELIVERY
+#define HID_DELIVERY                                HID_DELIVERY_ALL
+#endif /* HID_DELIVERY */
+
+/* Decoded values kept in the state snapshot, over all input reports */
+#ifndef HID_STATE_MAX_VALUES
+#define HID_STATE_MAX_VALUES                        32U
+#endif /* HID_STATE_MAX_VALUES */
+
+/* HID interfaces bound per device, each with its own pipes, schedule and
+   report descriptor */
+#ifndef HID_MAX_INTERFACES
+#define HID_MAX_INTERFACES                          4U
+#endif /* HID_MAX_INTERFACES */
+
+/* Application collections with their own decoder, see
+   USBH_HID_RegisterCollection */
+#ifndef HID_MAX_COLLECTION_DECODERS
+#define HID_MAX_COLLECTION_DECODERS                 4U
+#endif /* HID_MAX_COLLECTION_DECODERS */
+
+/* Output reports queued for the interrupt OUT endpoint (or SET_REPORT),
+   see USBH_HID_RawSend. The queue size must be a power of 2 */
+#ifndef HID_OUT_REPORT_SIZE
+#define HID_OUT_REPORT_SIZE                         64U
+#endif /* HID_OUT_REPORT_SIZE */
+
+#ifndef HID_OUT_QUEUE_SIZE
+#define HID_OUT_QUEUE_SIZE                          4U
+#endif /* HID_OUT_QUEUE_SIZE */
+
+/* Size of the compiled report descriptor, see HID_ReportDescTypeDef */
+#ifndef HID_MAX_FIELDS
+#define HID_MAX_FIELDS                              32U
+#endif /* HID_MAX_FIELDS */
+
+#ifndef HID_MAX_REPORTS
+#define HID_MAX_REPORTS                             8U
+#endif /* HID_MAX_REPORTS */
 
 #define  HID_ITEM_LONG                              0xFEU
 
@@ -107,7 +173,6 @@ typedef enum
   USBH_HID_SEND_DATA,
   USBH_HID_BUSY,
   USBH_HID_GET_DATA,
-  USBH_HID_SYNC,
   USBH_HID_POLL,
   USBH_HID_ERROR,
 }
@@ -130,6 +195,8 @@ typedef enum
 {
   HID_MOUSE    = 0x01,
   HID_KEYBOARD = 0x02,
+  HID_GAMEPAD  = 0x03,          /* joystick or game pad, see usbh_hid_gamepad.h */
+  HID_TOUCH    = 0x04,          /* touch screen or pad, see usbh_hid_touch.h */
   HID_UNKNOWN = 0xFF,
 }
 HID_TypeTypeDef;
@@ -195,16 +262,161 @@ typedef struct _HIDDescriptor
 }
 HID_DescTypeDef;
 
+/* One run of elements of a Main item, as compiled by HID_ParseReportDesc.
+   Variable items are split so that element n of a field has usage
+   usage_min + n, the last usage repeating up to count. Array elements hold
+   indexes, where logical_min stands for usage_min. Constant (padding) items
+   get no field. */
+typedef struct
+{
+  uint16_t  offset;       /* bit offset of element 0, report ID byte excluded */
+  uint16_t  count;        /* number of elements */
+  uint16_t  index;        /* position of element 0 in the decoded values */
+  uint16_t  flags;        /* HID_FIELD_xxx */
+  uint16_t  usage_page;
+  uint16_t  usage_min;
+  uint16_t  usage_max;
+  uint8_t   size;         /* bits per element, 1 to 32 */
+  uint8_t   report;       /* index in HID_ReportDescTypeDef.report */
+  uint8_t   collection;   /* innermost collection, numbered from 1 in descriptor order */
+  int32_t   logical_min;
+  int32_t   logical_max;
+  uint32_t  app_usage;    /* usage page << 16 | usage of the application collection */
+}
+HID_FieldTypeDef;
+
+typedef struct
+{
+  uint8_t   id;           /* report ID, 0 when the device uses none */
+  uint8_t   type;         /* HID_REPORT_TYPE_INPUT/OUTPUT/FEATURE */
+  uint8_t   first_field;
+  uint8_t   nbr_fields;
+  uint16_t  size;         /* bits, report ID byte excluded */
+  uint16_t  nbr_values;   /* elements of all fields */
+}
+HID_ReportInfoTypeDef;
+
+/* Report descriptor compiled into per-report field tables */
+typedef struct
+{
+  HID_FieldTypeDef       field[HID_MAX_FIELDS];
+  HID_ReportInfoTypeDef  report[HID_MAX_REPORTS];
+  uint8_t                nbr_fields;
+  uint8_t                nbr_reports;
+  uint8_t                report_ids;   /* reports are prefixed with their ID */
+  uint32_t               app_usage;    /* first application collection */
+}
+HID_ReportDescTypeDef;
+
+
+typedef enum
+{
+  HID_QUEUE_DROP_NEWEST = 0U,   /* a full queue refuses the new report */
+  HID_QUEUE_DROP_OLDEST,        /* the new report overwrites the oldest */
+  HID_QUEUE_LATEST_WINS,        /* only the newest report is read */
+}
+HID_QueuePolicyTypeDef;
+
+typedef struct
+{
+  uint32_t  timestamp;          /* phost->Timer when the report arrived */
+  uint16_t  length;
+  uint8_t   report_id;          /* 0 when the device uses none */
+  uint8_t   data[HID_REPORT_SIZE];
+}
+HID_ReportSlotTypeDef;
+
+typedef enum
+{
+  HID_DELIVERY_ALL = 0U,        /* every report is queued */
+  HID_DELIVERY_CHANGES,         /* reports that leave the state as it was are dropped */
+  HID_DELIVERY_STATE,           /* nothing is queued: read the state snapshot */
+}
+HID_DeliveryTypeDef;
+
+/* Input reports folded into one state, decoded with the report descriptor.
+   Absolute values hold the latest report; relative values hold a running
+   sum, the motion between two reads being their difference. */
+typedef struct
+{
+  uint32_t  timestamp;          /* phost->Timer of the last change */
+  uint32_t  reports;            /* changes folded in */
+  uint8_t   report_id;          /* report of the last change */
+  int32_t   value[HID_STATE_MAX_VALUES];
+}
+HID_StateTypeDef;
 
+/* Single producer (USBH_Process), single consumer ring of whole reports.
+   head and tail run free; the producer only writes head and the consumer
+   only tail, so overwritten reports are detected and skipped by the
+   consumer. */
 typedef struct
 {
-  uint8_t  *buf;
-  uint16_t  head;
-  uint16_t tail;
-  uint16_t size;
-  uint8_t  lock;
-} FIFO_TypeDef;
+  HID_ReportSlotTypeDef   slot[HID_QUEUE_SIZE];
+  volatile uint32_t       head;
+  volatile uint32_t       tail;
+  HID_QueuePolicyTypeDef  policy;
+  uint32_t                dropped;      /* refused by HID_QUEUE_DROP_NEWEST */
+  uint32_t                overwritten;  /* lost under the other policies */
+  uint32_t                truncated;    /* longer than HID_REPORT_SIZE */
+} HID_QueueTypeDef;
+
+/* Request an interface holds EP0 with: one at a time over all interfaces */
+typedef enum
+{
+  HID_CTL_FREE = 0U,
+  HID_CTL_GET_REPORT,
+  HID_CTL_SET_REPORT,
+  HID_CTL_CLEAR_IN,             /* CLEAR_FEATURE(ENDPOINT_HALT) of the IN endpoint */
+  HID_CTL_CLEAR_OUT,            /* .. and of the OUT endpoint */
+}
+HID_CtlOwnerTypeDef;
 
+typedef enum
+{
+  HID_OUT_IDLE = 0U,
+  HID_OUT_WAIT,                 /* interrupt OUT transfer on the wire */
+  HID_OUT_NAK,                  /* NAKed, sent again at the next interval */
+  HID_OUT_RESEND,               /* interval up, set by the SOF */
+  HID_OUT_CLEAR,                /* OUT endpoint halted, clearing it on EP0 */
+  HID_OUT_SET_REPORT,           /* no OUT endpoint: SET_REPORT on EP0 */
+}
+HID_OutStateTypeDef;
+
+typedef struct
+{
+  uint16_t  length;             /* report ID byte included */
+  uint8_t   report_id;
+  uint8_t   data[HID_OUT_REPORT_SIZE];
+}
+HID_OutSlotTypeDef;
+
+/* Output reports, queued by the application and sent by USBH_Process */
+typedef struct
+{
+  HID_OutSlotTypeDef      slot[HID_OUT_QUEUE_SIZE];
+  volatile uint32_t       head;
+  volatile uint32_t       tail;
+  HID_OutStateTypeDef     state;
+  uint32_t                start;        /* phost->Timer when the head report went out */
+  uint16_t                poll;         /* phost->Timer ticks between OUT tokens */
+  uint32_t                due;          /* phost->Timer when a NAKed report goes again */
+} HID_OutQueueTypeDef;
+
+/* Raw channel counters. Round trips run from an output report going out
+   to the next input report, in phost->Timer ticks */
+typedef struct
+{
+  uint32_t  sent;
+  uint32_t  set_reports;        /* of which through SET_REPORT */
+  uint32_t  busy;               /* USBH_HID_RawSend refused, queue full */
+  uint32_t  errors;             /* output reports dropped */
+  uint32_t  rtt_count;
+  uint32_t  rtt_last;
+  uint32_t  rtt_min;
+  uint32_t  rtt_max;
+  uint32_t  rtt_sum;
+} HID_RawStatsTypeDef;
 
 /* Structure for HID process */
 typedef struct _HID_Process
@@ -215,19 +427,40 @@ typedef struct _HID_Process
   uint8_t              OutEp;
   uint8_t              InEp;
   HID_CtlStateTypeDef  ctl_state;
-  FIFO_TypeDef         fifo;
+  HID_QueueTypeDef     queue;
+  HID_DeliveryTypeDef  delivery;
+  HID_StateTypeDef     State[2];     /* State[state_seq & 1] is published */
+  volatile uint32_t    state_seq;    /* written by USBH_Process */
+  volatile uint32_t    state_read;   /* state_seq at the last USBH_HID_GetState */
+  uint16_t             state_base[HID_MAX_REPORTS]; /* first value of each report */
   uint8_t              *pData;
   uint16_t             length;
   uint8_t              ep_addr;
-  uint16_t             poll;
-  uint32_t             timer;
+  uint16_t             poll;         /* phost->Timer ticks between IN tokens */
+  uint32_t             timer;        /* phost->Timer when the next IN token is due */
   uint8_t              DataReady;
-  uint8_t              current_interface;
+  uint8_t              current_interface;   /* index in phost->device.CfgDesc.Itf_Desc */
+  HID_TypeTypeDef      type;
+  HID_CtlOwnerTypeDef  ctl_busy;     /* request of this interface on EP0 */
   HID_DescTypeDef      HID_Desc;
-  USBH_StatusTypeDef(* Init)(USBH_HandleTypeDef *phost);
+  HID_ReportDescTypeDef ReportDesc;
+  uint8_t              route[HID_MAX_REPORTS];  /* collection decoder per report, 0xFF: queued */
+  uint8_t              Buf[HID_RX_BUFFER_SIZE]; /* holds a whole IN packet */
+  HID_OutQueueTypeDef  out;
+  HID_RawStatsTypeDef  raw_stats;
+  uint8_t              rtt_armed;    /* an output report awaits its answer */
+  uint32_t             rtt_start;
+  USBH_StatusTypeDef(* Init)(USBH_HandleTypeDef *phost);  /* NULL if no decoder serves the interface */
+  void                 *pDecoderData; /* kept by the decoder serving the interface */
+  struct _HID_Process  *next;        /* next interface of the same device */
 }
 HID_HandleTypeDef;
 
+/* Decoder of an application collection, called from USBH_Process with the
+   report in place (report ID byte included) */
+typedef void (*HID_CollectionDecodeTypeDef)(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                            const uint8_t *report, uint16_t length);
+
 /**
   * @}
   */
@@ -243,6 +476,19 @@ HID_HandleTypeDef;
 #define USB_HID_SET_IDLE                              0x0AU
 #define USB_HID_SET_PROTOCOL                          0x0BU
 
+/* Report types (GET_REPORT/SET_REPORT wValue high byte) */
+#define HID_REPORT_TYPE_INPUT                         0x01U
+#define HID_REPORT_TYPE_OUTPUT                        0x02U
+#define HID_REPORT_TYPE_FEATURE                       0x03U
+
+/* HID_FieldTypeDef flags: the low bits are the Main item data bits */
+#define HID_FIELD_CONSTANT                            0x0001U
+#define HID_FIELD_VARIABLE                            0x0002U
+#define HID_FIELD_RELATIVE                            0x0004U
+#define HID_FIELD_WRAP                                0x0008U
+#define HID_FIELD_NULL_STATE                          0x0040U
+#define HID_FIELD_SIGNED                              0x8000U  /* logical_min < 0 */
+
 
 
 
@@ -312,12 +558,29 @@ void USBH_HID_EventCallback(USBH_HandleTypeDef *phost);
 HID_TypeTypeDef USBH_HID_GetDeviceType(USBH_HandleTypeDef *phost);
 
 uint8_t USBH_HID_GetPollInterval(USBH_HandleTypeDef *phost);
-
-void USBH_HID_FifoInit(FIFO_TypeDef *f, uint8_t *buf, uint16_t size);
-
-uint16_t  USBH_HID_FifoRead(FIFO_TypeDef *f, void *buf, uint16_t  nbytes);
-
-uint16_t  USBH_HID_FifoWrite(FIFO_TypeDef *f, void *buf, uint16_t nbytes);
+HID_ReportDescTypeDef *USBH_HID_GetReportDesc(USBH_HandleTypeDef *phost);
+
+/* Multi-interface devices: pData is the first interface, the rest chain
+   from it. The functions taking phost alone act on the first interface. */
+HID_HandleTypeDef *USBH_HID_GetInterface(USBH_HandleTypeDef *phost, uint8_t n);
+HID_HandleTypeDef *USBH_HID_GetHandle(USBH_HandleTypeDef *phost, HID_TypeTypeDef type);
+USBH_StatusTypeDef USBH_HID_RegisterCollection(uint32_t app_usage, HID_CollectionDecodeTypeDef decode);
+
+/* Raw reports of an interface: queued output over the interrupt OUT
+   endpoint, or SET_REPORT when there is none, and timestamped input */
+USBH_StatusTypeDef USBH_HID_RawSend(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                    uint8_t report_id, const uint8_t *data, uint16_t length);
+uint8_t USBH_HID_RawReceive(HID_HandleTypeDef *HID_Handle, HID_ReportSlotTypeDef *report);
+const HID_RawStatsTypeDef *USBH_HID_RawGetStats(HID_HandleTypeDef *HID_Handle);
+
+void USBH_HID_QueueInit(HID_QueueTypeDef *q, HID_QueuePolicyTypeDef policy);
+uint8_t USBH_HID_QueuePut(HID_QueueTypeDef *q, const uint8_t *buf, uint16_t length,
+                          uint8_t report_id, uint32_t timestamp);
+uint8_t USBH_HID_QueueGet(HID_QueueTypeDef *q, HID_ReportSlotTypeDef *report);
+void USBH_HID_SetQueuePolicy(USBH_HandleTypeDef *phost, HID_QueuePolicyTypeDef policy);
+void USBH_HID_SetDelivery(USBH_HandleTypeDef *phost, HID_DeliveryTypeDef delivery);
+uint8_t USBH_HID_GetState(USBH_HandleTypeDef *phost, HID_StateTypeDef *state);
+uint16_t USBH_HID_GetStateIndex(USBH_HandleTypeDef *phost, const HID_FieldTypeDef *field);
 
 /**
   * @}
@@ -0,0 +1,202 @@
+/**
+  ******************************************************************************
+  * @file    usbh_hid_gamepad.h
+  * @brief   This file contains all the prototypes for the usbh_hid_gamepad.c
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive -----------------------------------------------*/
+#ifndef __USBH_HID_GAMEPAD_H
+#define __USBH_HID_GAMEPAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_hid.h"
+#include "usbh_hid_parser.h"
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_HID_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_HID_GAMEPAD
+  * @brief Joysticks and gamepads, decoded from the report descriptor.
+  *
+  *        Interfaces whose first application collection is a Joystick or
+  *        Game Pad (and which claim no boot protocol) are typed HID_GAMEPAD.
+  *        Their reports are decoded in place as they arrive in USBH_Process,
+  *        through the collection decoders, into a pad per input report: two
+  *        player adapters give each pad its own report ID.
+  *
+  *        Generic Desktop X..Wheel become axes in -32767..32767, hat switches
+  *        a direction and Button page usages 1-32 a bitmask. Scaling and the
+  *        per-axis deadzones are fixed point, precomputed when the pad is
+  *        bound, so a report costs one extraction pass plus a multiply per
+  *        axis.
+  * @{
+  */
+
+
+/** @defgroup USBH_HID_GAMEPAD_Exported_Defines
+  * @{
+  */
+/* Pads kept over all interfaces */
+#ifndef HID_GAMEPAD_MAX_PADS
+#define HID_GAMEPAD_MAX_PADS                            HID_MAX_INTERFACES
+#endif /* HID_GAMEPAD_MAX_PADS */
+
+/* Fields extracted per pad, and the elements they carry */
+#ifndef HID_GAMEPAD_MAX_ITEMS
+#define HID_GAMEPAD_MAX_ITEMS                           8U
+#endif /* HID_GAMEPAD_MAX_ITEMS */
+
+#ifndef HID_GAMEPAD_MAX_VALUES
+#define HID_GAMEPAD_MAX_VALUES                          24U
+#endif /* HID_GAMEPAD_MAX_VALUES */
+
+/* Axes and hats decoded per pad */
+#ifndef HID_GAMEPAD_MAX_CONTROLS
+#define HID_GAMEPAD_MAX_CONTROLS                        16U
+#endif /* HID_GAMEPAD_MAX_CONTROLS */
+
+#ifndef HID_GAMEPAD_MAX_HATS
+#define HID_GAMEPAD_MAX_HATS                            2U
+#endif /* HID_GAMEPAD_MAX_HATS */
+
+/* Deadzone given to every axis when a pad is bound, see USBH_HID_GamepadSetDeadzone */
+#ifndef HID_GAMEPAD_DEADZONE
+#define HID_GAMEPAD_DEADZONE                            0U
+#endif /* HID_GAMEPAD_DEADZONE */
+
+#define HID_GAMEPAD_AXIS_MAX                            32767
+#define HID_GAMEPAD_HAT_CENTERED                        0xFFU
+
+#define HID_GAMEPAD_CTRL_AXIS                           0U
+#define HID_GAMEPAD_CTRL_HAT                            1U
+/**
+  * @}
+  */
+
+/** @defgroup USBH_HID_GAMEPAD_Exported_Types
+  * @{
+  */
+/* Axes, in Generic Desktop usage order from X (0x30) */
+typedef enum
+{
+  HID_GAMEPAD_X = 0U,
+  HID_GAMEPAD_Y,
+  HID_GAMEPAD_Z,
+  HID_GAMEPAD_RX,
+  HID_GAMEPAD_RY,
+  HID_GAMEPAD_RZ,
+  HID_GAMEPAD_SLIDER,
+  HID_GAMEPAD_DIAL,
+  HID_GAMEPAD_WHEEL,
+  HID_GAMEPAD_AXES,
+}
+HID_GAMEPAD_AxisTypeDef;
+
+typedef struct
+{
+  uint32_t  timestamp;                      /* phost->Timer of the last change */
+  uint32_t  reports;                        /* changes */
+  uint32_t  buttons;                        /* bit n: button n + 1 */
+  int16_t   axis[HID_GAMEPAD_AXES];         /* -32767..32767, 0 if the pad has no such axis */
+  uint8_t   hat[HID_GAMEPAD_MAX_HATS];      /* 0 up, clockwise in 45 degree steps to 7, or HID_GAMEPAD_HAT_CENTERED */
+}
+HID_GAMEPAD_StateTypeDef;
+
+/* An axis or hat, read from values[value] of the extracted report */
+typedef struct
+{
+  uint8_t   type;                           /* HID_GAMEPAD_CTRL_xxx */
+  uint8_t   target;                         /* axis or hat */
+  uint8_t   value;
+  uint8_t   positions;                      /* hats: 4 or 8 */
+  int32_t   min;                            /* logical range */
+  int32_t   max;
+  uint32_t  scale;                          /* axes: 65534 / (max - min), 16.16 */
+}
+HID_GAMEPAD_ControlTypeDef;
+
+/* A run of buttons, bitmap or array */
+typedef struct
+{
+  uint8_t   value;                          /* first value */
+  uint8_t   count;                          /* array elements, 1 for a bitmap */
+  uint8_t   shift;                          /* bitmaps: bit of the first button */
+  uint8_t   array;
+  int32_t   min;                            /* arrays: index of usage usage_min */
+  uint16_t  usage_min;
+  uint16_t  usage_max;
+}
+HID_GAMEPAD_ButtonsTypeDef;
+
+typedef struct _HID_GAMEPAD_Pad
+{
+  HID_HandleTypeDef           *HID_Handle;  /* interface */
+  uint8_t                     report_id;
+  uint8_t                     nbr_items;
+  uint8_t                     nbr_controls;
+  uint8_t                     nbr_buttons;  /* runs of buttons */
+  uint8_t                     nbr_hats;
+  uint16_t                    axes;         /* bit n: axis n reported */
+  HID_ExtractTypeDef          item[HID_GAMEPAD_MAX_ITEMS];
+  HID_GAMEPAD_ControlTypeDef  control[HID_GAMEPAD_MAX_CONTROLS];
+  HID_GAMEPAD_ButtonsTypeDef  button[HID_GAMEPAD_MAX_ITEMS];
+  uint16_t                    deadzone[HID_GAMEPAD_AXES];
+  uint32_t                    dz_gain[HID_GAMEPAD_AXES];    /* 32767 / (32767 - deadzone), 16.16 */
+
+  HID_GAMEPAD_StateTypeDef    State[2];     /* State[seq & 1] is published */
+  volatile uint32_t           seq;          /* written by USBH_Process */
+  uint32_t                    read;         /* seq at the last USBH_HID_GetGamepadState */
+}
+HID_GAMEPAD_HandleTypeDef;
+/**
+  * @}
+  */
+
+/** @defgroup USBH_HID_GAMEPAD_Exported_FunctionsPrototype
+  * @{
+  */
+USBH_StatusTypeDef USBH_HID_GamepadInit(USBH_HandleTypeDef *phost);
+HID_GAMEPAD_HandleTypeDef *USBH_HID_GetGamepad(USBH_HandleTypeDef *phost, uint8_t n);
+uint8_t USBH_HID_GetGamepadState(HID_GAMEPAD_HandleTypeDef *pad, HID_GAMEPAD_StateTypeDef *state);
+void USBH_HID_GamepadSetDeadzone(HID_GAMEPAD_HandleTypeDef *pad, HID_GAMEPAD_AxisTypeDef axis, uint16_t deadzone);
+void USBH_HID_GamepadCallback(USBH_HandleTypeDef *phost, HID_GAMEPAD_HandleTypeDef *pad);
+
+/**
+  * @}
+  */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBH_HID_GAMEPAD_H */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
@@ -53,6 +53,19 @@ extern "C" {
 #define USBH_HID_KEYBD_REPORT_SIZE                       0x8U
 #endif /* USBH_HID_KEYBD_REPORT_SIZE */
 
+/* Key events kept until read, see USBH_HID_GetKeybdEvent. Power of 2 */
+#ifndef USBH_HID_KEYBD_EVENT_QUEUE_SIZE
+#define USBH_HID_KEYBD_EVENT_QUEUE_SIZE                  32U
+#endif /* USBH_HID_KEYBD_EVENT_QUEUE_SIZE */
+
+/* Key state: one bit per Keyboard/Keypad usage, modifiers included */
+#define HID_KEYBD_STATE_WORDS                            8U
+
+/* Layout, selected at build time: QWERTY unless AZERTY_KEYBOARD is
+   defined, or the application's own tables with
+   USBH_HID_KEYBD_CUSTOM_LAYOUT (see USBH_HID_KeybdLayoutKey) */
+#define HID_KEYBD_LAYOUT_SIZE                            132U
+
 #define KEY_NONE                               0x00
 #define KEY_ERRORROLLOVER                      0x01
 #define KEY_POSTFAIL                           0x02
@@ -288,9 +301,29 @@ typedef struct
 }
 HID_KEYBD_Info_TypeDef;
 
+typedef struct
+{
+  uint32_t timestamp;           /* phost->Timer of the report */
+  uint8_t  usage;               /* KEY_xxx */
+  uint8_t  pressed;             /* 1: pressed, 0: released */
+  uint8_t  modifiers;           /* bit n: KEY_LEFTCONTROL + n held, after the event */
+}
+HID_KEYBD_EventTypeDef;
+
+#if defined(USBH_HID_KEYBD_CUSTOM_LAYOUT)
+/* Characters of the layout, without and with shift, indexed like the
+   QWERTY tables of usbh_hid_keybd.c */
+extern const uint8_t USBH_HID_KeybdLayoutKey[HID_KEYBD_LAYOUT_SIZE];
+extern const uint8_t USBH_HID_KeybdLayoutShiftKey[HID_KEYBD_LAYOUT_SIZE];
+#endif /* USBH_HID_KEYBD_CUSTOM_LAYOUT */
+
 USBH_StatusTypeDef USBH_HID_KeybdInit(USBH_HandleTypeDef *phost);
 HID_KEYBD_Info_TypeDef *USBH_HID_GetKeybdInfo(USBH_HandleTypeDef *phost);
 uint8_t USBH_HID_GetASCIICode(HID_KEYBD_Info_TypeDef *info);
+uint8_t USBH_HID_GetKeybdEvent(USBH_HandleTypeDef *phost, HID_KEYBD_EventTypeDef *event);
+uint8_t USBH_HID_KeybdEventToASCII(const HID_KEYBD_EventTypeDef *event);
+const uint32_t *USBH_HID_GetKeybdState(USBH_HandleTypeDef *phost);
+uint8_t USBH_HID_KeybdIsPressed(USBH_HandleTypeDef *phost, uint8_t usage);
 
 /**
   * @}
@@ -64,9 +64,10 @@ HID_MOUSE_Info_TypeDef;
 /** @defgroup USBH_HID_MOUSE_Exported_Defines
   * @{
   */
-#ifndef USBH_HID_MOUSE_REPORT_SIZE
-#define USBH_HID_MOUSE_REPORT_SIZE                       0x8U
-#endif /* USBH_HID_MOUSE_REPORT_SIZE */
+/* Decoded values kept of the pointer report */
+#ifndef USBH_HID_MOUSE_MAX_VALUES
+#define USBH_HID_MOUSE_MAX_VALUES                        16U
+#endif /* USBH_HID_MOUSE_MAX_VALUES */
 /**
   * @}
   */
@@ -3,8 +3,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "usbh_hid.h"
 
-// try by assuming the None is Mouse (may need to change for other devices)
-// we *should* be able to determine type by reading the info report
+// decodes the pointer (X, Y & buttons 1-3) found in the report descriptor
 typedef struct _HID_NONE_Info
 {
   uint8_t x;
@@ -14,9 +13,10 @@ typedef struct _HID_NONE_Info
 HID_NONE_Info_TypeDef;
 
 
-#ifndef USBH_HID_NONE_REPORT_SIZE
-#define USBH_HID_NONE_REPORT_SIZE                       0x8U
-#endif /* USBH_HID_NONE_REPORT_SIZE */
+// decoded values kept of the pointer report
+#ifndef USBH_HID_NONE_MAX_VALUES
+#define USBH_HID_NONE_MAX_VALUES                        16U
+#endif /* USBH_HID_NONE_MAX_VALUES */
 
 USBH_StatusTypeDef USBH_HID_NoneInit(USBH_HandleTypeDef *phost);
 HID_NONE_Info_TypeDef *USBH_HID_GetNoneInfo(USBH_HandleTypeDef *phost);
@@ -64,10 +64,33 @@ typedef struct
 }
 HID_Report_ItemTypedef;
 
+/* A run of report elements extracted into an output structure */
+typedef struct
+{
+  uint16_t offset;       /* bit offset of element 0 in the report */
+  uint8_t  size;         /* bits per element, 1 to 32 */
+  uint8_t  count;        /* elements */
+  uint8_t  flags;        /* HID_EXTRACT_SIGNED */
+  uint8_t  width;        /* bytes per element in the output: 1, 2 or 4 */
+  uint16_t dest;         /* byte offset of element 0 in the output */
+}
+HID_ExtractTypeDef;
+
+#define HID_EXTRACT_SIGNED                          0x01U
+
 
 uint32_t HID_ReadItem(HID_Report_ItemTypedef *ri, uint8_t ndx);
 uint32_t HID_WriteItem(HID_Report_ItemTypedef *ri, uint32_t value, uint8_t ndx);
 
+USBH_StatusTypeDef HID_ParseReportDesc(HID_ReportDescTypeDef *desc, const uint8_t *buf, uint16_t length);
+const HID_ReportInfoTypeDef *HID_DecodeReport(const HID_ReportDescTypeDef *desc, uint8_t type,
+                                              const uint8_t *buf, uint16_t length,
+                                              int32_t *values, uint16_t nbr_values);
+void HID_ExtractReport(const HID_ExtractTypeDef *items, uint8_t nbr_items,
+                       const uint8_t *buf, uint16_t length, void *out);
+const HID_FieldTypeDef *HID_FindField(const HID_ReportDescTypeDef *desc, uint8_t type,
+                                      uint16_t usage_page, uint16_t usage);
+
 
 /**
   * @}
@@ -0,0 +1,241 @@
+/**
+  ******************************************************************************
+  * @file    usbh_hid_touch.h
+  * @brief   This file contains all the prototypes for the usbh_hid_touch.c
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive -----------------------------------------------*/
+#ifndef __USBH_HID_TOUCH_H
+#define __USBH_HID_TOUCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_hid.h"
+#include "usbh_hid_parser.h"
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_HID_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_HID_TOUCH
+  * @brief Multi-touch panels (Digitizer page), decoded from the report
+  *        descriptor.
+  *
+  *        Interfaces whose first application collection is a Touch Screen
+  *        or Touch Pad (and which claim no boot protocol) are typed
+  *        HID_TOUCH. Their reports are decoded in place as they arrive in
+  *        USBH_Process, through the collection decoders.
+  *
+  *        A scan of the panel may be split over several reports (hybrid
+  *        mode): the first carries the Contact Count of the whole scan, the
+  *        others 0. Contacts are gathered until the count is reached, then
+  *        tracked by Contact ID into fixed slots and delivered as one frame:
+  *        to USBH_HID_TouchCallback, and as the snapshot read by
+  *        USBH_HID_GetTouchFrame. Reports without a Contact Count are a frame
+  *        each.
+  * @{
+  */
+
+
+/** @defgroup USBH_HID_TOUCH_Exported_Defines
+  * @{
+  */
+/* Panels kept over all interfaces */
+#ifndef HID_TOUCH_MAX_PANELS
+#define HID_TOUCH_MAX_PANELS                            1U
+#endif /* HID_TOUCH_MAX_PANELS */
+
+/* Contacts tracked per panel, at most 32 */
+#ifndef HID_TOUCH_MAX_CONTACTS
+#define HID_TOUCH_MAX_CONTACTS                          10U
+#endif /* HID_TOUCH_MAX_CONTACTS */
+
+/* Fingers laid out in one report, and fields extracted for them: by default
+   every usage of every finger, plus Contact Count and Scan Time */
+#ifndef HID_TOUCH_REPORT_FINGERS
+#define HID_TOUCH_REPORT_FINGERS                        5U
+#endif /* HID_TOUCH_REPORT_FINGERS */
+
+#ifndef HID_TOUCH_MAX_ITEMS
+#define HID_TOUCH_MAX_ITEMS                             ((HID_TOUCH_REPORT_FINGERS * HID_TOUCH_V_NBR) + 2U)
+#endif /* HID_TOUCH_MAX_ITEMS */
+
+/* Touch reports (IDs) per panel */
+#ifndef HID_TOUCH_MAX_REPORTS
+#define HID_TOUCH_MAX_REPORTS                           2U
+#endif /* HID_TOUCH_MAX_REPORTS */
+
+/* Decode time and latency per frame. Off by default as it costs two
+   timestamp reads per report. HID_TOUCH_TIMESTAMP() must return a free
+   running 32bit counter; the default is the Cortex-M DWT cycle counter,
+   which the application must enable. */
+#ifndef HID_TOUCH_STATS
+#define HID_TOUCH_STATS                                 0U
+#endif /* HID_TOUCH_STATS */
+
+#ifndef HID_TOUCH_TIMESTAMP
+#define HID_TOUCH_TIMESTAMP()                           (DWT->CYCCNT)
+#endif /* HID_TOUCH_TIMESTAMP */
+
+/* Contact states */
+#define HID_TOUCH_NONE                                  0U  /* free slot */
+#define HID_TOUCH_DOWN                                  1U  /* first frame of the contact */
+#define HID_TOUCH_MOVE                                  2U
+#define HID_TOUCH_UP                                    3U  /* last frame, at the last position; freed in the next */
+
+/* Values of a finger, see HID_TOUCH_LayoutTypeDef */
+#define HID_TOUCH_V_TIP                                 0U
+#define HID_TOUCH_V_INRANGE                             1U
+#define HID_TOUCH_V_CONFIDENCE                          2U
+#define HID_TOUCH_V_ID                                  3U
+#define HID_TOUCH_V_X                                   4U
+#define HID_TOUCH_V_Y                                   5U
+#define HID_TOUCH_V_WIDTH                               6U
+#define HID_TOUCH_V_HEIGHT                              7U
+#define HID_TOUCH_V_NBR                                 8U
+/**
+  * @}
+  */
+
+/** @defgroup USBH_HID_TOUCH_Exported_Types
+  * @{
+  */
+typedef struct
+{
+  uint8_t   id;                             /* Contact ID, low 8 bits */
+  uint8_t   state;                          /* HID_TOUCH_xxx */
+  uint8_t   confidence;                     /* 0: the panel takes it for a palm */
+  uint16_t  x;                              /* 0..x_range of the panel */
+  uint16_t  y;
+  uint16_t  width;                          /* logical units, 0 if not reported */
+  uint16_t  height;
+}
+HID_TOUCH_ContactTypeDef;
+
+/* Contacts keep their slot from DOWN to UP */
+typedef struct
+{
+  uint32_t                  timestamp;      /* phost->Timer when the scan completed */
+  uint32_t                  frames;         /* delivered so far */
+  uint16_t                  scan_time;      /* device scan time (100us units), 0 if not reported */
+  uint8_t                   count;          /* slots not HID_TOUCH_NONE */
+  HID_TOUCH_ContactTypeDef  contact[HID_TOUCH_MAX_CONTACTS];
+}
+HID_TOUCH_FrameTypeDef;
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+}
+HID_TOUCH_TimeTypeDef;
+
+typedef struct
+{
+  uint32_t  reports;
+  uint32_t  frames;
+  uint32_t  partial;                        /* scans cut short by the next one, delivered as they were */
+  uint32_t  stray;                          /* continuation reports with no scan open */
+  uint32_t  overflow;                       /* contacts with no free slot */
+#if (HID_TOUCH_STATS == 1U)
+  HID_TOUCH_TimeTypeDef  decode;            /* decoding a frame, summed over its reports */
+  HID_TOUCH_TimeTypeDef  latency;           /* first report of a scan -> frame delivered */
+#endif /* (HID_TOUCH_STATS == 1U) */
+}
+HID_TOUCH_StatsTypeDef;
+
+/* A touch report compiled: HID_TOUCH_V_xxx of finger n land in
+   values[n * HID_TOUCH_V_NBR + HID_TOUCH_V_xxx] */
+typedef struct
+{
+  uint8_t             report_id;
+  uint8_t             nbr_items;
+  uint8_t             nbr_fingers;
+  uint8_t             present[HID_TOUCH_REPORT_FINGERS];  /* bit n: HID_TOUCH_V_n reported */
+  uint8_t             count;                /* Contact Count reported */
+  uint8_t             scan_time;            /* Scan Time reported */
+  HID_ExtractTypeDef  item[HID_TOUCH_MAX_ITEMS];
+}
+HID_TOUCH_LayoutTypeDef;
+
+typedef struct _HID_TOUCH_Panel
+{
+  HID_HandleTypeDef         *HID_Handle;    /* interface */
+  uint8_t                   nbr_layouts;
+  HID_TOUCH_LayoutTypeDef   layout[HID_TOUCH_MAX_REPORTS];
+  int32_t                   x_min;          /* logical range of the first finger's X and Y */
+  int32_t                   y_min;
+  uint16_t                  x_range;
+  uint16_t                  y_range;
+
+  /* Scan being gathered */
+  uint8_t                   expected;       /* contacts, 0 if none is open */
+  uint8_t                   received;
+  uint16_t                  scan_time;
+  HID_TOUCH_ContactTypeDef  pending[HID_TOUCH_MAX_CONTACTS];  /* state holds the tip switch */
+
+  HID_TOUCH_FrameTypeDef    Frame[2];       /* Frame[seq & 1] is published */
+  volatile uint32_t         seq;            /* written by USBH_Process */
+  uint32_t                  read;           /* seq at the last USBH_HID_GetTouchFrame */
+
+  HID_TOUCH_StatsTypeDef    stats;
+#if (HID_TOUCH_STATS == 1U)
+  uint32_t                  scan_start;     /* HID_TOUCH_TIMESTAMP() at the first report of the scan */
+  uint32_t                  scan_decode;
+#endif /* (HID_TOUCH_STATS == 1U) */
+}
+HID_TOUCH_HandleTypeDef;
+/**
+  * @}
+  */
+
+/** @defgroup USBH_HID_TOUCH_Exported_FunctionsPrototype
+  * @{
+  */
+USBH_StatusTypeDef USBH_HID_TouchInit(USBH_HandleTypeDef *phost);
+HID_TOUCH_HandleTypeDef *USBH_HID_GetTouch(USBH_HandleTypeDef *phost, uint8_t n);
+uint8_t USBH_HID_GetTouchFrame(HID_TOUCH_HandleTypeDef *panel, HID_TOUCH_FrameTypeDef *frame);
+const HID_TOUCH_StatsTypeDef *USBH_HID_GetTouchStats(HID_TOUCH_HandleTypeDef *panel);
+void USBH_HID_ResetTouchStats(HID_TOUCH_HandleTypeDef *panel);
+void USBH_HID_TouchCallback(USBH_HandleTypeDef *phost, HID_TOUCH_HandleTypeDef *panel,
+                            const HID_TOUCH_FrameTypeDef *frame);
+
+/**
+  * @}
+  */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBH_HID_TOUCH_H */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
@@ -25,6 +25,8 @@
   *           This driver implements the following aspects of the specification:
   *             - The Boot Interface Subclass
   *             - The Mouse and Keyboard protocols
+  *             - Every HID interface of a device, each with its own pipes,
+  *               schedule and report descriptor
   *
   *  @endverbatim
   *
@@ -41,6 +43,7 @@ EndBSPDependencies */
 /* Includes ------------------------------------------------------------------*/
 #include "usbh_hid.h"
 #include "usbh_hid_parser.h"
+#include "usbh_hid_usage.h"
 
 
 /** @addtogroup USBH_LIB
@@ -88,6 +91,15 @@ EndBSPDependencies */
   * @{
   */
 
+typedef struct
+{
+  uint32_t                     app_usage;
+  HID_CollectionDecodeTypeDef  decode;
+} HID_CollectionDecoderTypeDef;
+
+static HID_CollectionDecoderTypeDef HID_Collections[HID_MAX_COLLECTION_DECODERS];
+static uint8_t HID_NbrCollections;
+
 /**
   * @}
   */
@@ -102,10 +114,30 @@ static USBH_StatusTypeDef USBH_HID_InterfaceDeInit(USBH_HandleTypeDef *phost);
 static USBH_StatusTypeDef USBH_HID_ClassRequest(USBH_HandleTypeDef *phost);
 static USBH_StatusTypeDef USBH_HID_Process(USBH_HandleTypeDef *phost);
 static USBH_StatusTypeDef USBH_HID_SOFProcess(USBH_HandleTypeDef *phost);
-static void USBH_HID_ParseHIDDesc(HID_DescTypeDef *desc, uint8_t *buf);
+static USBH_StatusTypeDef USBH_HID_InitInterface(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                                 uint8_t interface);
+static USBH_StatusTypeDef USBH_HID_InterfaceRequest(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle);
+static USBH_StatusTypeDef USBH_HID_ProcessInterface(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle);
+static void USBH_HID_Deliver(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle, uint16_t length);
+static void USBH_HID_ProcessOut(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle);
+static void USBH_HID_OutDone(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle, uint8_t sent);
+static void USBH_HID_ParseHIDDesc(HID_DescTypeDef *desc, uint8_t *buf, uint8_t itf_num);
+static uint16_t USBH_HID_ItfNum(USBH_HandleTypeDef *phost);
+static uint8_t USBH_HID_ControlBusy(USBH_HandleTypeDef *phost);
+static uint8_t USBH_HID_ControlTake(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                    HID_CtlOwnerTypeDef owner);
+static uint8_t USBH_HID_FindReport(const HID_ReportDescTypeDef *desc, uint8_t report_id);
+static void USBH_HID_RouteInit(HID_HandleTypeDef *HID_Handle);
+static void USBH_HID_BindDecoders(USBH_HandleTypeDef *phost);
+static uint16_t USBH_HID_PollTicks(USBH_HandleTypeDef *phost, uint8_t bInterval);
+static void USBH_HID_StateInit(HID_HandleTypeDef *HID_Handle);
+static uint8_t USBH_HID_UpdateState(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                    uint16_t length, uint8_t *notify);
 
 extern USBH_StatusTypeDef USBH_HID_MouseInit(USBH_HandleTypeDef *phost);
 extern USBH_StatusTypeDef USBH_HID_KeybdInit(USBH_HandleTypeDef *phost);
+extern USBH_StatusTypeDef USBH_HID_GamepadInit(USBH_HandleTypeDef *phost);
+extern USBH_StatusTypeDef USBH_HID_TouchInit(USBH_HandleTypeDef *phost);
 
 USBH_ClassTypeDef  HID_Class =
 {
@@ -130,68 +162,107 @@ USBH_ClassTypeDef  HID_Class =
 
 /**
   * @brief  USBH_HID_InterfaceInit
-  *         The function init the HID class.
+  *         The function init the HID class. Every HID interface of the
+  *         device is bound, pData holding the first.
   * @param  phost: Host handle
   * @retval USBH Status
   */
 static USBH_StatusTypeDef USBH_HID_InterfaceInit(USBH_HandleTypeDef *phost)
 {
-  USBH_StatusTypeDef status;
   HID_HandleTypeDef *HID_Handle;
-  uint16_t ep_mps;
-  uint8_t max_ep;
-  uint8_t num = 0U;
+  HID_HandleTypeDef **link;
+  USBH_InterfaceDescTypeDef *itf;
   uint8_t interface;
+  uint8_t count = 0U;
 
-  // set subclass to 0xFF to force a match, as HID subclass is undefined in many cases
-  // a setting of 1 infers "BOOT MODE" (for PC BIOS integration) but we don't care!
-  interface = USBH_FindInterface(phost, phost->pActiveClass->ClassCode, 0xFF, 0xFFU);
+  link = (HID_HandleTypeDef **)&phost->pActiveClass->pData;
+  *link = NULL;
 
-  if ((interface == 0xFFU) || (interface >= USBH_MAX_NUM_INTERFACES)) /* No Valid Interface */
+  for (interface = 0U; (interface < USBH_MAX_NUM_INTERFACES) && (count < HID_MAX_INTERFACES); interface++)
   {
-    USBH_DbgLog("Cannot Find the interface for %s class.", phost->pActiveClass->Name);
-    return USBH_FAIL;
-  }
+    itf = &phost->device.CfgDesc.Itf_Desc[interface];
+
+    /* Any subclass will do, as HID subclass is undefined in many cases:
+       a setting of 1 infers "BOOT MODE" (for PC BIOS integration) */
+    if ((itf->bInterfaceClass != phost->pActiveClass->ClassCode) || (itf->bAlternateSetting != 0U) ||
+        (itf->bLength == 0U))
+    {
+      continue;
+    }
+
+    HID_Handle = (HID_HandleTypeDef *)USBH_malloc(sizeof(HID_HandleTypeDef));
+
+    if (HID_Handle == NULL)
+    {
+      USBH_DbgLog("Cannot allocate memory for HID Handle");
+      break;
+    }
+
+    if (USBH_HID_InitInterface(phost, HID_Handle, interface) != USBH_OK)
+    {
+      USBH_free(HID_Handle);
+      continue;
+    }
 
-  status = USBH_SelectInterface(phost, interface);
+    *link = HID_Handle;
+    link = &HID_Handle->next;
+    count++;
+  }
 
-  if (status != USBH_OK)
+  if (count == 0U) /* No Valid Interface */
   {
+    USBH_DbgLog("Cannot Find the interface for %s class.", phost->pActiveClass->Name);
     return USBH_FAIL;
   }
 
-  phost->pActiveClass->pData = (HID_HandleTypeDef *)USBH_malloc(sizeof(HID_HandleTypeDef));
   HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
 
-  if (HID_Handle == NULL)
-  {
-    USBH_DbgLog("Cannot allocate memory for HID Handle");
-    return USBH_FAIL;
-  }
+  return USBH_SelectInterface(phost, HID_Handle->current_interface);
+}
+
+/**
+  * @brief  USBH_HID_InitInterface
+  *         Open the pipes of one HID interface and pick its decoder.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @param  interface: interface index
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef USBH_HID_InitInterface(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                                 uint8_t interface)
+{
+  USBH_InterfaceDescTypeDef *itf = &phost->device.CfgDesc.Itf_Desc[interface];
+  uint16_t ep_mps;
+  uint8_t max_ep;
+  uint8_t num = 0U;
 
   /* Initialize hid handler */
   (void)USBH_memset(HID_Handle, 0, sizeof(HID_HandleTypeDef));
 
   HID_Handle->state = USBH_HID_ERROR;
+  HID_Handle->raw_stats.rtt_min = 0xFFFFFFFFU;
+
+  USBH_HID_QueueInit(&HID_Handle->queue, HID_QUEUE_POLICY);
+  HID_Handle->delivery = HID_DELIVERY;
 
   /* Store the HID interface */
   HID_Handle->current_interface = interface;
 
   /*Decode Bootclass Protocol: Mouse or Keyboard*/
-  if (phost->device.CfgDesc.Itf_Desc[interface].bInterfaceProtocol == HID_KEYBRD_BOOT_CODE)
+  if (itf->bInterfaceProtocol == HID_KEYBRD_BOOT_CODE)
   {
     USBH_UsrLog("KeyBoard device found!");
-    HID_Handle->Init = USBH_HID_KeybdInit;
+    HID_Handle->type = HID_KEYBOARD;
   }
-  else if (phost->device.CfgDesc.Itf_Desc[interface].bInterfaceProtocol  == HID_MOUSE_BOOT_CODE)
+  else if (itf->bInterfaceProtocol == HID_MOUSE_BOOT_CODE)
   {
     USBH_UsrLog("Mouse device found!");
-    HID_Handle->Init = USBH_HID_MouseInit;
+    HID_Handle->type = HID_MOUSE;
   }
-  else if (phost->device.CfgDesc.Itf_Desc[interface].bInterfaceProtocol  == HID_NONE_BOOT_CODE)
+  else if (itf->bInterfaceProtocol == HID_NONE_BOOT_CODE)
   {
     USBH_UsrLog("HID device with no protocol found!");
-    HID_Handle->Init = USBH_HID_NoneInit;
+    HID_Handle->type = HID_UNKNOWN;
   }
   else
   {
@@ -199,32 +270,63 @@ static USBH_StatusTypeDef USBH_HID_InterfaceInit(USBH_HandleTypeDef *phost)
     return USBH_FAIL;
   }
 
+  /* Check of available number of endpoints */
+  /* Find the number of EPs in the Interface Descriptor */
+  /* Choose the lower number in order not to overrun the buffer allocated */
+  max_ep = ((itf->bNumEndpoints <= USBH_MAX_NUM_ENDPOINTS) ?
+            itf->bNumEndpoints : USBH_MAX_NUM_ENDPOINTS);
+
+  /* Input reports come on the interrupt IN endpoint, wherever it is listed */
+  for (num = 0U; num < max_ep; num++)
+  {
+    if ((itf->Ep_Desc[num].bEndpointAddress & 0x80U) != 0U)
+    {
+      break;
+    }
+  }
+
+  if (num == max_ep)
+  {
+    USBH_ErrLog("HID: interface %d has no IN endpoint", itf->bInterfaceNumber);
+    return USBH_FAIL;
+  }
+
+  /* The HCD rounds IN transfers up to whole packets: a packet must fit Buf */
+  ep_mps = itf->Ep_Desc[num].wMaxPacketSize & 0x7FFU;
+  if (ep_mps > sizeof(HID_Handle->Buf))
+  {
+    USBH_ErrLog("HID: interface %d packets exceed HID_RX_BUFFER_SIZE", itf->bInterfaceNumber);
+    return USBH_FAIL;
+  }
+
   HID_Handle->state     = USBH_HID_INIT;
   HID_Handle->ctl_state = USBH_HID_REQ_INIT;
-  HID_Handle->ep_addr   = phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[0].bEndpointAddress;
-  HID_Handle->length    = phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[0].wMaxPacketSize;
-  HID_Handle->poll      = phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[0].bInterval;
+  HID_Handle->ep_addr   = itf->Ep_Desc[num].bEndpointAddress;
+  HID_Handle->length    = ep_mps;
+  HID_Handle->poll      = USBH_HID_PollTicks(phost, itf->Ep_Desc[num].bInterval);
+  HID_Handle->pData     = HID_Handle->Buf;
 
   if (HID_Handle->poll < HID_MIN_POLL)
   {
     HID_Handle->poll = HID_MIN_POLL;
   }
 
-  /* Check of available number of endpoints */
-  /* Find the number of EPs in the Interface Descriptor */
-  /* Choose the lower number in order not to overrun the buffer allocated */
-  max_ep = ((phost->device.CfgDesc.Itf_Desc[interface].bNumEndpoints <= USBH_MAX_NUM_ENDPOINTS) ?
-            phost->device.CfgDesc.Itf_Desc[interface].bNumEndpoints : USBH_MAX_NUM_ENDPOINTS);
+  (void)USBH_memset(HID_Handle->route, 0xFF, sizeof(HID_Handle->route));
 
 
   /* Decode endpoint IN and OUT address from interface descriptor */
   for (num = 0U; num < max_ep; num++)
   {
-    if ((phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[num].bEndpointAddress & 0x80U) != 0U)
+    if ((itf->Ep_Desc[num].bEndpointAddress & 0x80U) != 0U)
     {
-      HID_Handle->InEp = (phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[num].bEndpointAddress);
+      HID_Handle->InEp = (itf->Ep_Desc[num].bEndpointAddress);
       HID_Handle->InPipe = USBH_AllocPipe(phost, HID_Handle->InEp);
-      ep_mps = phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[num].wMaxPacketSize;
+      if (HID_Handle->InPipe == 0xFFU)
+      {
+        HID_Handle->InPipe = 0U;
+        break;
+      }
+      ep_mps = itf->Ep_Desc[num].wMaxPacketSize;
 
       /* Open pipe for IN endpoint */
       (void)USBH_OpenPipe(phost, HID_Handle->InPipe, HID_Handle->InEp, phost->device.address,
@@ -234,9 +336,15 @@ static USBH_StatusTypeDef USBH_HID_InterfaceInit(USBH_HandleTypeDef *phost)
     }
     else
     {
-      HID_Handle->OutEp = (phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[num].bEndpointAddress);
+      HID_Handle->OutEp = (itf->Ep_Desc[num].bEndpointAddress);
       HID_Handle->OutPipe = USBH_AllocPipe(phost, HID_Handle->OutEp);
-      ep_mps = phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[num].wMaxPacketSize;
+      if (HID_Handle->OutPipe == 0xFFU)
+      {
+        HID_Handle->OutPipe = 0U;
+        break;
+      }
+      ep_mps = itf->Ep_Desc[num].wMaxPacketSize;
+      HID_Handle->out.poll = USBH_HID_PollTicks(phost, itf->Ep_Desc[num].bInterval);
 
       /* Open pipe for OUT endpoint */
       (void)USBH_OpenPipe(phost, HID_Handle->OutPipe, HID_Handle->OutEp, phost->device.address,
@@ -246,6 +354,26 @@ static USBH_StatusTypeDef USBH_HID_InterfaceInit(USBH_HandleTypeDef *phost)
     }
   }
 
+  /* Out of host channels: leave the interface unused */
+  if (num < max_ep)
+  {
+    USBH_ErrLog("HID: no free pipe for interface %d", itf->bInterfaceNumber);
+
+    if (HID_Handle->InPipe != 0U)
+    {
+      (void)USBH_ClosePipe(phost, HID_Handle->InPipe);
+      (void)USBH_FreePipe(phost, HID_Handle->InPipe);
+    }
+
+    if (HID_Handle->OutPipe != 0U)
+    {
+      (void)USBH_ClosePipe(phost, HID_Handle->OutPipe);
+      (void)USBH_FreePipe(phost, HID_Handle->OutPipe);
+    }
+
+    return USBH_FAIL;
+  }
+
   return USBH_OK;
 }
 
@@ -258,58 +386,145 @@ static USBH_StatusTypeDef USBH_HID_InterfaceInit(USBH_HandleTypeDef *phost)
 static USBH_StatusTypeDef USBH_HID_InterfaceDeInit(USBH_HandleTypeDef *phost)
 {
   HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
-  uint8_t interface;
-  uint8_t max_ep;
-  uint8_t num = 0U;
-
-  /* Get the HID interface */
-  interface = HID_Handle->current_interface;
-
-  /* Check of available number of endpoints */
-  /* Find the number of EPs in the Interface Descriptor */
-  /* Choose the lower number in order not to overrun the buffer allocated */
-  max_ep = ((phost->device.CfgDesc.Itf_Desc[interface].bNumEndpoints <= USBH_MAX_NUM_ENDPOINTS) ?
-            phost->device.CfgDesc.Itf_Desc[interface].bNumEndpoints : USBH_MAX_NUM_ENDPOINTS);
+  HID_HandleTypeDef *next;
 
-  /* Decode endpoint IN and OUT address from interface descriptor */
-  for (num = 0U; num < max_ep; num++)
+  while (HID_Handle != NULL)
   {
-    if ((phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[num].bEndpointAddress & 0x80U) != 0U)
+    next = HID_Handle->next;
+
+    if (HID_Handle->InPipe != 0U)
     {
       (void)USBH_ClosePipe(phost, HID_Handle->InPipe);
       (void)USBH_FreePipe(phost, HID_Handle->InPipe);
       HID_Handle->InPipe = 0U;     /* Reset the pipe as Free */
     }
-    else
+
+    if (HID_Handle->OutPipe != 0U)
     {
       (void)USBH_ClosePipe(phost, HID_Handle->OutPipe);
       (void)USBH_FreePipe(phost, HID_Handle->OutPipe);
       HID_Handle->OutPipe = 0U;     /* Reset the pipe as Free */
     }
-  }
 
-  if ((phost->pActiveClass->pData) != NULL)
-  {
-    USBH_free(phost->pActiveClass->pData);
-    phost->pActiveClass->pData = 0U;
+    USBH_free(HID_Handle);
+    HID_Handle = next;
   }
 
+  phost->pActiveClass->pData = 0U;
+
   return USBH_OK;
 }
 
 /**
   * @brief  USBH_HID_ClassRequest
   *         The function is responsible for handling Standard requests
-  *         for HID class.
+  *         for HID class, one interface after the other.
   * @param  phost: Host handle
   * @retval USBH Status
   */
 static USBH_StatusTypeDef USBH_HID_ClassRequest(USBH_HandleTypeDef *phost)
+{
+  USBH_StatusTypeDef status;
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+
+  while ((HID_Handle != NULL) && (HID_Handle->ctl_state == USBH_HID_REQ_IDLE))
+  {
+    HID_Handle = HID_Handle->next;
+  }
+
+  if (HID_Handle == NULL)
+  {
+    /* all requests performed: the interface types are final */
+    USBH_HID_BindDecoders(phost);
+    phost->device.current_interface = ((HID_HandleTypeDef *) phost->pActiveClass->pData)->current_interface;
+    phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
+    return USBH_OK;
+  }
+
+  /* Class requests address the current interface */
+  phost->device.current_interface = HID_Handle->current_interface;
+
+  status = USBH_HID_InterfaceRequest(phost, HID_Handle);
+
+  if (status == USBH_FAIL)
+  {
+    if (HID_Handle == phost->pActiveClass->pData)
+    {
+      return USBH_FAIL;
+    }
+
+    /* Carry on with the other interfaces */
+    USBH_ErrLog("HID: interface %d left unused",
+                phost->device.CfgDesc.Itf_Desc[HID_Handle->current_interface].bInterfaceNumber);
+    HID_Handle->ctl_state = USBH_HID_REQ_IDLE;
+    HID_Handle->state = USBH_HID_ERROR;
+  }
+
+  return USBH_BUSY;
+}
+
+/**
+  * @brief  USBH_HID_BindDecoders
+  *         Pick the decoder of each interface once every interface is
+  *         classified. The decoders keep one device's data: they serve the
+  *         first interface of their type, so each Init runs once.
+  * @param  phost: Host handle
+  * @retval None
+  */
+static void USBH_HID_BindDecoders(USBH_HandleTypeDef *phost)
+{
+  HID_HandleTypeDef *HID_Handle;
+
+  for (HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData; HID_Handle != NULL;
+       HID_Handle = HID_Handle->next)
+  {
+    HID_Handle->Init = NULL;
+
+    if (USBH_HID_GetHandle(phost, HID_Handle->type) != HID_Handle)
+    {
+      continue;
+    }
+
+    switch (HID_Handle->type)
+    {
+      case HID_KEYBOARD:
+        HID_Handle->Init = USBH_HID_KeybdInit;
+        break;
+
+      case HID_MOUSE:
+        HID_Handle->Init = USBH_HID_MouseInit;
+        break;
+
+      case HID_GAMEPAD:
+        HID_Handle->Init = USBH_HID_GamepadInit;
+        break;
+
+      case HID_TOUCH:
+        HID_Handle->Init = USBH_HID_TouchInit;
+        break;
+
+      case HID_UNKNOWN:
+        HID_Handle->Init = USBH_HID_NoneInit;
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+/**
+  * @brief  USBH_HID_InterfaceRequest
+  *         Class requests of one interface.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef USBH_HID_InterfaceRequest(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle)
 {
 
   USBH_StatusTypeDef status         = USBH_BUSY;
   USBH_StatusTypeDef classReqStatus = USBH_BUSY;
-  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
 
   /* Switch HID state machine */
   switch (HID_Handle->ctl_state)
@@ -317,7 +532,8 @@ static USBH_StatusTypeDef USBH_HID_ClassRequest(USBH_HandleTypeDef *phost)
     case USBH_HID_REQ_INIT:
     case USBH_HID_REQ_GET_HID_DESC:
 
-      USBH_HID_ParseHIDDesc(&HID_Handle->HID_Desc, phost->device.CfgDesc_Raw);
+      USBH_HID_ParseHIDDesc(&HID_Handle->HID_Desc, phost->device.CfgDesc_Raw,
+                            phost->device.CfgDesc.Itf_Desc[HID_Handle->current_interface].bInterfaceNumber);
 
       HID_Handle->ctl_state = USBH_HID_REQ_GET_REPORT_DESC;
 
@@ -328,8 +544,36 @@ static USBH_StatusTypeDef USBH_HID_ClassRequest(USBH_HandleTypeDef *phost)
       classReqStatus = USBH_HID_GetHIDReportDescriptor(phost, HID_Handle->HID_Desc.wItemLength);
       if (classReqStatus == USBH_OK)
       {
-        printf("TODO: parse device.data to discover type of device\n\r");
         /* The descriptor is available in phost->device.Data */
+        if (HID_ParseReportDesc(&HID_Handle->ReportDesc, phost->device.Data,
+                                HID_Handle->HID_Desc.wItemLength) != USBH_OK)
+        {
+          USBH_ErrLog("HID: Report Descriptor not parsed, only boot reports can be decoded");
+        }
+        USBH_HID_StateInit(HID_Handle);
+
+        /* Report protocol keyboards (NKRO) often leave out the boot protocol */
+        if ((HID_Handle->type == HID_UNKNOWN) &&
+            (HID_Handle->ReportDesc.app_usage == (((uint32_t)HID_USAGE_PAGE_GEN_DES << 16) | HID_USAGE_KBD)))
+        {
+          HID_Handle->type = HID_KEYBOARD;
+        }
+        else if ((HID_Handle->type == HID_UNKNOWN) &&
+                 ((HID_Handle->ReportDesc.app_usage == (((uint32_t)HID_USAGE_PAGE_GEN_DES << 16) | HID_USAGE_JOYSTICK)) ||
+                  (HID_Handle->ReportDesc.app_usage == (((uint32_t)HID_USAGE_PAGE_GEN_DES << 16) | HID_USAGE_GAMEPAD))))
+        {
+          HID_Handle->type = HID_GAMEPAD;
+        }
+        else if ((HID_Handle->type == HID_UNKNOWN) &&
+                 ((HID_Handle->ReportDesc.app_usage == (((uint32_t)HID_USAGE_PAGE_DIGITIZER << 16) | HID_USAGE_TOUCHSCREEN)) ||
+                  (HID_Handle->ReportDesc.app_usage == (((uint32_t)HID_USAGE_PAGE_DIGITIZER << 16) | HID_USAGE_TOUCHPAD))))
+        {
+          HID_Handle->type = HID_TOUCH;
+        }
+        else
+        {
+          /* .. */
+        }
         HID_Handle->ctl_state = USBH_HID_REQ_SET_IDLE;
       }
       else if (classReqStatus == USBH_NOT_SUPPORTED)
@@ -363,20 +607,27 @@ static USBH_StatusTypeDef USBH_HID_ClassRequest(USBH_HandleTypeDef *phost)
       break;
 
     case USBH_HID_REQ_SET_PROTOCOL:
+      /* SET_PROTOCOL is only required of boot subclass interfaces */
+      if (phost->device.CfgDesc.Itf_Desc[HID_Handle->current_interface].bInterfaceSubClass != 1U)
+      {
+        HID_Handle->ctl_state = USBH_HID_REQ_IDLE;
+        status = USBH_OK;
+        break;
+      }
+
       /* set protocol */
       classReqStatus = USBH_HID_SetProtocol(phost, 0U);
       if (classReqStatus == USBH_OK)
       {
         HID_Handle->ctl_state = USBH_HID_REQ_IDLE;
-
-        /* all requests performed */
-        phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
         status = USBH_OK;
       }
       else if (classReqStatus == USBH_NOT_SUPPORTED)
       {
+        /* Stalled like SET_IDLE may be: the device stays in its current protocol */
         USBH_ErrLog("Control error: HID: Device Set protocol request failed");
-        status = USBH_FAIL;
+        HID_Handle->ctl_state = USBH_HID_REQ_IDLE;
+        status = USBH_OK;
       }
       else
       {
@@ -395,19 +646,46 @@ static USBH_StatusTypeDef USBH_HID_ClassRequest(USBH_HandleTypeDef *phost)
 /**
   * @brief  USBH_HID_Process
   *         The function is for managing state machine for HID data transfers
+  *         of every interface.
   * @param  phost: Host handle
   * @retval USBH Status
   */
 static USBH_StatusTypeDef USBH_HID_Process(USBH_HandleTypeDef *phost)
 {
-  USBH_StatusTypeDef status = USBH_OK;
   HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+  USBH_StatusTypeDef status;
+
+  /* The first interface's status is the class status */
+  status = USBH_HID_ProcessInterface(phost, HID_Handle);
+
+  for (HID_Handle = HID_Handle->next; HID_Handle != NULL; HID_Handle = HID_Handle->next)
+  {
+    (void)USBH_HID_ProcessInterface(phost, HID_Handle);
+  }
+
+  return status;
+}
+
+/**
+  * @brief  USBH_HID_ProcessInterface
+  *         State machine of one interface.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef USBH_HID_ProcessInterface(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle)
+{
+  USBH_StatusTypeDef status = USBH_OK;
+  USBH_StatusTypeDef req_status;
   uint32_t XferSize;
 
   switch (HID_Handle->state)
   {
     case USBH_HID_INIT:
-      status = HID_Handle->Init(phost);
+      status = (HID_Handle->Init != NULL) ? HID_Handle->Init(phost) : USBH_OK;
+
+      /* Bound once the decoders are set up: their Init may register collections */
+      USBH_HID_RouteInit(HID_Handle);
 
       if (status == USBH_OK)
       {
@@ -426,11 +704,20 @@ static USBH_StatusTypeDef USBH_HID_Process(USBH_HandleTypeDef *phost)
       break;
 
     case USBH_HID_IDLE:
+      /* EP0 carries one interface's request at a time */
+      if (USBH_HID_ControlTake(phost, HID_Handle, HID_CTL_GET_REPORT) == 0U)
+      {
+        break;
+      }
+
+      phost->device.current_interface = HID_Handle->current_interface;
       status = USBH_HID_GetReport(phost, 0x01U, 0U, HID_Handle->pData, (uint8_t)HID_Handle->length);
+      HID_Handle->ctl_busy = (status == USBH_BUSY) ? HID_CTL_GET_REPORT : HID_CTL_FREE;
 
       if (status == USBH_OK)
       {
-        HID_Handle->state = USBH_HID_SYNC;
+        HID_Handle->state = USBH_HID_GET_DATA;
+        HID_Handle->timer = phost->Timer;
       }
       else if (status == USBH_BUSY)
       {
@@ -439,7 +726,8 @@ static USBH_StatusTypeDef USBH_HID_Process(USBH_HandleTypeDef *phost)
       }
       else if (status == USBH_NOT_SUPPORTED)
       {
-        HID_Handle->state = USBH_HID_SYNC;
+        HID_Handle->state = USBH_HID_GET_DATA;
+        HID_Handle->timer = phost->Timer;
         status = USBH_OK;
       }
       else
@@ -448,18 +736,6 @@ static USBH_StatusTypeDef USBH_HID_Process(USBH_HandleTypeDef *phost)
         status = USBH_FAIL;
       }
 
-#if (USBH_USE_OS == 1U)
-      USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
-#endif /* (USBH_USE_OS == 1U) */
-      break;
-
-    case USBH_HID_SYNC:
-      /* Sync with start of Even Frame */
-      if ((phost->Timer & 1U) != 0U)
-      {
-        HID_Handle->state = USBH_HID_GET_DATA;
-      }
-
 #if (USBH_USE_OS == 1U)
       USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
 #endif /* (USBH_USE_OS == 1U) */
@@ -471,8 +747,16 @@ static USBH_StatusTypeDef USBH_HID_Process(USBH_HandleTypeDef *phost)
                                       HID_Handle->InPipe);
 
       HID_Handle->state = USBH_HID_POLL;
-      HID_Handle->timer = phost->Timer;
       HID_Handle->DataReady = 0U;
+
+      /* Schedule the next IN token one interval after this one was due,
+         so that late service doesn't stretch the interval. Restart the
+         schedule if a whole interval was missed. */
+      HID_Handle->timer += HID_Handle->poll;
+      if ((int32_t)(phost->Timer - HID_Handle->timer) >= 0)
+      {
+        HID_Handle->timer = phost->Timer + HID_Handle->poll;
+      }
       break;
 
     case USBH_HID_POLL:
@@ -480,25 +764,33 @@ static USBH_StatusTypeDef USBH_HID_Process(USBH_HandleTypeDef *phost)
       {
         XferSize = USBH_LL_GetLastXferSize(phost, HID_Handle->InPipe);
 
-        if ((HID_Handle->DataReady == 0U) && (XferSize != 0U) && (HID_Handle->fifo.buf != NULL))
+        if ((HID_Handle->DataReady == 0U) && (XferSize != 0U))
         {
-          (void)USBH_HID_FifoWrite(&HID_Handle->fifo, HID_Handle->pData, HID_Handle->length);
           HID_Handle->DataReady = 1U;
-          USBH_HID_EventCallback(phost);
+          USBH_HID_Deliver(phost, HID_Handle, (uint16_t)XferSize);
+        }
 
-#if (USBH_USE_OS == 1U)
-          USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
-#endif /* (USBH_USE_OS == 1U) */
+        /* Already due: issue the next IN token without waiting for a SOF */
+        if ((int32_t)(phost->Timer - HID_Handle->timer) >= 0)
+        {
+          HID_Handle->state = USBH_HID_GET_DATA;
         }
       }
       else
       {
         /* IN Endpoint Stalled */
-        if (USBH_LL_GetURBState(phost, HID_Handle->InPipe) == USBH_URB_STALL)
+        if ((USBH_LL_GetURBState(phost, HID_Handle->InPipe) == USBH_URB_STALL) &&
+            (USBH_HID_ControlTake(phost, HID_Handle, HID_CTL_CLEAR_IN) != 0U))
         {
           /* Issue Clear Feature on interrupt IN endpoint */
-          if (USBH_ClrFeature(phost, HID_Handle->ep_addr) == USBH_OK)
+          req_status = USBH_ClrFeature(phost, HID_Handle->ep_addr);
+          HID_Handle->ctl_busy = (req_status == USBH_BUSY) ? HID_CTL_CLEAR_IN : HID_CTL_FREE;
+
+          if (req_status == USBH_OK)
           {
+            /* The device restarts the endpoint on DATA0 */
+            (void)USBH_LL_SetToggle(phost, HID_Handle->InPipe, 0U);
+
             /* Change state to issue next IN token */
             HID_Handle->state = USBH_HID_GET_DATA;
           }
@@ -510,67 +802,317 @@ static USBH_StatusTypeDef USBH_HID_Process(USBH_HandleTypeDef *phost)
       break;
   }
 
-  return status;
-}
-
-/**
-  * @brief  USBH_HID_SOFProcess
-  *         The function is for managing the SOF Process
-  * @param  phost: Host handle
-  * @retval USBH Status
-  */
-static USBH_StatusTypeDef USBH_HID_SOFProcess(USBH_HandleTypeDef *phost)
-{
-  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
-
-  if (HID_Handle->state == USBH_HID_POLL)
+  /* Output runs alongside input once the interface is polled */
+  if ((HID_Handle->state == USBH_HID_GET_DATA) || (HID_Handle->state == USBH_HID_POLL))
   {
-    if ((phost->Timer - HID_Handle->timer) >= HID_Handle->poll)
-    {
-      HID_Handle->state = USBH_HID_GET_DATA;
-
-#if (USBH_USE_OS == 1U)
-      USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
-#endif /* (USBH_USE_OS == 1U) */
-    }
+    USBH_HID_ProcessOut(phost, HID_Handle);
   }
-  return USBH_OK;
+
+  return status;
 }
 
 /**
-  * @brief  USBH_Get_HID_ReportDescriptor
-  *         Issue report Descriptor command to the device. Once the response
-  *         received, parse the report descriptor and update the status.
+  * @brief  USBH_HID_ProcessOut
+  *         Send the queued output reports of an interface, one at a time.
   * @param  phost: Host handle
-  * @param  Length : HID Report Descriptor Length
-  * @retval USBH Status
+  * @param  HID_Handle: HID handle of the interface
+  * @retval none
   */
-USBH_StatusTypeDef USBH_HID_GetHIDReportDescriptor(USBH_HandleTypeDef *phost,
-                                                   uint16_t length)
+static void USBH_HID_ProcessOut(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle)
 {
-
+  HID_OutQueueTypeDef *out = &HID_Handle->out;
+  HID_OutSlotTypeDef *slot = &out->slot[out->tail & (HID_OUT_QUEUE_SIZE - 1U)];
   USBH_StatusTypeDef status;
+  USBH_URBStateTypeDef URB_Status;
 
-  if (length > sizeof(phost->device.Data))
+  switch (out->state)
   {
-    USBH_ErrLog("Control error: Get HID Report Descriptor failed, data buffer size issue");
-    return USBH_NOT_SUPPORTED;
-  }
-
-  status = USBH_GetDescriptor(phost,
-                              USB_REQ_RECIPIENT_INTERFACE | USB_REQ_TYPE_STANDARD,
-                              USB_DESC_HID_REPORT,
-                              phost->device.Data,
-                              length);
-
-  /* HID report descriptor is available in phost->device.Data.
-  In case of USB Boot Mode devices for In report handling ,
-  HID report descriptor parsing is not required.
-  In case, for supporting Non-Boot Protocol devices and output reports,
-  user may parse the report descriptor*/
-
+    case HID_OUT_IDLE:
+      if (out->tail == out->head)
+      {
+        break;
+      }
 
-  return status;
+      if (HID_Handle->OutPipe != 0U)
+      {
+        (void)USBH_InterruptSendData(phost, slot->data, (uint8_t)slot->length, HID_Handle->OutPipe);
+        out->start = phost->Timer;
+        out->state = HID_OUT_WAIT;
+      }
+      else if (USBH_HID_ControlTake(phost, HID_Handle, HID_CTL_SET_REPORT) != 0U)
+      {
+        /* Hold EP0 from now on */
+        out->start = phost->Timer;
+        out->state = HID_OUT_SET_REPORT;
+      }
+      else
+      {
+        /* EP0 taken by another interface */
+      }
+      break;
+
+    case HID_OUT_WAIT:
+      URB_Status = USBH_LL_GetURBState(phost, HID_Handle->OutPipe);
+
+      if (URB_Status == USBH_URB_DONE)
+      {
+        USBH_HID_OutDone(phost, HID_Handle, 1U);
+      }
+      else if (URB_Status == USBH_URB_NOTREADY)
+      {
+        /* NAKed: send it again at the next interval, the round trip still
+           runs from the first try */
+        out->due = phost->Timer + out->poll;
+        out->state = HID_OUT_NAK;
+      }
+      else if (URB_Status == USBH_URB_STALL)
+      {
+        out->state = HID_OUT_CLEAR;
+      }
+      else if (URB_Status == USBH_URB_ERROR)
+      {
+        USBH_HID_OutDone(phost, HID_Handle, 0U);
+      }
+      else
+      {
+        /* .. */
+      }
+      break;
+
+    case HID_OUT_NAK:
+      if ((int32_t)(phost->Timer - out->due) < 0)
+      {
+        break;
+      }
+      /* FALLTHROUGH */
+
+    case HID_OUT_RESEND:
+      (void)USBH_InterruptSendData(phost, slot->data, (uint8_t)slot->length, HID_Handle->OutPipe);
+      out->state = HID_OUT_WAIT;
+      break;
+
+    case HID_OUT_CLEAR:
+      /* EP0 carries one interface's request at a time */
+      if (USBH_HID_ControlTake(phost, HID_Handle, HID_CTL_CLEAR_OUT) == 0U)
+      {
+        break;
+      }
+
+      status = USBH_ClrFeature(phost, HID_Handle->OutEp);
+      HID_Handle->ctl_busy = (status == USBH_BUSY) ? HID_CTL_CLEAR_OUT : HID_CTL_FREE;
+
+      if (status == USBH_OK)
+      {
+        /* The device restarts the endpoint on DATA0: send the report again */
+        (void)USBH_LL_SetToggle(phost, HID_Handle->OutPipe, 0U);
+        out->state = HID_OUT_IDLE;
+      }
+      else if (status != USBH_BUSY)
+      {
+        USBH_HID_OutDone(phost, HID_Handle, 0U);
+      }
+      else
+      {
+        /* .. */
+      }
+      break;
+
+    case HID_OUT_SET_REPORT:
+      phost->device.current_interface = HID_Handle->current_interface;
+      status = USBH_HID_SetReport(phost, HID_REPORT_TYPE_OUTPUT, slot->report_id,
+                                  slot->data, (uint8_t)slot->length);
+      HID_Handle->ctl_busy = (status == USBH_BUSY) ? HID_CTL_SET_REPORT : HID_CTL_FREE;
+
+      if (status == USBH_OK)
+      {
+        HID_Handle->raw_stats.set_reports++;
+        USBH_HID_OutDone(phost, HID_Handle, 1U);
+      }
+      else if (status != USBH_BUSY)
+      {
+        USBH_HID_OutDone(phost, HID_Handle, 0U);
+      }
+      else
+      {
+        /* .. */
+      }
+      break;
+
+    default:
+      out->state = HID_OUT_IDLE;
+      break;
+  }
+}
+
+/**
+  * @brief  USBH_HID_OutDone
+  *         Retire the output report at the head of the queue.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @param  sent: 1 if it went out, 0 if it was dropped
+  * @retval none
+  */
+static void USBH_HID_OutDone(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle, uint8_t sent)
+{
+  if (sent != 0U)
+  {
+    HID_Handle->raw_stats.sent++;
+
+    /* The next input report answers it */
+    HID_Handle->rtt_start = HID_Handle->out.start;
+    HID_Handle->rtt_armed = 1U;
+  }
+  else
+  {
+    HID_Handle->raw_stats.errors++;
+  }
+
+  HID_Handle->out.tail++;
+  HID_Handle->out.state = HID_OUT_IDLE;
+
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+/**
+  * @brief  USBH_HID_Deliver
+  *         Hand a received report to its collection decoder, or queue it.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @param  length: report length
+  * @retval none
+  */
+static void USBH_HID_Deliver(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle, uint16_t length)
+{
+  uint8_t report_id = (HID_Handle->ReportDesc.report_ids != 0U) ? HID_Handle->pData[0] : 0U;
+  uint8_t notify = 1U;
+  uint32_t rtt;
+  uint8_t r;
+
+  if (HID_Handle->rtt_armed != 0U)
+  {
+    rtt = phost->Timer - HID_Handle->rtt_start;
+    HID_Handle->rtt_armed = 0U;
+    HID_Handle->raw_stats.rtt_count++;
+    HID_Handle->raw_stats.rtt_last = rtt;
+    HID_Handle->raw_stats.rtt_sum += rtt;
+    if (rtt < HID_Handle->raw_stats.rtt_min)
+    {
+      HID_Handle->raw_stats.rtt_min = rtt;
+    }
+    if (rtt > HID_Handle->raw_stats.rtt_max)
+    {
+      HID_Handle->raw_stats.rtt_max = rtt;
+    }
+  }
+
+  if ((HID_Handle->delivery != HID_DELIVERY_ALL) &&
+      (USBH_HID_UpdateState(phost, HID_Handle, length, &notify) == 0U))
+  {
+    return;
+  }
+
+  /* Route by report ID to the decoder of its application collection */
+  r = USBH_HID_FindReport(&HID_Handle->ReportDesc, report_id);
+  if ((r < HID_MAX_REPORTS) && (HID_Handle->route[r] < HID_NbrCollections))
+  {
+    HID_Collections[HID_Handle->route[r]].decode(phost, HID_Handle, HID_Handle->pData, length);
+    return;
+  }
+
+  if ((HID_Handle->delivery != HID_DELIVERY_STATE) ||
+      (HID_Handle->ReportDesc.nbr_reports == 0U))
+  {
+    (void)USBH_HID_QueuePut(&HID_Handle->queue, HID_Handle->pData, length, report_id, phost->Timer);
+    notify = 1U;
+  }
+
+  if (notify != 0U)
+  {
+    USBH_HID_EventCallback(phost);
+
+#if (USBH_USE_OS == 1U)
+    USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+  }
+}
+
+/**
+  * @brief  USBH_HID_SOFProcess
+  *         The function is for managing the SOF Process
+  * @param  phost: Host handle
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef USBH_HID_SOFProcess(USBH_HandleTypeDef *phost)
+{
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+
+  for (; HID_Handle != NULL; HID_Handle = HID_Handle->next)
+  {
+    if (HID_Handle->state == USBH_HID_POLL)
+    {
+      if ((int32_t)(phost->Timer - HID_Handle->timer) >= 0)
+      {
+        HID_Handle->state = USBH_HID_GET_DATA;
+
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      }
+    }
+
+    if ((HID_Handle->out.state == HID_OUT_NAK) &&
+        ((int32_t)(phost->Timer - HID_Handle->out.due) >= 0))
+    {
+      HID_Handle->out.state = HID_OUT_RESEND;
+
+#if (USBH_USE_OS == 1U)
+      USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+    }
+  }
+  return USBH_OK;
+}
+
+/**
+  * @brief  USBH_Get_HID_ReportDescriptor
+  *         Issue report Descriptor command to the device. Once the response
+  *         received, parse the report descriptor and update the status.
+  * @param  phost: Host handle
+  * @param  Length : HID Report Descriptor Length
+  * @retval USBH Status
+  */
+USBH_StatusTypeDef USBH_HID_GetHIDReportDescriptor(USBH_HandleTypeDef *phost,
+                                                   uint16_t length)
+{
+
+  USBH_StatusTypeDef status;
+
+  if (length > sizeof(phost->device.Data))
+  {
+    USBH_ErrLog("Control error: Get HID Report Descriptor failed, data buffer size issue");
+    return USBH_NOT_SUPPORTED;
+  }
+
+  phost->Control.setup.b.bmRequestType = USB_D2H | USB_REQ_RECIPIENT_INTERFACE | \
+                                         USB_REQ_TYPE_STANDARD;
+
+  phost->Control.setup.b.bRequest = USB_REQ_GET_DESCRIPTOR;
+  phost->Control.setup.b.wValue.w = USB_DESC_HID_REPORT;
+  phost->Control.setup.b.wIndex.w = USBH_HID_ItfNum(phost);
+  phost->Control.setup.b.wLength.w = length;
+
+  status = USBH_CtlReq(phost, phost->device.Data, length);
+
+  /* HID report descriptor is available in phost->device.Data.
+  The class request compiles it into HID_Handle->ReportDesc, see
+  HID_ParseReportDesc */
+
+
+  return status;
 }
 
 /**
@@ -592,11 +1134,15 @@ USBH_StatusTypeDef USBH_HID_GetHIDDescriptor(USBH_HandleTypeDef *phost,
     return USBH_NOT_SUPPORTED;
   }
 
-  status = USBH_GetDescriptor(phost,
-                              USB_REQ_RECIPIENT_INTERFACE | USB_REQ_TYPE_STANDARD,
-                              USB_DESC_HID,
-                              phost->device.Data,
-                              length);
+  phost->Control.setup.b.bmRequestType = USB_D2H | USB_REQ_RECIPIENT_INTERFACE | \
+                                         USB_REQ_TYPE_STANDARD;
+
+  phost->Control.setup.b.bRequest = USB_REQ_GET_DESCRIPTOR;
+  phost->Control.setup.b.wValue.w = USB_DESC_HID;
+  phost->Control.setup.b.wIndex.w = USBH_HID_ItfNum(phost);
+  phost->Control.setup.b.wLength.w = length;
+
+  status = USBH_CtlReq(phost, phost->device.Data, length);
 
   return status;
 }
@@ -621,7 +1167,7 @@ USBH_StatusTypeDef USBH_HID_SetIdle(USBH_HandleTypeDef *phost,
   phost->Control.setup.b.bRequest = USB_HID_SET_IDLE;
   phost->Control.setup.b.wValue.w = (uint16_t)(((uint32_t)duration << 8U) | (uint32_t)reportId);
 
-  phost->Control.setup.b.wIndex.w = 0U;
+  phost->Control.setup.b.wIndex.w = USBH_HID_ItfNum(phost);
   phost->Control.setup.b.wLength.w = 0U;
 
   return USBH_CtlReq(phost, NULL, 0U);
@@ -652,7 +1198,7 @@ USBH_StatusTypeDef USBH_HID_SetReport(USBH_HandleTypeDef *phost,
   phost->Control.setup.b.bRequest = USB_HID_SET_REPORT;
   phost->Control.setup.b.wValue.w = (uint16_t)(((uint32_t)reportType << 8U) | (uint32_t)reportId);
 
-  phost->Control.setup.b.wIndex.w = 0U;
+  phost->Control.setup.b.wIndex.w = USBH_HID_ItfNum(phost);
   phost->Control.setup.b.wLength.w = reportLen;
 
   return USBH_CtlReq(phost, reportBuff, (uint16_t)reportLen);
@@ -683,7 +1229,7 @@ USBH_StatusTypeDef USBH_HID_GetReport(USBH_HandleTypeDef *phost,
   phost->Control.setup.b.bRequest = USB_HID_GET_REPORT;
   phost->Control.setup.b.wValue.w = (uint16_t)(((uint32_t)reportType << 8U) | (uint32_t)reportId);
 
-  phost->Control.setup.b.wIndex.w = 0U;
+  phost->Control.setup.b.wIndex.w = USBH_HID_ItfNum(phost);
   phost->Control.setup.b.wLength.w = reportLen;
 
   return USBH_CtlReq(phost, reportBuff, (uint16_t)reportLen);
@@ -712,7 +1258,7 @@ USBH_StatusTypeDef USBH_HID_SetProtocol(USBH_HandleTypeDef *phost,
     phost->Control.setup.b.wValue.w = 1U;
   }
 
-  phost->Control.setup.b.wIndex.w = 0U;
+  phost->Control.setup.b.wIndex.w = USBH_HID_ItfNum(phost);
   phost->Control.setup.b.wLength.w = 0U;
 
   return USBH_CtlReq(phost, NULL, 0U);
@@ -721,16 +1267,18 @@ USBH_StatusTypeDef USBH_HID_SetProtocol(USBH_HandleTypeDef *phost,
 
 /**
   * @brief  USBH_ParseHIDDesc
-  *         This function Parse the HID descriptor
+  *         This function Parse the HID descriptor of an interface
   * @param  desc: HID Descriptor
   * @param  buf: Buffer where the source descriptor is available
+  * @param  itf_num: bInterfaceNumber
   * @retval None
   */
-static void USBH_HID_ParseHIDDesc(HID_DescTypeDef *desc, uint8_t *buf)
+static void USBH_HID_ParseHIDDesc(HID_DescTypeDef *desc, uint8_t *buf, uint8_t itf_num)
 {
   USBH_DescHeader_t *pdesc = (USBH_DescHeader_t *)buf;
   uint16_t CfgDescLen;
   uint16_t ptr;
+  uint8_t in_itf = 0U;
 
   CfgDescLen = LE16(buf + 2U);
 
@@ -742,7 +1290,12 @@ static void USBH_HID_ParseHIDDesc(HID_DescTypeDef *desc, uint8_t *buf)
     {
       pdesc = USBH_GetNextDesc((uint8_t *)pdesc, &ptr);
 
-      if (pdesc->bDescriptorType == USB_DESC_TYPE_HID)
+      if (pdesc->bDescriptorType == USB_DESC_TYPE_INTERFACE)
+      {
+        /* bInterfaceNumber, bAlternateSetting */
+        in_itf = ((((uint8_t *)pdesc)[2] == itf_num) && (((uint8_t *)pdesc)[3] == 0U)) ? 1U : 0U;
+      }
+      else if ((pdesc->bDescriptorType == USB_DESC_TYPE_HID) && (in_itf != 0U))
       {
         desc->bLength = *(uint8_t *)((uint8_t *)pdesc + 0U);
         desc->bDescriptorType = *(uint8_t *)((uint8_t *)pdesc + 1U);
@@ -753,36 +1306,175 @@ static void USBH_HID_ParseHIDDesc(HID_DescTypeDef *desc, uint8_t *buf)
         desc->wItemLength = LE16((uint8_t *)pdesc + 7U);
         break;
       }
+      else
+      {
+        /* .. */
+      }
     }
   }
 }
 
 /**
-  * @brief  USBH_HID_GetDeviceType
-  *         Return Device function.
+  * @brief  USBH_HID_PollTicks
+  *         Convert an interrupt endpoint bInterval to phost->Timer ticks,
+  *         which count frames, or microframes on high speed.
   * @param  phost: Host handle
-  * @retval HID function: HID_MOUSE / HID_KEYBOARD
+  * @param  bInterval: endpoint bInterval
+  * @retval poll interval
   */
-HID_TypeTypeDef USBH_HID_GetDeviceType(USBH_HandleTypeDef *phost)
+static uint16_t USBH_HID_PollTicks(USBH_HandleTypeDef *phost, uint8_t bInterval)
 {
-  HID_TypeTypeDef   type = HID_UNKNOWN;
-  uint8_t InterfaceProtocol;
+  uint8_t n;
 
-  if (phost->gState == HOST_CLASS)
+  if (phost->device.speed == USBH_SPEED_HIGH)
+  {
+    /* 2^(bInterval-1) microframes */
+    n = (bInterval < 1U) ? 1U : ((bInterval > 16U) ? 16U : bInterval);
+    return (uint16_t)(1U << (n - 1U));
+  }
+
+  return (bInterval < 1U) ? 1U : (uint16_t)bInterval;
+}
+
+/**
+  * @brief  USBH_HID_ItfNum
+  *         bInterfaceNumber of the current interface, the wIndex of
+  *         HID class requests.
+  * @param  phost: Host handle
+  * @retval interface number
+  */
+static uint16_t USBH_HID_ItfNum(USBH_HandleTypeDef *phost)
+{
+  if (phost->device.current_interface >= USBH_MAX_NUM_INTERFACES)
   {
-    InterfaceProtocol = phost->device.CfgDesc.Itf_Desc[phost->device.current_interface].bInterfaceProtocol;
-    if (InterfaceProtocol == HID_KEYBRD_BOOT_CODE)
+    return 0U;
+  }
+
+  return phost->device.CfgDesc.Itf_Desc[phost->device.current_interface].bInterfaceNumber;
+}
+
+/**
+  * @brief  USBH_HID_ControlBusy
+  *         Whether an interface has a request on EP0.
+  * @param  phost: Host handle
+  * @retval 1 if busy, 0 otherwise
+  */
+static uint8_t USBH_HID_ControlBusy(USBH_HandleTypeDef *phost)
+{
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+
+  for (; HID_Handle != NULL; HID_Handle = HID_Handle->next)
+  {
+    if (HID_Handle->ctl_busy != HID_CTL_FREE)
     {
-      type = HID_KEYBOARD;
+      return 1U;
     }
-    else
+  }
+
+  return 0U;
+}
+
+/**
+  * @brief  USBH_HID_ControlTake
+  *         Claim EP0 for a request of an interface, unless another request
+  *         holds it.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @param  owner: request to issue
+  * @retval 1 if the request may go on EP0, 0 otherwise
+  */
+static uint8_t USBH_HID_ControlTake(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                    HID_CtlOwnerTypeDef owner)
+{
+  if (HID_Handle->ctl_busy == owner)
+  {
+    return 1U;
+  }
+
+  if (USBH_HID_ControlBusy(phost) != 0U)
+  {
+    return 0U;
+  }
+
+  HID_Handle->ctl_busy = owner;
+
+  return 1U;
+}
+
+/**
+  * @brief  USBH_HID_FindReport
+  *         Look an input report up by ID.
+  * @param  desc: report descriptor
+  * @param  report_id: report ID, 0 when the device uses none
+  * @retval report index, 0xFF if not described
+  */
+static uint8_t USBH_HID_FindReport(const HID_ReportDescTypeDef *desc, uint8_t report_id)
+{
+  uint8_t r;
+
+  for (r = 0U; r < desc->nbr_reports; r++)
+  {
+    if ((desc->report[r].type == HID_REPORT_TYPE_INPUT) && (desc->report[r].id == report_id))
+    {
+      return r;
+    }
+  }
+
+  return 0xFFU;
+}
+
+/**
+  * @brief  USBH_HID_RouteInit
+  *         Bind the input reports of an interface to the decoders of their
+  *         application collection.
+  * @param  HID_Handle: HID handle of the interface
+  * @retval none
+  */
+static void USBH_HID_RouteInit(HID_HandleTypeDef *HID_Handle)
+{
+  const HID_ReportDescTypeDef *desc = &HID_Handle->ReportDesc;
+  const HID_ReportInfoTypeDef *report;
+  uint32_t app_usage;
+  uint8_t r;
+  uint8_t c;
+
+  for (r = 0U; r < desc->nbr_reports; r++)
+  {
+    report = &desc->report[r];
+    HID_Handle->route[r] = 0xFFU;
+
+    if (report->type != HID_REPORT_TYPE_INPUT)
+    {
+      continue;
+    }
+
+    app_usage = (report->nbr_fields != 0U) ? desc->field[report->first_field].app_usage : desc->app_usage;
+
+    for (c = 0U; c < HID_NbrCollections; c++)
     {
-      if (InterfaceProtocol == HID_MOUSE_BOOT_CODE)
+      if (HID_Collections[c].app_usage == app_usage)
       {
-        type = HID_MOUSE;
+        HID_Handle->route[r] = c;
+        break;
       }
     }
   }
+}
+
+/**
+  * @brief  USBH_HID_GetDeviceType
+  *         Return Device function.
+  * @param  phost: Host handle
+  * @retval HID function: HID_MOUSE / HID_KEYBOARD / HID_GAMEPAD / HID_TOUCH
+  */
+HID_TypeTypeDef USBH_HID_GetDeviceType(USBH_HandleTypeDef *phost)
+{
+  HID_TypeTypeDef   type = HID_UNKNOWN;
+
+  if (phost->gState == HOST_CLASS)
+  {
+    type = ((HID_HandleTypeDef *) phost->pActiveClass->pData)->type;
+  }
   return type;
 }
 
@@ -791,7 +1483,7 @@ HID_TypeTypeDef USBH_HID_GetDeviceType(USBH_HandleTypeDef *phost)
   * @brief  USBH_HID_GetPollInterval
   *         Return HID device poll time
   * @param  phost: Host handle
-  * @retval poll time (ms)
+  * @retval poll time (frames, microframes on high speed), saturated at 255
   */
 uint8_t USBH_HID_GetPollInterval(USBH_HandleTypeDef *phost)
 {
@@ -803,7 +1495,7 @@ uint8_t USBH_HID_GetPollInterval(USBH_HandleTypeDef *phost)
       (phost->gState == HOST_CHECK_CLASS) ||
       ((phost->gState == HOST_CLASS)))
   {
-    return (uint8_t)(HID_Handle->poll);
+    return (HID_Handle->poll > 0xFFU) ? 0xFFU : (uint8_t)(HID_Handle->poll);
   }
   else
   {
@@ -811,109 +1503,471 @@ uint8_t USBH_HID_GetPollInterval(USBH_HandleTypeDef *phost)
   }
 }
 /**
-  * @brief  USBH_HID_FifoInit
-  *         Initialize FIFO.
-  * @param  f: Fifo address
-  * @param  buf: Fifo buffer
-  * @param  size: Fifo Size
+  * @brief  USBH_HID_GetReportDesc
+  *         Return the compiled report descriptor.
+  * @param  phost: Host handle
+  * @retval report descriptor, NULL before the class is active
+  */
+HID_ReportDescTypeDef *USBH_HID_GetReportDesc(USBH_HandleTypeDef *phost)
+{
+  HID_HandleTypeDef *HID_Handle;
+
+  if (phost->gState != HOST_CLASS)
+  {
+    return NULL;
+  }
+
+  HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+
+  return &HID_Handle->ReportDesc;
+}
+
+/**
+  * @brief  USBH_HID_GetInterface
+  *         Return the handle of an interface.
+  * @param  phost: Host handle
+  * @param  n: interface, counted from 0 among the HID interfaces bound
+  * @retval HID handle, NULL if there are fewer interfaces
+  */
+HID_HandleTypeDef *USBH_HID_GetInterface(USBH_HandleTypeDef *phost, uint8_t n)
+{
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+
+  while ((HID_Handle != NULL) && (n != 0U))
+  {
+    HID_Handle = HID_Handle->next;
+    n--;
+  }
+
+  return HID_Handle;
+}
+
+/**
+  * @brief  USBH_HID_GetHandle
+  *         Return the first interface of a type.
+  * @param  phost: Host handle
+  * @param  type: HID_KEYBOARD, HID_MOUSE, HID_GAMEPAD, HID_TOUCH, or HID_UNKNOWN
+  *         for no boot protocol
+  * @retval HID handle, NULL if none
+  */
+HID_HandleTypeDef *USBH_HID_GetHandle(USBH_HandleTypeDef *phost, HID_TypeTypeDef type)
+{
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+
+  while ((HID_Handle != NULL) && (HID_Handle->type != type))
+  {
+    HID_Handle = HID_Handle->next;
+  }
+
+  return HID_Handle;
+}
+
+/**
+  * @brief  USBH_HID_RegisterCollection
+  *         Hand the input reports of an application collection to a decoder
+  *         rather than the interface's queue, whichever interface and report
+  *         ID carry them. Call before USBH_Start, or from a decoder's Init.
+  * @param  app_usage: usage page << 16 | usage of the application collection
+  * @param  decode: decoder, replacing any already registered for app_usage
+  * @retval USBH Status: USBH_FAIL if HID_MAX_COLLECTION_DECODERS are taken
+  */
+USBH_StatusTypeDef USBH_HID_RegisterCollection(uint32_t app_usage, HID_CollectionDecodeTypeDef decode)
+{
+  uint8_t c;
+
+  for (c = 0U; c < HID_NbrCollections; c++)
+  {
+    if (HID_Collections[c].app_usage == app_usage)
+    {
+      break;
+    }
+  }
+
+  if (c >= HID_MAX_COLLECTION_DECODERS)
+  {
+    return USBH_FAIL;
+  }
+
+  HID_Collections[c].app_usage = app_usage;
+  HID_Collections[c].decode = decode;
+
+  if (c == HID_NbrCollections)
+  {
+    HID_NbrCollections++;
+  }
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  USBH_HID_RawSend
+  *         Queue an output report. It goes out over the interrupt OUT
+  *         endpoint, or as a SET_REPORT when the interface has none.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @param  report_id: report ID, prefixed to data unless 0
+  * @param  data: report
+  * @param  length: report length, report ID excluded
+  * @retval USBH Status: USBH_BUSY if the queue is full, USBH_FAIL if the
+  *         report is too long or the interface isn't running
+  */
+USBH_StatusTypeDef USBH_HID_RawSend(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                    uint8_t report_id, const uint8_t *data, uint16_t length)
+{
+  HID_OutQueueTypeDef *out = &HID_Handle->out;
+  HID_OutSlotTypeDef *slot;
+  uint32_t head = out->head;
+  uint16_t prefix = (report_id != 0U) ? 1U : 0U;
+
+  if ((HID_Handle->state == USBH_HID_ERROR) || ((length + prefix) > HID_OUT_REPORT_SIZE) ||
+      ((length + prefix) > 0xFFU))
+  {
+    return USBH_FAIL;
+  }
+
+  if ((head - out->tail) >= HID_OUT_QUEUE_SIZE)
+  {
+    HID_Handle->raw_stats.busy++;
+    return USBH_BUSY;
+  }
+
+  slot = &out->slot[head & (HID_OUT_QUEUE_SIZE - 1U)];
+  slot->data[0] = report_id;
+  (void)USBH_memcpy(&slot->data[prefix], data, length);
+  slot->length = length + prefix;
+  slot->report_id = report_id;
+
+  /* Publish the slot */
+  out->head = head + 1U;
+
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  USBH_HID_RawReceive
+  *         Read the next input report of an interface.
+  * @param  HID_Handle: HID handle of the interface
+  * @param  report: copy of the report, timestamped on arrival
+  * @retval 1 if a report was read, 0 if none is queued
+  */
+uint8_t USBH_HID_RawReceive(HID_HandleTypeDef *HID_Handle, HID_ReportSlotTypeDef *report)
+{
+  return USBH_HID_QueueGet(&HID_Handle->queue, report);
+}
+
+/**
+  * @brief  USBH_HID_RawGetStats
+  *         Return the raw channel counters of an interface.
+  * @param  HID_Handle: HID handle of the interface
+  * @retval counters, rtt_min is 0xFFFFFFFF until a round trip completes
+  */
+const HID_RawStatsTypeDef *USBH_HID_RawGetStats(HID_HandleTypeDef *HID_Handle)
+{
+  return &HID_Handle->raw_stats;
+}
+
+/**
+  * @brief  USBH_HID_QueueInit
+  *         Initialize the report queue.
+  * @param  q: report queue
+  * @param  policy: what a full queue does with a new report
   * @retval none
   */
-void USBH_HID_FifoInit(FIFO_TypeDef *f, uint8_t *buf, uint16_t size)
+void USBH_HID_QueueInit(HID_QueueTypeDef *q, HID_QueuePolicyTypeDef policy)
 {
-  f->head = 0U;
-  f->tail = 0U;
-  f->lock = 0U;
-  f->size = size;
-  f->buf = buf;
+  q->head = 0U;
+  q->tail = 0U;
+  q->policy = policy;
+  q->dropped = 0U;
+  q->overwritten = 0U;
+  q->truncated = 0U;
 }
 
 /**
-  * @brief  USBH_HID_FifoRead
-  *         Read from FIFO.
-  * @param  f: Fifo address
-  * @param  buf: read buffer
-  * @param  nbytes: number of item to read
-  * @retval number of read items
+  * @brief  USBH_HID_QueuePut
+  *         Queue a report. Called by the producer only.
+  * @param  q: report queue
+  * @param  buf: report
+  * @param  length: report length
+  * @param  report_id: report ID, 0 if none
+  * @param  timestamp: arrival time
+  * @retval 1 if queued, 0 if dropped
   */
-uint16_t USBH_HID_FifoRead(FIFO_TypeDef *f, void *buf, uint16_t nbytes)
+uint8_t USBH_HID_QueuePut(HID_QueueTypeDef *q, const uint8_t *buf, uint16_t length,
+                          uint8_t report_id, uint32_t timestamp)
 {
-  uint16_t i;
-  uint8_t *p;
+  HID_ReportSlotTypeDef *slot;
+  uint32_t head = q->head;
 
-  p = (uint8_t *) buf;
+  if ((q->policy == HID_QUEUE_DROP_NEWEST) && ((head - q->tail) >= HID_QUEUE_SIZE))
+  {
+    q->dropped++;
+    return 0U;
+  }
+
+  if (length > HID_REPORT_SIZE)
+  {
+    length = HID_REPORT_SIZE;
+    q->truncated++;
+  }
+
+  slot = &q->slot[head & (HID_QUEUE_SIZE - 1U)];
+  slot->timestamp = timestamp;
+  slot->length = length;
+  slot->report_id = report_id;
+  (void)USBH_memcpy(slot->data, buf, length);
+
+  /* Publish the slot */
+  q->head = head + 1U;
+
+  return 1U;
+}
+
+/**
+  * @brief  USBH_HID_QueueGet
+  *         Read the next report. Called by the consumer only.
+  * @param  q: report queue
+  * @param  report: copy of the report
+  * @retval 1 if a report was read, 0 if the queue is empty
+  */
+uint8_t USBH_HID_QueueGet(HID_QueueTypeDef *q, HID_ReportSlotTypeDef *report)
+{
+  HID_ReportSlotTypeDef *slot;
+  uint32_t head;
+  uint32_t tail = q->tail;
+  uint32_t skip;
 
-  if (f->lock == 0U)
+  for (;;)
   {
-    f->lock = 1U;
+    head = q->head;
 
-    for (i = 0U; i < nbytes; i++)
+    if (head == tail)
     {
-      if (f->tail != f->head)
-      {
-        *p++ = f->buf[f->tail];
-        f->tail++;
+      q->tail = tail;
+      return 0U;
+    }
 
-        if (f->tail == f->size)
-        {
-          f->tail = 0U;
-        }
-      }
-      else
-      {
-        f->lock = 0U;
-        return i;
-      }
+    /* The slot after head may be under the producer: overwriting policies
+       keep HID_QUEUE_SIZE - 1 reports, latest wins keeps one */
+    if (q->policy == HID_QUEUE_LATEST_WINS)
+    {
+      skip = head - tail - 1U;
+    }
+    else if ((q->policy == HID_QUEUE_DROP_OLDEST) && ((head - tail) >= HID_QUEUE_SIZE))
+    {
+      skip = head - tail - (HID_QUEUE_SIZE - 1U);
+    }
+    else
+    {
+      skip = 0U;
+    }
+    q->overwritten += skip;
+    tail += skip;
+
+    slot = &q->slot[tail & (HID_QUEUE_SIZE - 1U)];
+    report->timestamp = slot->timestamp;
+    report->length = (slot->length > HID_REPORT_SIZE) ? HID_REPORT_SIZE : slot->length;
+    report->report_id = slot->report_id;
+    (void)USBH_memcpy(report->data, slot->data, report->length);
+
+    /* Keep the copy unless the producer reached the slot meanwhile */
+    if ((q->policy == HID_QUEUE_DROP_NEWEST) || ((q->head - tail) < HID_QUEUE_SIZE))
+    {
+      q->tail = tail + 1U;
+      return 1U;
     }
   }
+}
+
+/**
+  * @brief  USBH_HID_SetQueuePolicy
+  *         Select what a full report queue does with a new report.
+  * @param  phost: Host handle
+  * @param  policy: queue policy
+  * @retval none
+  */
+void USBH_HID_SetQueuePolicy(USBH_HandleTypeDef *phost, HID_QueuePolicyTypeDef policy)
+{
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+
+  HID_Handle->queue.policy = policy;
+}
+
+/**
+  * @brief  USBH_HID_SetDelivery
+  *         Select how input reports reach the application. The state
+  *         snapshot is kept by HID_DELIVERY_CHANGES and HID_DELIVERY_STATE,
+  *         and needs a parsed report descriptor: without one, every report
+  *         is queued.
+  * @param  phost: Host handle
+  * @param  delivery: delivery mode
+  * @retval none
+  */
+void USBH_HID_SetDelivery(USBH_HandleTypeDef *phost, HID_DeliveryTypeDef delivery)
+{
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+
+  HID_Handle->delivery = delivery;
+}
+
+/**
+  * @brief  USBH_HID_GetState
+  *         Copy the latest state snapshot. Lock free: the copy is retried
+  *         if USBH_Process published a new state meanwhile. Under
+  *         HID_DELIVERY_STATE, USBH_HID_EventCallback is called again at the
+  *         first change after this read.
+  * @param  phost: Host handle
+  * @param  state: copy of the state
+  * @retval 1 if the state changed since the last read, 0 otherwise
+  */
+uint8_t USBH_HID_GetState(USBH_HandleTypeDef *phost, HID_StateTypeDef *state)
+{
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+  uint32_t seq;
+  uint8_t changed;
+
+  do
+  {
+    seq = HID_Handle->state_seq;
+    (void)USBH_memcpy(state, &HID_Handle->State[seq & 1U], sizeof(HID_StateTypeDef));
+  } while (seq != HID_Handle->state_seq);
+
+  changed = (seq != HID_Handle->state_read) ? 1U : 0U;
+  HID_Handle->state_read = seq;
+
+  return changed;
+}
 
-  f->lock = 0U;
+/**
+  * @brief  USBH_HID_GetStateIndex
+  *         Locate a field in HID_StateTypeDef.value.
+  * @param  phost: Host handle
+  * @param  field: input field, see HID_FindField
+  * @retval index of the field's first element, 0xFFFF if not kept
+  */
+uint16_t USBH_HID_GetStateIndex(USBH_HandleTypeDef *phost, const HID_FieldTypeDef *field)
+{
+  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+  uint32_t ndx;
+
+  ndx = (uint32_t)HID_Handle->state_base[field->report] + field->index;
 
-  return nbytes;
+  return (ndx < HID_STATE_MAX_VALUES) ? (uint16_t)ndx : 0xFFFFU;
 }
 
 /**
-  * @brief  USBH_HID_FifoWrite
-  *         Write To FIFO.
-  * @param  f: Fifo address
-  * @param  buf: read buffer
-  * @param  nbytes: number of item to write
-  * @retval number of written items
+  * @brief  USBH_HID_StateInit
+  *         Lay the input reports out in the state snapshot.
+  * @param  HID_Handle: HID handle
+  * @retval none
   */
-uint16_t USBH_HID_FifoWrite(FIFO_TypeDef *f, void *buf, uint16_t  nbytes)
+static void USBH_HID_StateInit(HID_HandleTypeDef *HID_Handle)
 {
-  uint16_t i;
-  uint8_t *p;
+  HID_ReportDescTypeDef *desc = &HID_Handle->ReportDesc;
+  uint32_t base = 0U;
+  uint8_t r;
 
-  p = (uint8_t *) buf;
+  (void)USBH_memset(HID_Handle->State, 0, sizeof(HID_Handle->State));
+  HID_Handle->state_seq = 0U;
+  HID_Handle->state_read = 0U;
 
-  if (f->lock == 0U)
+  for (r = 0U; r < desc->nbr_reports; r++)
   {
-    f->lock = 1U;
+    HID_Handle->state_base[r] = (uint16_t)((base > 0xFFFFU) ? 0xFFFFU : base);
 
-    for (i = 0U; i < nbytes; i++)
+    if (desc->report[r].type == HID_REPORT_TYPE_INPUT)
     {
-      if (((f->head + 1U) == f->tail) ||
-          (((f->head + 1U) == f->size) && (f->tail == 0U)))
+      base += desc->report[r].nbr_values;
+    }
+  }
+}
+
+/**
+  * @brief  USBH_HID_UpdateState
+  *         Fold a received report into the state snapshot.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle
+  * @param  length: report length
+  * @param  notify: set if the application had read the previous state
+  * @retval 1 if the report changed the state or couldn't be decoded,
+  *         0 if it repeats the state
+  */
+static uint8_t USBH_HID_UpdateState(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                    uint16_t length, uint8_t *notify)
+{
+  const HID_ReportDescTypeDef *desc = &HID_Handle->ReportDesc;
+  const HID_ReportInfoTypeDef *report;
+  const HID_FieldTypeDef *field;
+  HID_StateTypeDef *next;
+  int32_t values[HID_STATE_MAX_VALUES];
+  uint32_t seq = HID_Handle->state_seq;
+  uint32_t ndx;
+  uint8_t changed = 0U;
+  uint8_t f;
+  uint16_t n;
+
+  report = HID_DecodeReport(desc, HID_REPORT_TYPE_INPUT, HID_Handle->pData, length,
+                            values, HID_STATE_MAX_VALUES);
+  if (report == NULL)
+  {
+    /* Not in the state: delivered as is, outside HID_DELIVERY_STATE */
+    *notify = 0U;
+    return 1U;
+  }
+
+  /* Build the next state in the buffer not published */
+  next = &HID_Handle->State[(seq + 1U) & 1U];
+  (void)USBH_memcpy(next, &HID_Handle->State[seq & 1U], sizeof(HID_StateTypeDef));
+
+  for (f = 0U; f < report->nbr_fields; f++)
+  {
+    field = &desc->field[report->first_field + f];
+    ndx = (uint32_t)HID_Handle->state_base[report - desc->report] + field->index;
+
+    for (n = 0U; (n < field->count) && ((field->index + n) < HID_STATE_MAX_VALUES) &&
+         (ndx < HID_STATE_MAX_VALUES); n++)
+    {
+      if ((field->flags & HID_FIELD_RELATIVE) != 0U)
       {
-        f->lock = 0U;
-        return i;
+        if (values[field->index + n] != 0)
+        {
+          next->value[ndx] += values[field->index + n];
+          changed = 1U;
+        }
+      }
+      else if (next->value[ndx] != values[field->index + n])
+      {
+        next->value[ndx] = values[field->index + n];
+        changed = 1U;
       }
       else
       {
-        f->buf[f->head] = *p++;
-        f->head++;
-
-        if (f->head == f->size)
-        {
-          f->head = 0U;
-        }
+        /* .. */
       }
+      ndx++;
     }
   }
 
-  f->lock = 0U;
+  if (changed != 0U)
+  {
+    next->timestamp = phost->Timer;
+    next->reports++;
+    next->report_id = report->id;
+
+    /* Wake the application once per read, however many changes follow */
+    *notify = (HID_Handle->state_read == seq) ? 1U : 0U;
+
+    /* Publish */
+    HID_Handle->state_seq = seq + 1U;
+  }
 
-  return nbytes;
+  return changed;
 }
 
 /**
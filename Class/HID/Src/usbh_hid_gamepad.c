@@ -0,0 +1,654 @@
+/**
+  ******************************************************************************
+  * @file    usbh_hid_gamepad.c
+  * @brief   This file is the application layer for USB Host HID joysticks and
+  *          gamepads, decoded from the report descriptor
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_hid_gamepad.h"
+#include "usbh_hid_usage.h"
+
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_HID_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_HID_GAMEPAD
+  * @brief    This file includes HID Layer Handlers for USB Host HID class.
+  * @{
+  */
+
+/** @defgroup USBH_HID_GAMEPAD_Private_Defines
+  * @{
+  */
+#define GAMEPAD_APP_JOYSTICK    (((uint32_t)HID_USAGE_PAGE_GEN_DES << 16) | HID_USAGE_JOYSTICK)
+#define GAMEPAD_APP_GAMEPAD     (((uint32_t)HID_USAGE_PAGE_GEN_DES << 16) | HID_USAGE_GAMEPAD)
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HID_GAMEPAD_Private_FunctionPrototypes
+  * @{
+  */
+static uint8_t USBH_HID_GamepadIsPad(uint32_t app_usage);
+static uint8_t USBH_HID_GamepadItem(HID_GAMEPAD_HandleTypeDef *pad, const HID_FieldTypeDef *field,
+                                    uint8_t size, uint8_t count, uint8_t *nbr_values);
+static void USBH_HID_GamepadBindDesktop(HID_GAMEPAD_HandleTypeDef *pad, const HID_FieldTypeDef *field,
+                                        uint8_t *nbr_values);
+static void USBH_HID_GamepadBindButtons(HID_GAMEPAD_HandleTypeDef *pad, const HID_FieldTypeDef *field,
+                                        uint8_t *nbr_values);
+static uint8_t USBH_HID_GamepadBind(HID_GAMEPAD_HandleTypeDef *pad, HID_HandleTypeDef *HID_Handle, uint8_t r);
+static int16_t USBH_HID_GamepadAxis(const HID_GAMEPAD_HandleTypeDef *pad, const HID_GAMEPAD_ControlTypeDef *ctl,
+                                    int32_t v);
+static void USBH_HID_GamepadDecode(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                   const uint8_t *report, uint16_t length);
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HID_GAMEPAD_Private_Variables
+  * @{
+  */
+static HID_GAMEPAD_HandleTypeDef gamepad_pads[HID_GAMEPAD_MAX_PADS];
+static uint8_t                   gamepad_nbr_pads;
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HID_GAMEPAD_Private_Functions
+  * @{
+  */
+
+/**
+  * @brief  USBH_HID_GamepadIsPad
+  *         Whether an application collection is a Joystick or Game Pad.
+  * @param  app_usage: usage page << 16 | usage of the application collection
+  * @retval 1 for a pad, 0 otherwise
+  */
+static uint8_t USBH_HID_GamepadIsPad(uint32_t app_usage)
+{
+  return ((app_usage == GAMEPAD_APP_JOYSTICK) || (app_usage == GAMEPAD_APP_GAMEPAD)) ? 1U : 0U;
+}
+
+/**
+  * @brief  USBH_HID_GamepadItem
+  *         Extract a field into values[pad->item[n].dest / 4].
+  * @param  pad: pad being bound
+  * @param  field: compiled field
+  * @param  size: bits per element
+  * @param  count: elements
+  * @param  nbr_values: values taken so far, updated
+  * @retval first value, 0xFF if the pad is full
+  */
+static uint8_t USBH_HID_GamepadItem(HID_GAMEPAD_HandleTypeDef *pad, const HID_FieldTypeDef *field,
+                                    uint8_t size, uint8_t count, uint8_t *nbr_values)
+{
+  HID_ExtractTypeDef *item;
+  uint8_t value = *nbr_values;
+
+  if ((pad->nbr_items >= HID_GAMEPAD_MAX_ITEMS) || (((uint32_t)value + count) > HID_GAMEPAD_MAX_VALUES))
+  {
+    return 0xFFU;
+  }
+
+  item = &pad->item[pad->nbr_items++];
+  item->offset = field->offset;
+  item->size   = size;
+  item->count  = count;
+  item->flags  = ((field->flags & HID_FIELD_SIGNED) != 0U) ? HID_EXTRACT_SIGNED : 0U;
+  item->width  = 4U;
+  item->dest   = (uint16_t)(value * 4U);
+
+  *nbr_values = (uint8_t)(value + count);
+  return value;
+}
+
+/**
+  * @brief  USBH_HID_GamepadBindDesktop
+  *         Bind the axes and hats of a Generic Desktop variable field.
+  * @param  pad: pad being bound
+  * @param  field: compiled field
+  * @param  nbr_values: values taken so far, updated
+  * @retval none
+  */
+static void USBH_HID_GamepadBindDesktop(HID_GAMEPAD_HandleTypeDef *pad, const HID_FieldTypeDef *field,
+                                        uint8_t *nbr_values)
+{
+  HID_GAMEPAD_ControlTypeDef *ctl;
+  uint32_t range = (uint32_t)field->logical_max - (uint32_t)field->logical_min;
+  uint32_t usage;
+  uint8_t value = 0xFFU;
+  uint16_t n;
+
+  if ((field->logical_max <= field->logical_min) || (field->count > 0xFFU))
+  {
+    return;
+  }
+
+  for (n = 0U; (n < field->count) && (pad->nbr_controls < HID_GAMEPAD_MAX_CONTROLS); n++)
+  {
+    usage = (uint32_t)field->usage_min + n;
+    if (usage > field->usage_max)
+    {
+      usage = field->usage_max;
+    }
+
+    if ((usage >= HID_USAGE_X) && (usage <= HID_USAGE_WHEEL))
+    {
+      if ((pad->axes & (1U << (usage - HID_USAGE_X))) != 0U)
+      {
+        continue; /* first one wins */
+      }
+    }
+    else if ((usage == HID_USAGE_HATSW) && (pad->nbr_hats < HID_GAMEPAD_MAX_HATS) &&
+             ((range == 3U) || (range == 7U)))
+    {
+      /* 4 or 8 positions, clockwise from up */
+    }
+    else
+    {
+      continue;
+    }
+
+    if (value == 0xFFU)
+    {
+      value = USBH_HID_GamepadItem(pad, field, field->size, (uint8_t)field->count, nbr_values);
+      if (value == 0xFFU)
+      {
+        return;
+      }
+    }
+
+    ctl = &pad->control[pad->nbr_controls++];
+    ctl->value = (uint8_t)(value + n);
+    ctl->min   = field->logical_min;
+    ctl->max   = field->logical_max;
+
+    if (usage == HID_USAGE_HATSW)
+    {
+      ctl->type      = HID_GAMEPAD_CTRL_HAT;
+      ctl->target    = pad->nbr_hats++;
+      ctl->positions = (uint8_t)(range + 1U);
+    }
+    else
+    {
+      ctl->type   = HID_GAMEPAD_CTRL_AXIS;
+      ctl->target = (uint8_t)(usage - HID_USAGE_X);
+      ctl->scale  = (65534UL << 16) / range;
+      pad->axes  |= (uint16_t)(1U << ctl->target);
+    }
+  }
+}
+
+/**
+  * @brief  USBH_HID_GamepadBindButtons
+  *         Bind a Button page field: a bitmap is read in one go as a single
+  *         element.
+  * @param  pad: pad being bound
+  * @param  field: compiled field
+  * @param  nbr_values: values taken so far, updated
+  * @retval none
+  */
+static void USBH_HID_GamepadBindButtons(HID_GAMEPAD_HandleTypeDef *pad, const HID_FieldTypeDef *field,
+                                        uint8_t *nbr_values)
+{
+  HID_GAMEPAD_ButtonsTypeDef *btn = &pad->button[pad->nbr_buttons];
+  uint32_t bits;
+  uint8_t value;
+
+  if ((field->usage_min == 0U) || (field->usage_min > 32U) || (field->count > 0xFFU))
+  {
+    return;
+  }
+
+  if ((field->flags & HID_FIELD_VARIABLE) != 0U)
+  {
+    if (field->size != 1U)
+    {
+      return;
+    }
+
+    bits = (uint32_t)field->usage_max - field->usage_min + 1U;
+    if (bits > field->count)
+    {
+      bits = field->count;
+    }
+    if (bits > (33U - field->usage_min))
+    {
+      bits = 33U - field->usage_min;
+    }
+
+    value = USBH_HID_GamepadItem(pad, field, (uint8_t)bits, 1U, nbr_values);
+    btn->array = 0U;
+    btn->count = 1U;
+  }
+  else
+  {
+    value = USBH_HID_GamepadItem(pad, field, field->size, (uint8_t)field->count, nbr_values);
+    btn->array = 1U;
+    btn->count = (uint8_t)field->count;
+  }
+
+  if (value == 0xFFU)
+  {
+    return;
+  }
+
+  btn->value     = value;
+  btn->shift     = (uint8_t)(field->usage_min - 1U);
+  btn->min       = field->logical_min;
+  btn->usage_min = field->usage_min;
+  btn->usage_max = field->usage_max;
+  pad->nbr_buttons++;
+}
+
+/**
+  * @brief  USBH_HID_GamepadBind
+  *         Lay a pad out over an input report.
+  * @param  pad: pad to bind
+  * @param  HID_Handle: HID handle of the interface
+  * @param  r: index of the report in the compiled descriptor
+  * @retval 1 if the report carries any control, 0 otherwise
+  */
+static uint8_t USBH_HID_GamepadBind(HID_GAMEPAD_HandleTypeDef *pad, HID_HandleTypeDef *HID_Handle, uint8_t r)
+{
+  const HID_ReportDescTypeDef *desc = &HID_Handle->ReportDesc;
+  const HID_ReportInfoTypeDef *report = &desc->report[r];
+  const HID_FieldTypeDef *field;
+  uint8_t nbr_values = 0U;
+  uint8_t a;
+  uint8_t f;
+
+  (void)USBH_memset(pad, 0, sizeof(HID_GAMEPAD_HandleTypeDef));
+  pad->HID_Handle = HID_Handle;
+  pad->report_id  = report->id;
+
+  for (f = 0U; f < report->nbr_fields; f++)
+  {
+    field = &desc->field[report->first_field + f];
+
+    if ((USBH_HID_GamepadIsPad(field->app_usage) == 0U) || ((field->flags & HID_FIELD_RELATIVE) != 0U))
+    {
+      continue;
+    }
+
+    if ((field->usage_page == HID_USAGE_PAGE_GEN_DES) && ((field->flags & HID_FIELD_VARIABLE) != 0U))
+    {
+      USBH_HID_GamepadBindDesktop(pad, field, &nbr_values);
+    }
+    else if ((field->usage_page == HID_USAGE_PAGE_BUTTON) && (pad->nbr_buttons < HID_GAMEPAD_MAX_ITEMS))
+    {
+      USBH_HID_GamepadBindButtons(pad, field, &nbr_values);
+    }
+    else
+    {
+      /* .. */
+    }
+  }
+
+  for (a = 0U; a < (uint8_t)HID_GAMEPAD_AXES; a++)
+  {
+    USBH_HID_GamepadSetDeadzone(pad, (HID_GAMEPAD_AxisTypeDef)a, HID_GAMEPAD_DEADZONE);
+  }
+
+  for (a = 0U; a < HID_GAMEPAD_MAX_HATS; a++)
+  {
+    pad->State[0].hat[a] = HID_GAMEPAD_HAT_CENTERED;
+    pad->State[1].hat[a] = HID_GAMEPAD_HAT_CENTERED;
+  }
+
+  return (pad->nbr_items != 0U) ? 1U : 0U;
+}
+
+/**
+  * @brief  USBH_HID_GamepadInit
+  *         The function init the HID gamepads: a pad is bound to each input
+  *         report of every HID_GAMEPAD interface.
+  * @param  phost: Host handle
+  * @retval USBH Status
+  */
+USBH_StatusTypeDef USBH_HID_GamepadInit(USBH_HandleTypeDef *phost)
+{
+  HID_HandleTypeDef *HID_Handle;
+  HID_GAMEPAD_HandleTypeDef *first;
+  const HID_ReportDescTypeDef *desc;
+  uint8_t n;
+  uint8_t r;
+
+  gamepad_nbr_pads = 0U;
+
+  /* Routes are bound after the decoders' Init, so this reaches every gamepad interface */
+  if ((USBH_HID_RegisterCollection(GAMEPAD_APP_JOYSTICK, USBH_HID_GamepadDecode) != USBH_OK) ||
+      (USBH_HID_RegisterCollection(GAMEPAD_APP_GAMEPAD, USBH_HID_GamepadDecode) != USBH_OK))
+  {
+    USBH_ErrLog("HID: no room for the gamepad decoder, raise HID_MAX_COLLECTION_DECODERS");
+    return USBH_OK; /* reports are queued instead */
+  }
+
+  for (n = 0U; n < HID_MAX_INTERFACES; n++)
+  {
+    HID_Handle = USBH_HID_GetInterface(phost, n);
+
+    if (HID_Handle == NULL)
+    {
+      break;
+    }
+
+    if (HID_Handle->type != HID_GAMEPAD)
+    {
+      continue;
+    }
+
+    /* The pads of an interface are consecutive, from pDecoderData */
+    first = &gamepad_pads[gamepad_nbr_pads];
+    desc = &HID_Handle->ReportDesc;
+
+    for (r = 0U; (r < desc->nbr_reports) && (gamepad_nbr_pads < HID_GAMEPAD_MAX_PADS); r++)
+    {
+      if ((desc->report[r].type == HID_REPORT_TYPE_INPUT) &&
+          (USBH_HID_GamepadBind(&gamepad_pads[gamepad_nbr_pads], HID_Handle, r) != 0U))
+      {
+        gamepad_nbr_pads++;
+      }
+    }
+
+    HID_Handle->pDecoderData = (first < &gamepad_pads[gamepad_nbr_pads]) ? first : NULL;
+  }
+
+  USBH_UsrLog("HID: %d gamepad(s)", gamepad_nbr_pads);
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  USBH_HID_GamepadAxis
+  *         Scale an axis value to -32767..32767 and apply its deadzone.
+  * @param  pad: pad of the axis
+  * @param  ctl: axis control
+  * @param  v: logical value
+  * @retval axis position
+  */
+static int16_t USBH_HID_GamepadAxis(const HID_GAMEPAD_HandleTypeDef *pad, const HID_GAMEPAD_ControlTypeDef *ctl,
+                                    int32_t v)
+{
+  uint32_t dz = pad->deadzone[ctl->target];
+  uint32_t mag;
+  int32_t x;
+
+  if (v <= ctl->min)
+  {
+    x = -HID_GAMEPAD_AXIS_MAX;
+  }
+  else if (v >= ctl->max)
+  {
+    x = HID_GAMEPAD_AXIS_MAX;
+  }
+  else
+  {
+    x = (int32_t)(((uint64_t)((uint32_t)v - (uint32_t)ctl->min) * ctl->scale) >> 16) - HID_GAMEPAD_AXIS_MAX;
+  }
+
+  if (dz != 0U)
+  {
+    mag = (uint32_t)((x < 0) ? -x : x);
+    if (mag <= dz)
+    {
+      return 0;
+    }
+
+    mag = (uint32_t)(((uint64_t)(mag - dz) * pad->dz_gain[ctl->target]) >> 16);
+    if (mag > (uint32_t)HID_GAMEPAD_AXIS_MAX)
+    {
+      mag = (uint32_t)HID_GAMEPAD_AXIS_MAX;
+    }
+    x = (x < 0) ? -(int32_t)mag : (int32_t)mag;
+  }
+
+  return (int16_t)x;
+}
+
+/**
+  * @brief  USBH_HID_GamepadDecode
+  *         Decoder of the Joystick and Game Pad application collections,
+  *         called from USBH_Process with the report in place.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @param  report: input report, report ID byte included
+  * @param  length: report length
+  * @retval none
+  */
+static void USBH_HID_GamepadDecode(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                   const uint8_t *report, uint16_t length)
+{
+  HID_GAMEPAD_HandleTypeDef *pad = (HID_GAMEPAD_HandleTypeDef *)HID_Handle->pDecoderData;
+  const HID_GAMEPAD_ControlTypeDef *ctl;
+  const HID_GAMEPAD_ButtonsTypeDef *btn;
+  const HID_GAMEPAD_StateTypeDef *cur;
+  HID_GAMEPAD_StateTypeDef *next;
+  int32_t values[HID_GAMEPAD_MAX_VALUES];
+  uint32_t seq;
+  uint32_t usage;
+  int32_t v;
+  uint8_t report_id = 0U;
+  uint8_t changed;
+  uint8_t n;
+  uint8_t e;
+
+  if (HID_Handle->ReportDesc.report_ids != 0U)
+  {
+    report_id = (length != 0U) ? report[0] : 0U;
+  }
+
+  while ((pad != NULL) && (pad < &gamepad_pads[gamepad_nbr_pads]) && (pad->HID_Handle == HID_Handle) &&
+         (pad->report_id != report_id))
+  {
+    pad++;
+  }
+
+  if ((pad == NULL) || (pad >= &gamepad_pads[gamepad_nbr_pads]) || (pad->HID_Handle != HID_Handle))
+  {
+    /* Not a pad (eg. a gamepad collection on a keyboard interface): queued as any report */
+    (void)USBH_HID_QueuePut(&HID_Handle->queue, report, length, report_id, phost->Timer);
+    USBH_HID_EventCallback(phost);
+    return;
+  }
+
+  if (report_id != 0U)
+  {
+    report++;
+    length--;
+  }
+  HID_ExtractReport(pad->item, pad->nbr_items, report, length, values);
+
+  /* Build the next state in the buffer not published */
+  seq  = pad->seq;
+  cur  = &pad->State[seq & 1U];
+  next = &pad->State[(seq + 1U) & 1U];
+
+  next->buttons = 0U;
+  for (n = 0U; n < pad->nbr_buttons; n++)
+  {
+    btn = &pad->button[n];
+
+    if (btn->array == 0U)
+    {
+      next->buttons |= (uint32_t)values[btn->value] << btn->shift;
+      continue;
+    }
+
+    for (e = 0U; e < btn->count; e++)
+    {
+      usage = (uint32_t)(values[btn->value + e] - btn->min) + btn->usage_min;
+      if ((usage >= btn->usage_min) && (usage <= btn->usage_max) && (usage <= 32U))
+      {
+        next->buttons |= 1UL << (usage - 1U);
+      }
+    }
+  }
+
+  for (n = 0U; n < pad->nbr_controls; n++)
+  {
+    ctl = &pad->control[n];
+    v = values[ctl->value];
+
+    if (ctl->type == HID_GAMEPAD_CTRL_AXIS)
+    {
+      next->axis[ctl->target] = USBH_HID_GamepadAxis(pad, ctl, v);
+    }
+    else if ((v < ctl->min) || (v > ctl->max))
+    {
+      next->hat[ctl->target] = HID_GAMEPAD_HAT_CENTERED; /* null state */
+    }
+    else
+    {
+      next->hat[ctl->target] = (uint8_t)((uint32_t)(v - ctl->min) * (8U / ctl->positions));
+    }
+  }
+
+  changed = (next->buttons != cur->buttons) ? 1U : 0U;
+  for (n = 0U; (n < (uint8_t)HID_GAMEPAD_AXES) && (changed == 0U); n++)
+  {
+    changed = (next->axis[n] != cur->axis[n]) ? 1U : 0U;
+  }
+  for (n = 0U; (n < HID_GAMEPAD_MAX_HATS) && (changed == 0U); n++)
+  {
+    changed = (next->hat[n] != cur->hat[n]) ? 1U : 0U;
+  }
+
+  if (changed == 0U)
+  {
+    return;
+  }
+
+  next->timestamp = phost->Timer;
+  next->reports   = cur->reports + 1U;
+
+  /* Publish */
+  pad->seq = seq + 1U;
+
+  USBH_HID_GamepadCallback(phost, pad);
+
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+/**
+  * @brief  USBH_HID_GetGamepad
+  *         Return pad n over all interfaces. Pads outlive their device until
+  *         the next one binds.
+  * @param  phost: Host handle
+  * @param  n: pad index
+  * @retval pad, NULL if there are fewer
+  */
+HID_GAMEPAD_HandleTypeDef *USBH_HID_GetGamepad(USBH_HandleTypeDef *phost, uint8_t n)
+{
+  HID_HandleTypeDef *HID_Handle = USBH_HID_GetHandle(phost, HID_GAMEPAD);
+
+  if ((HID_Handle == NULL) || (n >= gamepad_nbr_pads))
+  {
+    return NULL;
+  }
+
+  return &gamepad_pads[n];
+}
+
+/**
+  * @brief  USBH_HID_GetGamepadState
+  *         Copy the latest state of a pad, lock free.
+  * @param  pad: pad
+  * @param  state: copy of the state
+  * @retval 1 if it changed since the last read, 0 otherwise
+  */
+uint8_t USBH_HID_GetGamepadState(HID_GAMEPAD_HandleTypeDef *pad, HID_GAMEPAD_StateTypeDef *state)
+{
+  uint32_t seq;
+  uint8_t changed;
+
+  do
+  {
+    seq = pad->seq;
+    (void)USBH_memcpy(state, &pad->State[seq & 1U], sizeof(HID_GAMEPAD_StateTypeDef));
+  } while (seq != pad->seq);
+
+  changed = (seq != pad->read) ? 1U : 0U;
+  pad->read = seq;
+
+  return changed;
+}
+
+/**
+  * @brief  USBH_HID_GamepadSetDeadzone
+  *         Axis values within deadzone of the centre read 0, the rest are
+  *         rescaled to still reach HID_GAMEPAD_AXIS_MAX.
+  * @param  pad: pad
+  * @param  axis: HID_GAMEPAD_X .. HID_GAMEPAD_WHEEL
+  * @param  deadzone: 0 to turn it off
+  * @retval none
+  */
+void USBH_HID_GamepadSetDeadzone(HID_GAMEPAD_HandleTypeDef *pad, HID_GAMEPAD_AxisTypeDef axis, uint16_t deadzone)
+{
+  uint32_t span;
+
+  if (axis >= HID_GAMEPAD_AXES)
+  {
+    return;
+  }
+
+  if (deadzone >= (uint16_t)HID_GAMEPAD_AXIS_MAX)
+  {
+    deadzone = (uint16_t)(HID_GAMEPAD_AXIS_MAX - 1);
+  }
+  span = (uint32_t)HID_GAMEPAD_AXIS_MAX - deadzone;
+
+  /* Rounded up, so that full deflection still reads HID_GAMEPAD_AXIS_MAX */
+  pad->deadzone[axis] = deadzone;
+  pad->dz_gain[axis]  = (((uint32_t)HID_GAMEPAD_AXIS_MAX << 16) + span - 1U) / span;
+}
+
+/**
+  * @brief  USBH_HID_GamepadCallback
+  *         Called from USBH_Process when a pad's state changes.
+  * @param  phost: Host handle
+  * @param  pad: pad
+  * @retval None
+  */
+__weak void USBH_HID_GamepadCallback(USBH_HandleTypeDef *phost, HID_GAMEPAD_HandleTypeDef *pad)
+{
+  /* Prevent unused argument(s) compilation warning */
+  UNUSED(phost);
+  UNUSED(pad);
+}
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
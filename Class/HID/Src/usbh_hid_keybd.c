@@ -28,6 +28,8 @@ EndBSPDependencies */
 /* Includes ------------------------------------------------------------------*/
 #include "usbh_hid_keybd.h"
 #include "usbh_hid_parser.h"
+#include "usbh_hid_usage.h"
+#include <stddef.h>
 
 /** @addtogroup USBH_LIB
   * @{
@@ -72,6 +74,9 @@ EndBSPDependencies */
 #define  KBD_RIGHT_ALT                                  0x40
 #define  KBD_RIGHT_GUI                                  0x80
 #define  KBR_MAX_NBR_PRESSED                            6
+#define  KBD_USAGE_ERROR_ROLLOVER                       0x01U
+#define  KBD_USAGE_FIRST_KEY                            0x04U
+#define  KBD_APP_KEYBOARD                               (((uint32_t)HID_USAGE_PAGE_GEN_DES << 16) | HID_USAGE_KBD)
 
 /** @defgroup USBH_HID_KEYBD_Private_Macros
   * @{
@@ -83,7 +88,16 @@ EndBSPDependencies */
 /** @defgroup USBH_HID_KEYBD_Private_FunctionPrototypes
   * @{
   */
-static USBH_StatusTypeDef USBH_HID_KeybdDecode(USBH_HandleTypeDef *phost);
+static void USBH_HID_KeybdDecode(USBH_HandleTypeDef *phost);
+static void USBH_HID_KeybdCollection(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                     const uint8_t *report, uint16_t length);
+static void USBH_HID_KeybdApply(HID_HandleTypeDef *HID_Handle, uint8_t n, const uint8_t *data,
+                                uint16_t length, uint8_t report_id, uint32_t timestamp);
+static USBH_StatusTypeDef USBH_HID_KeybdReport(HID_HandleTypeDef *HID_Handle,
+                                               const uint8_t *data, uint16_t length, uint8_t report_id,
+                                               uint32_t *state, uint8_t *keys);
+static void USBH_HID_KeybdDiff(uint32_t timestamp);
+static uint32_t USBH_HID_KeybdBits(const uint8_t *data, uint16_t length, uint16_t offset, uint8_t size);
 /**
   * @}
   */
@@ -93,129 +107,44 @@ static USBH_StatusTypeDef USBH_HID_KeybdDecode(USBH_HandleTypeDef *phost);
   */
 
 HID_KEYBD_Info_TypeDef    keybd_info;
-uint8_t                   keybd_rx_report_buf[USBH_HID_KEYBD_REPORT_SIZE];
-uint8_t                   keybd_report_data[USBH_HID_KEYBD_REPORT_SIZE];
-
-static const HID_Report_ItemTypedef imp_0_lctrl =
-{
-  keybd_report_data, /*data*/
-  1,     /*size*/
-  0,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-static const HID_Report_ItemTypedef imp_0_lshift =
-{
-  keybd_report_data, /*data*/
-  1,     /*size*/
-  1,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-static const HID_Report_ItemTypedef imp_0_lalt =
-{
-  keybd_report_data, /*data*/
-  1,     /*size*/
-  2,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-static const HID_Report_ItemTypedef imp_0_lgui =
-{
-  keybd_report_data, /*data*/
-  1,     /*size*/
-  3,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-static const HID_Report_ItemTypedef imp_0_rctrl =
-{
-  keybd_report_data, /*data*/
-  1,     /*size*/
-  4,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-static const HID_Report_ItemTypedef imp_0_rshift =
+HID_ReportSlotTypeDef     keybd_report;
+
+/* Keys held, per interface and over all of them */
+static uint32_t           keybd_itf_state[HID_MAX_INTERFACES][HID_KEYBD_STATE_WORDS];
+static uint32_t           keybd_state[HID_KEYBD_STATE_WORDS];
+
+/* Press and release events, written by the decoder, read by
+   USBH_HID_GetKeybdEvent */
+static HID_KEYBD_EventTypeDef keybd_events[USBH_HID_KEYBD_EVENT_QUEUE_SIZE];
+static volatile uint32_t  keybd_event_head;
+static volatile uint32_t  keybd_event_tail;
+static uint32_t           keybd_event_dropped;
+
+/* Reports decoded, written by USBH_Process; keybd_read is its value at
+   the last USBH_HID_GetKeybdInfo */
+static volatile uint32_t  keybd_seq;
+static uint32_t           keybd_read;
+
+/* Boot report: modifier bits, a reserved byte, then 6 key codes */
+static const HID_ExtractTypeDef keybd_boot_items[] =
 {
-  keybd_report_data, /*data*/
-  1,     /*size*/
-  5,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-static const HID_Report_ItemTypedef imp_0_ralt =
-{
-  keybd_report_data, /*data*/
-  1,     /*size*/
-  6,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-static const HID_Report_ItemTypedef imp_0_rgui =
-{
-  keybd_report_data, /*data*/
-  1,     /*size*/
-  7,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
+  /* offset, size, count, flags, width, dest */
+  { 0U, 1U, 1U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, lctrl) },
+  { 1U, 1U, 1U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, lshift) },
+  { 2U, 1U, 1U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, lalt) },
+  { 3U, 1U, 1U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, lgui) },
+  { 4U, 1U, 1U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, rctrl) },
+  { 5U, 1U, 1U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, rshift) },
+  { 6U, 1U, 1U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, ralt) },
+  { 7U, 1U, 1U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, rgui) },
+  { 16U, 8U, 6U, 0U, 1U, (uint16_t)offsetof(HID_KEYBD_Info_TypeDef, keys) },
 };
 
-static const HID_Report_ItemTypedef imp_0_key_array =
-{
-  keybd_report_data + 2U, /*data*/
-  8,     /*size*/
-  0,     /*shift*/
-  6,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  101,   /*max value read can return*/
-  0,     /*min vale device can report*/
-  101,   /*max value device can report*/
-  1      /*resolution*/
-};
+#if defined(USBH_HID_KEYBD_CUSTOM_LAYOUT)
+#define HID_KEYBRD_Key          USBH_HID_KeybdLayoutKey
+#define HID_KEYBRD_ShiftKey     USBH_HID_KeybdLayoutShiftKey
 
-#ifdef QWERTY_KEYBOARD
+#elif defined(QWERTY_KEYBOARD)
 static const uint8_t HID_KEYBRD_Key[] =
 {
   /*  0 */ '\0',  /*  1 */ '`',   /*  2 */ '1',   /*  3 */ '2',
@@ -408,39 +337,27 @@ static  const  uint8_t  HID_KEYBRD_Codes[] =
   */
 USBH_StatusTypeDef USBH_HID_KeybdInit(USBH_HandleTypeDef *phost)
 {
-  uint32_t x;
-  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
-
-  keybd_info.lctrl = 0U;
-  keybd_info.lshift = 0U;
-  keybd_info.lalt = 0U;
-  keybd_info.lgui = 0U;
-  keybd_info.rctrl = 0U;
-  keybd_info.rshift = 0U;
-  keybd_info.ralt = 0U;
-  keybd_info.rgui = 0U;
-
-  for (x = 0U; x < sizeof(keybd_report_data); x++)
+  (void)USBH_memset(&keybd_info, 0, sizeof(keybd_info));
+  (void)USBH_memset(keybd_itf_state, 0, sizeof(keybd_itf_state));
+  (void)USBH_memset(keybd_state, 0, sizeof(keybd_state));
+
+  keybd_event_head = 0U;
+  keybd_event_tail = 0U;
+  keybd_event_dropped = 0U;
+  keybd_seq = 0U;
+  keybd_read = 0U;
+
+  /* Keyboard reports are decoded in place as they arrive, whatever their
+     length (NKRO bitmaps outgrow the boot report and the queue slots).
+     Routes are bound after the decoders' Init, so this reaches every
+     keyboard interface. Only keyboards without a report descriptor are
+     read from their queue. */
+  if (USBH_HID_RegisterCollection(KBD_APP_KEYBOARD, USBH_HID_KeybdCollection) != USBH_OK)
   {
-    keybd_report_data[x] = 0U;
-    keybd_rx_report_buf[x] = 0U;
+    USBH_ErrLog("HID: no room for the keyboard decoder, raise HID_MAX_COLLECTION_DECODERS");
   }
 
-  if (HID_Handle->length > (sizeof(keybd_report_data)))
-  {
-    HID_Handle->length = (uint16_t)(sizeof(keybd_report_data));
-  }
-
-  HID_Handle->pData = keybd_rx_report_buf;
-
-  if ((HID_QUEUE_SIZE * sizeof(keybd_report_data)) > sizeof(phost->device.Data))
-  {
-    return USBH_FAIL;
-  }
-  else
-  {
-    USBH_HID_FifoInit(&HID_Handle->fifo, phost->device.Data, (uint16_t)(HID_QUEUE_SIZE * sizeof(keybd_report_data)));
-  }
+  UNUSED(phost);
 
   return USBH_OK;
 }
@@ -449,12 +366,19 @@ USBH_StatusTypeDef USBH_HID_KeybdInit(USBH_HandleTypeDef *phost)
   * @brief  USBH_HID_GetKeybdInfo
   *         The function return keyboard information.
   * @param  phost: Host handle
-  * @retval keyboard information
+  * @retval keyboard information, NULL if no report came in since the last
+  *         call: modifiers of all keyboard interfaces, keys of the last report
   */
 HID_KEYBD_Info_TypeDef *USBH_HID_GetKeybdInfo(USBH_HandleTypeDef *phost)
 {
-  if (USBH_HID_KeybdDecode(phost) == USBH_OK)
+  uint32_t seq;
+
+  USBH_HID_KeybdDecode(phost);
+
+  seq = keybd_seq;
+  if (seq != keybd_read)
   {
+    keybd_read = seq;
     return &keybd_info;
   }
   else
@@ -463,43 +387,438 @@ HID_KEYBD_Info_TypeDef *USBH_HID_GetKeybdInfo(USBH_HandleTypeDef *phost)
   }
 }
 
+/**
+  * @brief  USBH_HID_GetKeybdEvent
+  *         Read the next key press or release, decoding the reports queued.
+  * @param  phost: Host handle
+  * @param  event: key event
+  * @retval 1 if an event was read, 0 if none is pending
+  */
+uint8_t USBH_HID_GetKeybdEvent(USBH_HandleTypeDef *phost, HID_KEYBD_EventTypeDef *event)
+{
+  uint32_t tail = keybd_event_tail;
+
+  (void)USBH_HID_KeybdDecode(phost);
+
+  if (tail == keybd_event_head)
+  {
+    return 0U;
+  }
+
+  *event = keybd_events[tail & (USBH_HID_KEYBD_EVENT_QUEUE_SIZE - 1U)];
+  keybd_event_tail = tail + 1U;
+
+  return 1U;
+}
+
+/**
+  * @brief  USBH_HID_GetKeybdState
+  *         Return the keys held, decoding the reports queued.
+  * @param  phost: Host handle
+  * @retval HID_KEYBD_STATE_WORDS words, bit n of word w for usage 32w + n
+  */
+const uint32_t *USBH_HID_GetKeybdState(USBH_HandleTypeDef *phost)
+{
+  (void)USBH_HID_KeybdDecode(phost);
+
+  return keybd_state;
+}
+
+/**
+  * @brief  USBH_HID_KeybdIsPressed
+  *         Whether a key is held, decoding the reports queued.
+  * @param  phost: Host handle
+  * @param  usage: KEY_xxx
+  * @retval 1 if held, 0 otherwise
+  */
+uint8_t USBH_HID_KeybdIsPressed(USBH_HandleTypeDef *phost, uint8_t usage)
+{
+  (void)USBH_HID_KeybdDecode(phost);
+
+  return (uint8_t)((keybd_state[usage >> 5U] >> (usage & 0x1FU)) & 1U);
+}
+
 /**
   * @brief  USBH_HID_KeybdDecode
-  *         The function decode keyboard data.
+  *         The function decode the reports queued by the keyboard
+  *         interfaces without a report descriptor, in order: the others
+  *         are decoded as they arrive.
   * @param  phost: Host handle
-  * @retval USBH Status
+  * @retval none
+  */
+static void USBH_HID_KeybdDecode(USBH_HandleTypeDef *phost)
+{
+  HID_HandleTypeDef *HID_Handle;
+  uint8_t n;
+
+  for (n = 0U; n < HID_MAX_INTERFACES; n++)
+  {
+    HID_Handle = USBH_HID_GetInterface(phost, n);
+
+    if (HID_Handle == NULL)
+    {
+      break;
+    }
+
+    if ((HID_Handle->type != HID_KEYBOARD) || (HID_Handle->length == 0U) ||
+        (HID_Handle->ReportDesc.nbr_reports != 0U))
+    {
+      continue;
+    }
+
+    /*Fill report */
+    while (USBH_HID_QueueGet(&HID_Handle->queue, &keybd_report) != 0U)
+    {
+      USBH_HID_KeybdApply(HID_Handle, n, keybd_report.data, keybd_report.length,
+                          keybd_report.report_id, keybd_report.timestamp);
+    }
+  }
+}
+
+/**
+  * @brief  USBH_HID_KeybdCollection
+  *         Decoder of the Keyboard application collection, called from
+  *         USBH_Process with the report in place.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @param  report: input report, report ID byte included
+  * @param  length: report length
+  * @retval none
+  */
+static void USBH_HID_KeybdCollection(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                     const uint8_t *report, uint16_t length)
+{
+  uint8_t report_id = ((HID_Handle->ReportDesc.report_ids != 0U) && (length > 0U)) ? report[0] : 0U;
+  uint32_t seq = keybd_seq;
+  uint8_t n;
+
+  /* Keys are held per interface */
+  for (n = 0U; (n < HID_MAX_INTERFACES) && (USBH_HID_GetInterface(phost, n) != HID_Handle); n++)
+  {
+    /* .. */
+  }
+
+  if (n == HID_MAX_INTERFACES)
+  {
+    return;
+  }
+
+  USBH_HID_KeybdApply(HID_Handle, n, report, length, report_id, phost->Timer);
+
+  if (keybd_seq != seq)
+  {
+    USBH_HID_EventCallback(phost);
+
+#if (USBH_USE_OS == 1U)
+    USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+  }
+}
+
+/**
+  * @brief  USBH_HID_KeybdApply
+  *         Decode a report of keyboard interface n into the keys held,
+  *         the key events and keybd_info.
+  * @param  HID_Handle: HID handle of the interface
+  * @param  n: interface index
+  * @param  data: input report, report ID byte included
+  * @param  length: report length
+  * @param  report_id: report ID, 0 when the device uses none
+  * @param  timestamp: report arrival
+  * @retval none
   */
-static USBH_StatusTypeDef USBH_HID_KeybdDecode(USBH_HandleTypeDef *phost)
+static void USBH_HID_KeybdApply(HID_HandleTypeDef *HID_Handle, uint8_t n, const uint8_t *data,
+                                uint16_t length, uint8_t report_id, uint32_t timestamp)
 {
+  uint8_t keys[KBR_MAX_NBR_PRESSED];
   uint8_t x;
 
-  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+  /* Decode report */
+  if (USBH_HID_KeybdReport(HID_Handle, data, length, report_id, keybd_itf_state[n], keys) != USBH_OK)
+  {
+    return;
+  }
+
+  USBH_HID_KeybdDiff(timestamp);
 
-  if ((HID_Handle->length == 0U) || (HID_Handle->fifo.buf == NULL))
+  for (x = 0U; x < KBR_MAX_NBR_PRESSED; x++)
   {
-    return USBH_FAIL;
+    keybd_info.keys[x] = keys[x];
   }
 
-  /*Fill report */
-  if (USBH_HID_FifoRead(&HID_Handle->fifo, &keybd_report_data, HID_Handle->length) ==  HID_Handle->length)
+  keybd_info.lctrl  = (uint8_t)((keybd_state[7] >> 0U) & 1U);
+  keybd_info.lshift = (uint8_t)((keybd_state[7] >> 1U) & 1U);
+  keybd_info.lalt   = (uint8_t)((keybd_state[7] >> 2U) & 1U);
+  keybd_info.lgui   = (uint8_t)((keybd_state[7] >> 3U) & 1U);
+  keybd_info.rctrl  = (uint8_t)((keybd_state[7] >> 4U) & 1U);
+  keybd_info.rshift = (uint8_t)((keybd_state[7] >> 5U) & 1U);
+  keybd_info.ralt   = (uint8_t)((keybd_state[7] >> 6U) & 1U);
+  keybd_info.rgui   = (uint8_t)((keybd_state[7] >> 7U) & 1U);
+
+  keybd_seq++;
+}
+
+/**
+  * @brief  USBH_HID_KeybdReport
+  *         Turn a report into the keys held on its interface, with the
+  *         fields of the report descriptor: bitmaps (NKRO) and arrays
+  *         (boot style). Without a descriptor, the boot report is assumed.
+  * @param  HID_Handle: HID handle of the interface
+  * @param  data: input report, report ID byte included
+  * @param  length: report length
+  * @param  report_id: report ID, 0 when the device uses none
+  * @param  state: keys held on the interface
+  * @param  keys: first keys of the report, in report order
+  * @retval USBH Status: USBH_FAIL if the report carries no keys, or
+  *         reports a rollover error, leaving state as it was
+  */
+static USBH_StatusTypeDef USBH_HID_KeybdReport(HID_HandleTypeDef *HID_Handle,
+                                               const uint8_t *data, uint16_t length, uint8_t report_id,
+                                               uint32_t *state, uint8_t *keys)
+{
+  const HID_ReportDescTypeDef *desc = &HID_Handle->ReportDesc;
+  const HID_ReportInfoTypeDef *info = NULL;
+  const HID_FieldTypeDef *field;
+  uint32_t next[HID_KEYBD_STATE_WORDS] = { 0U };
+  uint32_t usage;
+  uint32_t val;
+  uint16_t n;
+  uint16_t chunk;
+  uint8_t nkeys = 0U;
+  uint8_t found = 0U;
+  uint8_t r;
+  uint8_t f;
+
+  (void)USBH_memset(keys, 0, KBR_MAX_NBR_PRESSED);
+
+  for (r = 0U; r < desc->nbr_reports; r++)
   {
-    keybd_info.lctrl = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_lctrl, 0U);
-    keybd_info.lshift = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_lshift, 0U);
-    keybd_info.lalt = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_lalt, 0U);
-    keybd_info.lgui = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_lgui, 0U);
-    keybd_info.rctrl = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_rctrl, 0U);
-    keybd_info.rshift = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_rshift, 0U);
-    keybd_info.ralt = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_ralt, 0U);
-    keybd_info.rgui = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_rgui, 0U);
-
-    for (x = 0U; x < sizeof(keybd_info.keys); x++)
+    if ((desc->report[r].type == HID_REPORT_TYPE_INPUT) && (desc->report[r].id == report_id))
     {
-      keybd_info.keys[x] = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &imp_0_key_array, x);
+      info = &desc->report[r];
+      break;
     }
+  }
 
-    return USBH_OK;
+  if (info == NULL)
+  {
+    if ((desc->nbr_reports != 0U) || (length < USBH_HID_KEYBD_REPORT_SIZE))
+    {
+      return USBH_FAIL;
+    }
+
+    /* Boot report */
+    HID_ExtractReport(keybd_boot_items, (uint8_t)(sizeof(keybd_boot_items) / sizeof(keybd_boot_items[0])),
+                      data, length, &keybd_info);
+
+    next[7] = (uint32_t)keybd_info.lctrl | ((uint32_t)keybd_info.lshift << 1U) |
+              ((uint32_t)keybd_info.lalt << 2U) | ((uint32_t)keybd_info.lgui << 3U) |
+              ((uint32_t)keybd_info.rctrl << 4U) | ((uint32_t)keybd_info.rshift << 5U) |
+              ((uint32_t)keybd_info.ralt << 6U) | ((uint32_t)keybd_info.rgui << 7U);
+
+    for (n = 0U; n < KBR_MAX_NBR_PRESSED; n++)
+    {
+      usage = keybd_info.keys[n];
+      if (usage == KBD_USAGE_ERROR_ROLLOVER)
+      {
+        return USBH_FAIL;
+      }
+      if (usage >= KBD_USAGE_FIRST_KEY)
+      {
+        next[usage >> 5U] |= 1U << (usage & 0x1FU);
+        keys[nkeys++] = (uint8_t)usage;
+      }
+    }
+  }
+  else
+  {
+    /* Field offsets leave the report ID out */
+    if (desc->report_ids != 0U)
+    {
+      data++;
+      length = (length > 0U) ? (uint16_t)(length - 1U) : 0U;
+    }
+
+    for (f = 0U; f < info->nbr_fields; f++)
+    {
+      field = &desc->field[info->first_field + f];
+
+      if (field->usage_page != HID_USAGE_PAGE_KEYB)
+      {
+        continue;
+      }
+      found = 1U;
+
+      if ((field->flags & HID_FIELD_VARIABLE) == 0U)
+      {
+        /* Array: each element holds the index of a key held */
+        for (n = 0U; n < field->count; n++)
+        {
+          val = USBH_HID_KeybdBits(data, length, (uint16_t)(field->offset + (n * field->size)), field->size);
+
+          if (((int32_t)val < field->logical_min) || ((int32_t)val > field->logical_max))
+          {
+            continue;
+          }
+
+          usage = field->usage_min + (uint32_t)((int32_t)val - field->logical_min);
+          if (usage == KBD_USAGE_ERROR_ROLLOVER)
+          {
+            return USBH_FAIL;
+          }
+          if ((usage >= KBD_USAGE_FIRST_KEY) && (usage < (HID_KEYBD_STATE_WORDS * 32U)))
+          {
+            next[usage >> 5U] |= 1U << (usage & 0x1FU);
+            if (nkeys < KBR_MAX_NBR_PRESSED)
+            {
+              keys[nkeys++] = (uint8_t)usage;
+            }
+          }
+        }
+      }
+      else if (field->size == 1U)
+      {
+        /* Bitmap: 32 keys at a time */
+        for (n = 0U; n < field->count; n += chunk)
+        {
+          chunk = (((uint32_t)field->count - n) < 32U) ? (uint16_t)(field->count - n) : 32U;
+          usage = (uint32_t)field->usage_min + n;
+
+          if (usage >= (HID_KEYBD_STATE_WORDS * 32U))
+          {
+            break;
+          }
+
+          val = USBH_HID_KeybdBits(data, length, (uint16_t)(field->offset + n), (uint8_t)chunk);
+          next[usage >> 5U] |= val << (usage & 0x1FU);
+          if (((usage & 0x1FU) != 0U) && ((usage >> 5U) < (HID_KEYBD_STATE_WORDS - 1U)))
+          {
+            next[(usage >> 5U) + 1U] |= val >> (32U - (usage & 0x1FU));
+          }
+        }
+      }
+      else
+      {
+        /* Variable keys wider than a bit: held when non zero */
+        for (n = 0U; n < field->count; n++)
+        {
+          usage = (uint32_t)field->usage_min + n;
+          usage = (usage > field->usage_max) ? field->usage_max : usage;
+
+          if ((usage < (HID_KEYBD_STATE_WORDS * 32U)) &&
+              (USBH_HID_KeybdBits(data, length, (uint16_t)(field->offset + (n * field->size)), field->size) != 0U))
+          {
+            next[usage >> 5U] |= 1U << (usage & 0x1FU);
+          }
+        }
+      }
+    }
+
+    if (found == 0U)
+    {
+      return USBH_FAIL;
+    }
+
+    /* Usages 0 to 3 are no keys */
+    next[0] &= ~((1U << KBD_USAGE_FIRST_KEY) - 1U);
+
+    /* Keys of the bitmaps, after those of the arrays */
+    for (usage = KBD_USAGE_FIRST_KEY; (usage < 0xE0U) && (nkeys < KBR_MAX_NBR_PRESSED); usage++)
+    {
+      if (((next[usage >> 5U] >> (usage & 0x1FU)) & 1U) != 0U)
+      {
+        for (n = 0U; (n < nkeys) && (keys[n] != usage); n++)
+        {
+          /* .. */
+        }
+        if (n == nkeys)
+        {
+          keys[nkeys++] = (uint8_t)usage;
+        }
+      }
+    }
   }
-  return   USBH_FAIL;
+
+  (void)USBH_memcpy(state, next, sizeof(next));
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  USBH_HID_KeybdDiff
+  *         Queue an event per key whose state changed, from the keys held
+  *         on all the interfaces.
+  * @param  timestamp: report arrival
+  * @retval none
+  */
+static void USBH_HID_KeybdDiff(uint32_t timestamp)
+{
+  HID_KEYBD_EventTypeDef *event;
+  uint32_t state[HID_KEYBD_STATE_WORDS] = { 0U };
+  uint32_t changed;
+  uint8_t bit;
+  uint8_t w;
+  uint8_t n;
+
+  for (n = 0U; n < HID_MAX_INTERFACES; n++)
+  {
+    for (w = 0U; w < HID_KEYBD_STATE_WORDS; w++)
+    {
+      state[w] |= keybd_itf_state[n][w];
+    }
+  }
+
+  for (w = 0U; w < HID_KEYBD_STATE_WORDS; w++)
+  {
+    changed = state[w] ^ keybd_state[w];
+
+    /* One event per bit set, lowest usage first */
+    for (bit = 0U; changed != 0U; bit++)
+    {
+      if ((changed & 1U) == 0U)
+      {
+        changed >>= 1U;
+        continue;
+      }
+      changed >>= 1U;
+
+      if ((keybd_event_head - keybd_event_tail) >= USBH_HID_KEYBD_EVENT_QUEUE_SIZE)
+      {
+        keybd_event_dropped++;
+        continue;
+      }
+
+      event = &keybd_events[keybd_event_head & (USBH_HID_KEYBD_EVENT_QUEUE_SIZE - 1U)];
+      event->timestamp = timestamp;
+      event->usage = (uint8_t)((w * 32U) + bit);
+      event->pressed = (uint8_t)((state[w] >> bit) & 1U);
+      event->modifiers = (uint8_t)state[7];
+
+      /* Publish the event */
+      keybd_event_head++;
+    }
+  }
+
+  (void)USBH_memcpy(keybd_state, state, sizeof(state));
+}
+
+/**
+  * @brief  USBH_HID_KeybdBits
+  *         Read up to 32 bits of a report.
+  * @param  data: report, ID byte excluded
+  * @param  length: report length
+  * @param  offset: bit offset
+  * @param  size: number of bits
+  * @retval bits, unsigned
+  */
+static uint32_t USBH_HID_KeybdBits(const uint8_t *data, uint16_t length, uint16_t offset, uint8_t size)
+{
+  HID_ExtractTypeDef item = { offset, size, 1U, 0U, 4U, 0U };
+  uint32_t val = 0U;
+
+  HID_ExtractReport(&item, 1U, data, length, &val);
+
+  return val;
 }
 
 /**
@@ -513,6 +832,11 @@ uint8_t USBH_HID_GetASCIICode(HID_KEYBD_Info_TypeDef *info)
 {
   uint8_t output;
 
+  if (info->keys[0] >= sizeof(HID_KEYBRD_Codes))
+  {
+    return 0U;
+  }
+
   if ((info->lshift != 0U) || (info->rshift != 0U))
   {
     output = HID_KEYBRD_ShiftKey[HID_KEYBRD_Codes[info->keys[0]]];
@@ -524,3 +848,25 @@ uint8_t USBH_HID_GetASCIICode(HID_KEYBD_Info_TypeDef *info)
   return output;
 }
 
+/**
+  * @brief  USBH_HID_KeybdEventToASCII
+  *         The function decode a key press into an ASCII character, with
+  *         the shift state of the event.
+  * @param  event: key event
+  * @retval ASCII code, 0 for releases and keys without a character
+  */
+uint8_t USBH_HID_KeybdEventToASCII(const HID_KEYBD_EventTypeDef *event)
+{
+  if ((event->pressed == 0U) || (event->usage >= sizeof(HID_KEYBRD_Codes)))
+  {
+    return 0U;
+  }
+
+  if ((event->modifiers & (KBD_LEFT_SHIFT | KBD_RIGHT_SHIFT)) != 0U)
+  {
+    return HID_KEYBRD_ShiftKey[HID_KEYBRD_Codes[event->usage]];
+  }
+
+  return HID_KEYBRD_Key[HID_KEYBRD_Codes[event->usage]];
+}
+
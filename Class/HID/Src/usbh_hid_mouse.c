@@ -26,6 +26,7 @@ EndBSPDependencies */
 /* Includes ------------------------------------------------------------------*/
 #include "usbh_hid_mouse.h"
 #include "usbh_hid_parser.h"
+#include <stddef.h>
 
 
 /** @addtogroup USBH_LIB
@@ -72,6 +73,7 @@ EndBSPDependencies */
   * @{
   */
 static USBH_StatusTypeDef USBH_HID_MouseDecode(USBH_HandleTypeDef *phost);
+static int16_t USBH_HID_MouseValueIndex(const HID_ReportDescTypeDef *desc, uint16_t page, uint16_t usage);
 
 /**
   * @}
@@ -82,86 +84,27 @@ static USBH_StatusTypeDef USBH_HID_MouseDecode(USBH_HandleTypeDef *phost);
   * @{
   */
 HID_MOUSE_Info_TypeDef   mouse_info;
-uint8_t                  mouse_report_data[USBH_HID_MOUSE_REPORT_SIZE];
-uint8_t                  mouse_rx_report_buf[USBH_HID_MOUSE_REPORT_SIZE];
-
-/* Structures defining how to access items in a HID mouse report */
-/* Access button 1 state. */
-static const HID_Report_ItemTypedef prop_b1 =
-{
-  mouse_report_data, /*data*/
-  1,     /*size*/
-  0,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min value device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-
-/* Access button 2 state. */
-static const HID_Report_ItemTypedef prop_b2 =
+HID_ReportSlotTypeDef    mouse_report;
+
+/* Where x, y and the buttons land in mouse_values, found in the report
+   descriptor. mouse_report_ndx is 0xFF if no report carries the pointer */
+static int32_t           mouse_values[USBH_HID_MOUSE_MAX_VALUES];
+static uint8_t           mouse_boot;        /* no report descriptor: boot layout */
+static uint8_t           mouse_report_ndx;
+static int16_t           mouse_x;
+static int16_t           mouse_y;
+static int16_t           mouse_b[3];
+
+/* Boot report: 3 button bits, then signed x and y displacements. Only
+   used for interfaces whose report descriptor could not be compiled */
+static const HID_ExtractTypeDef mouse_boot_items[] =
 {
-  mouse_report_data, /*data*/
-  1,     /*size*/
-  1,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min value device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
+  /* offset, size, count, flags, width, dest */
+  { 0U, 1U, 3U, 0U, 1U, (uint16_t)offsetof(HID_MOUSE_Info_TypeDef, buttons) },
+  { 8U, 8U, 1U, HID_EXTRACT_SIGNED, 1U, (uint16_t)offsetof(HID_MOUSE_Info_TypeDef, x) },
+  { 16U, 8U, 1U, HID_EXTRACT_SIGNED, 1U, (uint16_t)offsetof(HID_MOUSE_Info_TypeDef, y) },
 };
 
-/* Access button 3 state. */
-static const HID_Report_ItemTypedef prop_b3 =
-{
-  mouse_report_data, /*data*/
-  1,     /*size*/
-  2,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-
-/* Access x coordinate change. */
-static const HID_Report_ItemTypedef prop_x =
-{
-  mouse_report_data + 1U, /*data*/
-  8,     /*size*/
-  0,     /*shift*/
-  0,     /*count (only for array items)*/
-  1,     /*signed?*/
-  0,     /*min value read can return*/
-  0xFFFF,/*max value read can return*/
-  0,     /*min vale device can report*/
-  0xFFFF,/*max value device can report*/
-  1      /*resolution*/
-};
-
-/* Access y coordinate change. */
-static const HID_Report_ItemTypedef prop_y =
-{
-  mouse_report_data + 2U, /*data*/
-  8,     /*size*/
-  0,     /*shift*/
-  0,     /*count (only for array items)*/
-  1,     /*signed?*/
-  0,     /*min value read can return*/
-  0xFFFF,/*max value read can return*/
-  0,     /*min vale device can report*/
-  0xFFFF,/*max value device can report*/
-  1      /*resolution*/
-};
-
-
 /**
   * @}
   */
@@ -179,8 +122,9 @@ static const HID_Report_ItemTypedef prop_y =
   */
 USBH_StatusTypeDef USBH_HID_MouseInit(USBH_HandleTypeDef *phost)
 {
-  uint32_t i;
-  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+  HID_HandleTypeDef *HID_Handle = USBH_HID_GetHandle(phost, HID_MOUSE);
+  const HID_ReportDescTypeDef *desc = &HID_Handle->ReportDesc;
+  const HID_FieldTypeDef *field;
 
   mouse_info.x = 0U;
   mouse_info.y = 0U;
@@ -188,30 +132,68 @@ USBH_StatusTypeDef USBH_HID_MouseInit(USBH_HandleTypeDef *phost)
   mouse_info.buttons[1] = 0U;
   mouse_info.buttons[2] = 0U;
 
-  for (i = 0U; i < sizeof(mouse_report_data); i++)
+  /* The interface is in Report protocol: the pointer is described by the
+     report carrying X, or else button 1. Without a compiled report
+     descriptor the boot layout is all there is to go by */
+  mouse_boot = (desc->nbr_reports == 0U) ? 1U : 0U;
+  mouse_report_ndx = 0xFFU;
+  field = HID_FindField(desc, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GEN_DES, HID_USAGE_X);
+  if (field == NULL)
   {
-    mouse_report_data[i] = 0U;
-    mouse_rx_report_buf[i] = 0U;
+    field = HID_FindField(desc, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_BUTTON, 1U);
   }
 
-  if (HID_Handle->length > sizeof(mouse_report_data))
+  if (field != NULL)
   {
-    HID_Handle->length = (uint16_t)sizeof(mouse_report_data);
+    mouse_report_ndx = field->report;
   }
-  HID_Handle->pData = mouse_rx_report_buf;
-
-  if ((HID_QUEUE_SIZE * sizeof(mouse_report_data)) > sizeof(phost->device.Data))
+  else if (mouse_boot == 0U)
   {
-    return USBH_FAIL;
+    USBH_UsrLog("HID: no pointer usages in the mouse report descriptor");
   }
   else
   {
-    USBH_HID_FifoInit(&HID_Handle->fifo, phost->device.Data, (uint16_t)(HID_QUEUE_SIZE * sizeof(mouse_report_data)));
+    /* .. */
   }
 
+  mouse_x    = USBH_HID_MouseValueIndex(desc, HID_USAGE_PAGE_GEN_DES, HID_USAGE_X);
+  mouse_y    = USBH_HID_MouseValueIndex(desc, HID_USAGE_PAGE_GEN_DES, HID_USAGE_Y);
+  mouse_b[0] = USBH_HID_MouseValueIndex(desc, HID_USAGE_PAGE_BUTTON, 1U);
+  mouse_b[1] = USBH_HID_MouseValueIndex(desc, HID_USAGE_PAGE_BUTTON, 2U);
+  mouse_b[2] = USBH_HID_MouseValueIndex(desc, HID_USAGE_PAGE_BUTTON, 3U);
+
+  /* Reports keep arriving whole in the interface buffer */
   return USBH_OK;
 }
 
+/**
+  * @brief  USBH_HID_MouseValueIndex
+  *         Position of a variable usage of the pointer report in the
+  *         decoded values.
+  * @param  desc: compiled report descriptor
+  * @param  page: usage page
+  * @param  usage: usage
+  * @retval value index, -1 if the pointer report doesn't carry the usage
+  */
+static int16_t USBH_HID_MouseValueIndex(const HID_ReportDescTypeDef *desc, uint16_t page, uint16_t usage)
+{
+  const HID_FieldTypeDef *field = HID_FindField(desc, HID_REPORT_TYPE_INPUT, page, usage);
+  uint32_t ndx;
+
+  if ((field == NULL) || (field->report != mouse_report_ndx) || ((field->flags & HID_FIELD_VARIABLE) == 0U))
+  {
+    return -1;
+  }
+
+  ndx = (uint32_t)field->index + (usage - field->usage_min);
+  if (((usage - field->usage_min) >= field->count) || (ndx >= USBH_HID_MOUSE_MAX_VALUES))
+  {
+    return -1;
+  }
+
+  return (int16_t)ndx;
+}
+
 /**
   * @brief  USBH_HID_GetMouseInfo
   *         The function return mouse information.
@@ -238,22 +220,40 @@ HID_MOUSE_Info_TypeDef *USBH_HID_GetMouseInfo(USBH_HandleTypeDef *phost)
   */
 static USBH_StatusTypeDef USBH_HID_MouseDecode(USBH_HandleTypeDef *phost)
 {
-  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+  HID_HandleTypeDef *HID_Handle = USBH_HID_GetHandle(phost, HID_MOUSE);
+  const HID_ReportInfoTypeDef *report;
+  uint8_t i;
 
-  if ((HID_Handle->length == 0U) || (HID_Handle->fifo.buf == NULL))
+  if ((HID_Handle == NULL) || (HID_Handle->length == 0U) ||
+      ((mouse_boot == 0U) && (mouse_report_ndx == 0xFFU)))
   {
     return USBH_FAIL;
   }
   /*Fill report */
-  if (USBH_HID_FifoRead(&HID_Handle->fifo, &mouse_report_data, HID_Handle->length) == HID_Handle->length)
+  if (USBH_HID_QueueGet(&HID_Handle->queue, &mouse_report) != 0U)
   {
-    /*Decode report */
-    mouse_info.x = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_x, 0U);
-    mouse_info.y = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_y, 0U);
-
-    mouse_info.buttons[0] = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_b1, 0U);
-    mouse_info.buttons[1] = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_b2, 0U);
-    mouse_info.buttons[2] = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_b3, 0U);
+    if (mouse_boot != 0U)
+    {
+      /*Decode boot report */
+      HID_ExtractReport(mouse_boot_items, (uint8_t)(sizeof(mouse_boot_items) / sizeof(mouse_boot_items[0])),
+                        mouse_report.data, mouse_report.length, &mouse_info);
+      return USBH_OK;
+    }
+
+    /*Decode report, in one pass over its fields */
+    report = HID_DecodeReport(&HID_Handle->ReportDesc, HID_REPORT_TYPE_INPUT, mouse_report.data,
+                              mouse_report.length, mouse_values, USBH_HID_MOUSE_MAX_VALUES);
+    if (report != &HID_Handle->ReportDesc.report[mouse_report_ndx])
+    {
+      return USBH_FAIL; /* not the pointer report */
+    }
+
+    mouse_info.x = (mouse_x < 0) ? 0U : (uint8_t)mouse_values[mouse_x];
+    mouse_info.y = (mouse_y < 0) ? 0U : (uint8_t)mouse_values[mouse_y];
+    for (i = 0U; i < 3U; i++)
+    {
+      mouse_info.buttons[i] = (mouse_b[i] < 0) ? 0U : (uint8_t)mouse_values[mouse_b[i]];
+    }
 
     return USBH_OK;
   }
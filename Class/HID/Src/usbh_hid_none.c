@@ -6,88 +6,34 @@ static USBH_StatusTypeDef USBH_HID_NoneDecode(USBH_HandleTypeDef *phost);
 
 
 HID_NONE_Info_TypeDef   none_info;
-uint8_t                 none_report_data[USBH_HID_NONE_REPORT_SIZE];
-uint8_t                 none_rx_report_buf[USBH_HID_NONE_REPORT_SIZE];
-
-/* Structures defining how to access items in a HID none report */
-/* Access button 1 state. */
-static const HID_Report_ItemTypedef prop_b1 =
-{
-  none_report_data, /*data*/
-  1,     /*size*/
-  0,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min value device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-
-/* Access button 2 state. */
-static const HID_Report_ItemTypedef prop_b2 =
-{
-  none_report_data, /*data*/
-  1,     /*size*/
-  1,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min value device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-
-/* Access button 3 state. */
-static const HID_Report_ItemTypedef prop_b3 =
-{
-  none_report_data, /*data*/
-  1,     /*size*/
-  2,     /*shift*/
-  0,     /*count (only for array items)*/
-  0,     /*signed?*/
-  0,     /*min value read can return*/
-  1,     /*max value read can return*/
-  0,     /*min vale device can report*/
-  1,     /*max value device can report*/
-  1      /*resolution*/
-};
-
-/* Access x coordinate change. */
-static const HID_Report_ItemTypedef prop_x =
-{
-  none_report_data + 1U, /*data*/
-  8,     /*size*/
-  0,     /*shift*/
-  0,     /*count (only for array items)*/
-  1,     /*signed?*/
-  0,     /*min value read can return*/
-  0xFFFF,/*max value read can return*/
-  0,     /*min vale device can report*/
-  0xFFFF,/*max value device can report*/
-  1      /*resolution*/
-};
-
-/* Access y coordinate change. */
-static const HID_Report_ItemTypedef prop_y =
-{
-  none_report_data + 2U, /*data*/
-  8,     /*size*/
-  0,     /*shift*/
-  0,     /*count (only for array items)*/
-  1,     /*signed?*/
-  0,     /*min value read can return*/
-  0xFFFF,/*max value read can return*/
-  0,     /*min vale device can report*/
-  0xFFFF,/*max value device can report*/
-  1      /*resolution*/
-};
+HID_ReportSlotTypeDef   none_slot;
+
+// where x, y & the buttons land in none_values, found in the report descriptor
+static int32_t          none_values[USBH_HID_NONE_MAX_VALUES];
+static uint8_t          none_report;
+static int16_t          none_x;
+static int16_t          none_y;
+static int16_t          none_b[3];
+
+// value index of a variable usage in none_report, -1 if absent
+static int16_t USBH_HID_NoneValueIndex(const HID_ReportDescTypeDef* desc, uint16_t page, uint16_t usage){
+  const HID_FieldTypeDef* field = HID_FindField(desc, HID_REPORT_TYPE_INPUT, page, usage);
+  uint32_t ndx;
+
+  if((field == NULL) || (field->report != none_report) || ((field->flags & HID_FIELD_VARIABLE) == 0U)){
+    return -1;
+  }
+  ndx = (uint32_t)field->index + (usage - field->usage_min);
+  if(((usage - field->usage_min) >= field->count) || (ndx >= USBH_HID_NONE_MAX_VALUES)){
+    return -1;
+  }
+  return (int16_t)ndx;
+}
 
 USBH_StatusTypeDef USBH_HID_NoneInit(USBH_HandleTypeDef* phost){
-  uint32_t i;
-  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *)phost->pActiveClass->pData;
+  HID_HandleTypeDef *HID_Handle = USBH_HID_GetHandle(phost, HID_UNKNOWN);
+  const HID_ReportDescTypeDef* desc;
+  const HID_FieldTypeDef* field;
 
   none_info.x = 0U;
   none_info.y = 0U;
@@ -95,22 +41,26 @@ USBH_StatusTypeDef USBH_HID_NoneInit(USBH_HandleTypeDef* phost){
   none_info.buttons[1] = 0U;
   none_info.buttons[2] = 0U;
 
-  for (i = 0U; i < sizeof(none_report_data); i++){
-    none_report_data[i] = 0U;
-    none_rx_report_buf[i] = 0U;
+  // the pointer is described by the report carrying X, or else button 1
+  desc = &HID_Handle->ReportDesc;
+  field = HID_FindField(desc, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GEN_DES, HID_USAGE_X);
+  if(field == NULL){
+    field = HID_FindField(desc, HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_BUTTON, 1U);
   }
-
-  if(HID_Handle->length > sizeof(none_report_data)){
-    HID_Handle->length = (uint16_t)sizeof(none_report_data);
-  }
-  HID_Handle->pData = none_rx_report_buf;
-
-  if ((HID_QUEUE_SIZE * sizeof(none_report_data)) > sizeof(phost->device.Data)){
-    return USBH_FAIL;
+  if(field == NULL){
+    USBH_UsrLog("HID: no pointer usages in the report descriptor");
+    none_report = 0xFFU;
   } else {
-    USBH_HID_FifoInit(&HID_Handle->fifo, phost->device.Data, (uint16_t)(HID_QUEUE_SIZE * sizeof(none_report_data)));
+    none_report = field->report;
   }
-
+  none_x    = USBH_HID_NoneValueIndex(desc, HID_USAGE_PAGE_GEN_DES, HID_USAGE_X);
+  none_y    = USBH_HID_NoneValueIndex(desc, HID_USAGE_PAGE_GEN_DES, HID_USAGE_Y);
+  none_b[0] = USBH_HID_NoneValueIndex(desc, HID_USAGE_PAGE_BUTTON, 1U);
+  none_b[1] = USBH_HID_NoneValueIndex(desc, HID_USAGE_PAGE_BUTTON, 2U);
+  none_b[2] = USBH_HID_NoneValueIndex(desc, HID_USAGE_PAGE_BUTTON, 3U);
+
+  // reports keep arriving whole in the interface buffer: the pointer is
+  // decoded from the queue, & interfaces without one are left to RawReceive
   return USBH_OK;
 }
 
@@ -123,24 +73,29 @@ HID_NONE_Info_TypeDef *USBH_HID_GetNoneInfo(USBH_HandleTypeDef *phost){
 }
 
 static USBH_StatusTypeDef USBH_HID_NoneDecode(USBH_HandleTypeDef *phost){
-  HID_HandleTypeDef *HID_Handle = (HID_HandleTypeDef *) phost->pActiveClass->pData;
+  HID_HandleTypeDef *HID_Handle = USBH_HID_GetHandle(phost, HID_UNKNOWN);
+  const HID_ReportInfoTypeDef* report;
+  uint8_t i;
 
-  if ((HID_Handle->length == 0U) || (HID_Handle->fifo.buf == NULL)){
+  if((HID_Handle == NULL) || (HID_Handle->length == 0U) || (none_report == 0xFFU)){
     return USBH_FAIL;
   }
 
   // Fill report
-  if(USBH_HID_FifoRead(&HID_Handle->fifo, &none_report_data, HID_Handle->length) == HID_Handle->length){
-    // Decode report
-    none_info.x = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_x, 0U);
-    none_info.y = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_y, 0U);
-
-    none_info.buttons[0] = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_b1, 0U);
-    none_info.buttons[1] = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_b2, 0U);
-    none_info.buttons[2] = (uint8_t)HID_ReadItem((HID_Report_ItemTypedef *) &prop_b3, 0U);
-
+  if(USBH_HID_QueueGet(&HID_Handle->queue, &none_slot) != 0U){
+    // Decode report, in one pass over its fields
+    report = HID_DecodeReport(&HID_Handle->ReportDesc, HID_REPORT_TYPE_INPUT, none_slot.data,
+                              none_slot.length, none_values, USBH_HID_NONE_MAX_VALUES);
+    if(report != &HID_Handle->ReportDesc.report[none_report]){
+      return USBH_FAIL; // not the pointer report
+    }
+
+    none_info.x = (none_x < 0) ? 0U : (uint8_t)none_values[none_x];
+    none_info.y = (none_y < 0) ? 0U : (uint8_t)none_values[none_y];
+    for(i = 0U; i < 3U; i++){
+      none_info.buttons[i] = (none_b[i] < 0) ? 0U : (uint8_t)none_values[none_b[i]];
+    }
     return USBH_OK;
   }
   return   USBH_FAIL;
 }
-
@@ -44,17 +44,60 @@ EndBSPDependencies */
   * @{
   */
 
-/** @defgroup USBH_HID_PARSER_Private_TypesDefinitions
+/** @defgroup USBH_HID_PARSER_Private_Defines
   * @{
   */
+#define HID_MAX_GLOBAL_STACK                        4U
+#define HID_MAX_COLLECTION_DEPTH                    8U
+
+#define HID_COLLECTION_APPLICATION                  0x01U
 /**
   * @}
   */
 
 
-/** @defgroup USBH_HID_PARSER_Private_Defines
+/** @defgroup USBH_HID_PARSER_Private_TypesDefinitions
   * @{
   */
+
+/* Global items, saved by PUSH */
+typedef struct
+{
+  uint16_t  usage_page;
+  uint8_t   report_id;
+  uint8_t   report_size;
+  uint16_t  report_count;
+  int32_t   logical_min;
+  int32_t   logical_max;
+  uint8_t   logical_max_len;    /* item data bytes, to reread logical_max unsigned */
+}
+HID_GlobalStateTypeDef;
+
+/* Local items, cleared by every Main item */
+typedef struct
+{
+  uint32_t  usage_min[HID_MAX_USAGE];   /* usage page << 16 | usage */
+  uint32_t  usage_max[HID_MAX_USAGE];
+  uint8_t   nbr_usage;
+  uint8_t   have_min;
+  uint32_t  pending_min;
+}
+HID_LocalStateTypeDef;
+
+typedef struct
+{
+  HID_ReportDescTypeDef   *desc;
+  HID_GlobalStateTypeDef  global;
+  HID_GlobalStateTypeDef  stack[HID_MAX_GLOBAL_STACK];
+  uint8_t                 stack_depth;
+  HID_LocalStateTypeDef   local;
+  uint8_t                 collection[HID_MAX_COLLECTION_DEPTH];
+  uint32_t                app_usage[HID_MAX_COLLECTION_DEPTH];
+  uint8_t                 depth;
+  uint8_t                 nbr_collections;
+}
+HID_ParserTypeDef;
+
 /**
   * @}
   */
@@ -70,6 +113,15 @@ EndBSPDependencies */
 /** @defgroup USBH_HID_PARSER_Private_FunctionPrototypes
   * @{
   */
+static uint32_t HID_ItemData(const uint8_t *buf, uint8_t len);
+static int32_t HID_ItemSigned(uint32_t data, uint8_t len);
+static uint32_t HID_LocalUsage(HID_LocalStateTypeDef *local, uint16_t ndx);
+static HID_ReportInfoTypeDef *HID_GetReportInfo(HID_ReportDescTypeDef *desc, uint8_t type, uint8_t id);
+static USBH_StatusTypeDef HID_ParseMain(HID_ParserTypeDef *parser, uint8_t type, uint32_t data);
+static USBH_StatusTypeDef HID_ParseGlobal(HID_ParserTypeDef *parser, uint8_t tag, uint32_t data, uint8_t len);
+static void HID_ParseLocal(HID_ParserTypeDef *parser, uint8_t tag, uint32_t data, uint8_t len);
+static void HID_CompileReports(HID_ReportDescTypeDef *desc);
+static uint32_t HID_ExtractBits(const uint8_t *data, uint32_t length, uint32_t offset, uint8_t size);
 
 /**
   * @}
@@ -98,11 +150,8 @@ EndBSPDependencies */
   */
 uint32_t HID_ReadItem(HID_Report_ItemTypedef *ri, uint8_t ndx)
 {
-  uint32_t val = 0U;
-  uint32_t x = 0U;
-  uint32_t bofs;
-  uint8_t *data = ri->data;
-  uint8_t shift = ri->shift;
+  uint32_t val;
+  uint32_t bofs = ri->shift;
 
   /* get the logical value of the item */
 
@@ -116,18 +165,11 @@ uint32_t HID_ReadItem(HID_Report_ItemTypedef *ri, uint8_t ndx)
     }
 
     /* calculate bit offset */
-    bofs = ndx * ri->size;
-    bofs += shift;
-    /* calculate byte offset + shift pair from bit offset. */
-    data += bofs / 8U;
-    shift = (uint8_t)(bofs % 8U);
+    bofs += ndx * ri->size;
   }
+
   /* read data bytes in little endian order */
-  for (x = 0U; x < (((ri->size & 0x7U) != 0U) ? ((ri->size / 8U) + 1U) : (ri->size / 8U)); x++)
-  {
-    val = (uint32_t)((uint32_t)(*data) << (x * 8U));
-  }
-  val = (val >> shift) & (((uint32_t)1U << ri->size) - 1U);
+  val = HID_ExtractBits(ri->data, (bofs + ri->size + 7U) / 8U, bofs, (uint8_t)ri->size);
 
   if ((val < ri->logical_min) || (val > ri->logical_max))
   {
@@ -139,7 +181,7 @@ uint32_t HID_ReadItem(HID_Report_ItemTypedef *ri, uint8_t ndx)
   if ((ri->sign != 0U) && ((val & ((uint32_t)1U << (ri->size - 1U))) != 0U))
   {
     /* yes, so sign extend value to 32 bits. */
-    uint32_t vs = (uint32_t)((0xffffffffU & ~((1U << (ri->size)) - 1U)) | val);
+    uint32_t vs = (ri->size < 32U) ? ((0xffffffffU & ~((1U << (ri->size)) - 1U)) | val) : val;
 
     if (ri->resolution == 1U)
     {
@@ -167,7 +209,8 @@ uint32_t HID_ReadItem(HID_Report_ItemTypedef *ri, uint8_t ndx)
 uint32_t HID_WriteItem(HID_Report_ItemTypedef *ri, uint32_t value, uint8_t ndx)
 {
   uint32_t x;
-  uint32_t mask;
+  uint64_t mask;
+  uint64_t val;
   uint32_t bofs;
   uint8_t *data = ri->data;
   uint8_t shift = ri->shift;
@@ -180,10 +223,10 @@ uint32_t HID_WriteItem(HID_Report_ItemTypedef *ri, uint32_t value, uint8_t ndx)
   /* if this is an array, we may need to offset ri->data.*/
   if (ri->count > 0U)
   {
-    /* If app tries to read outside of the array. */
-    if (ri->count >= ndx)
+    /* If app tries to write outside of the array. */
+    if (ri->count <= ndx)
     {
-      return (0U);
+      return (1U);
     }
     /* calculate bit offset */
     bofs = ndx * ri->size;
@@ -201,18 +244,717 @@ uint32_t HID_WriteItem(HID_Report_ItemTypedef *ri, uint32_t value, uint8_t ndx)
   }
 
   /* Write logical value to report in little endian order. */
-  mask = ((uint32_t)1U << ri->size) - 1U;
-  value = (value & mask) << shift;
+  mask = ((((uint64_t)1U) << ri->size) - 1U) << shift;
+  val = ((uint64_t)value << shift) & mask;
 
-  for (x = 0U; x < (((ri->size & 0x7U) != 0U) ? ((ri->size / 8U) + 1U) : (ri->size / 8U)); x++)
+  for (x = 0U; x < ((shift + ri->size + 7U) / 8U); x++)
   {
-    *(ri->data + x) = (uint8_t)((*(ri->data + x) & ~(mask >> (x * 8U))) |
-                                ((value >> (x * 8U)) & (mask >> (x * 8U))));
+    data[x] = (uint8_t)((data[x] & ~(uint8_t)(mask >> (x * 8U))) | (uint8_t)(val >> (x * 8U)));
   }
 
   return 0U;
 }
 
+/**
+  * @brief  HID_ParseReportDesc
+  *         The function compiles a report descriptor into per-report field
+  *         tables, in a single pass over its items.
+  * @param  desc: compiled descriptor
+  * @param  buf: report descriptor
+  * @param  length: report descriptor length
+  * @retval USBH Status (USBH_FAIL: malformed or too large, desc is left empty)
+  */
+USBH_StatusTypeDef HID_ParseReportDesc(HID_ReportDescTypeDef *desc, const uint8_t *buf, uint16_t length)
+{
+  HID_ParserTypeDef parser;
+  USBH_StatusTypeDef status = USBH_OK;
+  uint16_t ptr = 0U;
+  uint32_t data;
+  uint8_t prefix;
+  uint8_t len;
+
+  (void)USBH_memset(desc, 0, sizeof(HID_ReportDescTypeDef));
+  (void)USBH_memset(&parser, 0, sizeof(HID_ParserTypeDef));
+  parser.desc = desc;
+
+  while ((ptr < length) && (status == USBH_OK))
+  {
+    prefix = buf[ptr];
+
+    if (prefix == HID_ITEM_LONG)
+    {
+      /* Long items carry no report information: skip them */
+      if ((ptr + 2U) >= length)
+      {
+        status = USBH_FAIL;
+        break;
+      }
+      ptr += (uint16_t)(3U + buf[ptr + 1U]);
+      continue;
+    }
+
+    len = prefix & 0x03U;
+    if (len == 3U)
+    {
+      len = 4U;
+    }
+
+    if ((ptr + 1U + len) > length)
+    {
+      status = USBH_FAIL;
+      break;
+    }
+
+    data = HID_ItemData(&buf[ptr + 1U], len);
+
+    switch ((prefix >> 2) & 0x03U)
+    {
+      case HID_ITEM_TYPE_MAIN:
+        switch (prefix >> 4)
+        {
+          case HID_MAIN_ITEM_TAG_INPUT:
+            status = HID_ParseMain(&parser, HID_REPORT_TYPE_INPUT, data);
+            break;
+
+          case HID_MAIN_ITEM_TAG_OUTPUT:
+            status = HID_ParseMain(&parser, HID_REPORT_TYPE_OUTPUT, data);
+            break;
+
+          case HID_MAIN_ITEM_TAG_FEATURE:
+            status = HID_ParseMain(&parser, HID_REPORT_TYPE_FEATURE, data);
+            break;
+
+          case HID_MAIN_ITEM_TAG_COLLECTION:
+            if (parser.depth >= HID_MAX_COLLECTION_DEPTH)
+            {
+              status = USBH_FAIL;
+              break;
+            }
+            parser.nbr_collections++;
+            parser.collection[parser.depth] = parser.nbr_collections;
+            parser.app_usage[parser.depth] = (parser.depth != 0U) ? parser.app_usage[parser.depth - 1U] : 0U;
+
+            if ((data & 0xFFU) == HID_COLLECTION_APPLICATION)
+            {
+              parser.app_usage[parser.depth] = HID_LocalUsage(&parser.local, 0U);
+
+              if (desc->app_usage == 0U)
+              {
+                desc->app_usage = parser.app_usage[parser.depth];
+              }
+            }
+            parser.depth++;
+            break;
+
+          case HID_MAIN_ITEM_TAG_ENDCOLLECTION:
+            if (parser.depth == 0U)
+            {
+              status = USBH_FAIL;
+              break;
+            }
+            parser.depth--;
+            break;
+
+          default:
+            break;
+        }
+        (void)USBH_memset(&parser.local, 0, sizeof(HID_LocalStateTypeDef));
+        break;
+
+      case HID_ITEM_TYPE_GLOBAL:
+        status = HID_ParseGlobal(&parser, prefix >> 4, data, len);
+        break;
+
+      case HID_ITEM_TYPE_LOCAL:
+        HID_ParseLocal(&parser, prefix >> 4, data, len);
+        break;
+
+      default:
+        break;
+    }
+
+    ptr += (uint16_t)(1U + len);
+  }
+
+  if (status != USBH_OK)
+  {
+    (void)USBH_memset(desc, 0, sizeof(HID_ReportDescTypeDef));
+    return USBH_FAIL;
+  }
+
+  HID_CompileReports(desc);
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  HID_DecodeReport
+  *         The function decodes every field of a report in one pass over
+  *         its compiled table. Element n of a field is stored at
+  *         values[field->index + n]; signed fields are sign extended and
+  *         out of range values are returned as read.
+  * @param  desc: compiled descriptor
+  * @param  type: HID_REPORT_TYPE_INPUT/OUTPUT/FEATURE
+  * @param  buf: report, with its ID byte if the device uses report IDs
+  * @param  length: report length
+  * @param  values: decoded values
+  * @param  nbr_values: size of values, elements beyond are not decoded
+  * @retval report decoded, NULL if unknown or too short
+  */
+const HID_ReportInfoTypeDef *HID_DecodeReport(const HID_ReportDescTypeDef *desc, uint8_t type,
+                                              const uint8_t *buf, uint16_t length,
+                                              int32_t *values, uint16_t nbr_values)
+{
+  const HID_ReportInfoTypeDef *report;
+  const HID_FieldTypeDef *field;
+  uint8_t id = 0U;
+  uint8_t f;
+  uint16_t n;
+  uint16_t ndx;
+  uint32_t bit;
+  uint32_t val;
+
+  if (desc->report_ids != 0U)
+  {
+    if (length == 0U)
+    {
+      return NULL;
+    }
+    id = buf[0];
+    buf++;
+    length--;
+  }
+
+  report = HID_GetReportInfo((HID_ReportDescTypeDef *)desc, type, id);
+
+  if ((report == NULL) || ((uint32_t)report->size > ((uint32_t)length * 8U)))
+  {
+    return NULL;
+  }
+
+  for (f = 0U; f < report->nbr_fields; f++)
+  {
+    field = &desc->field[report->first_field + f];
+    bit = field->offset;
+    ndx = field->index;
+
+    for (n = 0U; (n < field->count) && (ndx < nbr_values); n++)
+    {
+      val = HID_ExtractBits(buf, length, bit, field->size);
+
+      if (((field->flags & HID_FIELD_SIGNED) != 0U) && (field->size < 32U) &&
+          ((val & ((uint32_t)1U << (field->size - 1U))) != 0U))
+      {
+        val |= ~(((uint32_t)1U << field->size) - 1U);
+      }
+      values[ndx] = (int32_t)val;
+
+      bit += field->size;
+      ndx++;
+    }
+  }
+
+  return report;
+}
+
+/**
+  * @brief  HID_ExtractReport
+  *         The function decodes a fixed report layout straight into the
+  *         members of an output structure, in one pass over the items.
+  *         Elements past the end of the report read as 0.
+  * @param  items: fields to extract
+  * @param  nbr_items: number of items
+  * @param  buf: report
+  * @param  length: report length
+  * @param  out: output structure
+  * @retval None
+  */
+void HID_ExtractReport(const HID_ExtractTypeDef *items, uint8_t nbr_items,
+                       const uint8_t *buf, uint16_t length, void *out)
+{
+  const HID_ExtractTypeDef *item;
+  uint8_t *dest;
+  uint32_t bit;
+  uint32_t val;
+  uint8_t n;
+
+  for (item = items; item < &items[nbr_items]; item++)
+  {
+    bit = item->offset;
+    dest = (uint8_t *)out + item->dest;
+
+    for (n = 0U; n < item->count; n++)
+    {
+      val = HID_ExtractBits(buf, length, bit, item->size);
+
+      if (((item->flags & HID_EXTRACT_SIGNED) != 0U) && (item->size < 32U) &&
+          ((val & ((uint32_t)1U << (item->size - 1U))) != 0U))
+      {
+        val |= ~(((uint32_t)1U << item->size) - 1U);
+      }
+
+      /* the low bytes on a little endian core */
+      (void)USBH_memcpy(dest, &val, item->width);
+
+      bit += item->size;
+      dest += item->width;
+    }
+  }
+}
+
+/**
+  * @brief  HID_FindField
+  *         The function looks up the field carrying a usage. For variable
+  *         fields the usage's value is values[field->index + usage -
+  *         field->usage_min]; for arrays the usage is one of the indexes
+  *         the elements may hold.
+  * @param  desc: compiled descriptor
+  * @param  type: HID_REPORT_TYPE_INPUT/OUTPUT/FEATURE
+  * @param  usage_page: usage page
+  * @param  usage: usage
+  * @retval field, NULL if not found
+  */
+const HID_FieldTypeDef *HID_FindField(const HID_ReportDescTypeDef *desc, uint8_t type,
+                                      uint16_t usage_page, uint16_t usage)
+{
+  const HID_FieldTypeDef *field;
+  uint8_t f;
+
+  for (f = 0U; f < desc->nbr_fields; f++)
+  {
+    field = &desc->field[f];
+
+    if ((desc->report[field->report].type == type) && (field->usage_page == usage_page) &&
+        (usage >= field->usage_min) && (usage <= field->usage_max))
+    {
+      return field;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  * @brief  HID_ItemData
+  *         The function reads the little endian data of a short item.
+  * @param  buf: item data
+  * @param  len: data bytes (0, 1, 2 or 4)
+  * @retval data
+  */
+static uint32_t HID_ItemData(const uint8_t *buf, uint8_t len)
+{
+  uint32_t data = 0U;
+  uint8_t x;
+
+  for (x = 0U; x < len; x++)
+  {
+    data |= (uint32_t)buf[x] << (x * 8U);
+  }
+
+  return data;
+}
+
+/**
+  * @brief  HID_ItemSigned
+  *         The function sign extends the data of a short item.
+  * @param  data: item data
+  * @param  len: data bytes (0, 1, 2 or 4)
+  * @retval signed data
+  */
+static int32_t HID_ItemSigned(uint32_t data, uint8_t len)
+{
+  if ((len == 1U) && ((data & 0x80U) != 0U))
+  {
+    data |= 0xFFFFFF00U;
+  }
+  else if ((len == 2U) && ((data & 0x8000U) != 0U))
+  {
+    data |= 0xFFFF0000U;
+  }
+  else
+  {
+    /* .. */
+  }
+
+  return (int32_t)data;
+}
+
+/**
+  * @brief  HID_LocalUsage
+  *         The function returns the usage of a Main item element: the
+  *         usages and usage ranges are taken in order, the last one
+  *         repeating for the remaining elements.
+  * @param  local: local item state
+  * @param  ndx: element index
+  * @retval usage page << 16 | usage, 0 if none
+  */
+static uint32_t HID_LocalUsage(HID_LocalStateTypeDef *local, uint16_t ndx)
+{
+  uint32_t span;
+  uint8_t u;
+
+  if (local->nbr_usage == 0U)
+  {
+    return 0U;
+  }
+
+  for (u = 0U; u < local->nbr_usage; u++)
+  {
+    span = local->usage_max[u] - local->usage_min[u] + 1U;
+
+    if (ndx < span)
+    {
+      return local->usage_min[u] + ndx;
+    }
+    ndx -= (uint16_t)span;
+  }
+
+  return local->usage_max[local->nbr_usage - 1U];
+}
+
+/**
+  * @brief  HID_GetReportInfo
+  *         The function looks up a report by type and ID.
+  * @param  desc: compiled descriptor
+  * @param  type: HID_REPORT_TYPE_INPUT/OUTPUT/FEATURE
+  * @param  id: report ID
+  * @retval report, NULL if not found
+  */
+static HID_ReportInfoTypeDef *HID_GetReportInfo(HID_ReportDescTypeDef *desc, uint8_t type, uint8_t id)
+{
+  uint8_t r;
+
+  for (r = 0U; r < desc->nbr_reports; r++)
+  {
+    if ((desc->report[r].type == type) && (desc->report[r].id == id))
+    {
+      return &desc->report[r];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  * @brief  HID_ParseMain
+  *         The function adds the fields of an Input, Output or Feature item
+  *         to its report.
+  * @param  parser: parser state
+  * @param  type: HID_REPORT_TYPE_INPUT/OUTPUT/FEATURE
+  * @param  data: Main item data
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef HID_ParseMain(HID_ParserTypeDef *parser, uint8_t type, uint32_t data)
+{
+  HID_ReportDescTypeDef *desc = parser->desc;
+  HID_GlobalStateTypeDef *global = &parser->global;
+  HID_ReportInfoTypeDef *report;
+  HID_FieldTypeDef *field = NULL;
+  uint32_t usage;
+  uint32_t bits;
+  int32_t logical_max;
+  uint16_t n;
+
+  report = HID_GetReportInfo(desc, type, global->report_id);
+
+  if (report == NULL)
+  {
+    if (desc->nbr_reports >= HID_MAX_REPORTS)
+    {
+      return USBH_FAIL;
+    }
+    report = &desc->report[desc->nbr_reports];
+    report->id = global->report_id;
+    report->type = type;
+    desc->nbr_reports++;
+  }
+
+  bits = (uint32_t)global->report_size * global->report_count;
+
+  if (((uint32_t)report->size + bits) > 0xFFFFU)
+  {
+    return USBH_FAIL;
+  }
+
+  /* Padding, and elements wider than a value, only take up room */
+  if (((data & HID_FIELD_CONSTANT) == 0U) && (global->report_size != 0U) &&
+      (global->report_size <= 32U) && (global->report_count != 0U))
+  {
+    /* A logical maximum that reads negative over a positive minimum was
+       meant unsigned */
+    logical_max = global->logical_max;
+    if ((global->logical_min >= 0) && (logical_max < global->logical_min) &&
+        (global->logical_max_len < 4U))
+    {
+      logical_max = (int32_t)(((uint32_t)logical_max) &
+                              ((global->logical_max_len == 1U) ? 0xFFU : 0xFFFFU));
+    }
+
+    for (n = 0U; n < global->report_count; n++)
+    {
+      usage = HID_LocalUsage(&parser->local, n);
+
+      /* Variable elements share a field while their usages follow on, or
+         the last usage repeats; an array is a single field */
+      if ((field != NULL) &&
+          (((data & HID_FIELD_VARIABLE) == 0U) ||
+           ((field->usage_page == (uint16_t)(usage >> 16)) &&
+            (((usage & 0xFFFFU) == field->usage_max) ||
+             (((usage & 0xFFFFU) == ((uint32_t)field->usage_max + 1U)) &&
+              (field->count == (uint16_t)(field->usage_max - field->usage_min + 1U)))))))
+      {
+        field->count++;
+        if ((data & HID_FIELD_VARIABLE) != 0U)
+        {
+          field->usage_max = (uint16_t)usage;
+        }
+        continue;
+      }
+
+      if (desc->nbr_fields >= HID_MAX_FIELDS)
+      {
+        return USBH_FAIL;
+      }
+
+      field = &desc->field[desc->nbr_fields];
+      desc->nbr_fields++;
+
+      field->offset = (uint16_t)(report->size + ((uint32_t)n * global->report_size));
+      field->count = 1U;
+      field->flags = (uint16_t)(data & 0x01FFU);
+      field->size = global->report_size;
+      field->report = (uint8_t)(report - desc->report);
+      field->collection = (parser->depth != 0U) ? parser->collection[parser->depth - 1U] : 0U;
+      field->logical_min = global->logical_min;
+      field->logical_max = logical_max;
+      field->app_usage = (parser->depth != 0U) ? parser->app_usage[parser->depth - 1U] : 0U;
+      field->usage_page = (uint16_t)(usage >> 16);
+      field->usage_min = (uint16_t)usage;
+      field->usage_max = (uint16_t)usage;
+
+      if (global->logical_min < 0)
+      {
+        field->flags |= HID_FIELD_SIGNED;
+      }
+
+      if (((data & HID_FIELD_VARIABLE) == 0U) && (parser->local.nbr_usage != 0U))
+      {
+        field->usage_max = (uint16_t)parser->local.usage_max[parser->local.nbr_usage - 1U];
+      }
+    }
+  }
+
+  report->size += (uint16_t)bits;
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  HID_ParseGlobal
+  *         The function updates the global item state.
+  * @param  parser: parser state
+  * @param  tag: item tag
+  * @param  data: item data
+  * @param  len: item data bytes
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef HID_ParseGlobal(HID_ParserTypeDef *parser, uint8_t tag, uint32_t data, uint8_t len)
+{
+  HID_GlobalStateTypeDef *global = &parser->global;
+
+  switch (tag)
+  {
+    case HID_GLOBAL_ITEM_TAG_USAGE_PAGE:
+      global->usage_page = (uint16_t)data;
+      break;
+
+    case HID_GLOBAL_ITEM_TAG_LOG_MIN:
+      global->logical_min = HID_ItemSigned(data, len);
+      break;
+
+    case HID_GLOBAL_ITEM_TAG_LOG_MAX:
+      global->logical_max = HID_ItemSigned(data, len);
+      global->logical_max_len = len;
+      break;
+
+    case HID_GLOBAL_ITEM_TAG_REPORT_SIZE:
+      global->report_size = (data > 0xFFU) ? 0xFFU : (uint8_t)data;
+      break;
+
+    case HID_GLOBAL_ITEM_TAG_REPORT_ID:
+      if ((data == 0U) || (data > 0xFFU))
+      {
+        return USBH_FAIL;
+      }
+      global->report_id = (uint8_t)data;
+      parser->desc->report_ids = 1U;
+      break;
+
+    case HID_GLOBAL_ITEM_TAG_REPORT_COUNT:
+      global->report_count = (data > 0xFFFFU) ? 0xFFFFU : (uint16_t)data;
+      break;
+
+    case HID_GLOBAL_ITEM_TAG_PUSH:
+      if (parser->stack_depth >= HID_MAX_GLOBAL_STACK)
+      {
+        return USBH_FAIL;
+      }
+      parser->stack[parser->stack_depth] = *global;
+      parser->stack_depth++;
+      break;
+
+    case HID_GLOBAL_ITEM_TAG_POP:
+      if (parser->stack_depth == 0U)
+      {
+        return USBH_FAIL;
+      }
+      parser->stack_depth--;
+      *global = parser->stack[parser->stack_depth];
+      break;
+
+    default:
+      /* Physical range and units are not compiled */
+      break;
+  }
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  HID_ParseLocal
+  *         The function updates the local item state.
+  * @param  parser: parser state
+  * @param  tag: item tag
+  * @param  data: item data
+  * @param  len: item data bytes
+  * @retval None
+  */
+static void HID_ParseLocal(HID_ParserTypeDef *parser, uint8_t tag, uint32_t data, uint8_t len)
+{
+  HID_LocalStateTypeDef *local = &parser->local;
+
+  /* A 4 byte usage carries its own page */
+  if (len < 4U)
+  {
+    data = ((uint32_t)parser->global.usage_page << 16) | (data & 0xFFFFU);
+  }
+
+  switch (tag)
+  {
+    case HID_LOCAL_ITEM_TAG_USAGE:
+      if (local->nbr_usage < HID_MAX_USAGE)
+      {
+        local->usage_min[local->nbr_usage] = data;
+        local->usage_max[local->nbr_usage] = data;
+        local->nbr_usage++;
+      }
+      break;
+
+    case HID_LOCAL_ITEM_TAG_USAGE_MIN:
+      local->pending_min = data;
+      local->have_min = 1U;
+      break;
+
+    case HID_LOCAL_ITEM_TAG_USAGE_MAX:
+      if ((local->have_min != 0U) && (local->nbr_usage < HID_MAX_USAGE) &&
+          (data >= local->pending_min) && ((data >> 16) == (local->pending_min >> 16)))
+      {
+        local->usage_min[local->nbr_usage] = local->pending_min;
+        local->usage_max[local->nbr_usage] = data;
+        local->nbr_usage++;
+      }
+      local->have_min = 0U;
+      break;
+
+    default:
+      /* Designators, strings and delimiters are not compiled */
+      break;
+  }
+}
+
+/**
+  * @brief  HID_CompileReports
+  *         The function groups the fields by report, keeping descriptor
+  *         order within a report, and numbers their decoded values.
+  * @param  desc: compiled descriptor
+  * @retval None
+  */
+static void HID_CompileReports(HID_ReportDescTypeDef *desc)
+{
+  HID_FieldTypeDef field;
+  uint8_t f;
+  uint8_t g;
+  uint8_t r;
+
+  /* Stable insertion sort on the report index */
+  for (f = 1U; f < desc->nbr_fields; f++)
+  {
+    field = desc->field[f];
+
+    for (g = f; (g > 0U) && (desc->field[g - 1U].report > field.report); g--)
+    {
+      desc->field[g] = desc->field[g - 1U];
+    }
+    desc->field[g] = field;
+  }
+
+  for (r = 0U; r < desc->nbr_reports; r++)
+  {
+    desc->report[r].first_field = 0U;
+    desc->report[r].nbr_fields = 0U;
+    desc->report[r].nbr_values = 0U;
+  }
+
+  for (f = 0U; f < desc->nbr_fields; f++)
+  {
+    HID_ReportInfoTypeDef *report = &desc->report[desc->field[f].report];
+
+    if (report->nbr_fields == 0U)
+    {
+      report->first_field = f;
+    }
+    report->nbr_fields++;
+
+    desc->field[f].index = report->nbr_values;
+    report->nbr_values += desc->field[f].count;
+  }
+}
+
+/**
+  * @brief  HID_ExtractBits
+  *         The function reads a little endian bit field with a single 64 bit
+  *         load where the report is long enough, byte by byte at its end.
+  *         The load relies on a little endian core, as all STM32 are.
+  * @param  data: report
+  * @param  length: report length
+  * @param  offset: bit offset
+  * @param  size: bits, 1 to 32
+  * @retval value, 0 past the end of the report
+  */
+static uint32_t HID_ExtractBits(const uint8_t *data, uint32_t length, uint32_t offset, uint8_t size)
+{
+  uint64_t val = 0U;
+  uint32_t byte = offset / 8U;
+  uint32_t x;
+
+  if ((byte + 8U) <= length)
+  {
+    /* memcpy compiles to an unaligned load where the core has one */
+    (void)USBH_memcpy(&val, &data[byte], 8U);
+  }
+  else
+  {
+    for (x = byte; x < length; x++)
+    {
+      val |= (uint64_t)data[x] << ((x - byte) * 8U);
+    }
+  }
+
+  val >>= (offset & 0x7U);
+
+  return (uint32_t)(val & ((((uint64_t)1U) << size) - 1U));
+}
+
 /**
   * @}
   */
@@ -0,0 +1,818 @@
+/**
+  ******************************************************************************
+  * @file    usbh_hid_touch.c
+  * @brief   This file is the application layer for USB Host HID multi-touch
+  *          panels, decoded from the report descriptor
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_hid_touch.h"
+#include "usbh_hid_usage.h"
+
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_HID_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_HID_TOUCH
+  * @brief    This file includes HID Layer Handlers for USB Host HID class.
+  * @{
+  */
+
+/** @defgroup USBH_HID_TOUCH_Private_Defines
+  * @{
+  */
+#define TOUCH_APP_SCREEN        (((uint32_t)HID_USAGE_PAGE_DIGITIZER << 16) | HID_USAGE_TOUCHSCREEN)
+#define TOUCH_APP_PAD           (((uint32_t)HID_USAGE_PAGE_DIGITIZER << 16) | HID_USAGE_TOUCHPAD)
+
+/* values[] past the fingers */
+#define TOUCH_V_COUNT           (HID_TOUCH_REPORT_FINGERS * HID_TOUCH_V_NBR)
+#define TOUCH_V_SCAN_TIME       (TOUCH_V_COUNT + 1U)
+#define TOUCH_NBR_VALUES        (TOUCH_V_COUNT + 2U)
+#define TOUCH_V_NONE            0xFFU
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HID_TOUCH_Private_Macros
+  * @{
+  */
+#if (HID_TOUCH_STATS == 1U)
+#define TOUCH_STAT(x)           do { x; } while (0)
+#else
+#define TOUCH_STAT(x)
+#endif /* (HID_TOUCH_STATS == 1U) */
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HID_TOUCH_Private_FunctionPrototypes
+  * @{
+  */
+static uint8_t USBH_HID_TouchIsPanel(uint32_t app_usage);
+static uint8_t USBH_HID_TouchValue(uint16_t page, uint32_t usage);
+static uint16_t USBH_HID_TouchRange(int32_t min, int32_t max);
+static uint8_t USBH_HID_TouchComplete(const HID_TOUCH_LayoutTypeDef *layout, uint8_t n);
+static uint8_t USBH_HID_TouchBind(HID_TOUCH_HandleTypeDef *panel, HID_TOUCH_LayoutTypeDef *layout,
+                                  const HID_ReportDescTypeDef *desc, uint8_t r);
+#if (HID_TOUCH_STATS == 1U)
+static void USBH_HID_TouchTime(HID_TOUCH_TimeTypeDef *t, uint32_t v);
+#endif /* (HID_TOUCH_STATS == 1U) */
+static uint16_t USBH_HID_TouchClamp(int32_t v, int32_t min, uint16_t range);
+static void USBH_HID_TouchFrame(USBH_HandleTypeDef *phost, HID_TOUCH_HandleTypeDef *panel);
+static void USBH_HID_TouchNotify(USBH_HandleTypeDef *phost, HID_TOUCH_HandleTypeDef *panel);
+static void USBH_HID_TouchDecode(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                 const uint8_t *report, uint16_t length);
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HID_TOUCH_Private_Variables
+  * @{
+  */
+static HID_TOUCH_HandleTypeDef touch_panels[HID_TOUCH_MAX_PANELS];
+static uint8_t                 touch_nbr_panels;
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HID_TOUCH_Private_Functions
+  * @{
+  */
+
+/**
+  * @brief  USBH_HID_TouchIsPanel
+  *         Whether an application collection is a Touch Screen or Touch Pad.
+  * @param  app_usage: usage page << 16 | usage of the application collection
+  * @retval 1 for a panel, 0 otherwise
+  */
+static uint8_t USBH_HID_TouchIsPanel(uint32_t app_usage)
+{
+  return ((app_usage == TOUCH_APP_SCREEN) || (app_usage == TOUCH_APP_PAD)) ? 1U : 0U;
+}
+
+/**
+  * @brief  USBH_HID_TouchValue
+  *         Where a usage lands in values[], per finger for HID_TOUCH_V_xxx.
+  * @param  page: usage page
+  * @param  usage: usage
+  * @retval value index, TOUCH_V_NONE if the usage isn't decoded
+  */
+static uint8_t USBH_HID_TouchValue(uint16_t page, uint32_t usage)
+{
+  uint8_t value = TOUCH_V_NONE;
+
+  if (page == HID_USAGE_PAGE_GEN_DES)
+  {
+    if (usage == HID_USAGE_X)
+    {
+      value = HID_TOUCH_V_X;
+    }
+    else if (usage == HID_USAGE_Y)
+    {
+      value = HID_TOUCH_V_Y;
+    }
+    else
+    {
+      /* .. */
+    }
+  }
+  else if (page == HID_USAGE_PAGE_DIGITIZER)
+  {
+    switch (usage)
+    {
+      case HID_USAGE_TIPSWITCH:
+        value = HID_TOUCH_V_TIP;
+        break;
+
+      case HID_USAGE_INRANGE:
+        value = HID_TOUCH_V_INRANGE;
+        break;
+
+      case HID_USAGE_CONFIDENCE:
+        value = HID_TOUCH_V_CONFIDENCE;
+        break;
+
+      case HID_USAGE_CONTACTID:
+        value = HID_TOUCH_V_ID;
+        break;
+
+      case HID_USAGE_WIDTH:
+        value = HID_TOUCH_V_WIDTH;
+        break;
+
+      case HID_USAGE_HEIGHT:
+        value = HID_TOUCH_V_HEIGHT;
+        break;
+
+      case HID_USAGE_CONTACTCOUNT:
+        value = TOUCH_V_COUNT;
+        break;
+
+      case HID_USAGE_SCANTIME:
+        value = TOUCH_V_SCAN_TIME;
+        break;
+
+      default:
+        break;
+    }
+  }
+  else
+  {
+    /* .. */
+  }
+
+  return value;
+}
+
+/**
+  * @brief  USBH_HID_TouchRange
+  *         Span of a logical range.
+  * @param  min: logical minimum
+  * @param  max: logical maximum
+  * @retval max - min, saturated to 16 bits, 0 for an empty range
+  */
+static uint16_t USBH_HID_TouchRange(int32_t min, int32_t max)
+{
+  uint32_t range = (uint32_t)max - (uint32_t)min;
+
+  if (max <= min)
+  {
+    return 0U;
+  }
+
+  return (range > 0xFFFFU) ? 0xFFFFU : (uint16_t)range;
+}
+
+/**
+  * @brief  USBH_HID_TouchComplete
+  *         Whether finger n of the layout has a position and a tip switch
+  *         (or in range).
+  * @param  layout: touch report layout
+  * @param  n: finger
+  * @retval 1 if complete, 0 otherwise
+  */
+static uint8_t USBH_HID_TouchComplete(const HID_TOUCH_LayoutTypeDef *layout, uint8_t n)
+{
+  uint8_t present = layout->present[n];
+
+  return (((present & (1U << HID_TOUCH_V_X)) != 0U) &&
+          ((present & (1U << HID_TOUCH_V_Y)) != 0U) &&
+          ((present & ((1U << HID_TOUCH_V_TIP) | (1U << HID_TOUCH_V_INRANGE))) != 0U)) ? 1U : 0U;
+}
+
+/**
+  * @brief  USBH_HID_TouchBind
+  *         Lay out an input report. Fingers are kept up to the first without
+  *         a position and a tip switch (or in range).
+  * @param  panel: panel being bound
+  * @param  layout: layout to fill
+  * @param  desc: compiled report descriptor
+  * @param  r: index of the report in desc
+  * @retval 1 if a finger is left, 0 otherwise
+  */
+static uint8_t USBH_HID_TouchBind(HID_TOUCH_HandleTypeDef *panel, HID_TOUCH_LayoutTypeDef *layout,
+                                  const HID_ReportDescTypeDef *desc, uint8_t r)
+{
+  const HID_ReportInfoTypeDef *report = &desc->report[r];
+  const HID_FieldTypeDef *field;
+  HID_ExtractTypeDef *item;
+  uint32_t usage;
+  uint8_t finger = 0xFFU;
+  uint8_t value;
+  uint8_t dest;
+  uint8_t kept;
+  uint8_t f;
+  uint16_t n;
+
+  (void)USBH_memset(layout, 0, sizeof(HID_TOUCH_LayoutTypeDef));
+  layout->report_id = report->id;
+
+  for (f = 0U; f < report->nbr_fields; f++)
+  {
+    field = &desc->field[report->first_field + f];
+
+    if ((USBH_HID_TouchIsPanel(field->app_usage) == 0U) || ((field->flags & HID_FIELD_VARIABLE) == 0U))
+    {
+      continue;
+    }
+
+    for (n = 0U; n < field->count; n++)
+    {
+      usage = (uint32_t)field->usage_min + n;
+      if (usage > field->usage_max)
+      {
+        usage = field->usage_max;
+      }
+
+      value = USBH_HID_TouchValue(field->usage_page, usage);
+      if (value == TOUCH_V_NONE)
+      {
+        continue;
+      }
+
+      if (layout->nbr_items >= HID_TOUCH_MAX_ITEMS)
+      {
+        break;
+      }
+
+      if (value == TOUCH_V_COUNT)
+      {
+        layout->count = 1U;
+        dest = TOUCH_V_COUNT;
+      }
+      else if (value == TOUCH_V_SCAN_TIME)
+      {
+        layout->scan_time = 1U;
+        dest = TOUCH_V_SCAN_TIME;
+      }
+      else
+      {
+        /* Fingers are alike: a usage the current one already has starts the next */
+        if ((finger == 0xFFU) || ((layout->present[finger] & (1U << value)) != 0U))
+        {
+          if ((uint8_t)(finger + 1U) >= HID_TOUCH_REPORT_FINGERS)
+          {
+            continue;
+          }
+          finger++;
+        }
+
+        layout->present[finger] |= (uint8_t)(1U << value);
+        dest = (uint8_t)((finger * HID_TOUCH_V_NBR) + value);
+
+        if ((value == HID_TOUCH_V_X) && (panel->x_range == 0U))
+        {
+          panel->x_min   = field->logical_min;
+          panel->x_range = USBH_HID_TouchRange(field->logical_min, field->logical_max);
+        }
+        else if ((value == HID_TOUCH_V_Y) && (panel->y_range == 0U))
+        {
+          panel->y_min   = field->logical_min;
+          panel->y_range = USBH_HID_TouchRange(field->logical_min, field->logical_max);
+        }
+        else
+        {
+          /* .. */
+        }
+      }
+
+      item = &layout->item[layout->nbr_items++];
+      item->offset = (uint16_t)(field->offset + (n * field->size));
+      item->size   = field->size;
+      item->count  = 1U;
+      item->flags  = ((field->flags & HID_FIELD_SIGNED) != 0U) ? HID_EXTRACT_SIGNED : 0U;
+      item->width  = 4U;
+      item->dest   = (uint16_t)(dest * 4U);
+    }
+  }
+
+  /* A finger cut short (eg. by HID_TOUCH_MAX_ITEMS) ends the layout, and its
+     items and those of the fingers after it are dropped */
+  f = 0U;
+  while ((f < (uint8_t)(finger + 1U)) && (USBH_HID_TouchComplete(layout, f) != 0U))
+  {
+    f++;
+  }
+  layout->nbr_fingers = f;
+
+  kept = 0U;
+  for (n = 0U; n < layout->nbr_items; n++)
+  {
+    dest = (uint8_t)(layout->item[n].dest / 4U);
+    if ((dest >= TOUCH_V_COUNT) || (dest < (layout->nbr_fingers * HID_TOUCH_V_NBR)))
+    {
+      layout->item[kept++] = layout->item[n];
+    }
+  }
+  layout->nbr_items = kept;
+
+  return (layout->nbr_fingers != 0U) ? 1U : 0U;
+}
+
+/**
+  * @brief  USBH_HID_TouchInit
+  *         The function init the HID touch panels: a panel is bound to each
+  *         HID_TOUCH interface, up to HID_TOUCH_MAX_PANELS.
+  * @param  phost: Host handle
+  * @retval USBH Status
+  */
+USBH_StatusTypeDef USBH_HID_TouchInit(USBH_HandleTypeDef *phost)
+{
+  HID_HandleTypeDef *HID_Handle;
+  HID_TOUCH_HandleTypeDef *panel;
+  const HID_ReportDescTypeDef *desc;
+  uint8_t n;
+  uint8_t r;
+
+  touch_nbr_panels = 0U;
+
+  /* Routes are bound after the decoders' Init, so this reaches every touch interface */
+  if ((USBH_HID_RegisterCollection(TOUCH_APP_SCREEN, USBH_HID_TouchDecode) != USBH_OK) ||
+      (USBH_HID_RegisterCollection(TOUCH_APP_PAD, USBH_HID_TouchDecode) != USBH_OK))
+  {
+    USBH_ErrLog("HID: no room for the touch decoder, raise HID_MAX_COLLECTION_DECODERS");
+    return USBH_OK; /* reports are queued instead */
+  }
+
+  for (n = 0U; (n < HID_MAX_INTERFACES) && (touch_nbr_panels < HID_TOUCH_MAX_PANELS); n++)
+  {
+    HID_Handle = USBH_HID_GetInterface(phost, n);
+
+    if (HID_Handle == NULL)
+    {
+      break;
+    }
+
+    if (HID_Handle->type != HID_TOUCH)
+    {
+      continue;
+    }
+
+    panel = &touch_panels[touch_nbr_panels];
+    (void)USBH_memset(panel, 0, sizeof(HID_TOUCH_HandleTypeDef));
+    panel->HID_Handle = HID_Handle;
+    desc = &HID_Handle->ReportDesc;
+
+    for (r = 0U; (r < desc->nbr_reports) && (panel->nbr_layouts < HID_TOUCH_MAX_REPORTS); r++)
+    {
+      if ((desc->report[r].type == HID_REPORT_TYPE_INPUT) &&
+          (USBH_HID_TouchBind(panel, &panel->layout[panel->nbr_layouts], desc, r) != 0U))
+      {
+        panel->nbr_layouts++;
+      }
+    }
+
+    if (panel->nbr_layouts != 0U)
+    {
+      HID_Handle->pDecoderData = panel;
+      touch_nbr_panels++;
+    }
+  }
+
+  USBH_UsrLog("HID: %d touch panel(s)", touch_nbr_panels);
+
+  return USBH_OK;
+}
+
+#if (HID_TOUCH_STATS == 1U)
+/**
+  * @brief  USBH_HID_TouchTime
+  *         Account a time measurement.
+  * @param  t: statistics to update
+  * @param  v: HID_TOUCH_TIMESTAMP() ticks
+  * @retval none
+  */
+static void USBH_HID_TouchTime(HID_TOUCH_TimeTypeDef *t, uint32_t v)
+{
+  if ((t->count == 0U) || (v < t->min))
+  {
+    t->min = v;
+  }
+
+  if (v > t->max)
+  {
+    t->max = v;
+  }
+
+  t->sum += v;
+  t->count++;
+}
+#endif /* (HID_TOUCH_STATS == 1U) */
+
+/**
+  * @brief  USBH_HID_TouchClamp
+  *         Offset a logical value into 0..range.
+  * @param  v: logical value
+  * @param  min: logical minimum
+  * @param  range: logical span
+  * @retval clamped value
+  */
+static uint16_t USBH_HID_TouchClamp(int32_t v, int32_t min, uint16_t range)
+{
+  uint32_t d = (uint32_t)v - (uint32_t)min;
+
+  if (v <= min)
+  {
+    return 0U;
+  }
+
+  return (d > range) ? range : (uint16_t)d;
+}
+
+/**
+  * @brief  USBH_HID_TouchFrame
+  *         Track the contacts gathered into the slots, and publish the frame.
+  * @param  phost: Host handle
+  * @param  panel: panel
+  * @retval none
+  */
+static void USBH_HID_TouchFrame(USBH_HandleTypeDef *phost, HID_TOUCH_HandleTypeDef *panel)
+{
+  const HID_TOUCH_ContactTypeDef *p;
+  const HID_TOUCH_FrameTypeDef *cur;
+  HID_TOUCH_FrameTypeDef *next;
+  HID_TOUCH_ContactTypeDef *c;
+  uint32_t seq = panel->seq;
+  uint32_t seen = 0U;
+  uint8_t count = 0U;
+  uint8_t n;
+  uint8_t s;
+
+  /* Build the next frame in the buffer not published */
+  cur  = &panel->Frame[seq & 1U];
+  next = &panel->Frame[(seq + 1U) & 1U];
+  (void)USBH_memcpy(next->contact, cur->contact, sizeof(next->contact));
+
+  for (s = 0U; s < HID_TOUCH_MAX_CONTACTS; s++)
+  {
+    if (next->contact[s].state == HID_TOUCH_UP)
+    {
+      next->contact[s].state = HID_TOUCH_NONE;
+    }
+  }
+
+  for (n = 0U; n < panel->received; n++)
+  {
+    p = &panel->pending[n];
+
+    for (s = 0U; s < HID_TOUCH_MAX_CONTACTS; s++)
+    {
+      if ((next->contact[s].state != HID_TOUCH_NONE) && (next->contact[s].id == p->id) &&
+          ((seen & (1UL << s)) == 0U))
+      {
+        break;
+      }
+    }
+
+    if (s >= HID_TOUCH_MAX_CONTACTS)
+    {
+      if (p->state == 0U)
+      {
+        continue; /* lifted, and not known */
+      }
+
+      for (s = 0U; (s < HID_TOUCH_MAX_CONTACTS) && (next->contact[s].state != HID_TOUCH_NONE); s++)
+      {
+        /* .. */
+      }
+
+      if (s >= HID_TOUCH_MAX_CONTACTS)
+      {
+        panel->stats.overflow++;
+        continue;
+      }
+      next->contact[s].state = HID_TOUCH_DOWN;
+    }
+    else
+    {
+      next->contact[s].state = (p->state != 0U) ? HID_TOUCH_MOVE : HID_TOUCH_UP;
+    }
+
+    c = &next->contact[s];
+    c->id         = p->id;
+    c->confidence = p->confidence;
+    c->x          = p->x;
+    c->y          = p->y;
+    c->width      = p->width;
+    c->height     = p->height;
+    seen |= 1UL << s;
+  }
+
+  /* Contacts the scan left out are gone */
+  for (s = 0U; s < HID_TOUCH_MAX_CONTACTS; s++)
+  {
+    if (((seen & (1UL << s)) == 0U) &&
+        ((next->contact[s].state == HID_TOUCH_DOWN) || (next->contact[s].state == HID_TOUCH_MOVE)))
+    {
+      next->contact[s].state = HID_TOUCH_UP;
+    }
+
+    if (next->contact[s].state != HID_TOUCH_NONE)
+    {
+      count++;
+    }
+  }
+
+  next->timestamp = phost->Timer;
+  next->frames    = cur->frames + 1U;
+  next->scan_time = panel->scan_time;
+  next->count     = count;
+
+  /* Publish */
+  panel->seq = seq + 1U;
+  panel->expected = 0U;
+  panel->received = 0U;
+  panel->stats.frames++;
+}
+
+/**
+  * @brief  USBH_HID_TouchNotify
+  *         Hand the published frame to the application.
+  * @param  phost: Host handle
+  * @param  panel: panel
+  * @retval none
+  */
+static void USBH_HID_TouchNotify(USBH_HandleTypeDef *phost, HID_TOUCH_HandleTypeDef *panel)
+{
+  USBH_HID_TouchCallback(phost, panel, &panel->Frame[panel->seq & 1U]);
+
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+/**
+  * @brief  USBH_HID_TouchDecode
+  *         Decoder of the Touch Screen and Touch Pad application collections,
+  *         called from USBH_Process with the report in place.
+  * @param  phost: Host handle
+  * @param  HID_Handle: HID handle of the interface
+  * @param  report: input report, report ID byte included
+  * @param  length: report length
+  * @retval none
+  */
+static void USBH_HID_TouchDecode(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
+                                 const uint8_t *report, uint16_t length)
+{
+  HID_TOUCH_HandleTypeDef *panel = (HID_TOUCH_HandleTypeDef *)HID_Handle->pDecoderData;
+  const HID_TOUCH_LayoutTypeDef *layout = NULL;
+  HID_TOUCH_ContactTypeDef *p;
+  int32_t values[TOUCH_NBR_VALUES];
+  const int32_t *v;
+  uint32_t count;
+  uint8_t report_id = 0U;
+  uint8_t present;
+  uint8_t done = 0U;
+  uint8_t n;
+#if (HID_TOUCH_STATS == 1U)
+  uint32_t t0 = HID_TOUCH_TIMESTAMP();
+  uint32_t t1;
+#endif /* (HID_TOUCH_STATS == 1U) */
+
+  if (HID_Handle->ReportDesc.report_ids != 0U)
+  {
+    report_id = (length != 0U) ? report[0] : 0U;
+  }
+
+  for (n = 0U; (panel != NULL) && (n < panel->nbr_layouts); n++)
+  {
+    if (panel->layout[n].report_id == report_id)
+    {
+      layout = &panel->layout[n];
+      break;
+    }
+  }
+
+  if (layout == NULL)
+  {
+    /* Not a panel, or not a touch report (eg. the pen): queued as any report */
+    (void)USBH_HID_QueuePut(&HID_Handle->queue, report, length, report_id, phost->Timer);
+    USBH_HID_EventCallback(phost);
+    return;
+  }
+
+  if (report_id != 0U)
+  {
+    report++;
+    length--;
+  }
+
+  /* Items past a short report are left as they are */
+  (void)USBH_memset(values, 0, sizeof(values));
+  HID_ExtractReport(layout->item, layout->nbr_items, report, length, values);
+  panel->stats.reports++;
+
+  /* Hybrid mode: only the first report of a scan has the contact count */
+  count = (layout->count != 0U) ? (uint32_t)values[TOUCH_V_COUNT] : layout->nbr_fingers;
+
+  if (count != 0U)
+  {
+    if (panel->expected != 0U)
+    {
+      panel->stats.partial++;
+      USBH_HID_TouchFrame(phost, panel);
+      USBH_HID_TouchNotify(phost, panel);
+    }
+
+    panel->expected  = (count > HID_TOUCH_MAX_CONTACTS) ? (uint8_t)HID_TOUCH_MAX_CONTACTS : (uint8_t)count;
+    panel->received  = 0U;
+    panel->scan_time = (layout->scan_time != 0U) ? (uint16_t)values[TOUCH_V_SCAN_TIME] : 0U;
+    TOUCH_STAT(panel->scan_start = t0);
+    TOUCH_STAT(panel->scan_decode = 0U);
+  }
+  else if (panel->expected == 0U)
+  {
+    panel->stats.stray++;
+    return;
+  }
+  else
+  {
+    /* .. */
+  }
+
+  for (n = 0U; (n < layout->nbr_fingers) && (panel->received < panel->expected); n++)
+  {
+    v = &values[n * HID_TOUCH_V_NBR];
+    present = layout->present[n];
+    p = &panel->pending[panel->received++];
+
+    if ((present & (1U << HID_TOUCH_V_TIP)) != 0U)
+    {
+      p->state = (v[HID_TOUCH_V_TIP] != 0) ? 1U : 0U;
+    }
+    else
+    {
+      p->state = (v[HID_TOUCH_V_INRANGE] != 0) ? 1U : 0U;
+    }
+
+    p->id         = ((present & (1U << HID_TOUCH_V_ID)) != 0U) ? (uint8_t)v[HID_TOUCH_V_ID] :
+                    (uint8_t)(panel->received - 1U);
+    p->confidence = ((present & (1U << HID_TOUCH_V_CONFIDENCE)) != 0U) ?
+                    ((v[HID_TOUCH_V_CONFIDENCE] != 0) ? 1U : 0U) : 1U;
+    p->x          = USBH_HID_TouchClamp(v[HID_TOUCH_V_X], panel->x_min, panel->x_range);
+    p->y          = USBH_HID_TouchClamp(v[HID_TOUCH_V_Y], panel->y_min, panel->y_range);
+    p->width      = ((present & (1U << HID_TOUCH_V_WIDTH)) != 0U) ?
+                    USBH_HID_TouchClamp(v[HID_TOUCH_V_WIDTH], 0, 0xFFFFU) : 0U;
+    p->height     = ((present & (1U << HID_TOUCH_V_HEIGHT)) != 0U) ?
+                    USBH_HID_TouchClamp(v[HID_TOUCH_V_HEIGHT], 0, 0xFFFFU) : 0U;
+  }
+
+  /* Frames go out once every contact of the scan is in */
+  if (panel->received >= panel->expected)
+  {
+    USBH_HID_TouchFrame(phost, panel);
+    done = 1U;
+  }
+
+#if (HID_TOUCH_STATS == 1U)
+  t1 = HID_TOUCH_TIMESTAMP();
+  panel->scan_decode += t1 - t0;
+  if (done != 0U)
+  {
+    USBH_HID_TouchTime(&panel->stats.decode, panel->scan_decode);
+    USBH_HID_TouchTime(&panel->stats.latency, t1 - panel->scan_start);
+  }
+#endif /* (HID_TOUCH_STATS == 1U) */
+
+  if (done != 0U)
+  {
+    USBH_HID_TouchNotify(phost, panel);
+  }
+}
+
+/**
+  * @brief  USBH_HID_GetTouch
+  *         Return panel n over all interfaces. Panels outlive their device
+  *         until the next one binds.
+  * @param  phost: Host handle
+  * @param  n: panel index
+  * @retval panel, NULL if there are fewer
+  */
+HID_TOUCH_HandleTypeDef *USBH_HID_GetTouch(USBH_HandleTypeDef *phost, uint8_t n)
+{
+  HID_HandleTypeDef *HID_Handle = USBH_HID_GetHandle(phost, HID_TOUCH);
+
+  if ((HID_Handle == NULL) || (n >= touch_nbr_panels))
+  {
+    return NULL;
+  }
+
+  return &touch_panels[n];
+}
+
+/**
+  * @brief  USBH_HID_GetTouchFrame
+  *         Copy the latest frame of a panel, lock free.
+  * @param  panel: panel
+  * @param  frame: copy of the frame
+  * @retval 1 if a frame came since the last read, 0 otherwise
+  */
+uint8_t USBH_HID_GetTouchFrame(HID_TOUCH_HandleTypeDef *panel, HID_TOUCH_FrameTypeDef *frame)
+{
+  uint32_t seq;
+  uint8_t changed;
+
+  do
+  {
+    seq = panel->seq;
+    (void)USBH_memcpy(frame, &panel->Frame[seq & 1U], sizeof(HID_TOUCH_FrameTypeDef));
+  } while (seq != panel->seq);
+
+  changed = (seq != panel->read) ? 1U : 0U;
+  panel->read = seq;
+
+  return changed;
+}
+
+/**
+  * @brief  USBH_HID_GetTouchStats
+  *         Return the decoding statistics of a panel.
+  * @param  panel: panel
+  * @retval statistics
+  */
+const HID_TOUCH_StatsTypeDef *USBH_HID_GetTouchStats(HID_TOUCH_HandleTypeDef *panel)
+{
+  return &panel->stats;
+}
+
+/**
+  * @brief  USBH_HID_ResetTouchStats
+  *         Clear the decoding statistics of a panel.
+  * @param  panel: panel
+  * @retval None
+  */
+void USBH_HID_ResetTouchStats(HID_TOUCH_HandleTypeDef *panel)
+{
+  (void)USBH_memset(&panel->stats, 0, sizeof(panel->stats));
+}
+
+/**
+  * @brief  USBH_HID_TouchCallback
+  *         Called from USBH_Process with every frame.
+  * @param  phost: Host handle
+  * @param  panel: panel
+  * @param  frame: frame just published
+  * @retval None
+  */
+__weak void USBH_HID_TouchCallback(USBH_HandleTypeDef *phost, HID_TOUCH_HandleTypeDef *panel,
+                                   const HID_TOUCH_FrameTypeDef *frame)
+{
+  /* Prevent unused argument(s) compilation warning */
+  UNUSED(phost);
+  UNUSED(panel);
+  UNUSED(frame);
+}
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
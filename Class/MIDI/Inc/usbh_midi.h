@@ -14,6 +14,50 @@
 #define USB_MIDI_CLASS USB_AUDIO_CLASS
 #define USBH_MIDI_CLASS &MIDI_Class
 
+// USB MIDI 2.0: alt setting 1 of the MIDIStreaming interface carries UMP
+#ifndef USBH_MIDI_UMP_ENABLE
+#define USBH_MIDI_UMP_ENABLE 1U
+#endif
+#define USB_MIDI_UMP_ALT_SETTING 0x01
+// UMP translation staging, one packet of the UMP endpoints. 512 covers high
+// speed bulk; full speed only hosts may lower it to 64
+#ifndef USB_MIDI_UMP_BUFFER_SIZE
+#define USB_MIDI_UMP_BUFFER_SIZE 512
+#endif
+#define USB_MIDI_CS_INTERFACE 0x24
+#define USB_MIDI_MS_HEADER 0x01
+#define USB_MIDI_BCD_MSC_2_0 0x0200
+#define USB_MIDI_CS_GR_TRM_BLOCK 0x26
+#define USB_MIDI_GR_TRM_BLOCK_HEADER 0x01
+#define USB_MIDI_GR_TRM_BLOCK 0x02
+#define USB_MIDI_GR_TRM_BLOCK_HEADER_SIZE 5
+#define USB_MIDI_GR_TRM_BLOCK_SIZE 13
+#define USBH_MIDI_MAX_GTB 4
+
+// stall_mask bits: data endpoints waiting for CLEAR_FEATURE(ENDPOINT_HALT)
+#define HMIDI_STALL_OUT 0x01
+#define HMIDI_STALL_IN 0x02
+
+// latency & throughput instrumentation. off by default as it costs a
+// timestamp read per URB. USBH_MIDI_TIMESTAMP() must return a free running
+// 32bit counter; the default is the Cortex-M DWT cycle counter, which the
+// application must enable.
+#ifndef USBH_MIDI_STATS
+#define USBH_MIDI_STATS 0U
+#endif
+#ifndef USBH_MIDI_TIMESTAMP
+#define USBH_MIDI_TIMESTAMP() (DWT->CYCCNT)
+#endif
+#define USBH_MIDI_STATS_BUCKETS 24 // log2 histogram: bucket n holds [2^(n-1), 2^n)
+
+// sysex streaming transmit & incremental receive. costs ~160 bytes of
+// staging per handle, set to 0 when the application never streams sysex
+#ifndef USBH_MIDI_SYSEX_ENABLE
+#define USBH_MIDI_SYSEX_ENABLE 1U
+#endif
+// raw sysex bytes staged per producer call / per receive delivery
+#define USB_MIDI_SYSEX_CHUNK 48
+
 extern USBH_ClassTypeDef MIDI_Class;
 
 typedef enum{
@@ -103,6 +147,95 @@ typedef enum{
   HMIDI_ERROR_STATE,
 } HMIDI_StateTypeDef;
 
+typedef enum{
+  HMIDI_REQ_IDLE=0,
+  HMIDI_REQ_SET_ALT,
+  HMIDI_REQ_GET_GTB_HEADER,
+  HMIDI_REQ_GET_GTB,
+  HMIDI_REQ_DONE,
+} HMIDI_ReqStateTypeDef;
+
+typedef enum{
+  HMIDI_PROTOCOL_MIDI1=0, // USB-MIDI 1.0 4-byte event packets (alt setting 0)
+  HMIDI_PROTOCOL_UMP,     // Universal MIDI Packets (alt setting 1)
+} HMIDI_ProtocolTypeDef;
+
+typedef enum{
+  HMIDI_UMP_TRANSLATE=0, // application speaks USB-MIDI 1.0 packets, driver converts
+  HMIDI_UMP_NATIVE,      // application sends & receives raw UMP words
+} HMIDI_UMPModeTypeDef;
+
+// Group Terminal Block descriptor (USB MIDI 2.0, 5.4.2.1)
+typedef struct{
+  uint8_t bGrpTrmBlkID;
+  uint8_t bGrpTrmBlkType; // 0: bidirectional, 1: input only, 2: output only
+  uint8_t nGroupTrm;      // first group (0-based)
+  uint8_t nNumGroupTrm;
+  uint8_t bMIDIProtocol;
+  uint16_t wMaxInputBandwidth;
+  uint16_t wMaxOutputBandwidth;
+} MIDI_GroupTerminalBlockTypeDef;
+
+// running state for the MIDI 1.0 <-> UMP sysex translation
+typedef struct{
+  uint8_t group;
+  uint8_t count;
+  uint8_t started;
+  uint8_t pkt_pos; // bytes of the current USB-MIDI packet already translated
+  uint8_t data[6];
+} MIDI_UMPSysExTypeDef;
+
+// single-producer (URB ISR) single-consumer ring of event packets
+typedef struct{
+  midi_package_t* buf;
+  uint16_t size; // must be a power of 2
+  volatile uint16_t head; // written by the receive path
+  volatile uint16_t tail; // written by the reader
+  uint32_t overflow; // events lost because the ring was full
+} USBH_MIDI_RingTypeDef;
+
+#define USBH_MIDI_ROUTE_ANY_CIN   0xFFFF
+#define USBH_MIDI_ROUTE_ANY_CHN   0xFFFF
+#define USBH_MIDI_ROUTE_ANY_CABLE 0xFF
+#define USBH_MIDI_ROUTE_ANY_STATUS 0x00
+#define USBH_MIDI_ROUTE_DROP      NULL
+
+// receive routing entry. the first matching entry decides an event's fate.
+// events matching no entry are left in the receive buffer as before.
+typedef struct{
+  uint16_t cin_mask; // bit per CIN
+  uint16_t chn_mask; // bit per channel. only checked for channel voice events
+  uint8_t cable;     // cable number or USBH_MIDI_ROUTE_ANY_CABLE
+  uint8_t status;    // 0x80..0xE0 match any channel, 0xF0..0xFF exact, 0 any
+  USBH_MIDI_RingTypeDef* dest; // destination ring or USBH_MIDI_ROUTE_DROP
+} USBH_MIDI_RouteTypeDef;
+
+typedef struct{
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t bucket[USBH_MIDI_STATS_BUCKETS];
+} USBH_MIDI_HistTypeDef;
+
+typedef struct{
+  USBH_MIDI_HistTypeDef rx_latency; // first packet of a burst -> ReceiveCallback
+  USBH_MIDI_HistTypeDef tx_latency; // Transmit -> last URB acknowledged
+  uint32_t rx_urbs;
+  uint32_t rx_events;   // 4 byte packets received (after UMP translation)
+  uint32_t rx_bursts;   // ReceiveCallback invocations
+  uint32_t tx_urbs;
+  uint32_t tx_bytes;
+  uint32_t tx_naks;     // chunks the device was not ready for
+  uint32_t rx_t0;
+  uint32_t tx_t0;
+  uint8_t rx_armed;
+} USBH_MIDI_StatsTypeDef;
+
+// fills dst with up to max raw sysex bytes (F0 .. F7 included)
+// returns the number of bytes written, 0 at the end of the dump
+typedef uint32_t (*USBH_MIDI_SysExProducerTypeDef)(void* ctx, uint8_t* dst, uint32_t max);
+
 typedef struct _MIDI_Process{
   HMIDI_StateTypeDef state;
   uint8_t InPipe;
@@ -111,6 +244,8 @@ typedef struct _MIDI_Process{
   uint8_t InEp;
   uint16_t OutEpSize;
   uint16_t InEpSize;
+  uint8_t OutEpType; // USB_EP_TYPE_BULK, or USB_EP_TYPE_INTR on some UMP devices
+  uint8_t InEpType;
 
   uint8_t *pTxData;;
   uint8_t *pRxData;;
@@ -119,6 +254,63 @@ typedef struct _MIDI_Process{
   HMIDI_DataStateTypeDef data_tx_state;
   HMIDI_DataStateTypeDef data_rx_state;
   uint8_t Rx_Poll;
+  uint16_t TxChunkLength; // bytes of pTxData covered by the URB in flight
+  uint8_t* pTxWire;       // bytes actually on the wire (pTxData or a staging buffer)
+  uint16_t TxWireLength;  // non-zero while a chunk is staged & not yet acked
+  uint8_t stall_mask;
+  uint32_t stall_count;   // halts cleared & resumed
+
+  uint8_t itf_num;     // bInterfaceNumber of the MIDIStreaming interface
+  uint8_t itf_alt0;    // config descriptor index of alt setting 0
+  uint8_t itf_alt1;    // config descriptor index of alt setting 1 (0xFF if absent)
+  HMIDI_ReqStateTypeDef req_state;
+  HMIDI_ProtocolTypeDef protocol;
+  HMIDI_UMPModeTypeDef ump_mode;
+  uint16_t gtb_length;
+  uint8_t gtb_count;
+  MIDI_GroupTerminalBlockTypeDef gtb[USBH_MIDI_MAX_GTB];
+  MIDI_UMPSysExTypeDef ump_tx_sysex;
+  MIDI_UMPSysExTypeDef ump_rx_sysex;
+  uint32_t ump_dropped; // translated events that did not fit the rx buffer
+#if (USBH_MIDI_UMP_ENABLE == 1U)
+  uint8_t ump_rx[USB_MIDI_UMP_BUFFER_SIZE];
+  uint8_t ump_tx[USB_MIDI_UMP_BUFFER_SIZE];
+#endif
+
+  // read by the URB interrupt. SetRoutes publishes the count last
+  const USBH_MIDI_RouteTypeDef* volatile routes;
+  volatile uint8_t route_count;
+
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+  // sysex streaming transmit
+  USBH_MIDI_SysExProducerTypeDef sx_producer;
+  void* sx_ctx;
+  uint8_t sx_cable;
+  uint8_t sx_eof;
+  uint8_t sx_pending_count;
+  uint8_t sx_pending[3];
+  uint16_t sx_raw_len;
+  uint16_t sx_raw_pos;
+  uint32_t sx_rate;  // bytes per second, 0 = unpaced
+  uint32_t sx_start; // phost->Timer when the stream began
+  uint32_t sx_sent;  // raw bytes encoded so far
+  uint32_t sx_due;   // phost->Timer when the pace allows the next packet
+  volatile uint8_t sx_paced; // set while waiting for sx_due, cleared by SOFProcess
+  uint8_t sx_raw[USB_MIDI_SYSEX_CHUNK];
+  uint8_t sx_tx[USB_MIDI_TX_BUFFER_SIZE];
+  uint16_t sx_tx_len; // encoded packets staged in sx_tx
+  uint16_t sx_tx_pos; // of which already translated to UMP
+
+  // sysex incremental receive
+  uint8_t sx_rx_enable;
+  uint8_t sx_rx_cable;
+  uint16_t sx_rx_len;
+  uint8_t sx_rx[USB_MIDI_SYSEX_CHUNK];
+#endif
+
+#if (USBH_MIDI_STATS == 1U)
+  USBH_MIDI_StatsTypeDef stats;
+#endif
 } MIDI_HandleTypeDef;
 
 USBH_StatusTypeDef USBH_MIDI_Transmit(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t *pbuff, uint32_t length);
@@ -127,17 +319,46 @@ uint16_t USBH_MIDI_GetLastReceivedDataSize(USBH_HandleTypeDef *phost, MIDI_Handl
 USBH_StatusTypeDef USBH_MIDI_Stop(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi);
 void USBH_MIDI_TransmitCallback(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi);
 void USBH_MIDI_ReceiveCallback(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint32_t length);
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+void USBH_MIDI_SysExTransmitCallback(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi);
+void USBH_MIDI_SysExReceiveCallback(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t cable, uint8_t* data, uint16_t length, uint8_t complete);
+#endif
 void USBH_MIDI_StartReception(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t* pbuff, uint32_t length);
 void USBH_MIDI_Retry(USBH_HandleTypeDef* phost, MIDI_HandleTypeDef* hmidi);
 
 void USBH_MIDI_URBDoneCallback(int chnum);
 
+// USB MIDI 2.0 (UMP)
+HMIDI_ProtocolTypeDef USBH_MIDI_GetProtocol(MIDI_HandleTypeDef* hmidi);
+void USBH_MIDI_SetUMPMode(MIDI_HandleTypeDef* hmidi, HMIDI_UMPModeTypeDef mode);
+USBH_StatusTypeDef USBH_MIDI_UMP_Transmit(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint32_t *words, uint32_t count);
+uint8_t USBH_MIDI_GetGroupTerminalBlocks(MIDI_HandleTypeDef* hmidi, const MIDI_GroupTerminalBlockTypeDef** gtb);
+
+// receive filtering & routing
+void USBH_MIDI_SetRoutes(MIDI_HandleTypeDef* hmidi, const USBH_MIDI_RouteTypeDef* routes, uint8_t count);
+USBH_StatusTypeDef USBH_MIDI_RingInit(USBH_MIDI_RingTypeDef* ring, midi_package_t* buf, uint16_t size);
+uint16_t USBH_MIDI_RingAvailable(USBH_MIDI_RingTypeDef* ring);
+uint16_t USBH_MIDI_RingRead(USBH_MIDI_RingTypeDef* ring, midi_package_t* dst, uint16_t count);
+
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+// sysex streaming
+USBH_StatusTypeDef USBH_MIDI_SysExTransmit(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t cable, USBH_MIDI_SysExProducerTypeDef producer, void* ctx, uint32_t bytes_per_sec);
+void USBH_MIDI_SysExReceive(MIDI_HandleTypeDef* hmidi, uint8_t enable);
+#endif
+
+#if (USBH_MIDI_STATS == 1U)
+const USBH_MIDI_StatsTypeDef* USBH_MIDI_GetStats(MIDI_HandleTypeDef* hmidi);
+void USBH_MIDI_ResetStats(MIDI_HandleTypeDef* hmidi);
+#endif
+
 // SubDriver interface (for Composite Host)
 
 typedef struct{
   USBH_StatusTypeDef(*Init)(USBH_HandleTypeDef* phost, uint8_t itf_midi, void** hmidi);
   USBH_StatusTypeDef(*DeInit)(USBH_HandleTypeDef* phost, void* hmidi);
   USBH_StatusTypeDef(*Process)(USBH_HandleTypeDef* phost, void* hmidi);
+  USBH_StatusTypeDef(*ClassRequest)(USBH_HandleTypeDef* phost, void* hmidi);
+  USBH_StatusTypeDef(*SOFProcess)(USBH_HandleTypeDef* phost, void* hmidi);
 } USBH_MIDI_SubDriverTypeDef;
 
 extern const USBH_MIDI_SubDriverTypeDef USBH_MIDI_SubDriver;
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "usbh_midi.h"
+
+// Universal MIDI Packet helpers
+// UMP words travel over USB as little-endian 32bit words. The message type
+// lives in the top nibble of the first word & determines the packet length.
+
+#define UMP_MT_UTILITY      0x0
+#define UMP_MT_SYSTEM       0x1
+#define UMP_MT_MIDI1_VOICE  0x2
+#define UMP_MT_DATA64       0x3
+#define UMP_MT_MIDI2_VOICE  0x4
+#define UMP_MT_DATA128      0x5
+#define UMP_MT_FLEX_DATA    0xD
+#define UMP_MT_STREAM       0xF
+
+#define UMP_SYSEX_COMPLETE  0x0
+#define UMP_SYSEX_START     0x1
+#define UMP_SYSEX_CONTINUE  0x2
+#define UMP_SYSEX_END       0x3
+
+// number of 32bit words in the packet starting with word0
+uint8_t USBH_MIDI_UMP_WordCount(uint32_t word0);
+
+// translate a buffer of UMP words into USB-MIDI 1.0 event packets
+// returns number of bytes written to pkts. events which don't fit in
+// max_length are dropped & counted into *dropped.
+uint32_t USBH_MIDI_UMP_ToMIDI1(MIDI_UMPSysExTypeDef* sx,
+                               const uint8_t* ump, uint32_t length,
+                               uint8_t* pkts, uint32_t max_length,
+                               uint32_t* dropped);
+
+// translate USB-MIDI 1.0 event packets into UMP words
+// returns number of bytes written to ump. *consumed is set to the number of
+// input bytes translated (whole packets only) so the caller can continue.
+// a sysex packet only partly translated is finished by the next call, which
+// must be given the same packet first. max_length below 8 can't hold a sysex
+// UMP: nothing is written & *consumed is 0.
+uint32_t USBH_MIDI_UMP_FromMIDI1(MIDI_UMPSysExTypeDef* sx,
+                                 const uint8_t* pkts, uint32_t length,
+                                 uint8_t* ump, uint32_t max_length,
+                                 uint32_t* consumed);
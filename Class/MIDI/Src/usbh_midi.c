@@ -1,4 +1,5 @@
 #include "usbh_midi.h"
+#include "usbh_midi_ump.h"
 
 // TODO: a bunch of this is no longer called
 // clean it up & document how the interface needs to be implemented to work.
@@ -10,6 +11,9 @@ static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef *phost);
 static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef *phost);
 
 static void MIDI_ProcessTransmission(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi);
+static USBH_StatusTypeDef _ClassRequest(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi);
+static void MIDI_ProcessError(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi);
+static void _SubmitRx(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi);
 
 // Core class for standalone interface
 USBH_ClassTypeDef MIDI_Class = {
@@ -27,14 +31,34 @@ USBH_ClassTypeDef MIDI_Class = {
 static USBH_StatusTypeDef SubInit(USBH_HandleTypeDef* phost, uint8_t itf_midi, void** hmidi);
 static USBH_StatusTypeDef SubDeInit(USBH_HandleTypeDef* phost, void* hmidi);
 static USBH_StatusTypeDef SubProcess(USBH_HandleTypeDef* phost, void* hmidi);
+static USBH_StatusTypeDef SubClassRequest(USBH_HandleTypeDef* phost, void* hmidi);
+static USBH_StatusTypeDef SubSOFProcess(USBH_HandleTypeDef* phost, void* hmidi);
 
 // SubDriver for inclusion in Composite interface
 const USBH_MIDI_SubDriverTypeDef USBH_MIDI_SubDriver = {
   .Init = SubInit,
   .DeInit = SubDeInit,
   .Process = SubProcess,
+  .ClassRequest = SubClassRequest,
+  .SOFProcess = SubSOFProcess,
 };
 
+#if (USBH_MIDI_STATS == 1U)
+#define MIDI_STAT(x) do{ x; }while(0)
+
+static void _HistAdd(USBH_MIDI_HistTypeDef* h, uint32_t v){
+  uint8_t b = 0;
+  while(b < (USBH_MIDI_STATS_BUCKETS - 1) && (v >> b)) b++;
+  h->bucket[b]++;
+  if(h->count == 0 || v < h->min) h->min = v;
+  if(v > h->max) h->max = v;
+  h->sum += v;
+  h->count++;
+}
+#else
+#define MIDI_STAT(x)
+#endif
+
 static uint8_t in_pipe_number = 0xff;
 static USBH_HandleTypeDef* _phost_handle = NULL;
 static MIDI_HandleTypeDef* _hmidi = NULL;
@@ -42,24 +66,48 @@ static MIDI_HandleTypeDef* _hmidi = NULL;
 static uint8_t* _rx_buffer = NULL;
 static uint32_t _rx_buf_len = 0;
 
-// shared by standalone & subdriver
-static void _Init(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t interface){
-  // stored global for URB handler
-  _phost_handle = phost;
-  _hmidi = hmidi;
+#if (USBH_MIDI_UMP_ENABLE == 1U)
+// look for the class-specific MS header of alt setting 1 declaring bcdMSC 2.0
+static uint8_t _HasUMPAltSetting(USBH_HandleTypeDef *phost, uint8_t itf_num){
+  uint8_t* raw = phost->device.CfgDesc_Raw;
+  uint16_t total = phost->device.CfgDesc.wTotalLength;
+  uint16_t ptr = 0;
+  uint8_t in_alt = 0;
 
-  // unset rx_buffer to ensure it waits for StartReception
-  _rx_buffer = NULL;
+  if(total > USBH_MAX_SIZE_CONFIGURATION) total = USBH_MAX_SIZE_CONFIGURATION;
+  if(total < USB_CONFIGURATION_DESC_SIZE) return 0;
+
+  ptr = raw[0]; // skip configuration descriptor
+  while(ptr + 2U <= total){
+    uint8_t* d = &raw[ptr];
+    if(d[0] < 2U || ptr + d[0] > total) break; // malformed
+    if(d[1] == USB_DESC_TYPE_INTERFACE && d[0] >= 4U){
+      in_alt = (d[2] == itf_num) && (d[3] == USB_MIDI_UMP_ALT_SETTING);
+    } else if(in_alt && d[0] >= 5U
+           && d[1] == USB_MIDI_CS_INTERFACE
+           && d[2] == USB_MIDI_MS_HEADER){
+      return LE16(&d[3]) == USB_MIDI_BCD_MSC_2_0;
+    }
+    ptr += d[0];
+  }
+  return 0;
+}
+#endif
 
+static void _OpenPipes(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t interface){
   /*Collect the notification endpoint address and length*/
   // note we have 2 possible endpoints for a sender/receiver pair
+  // UMP endpoints may be interrupt rather than bulk: keep the real type
   for(int i=0; i<2; i++){
-    if(phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[i].bEndpointAddress & 0x80U){
-      hmidi->InEp = (phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[i].bEndpointAddress);
-      hmidi->InEpSize = (phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[i].wMaxPacketSize);
+    USBH_EpDescTypeDef* ep = &phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[i];
+    if(ep->bEndpointAddress & 0x80U){
+      hmidi->InEp = ep->bEndpointAddress;
+      hmidi->InEpSize = ep->wMaxPacketSize & 0x7FFU;
+      hmidi->InEpType = ep->bmAttributes & 0x03U;
     } else {
-      hmidi->OutEp = (phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[i].bEndpointAddress);
-      hmidi->OutEpSize = (phost->device.CfgDesc.Itf_Desc[interface].Ep_Desc[i].wMaxPacketSize);
+      hmidi->OutEp = ep->bEndpointAddress;
+      hmidi->OutEpSize = ep->wMaxPacketSize & 0x7FFU;
+      hmidi->OutEpType = ep->bmAttributes & 0x03U;
     }
   }
 
@@ -69,20 +117,75 @@ static void _Init(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t
 
   /* Open pipe for Notification endpoint */
   (void)USBH_OpenPipe(phost, hmidi->OutPipe, hmidi->OutEp,
-                      phost->device.address, phost->device.speed, USB_EP_TYPE_BULK,
+                      phost->device.address, phost->device.speed, hmidi->OutEpType,
                       hmidi->OutEpSize);
   (void)USBH_OpenPipe(phost, hmidi->InPipe, hmidi->InEp,
-                      phost->device.address, phost->device.speed, USB_EP_TYPE_BULK,
+                      phost->device.address, phost->device.speed, hmidi->InEpType,
                       hmidi->InEpSize);
 
-  hmidi->state = HMIDI_IDLE_STATE;
-
   (void)USBH_LL_SetToggle(phost, hmidi->InPipe, 0U);
   (void)USBH_LL_SetToggle(phost, hmidi->OutPipe, 0U);
 
   in_pipe_number = hmidi->InPipe;
 }
 
+static void _ClosePipes(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+  if(hmidi->OutPipe){
+    (void)USBH_ClosePipe(phost, hmidi->OutPipe);
+    (void)USBH_FreePipe(phost, hmidi->OutPipe);
+    hmidi->OutPipe = 0U;    /* Reset the Channel as Free */
+  }
+  if(hmidi->InPipe){
+    (void)USBH_ClosePipe(phost, hmidi->InPipe);
+    (void)USBH_FreePipe(phost, hmidi->InPipe);
+    hmidi->InPipe = 0U;     /* Reset the Channel as Free */
+  }
+}
+
+// shared by standalone & subdriver
+static void _Init(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t interface){
+  // stored global for URB handler
+  _phost_handle = phost;
+  _hmidi = hmidi;
+
+  // unset rx_buffer to ensure it waits for StartReception
+  _rx_buffer = NULL;
+
+  hmidi->itf_num = phost->device.CfgDesc.Itf_Desc[interface].bInterfaceNumber;
+  hmidi->itf_alt0 = interface;
+  hmidi->itf_alt1 = 0xFFU;
+  hmidi->protocol = HMIDI_PROTOCOL_MIDI1;
+  hmidi->req_state = HMIDI_REQ_IDLE;
+
+#if (USBH_MIDI_UMP_ENABLE == 1U)
+  // prefer the UMP alt setting when the device offers one. the interface is
+  // only switched over in ClassRequest, as SET_INTERFACE is a control xfer.
+  if(_HasUMPAltSetting(phost, hmidi->itf_num)){
+    uint8_t alt1 = USBH_FindInterfaceIndex(phost, hmidi->itf_num, USB_MIDI_UMP_ALT_SETTING);
+    if(alt1 != 0xFFU){
+      hmidi->itf_alt1 = alt1;
+      interface = alt1;
+    }
+  }
+#endif
+
+  _OpenPipes(phost, hmidi, interface);
+
+#if (USBH_MIDI_UMP_ENABLE == 1U)
+  // translation stages through ump_rx, which must hold a whole packet. only
+  // hit when USB_MIDI_UMP_BUFFER_SIZE was configured below the endpoint
+  if(hmidi->itf_alt1 != 0xFFU && hmidi->InEpSize > USB_MIDI_UMP_BUFFER_SIZE){
+    USBH_ErrLog("MIDI: UMP endpoint of %u bytes exceeds USB_MIDI_UMP_BUFFER_SIZE, using MIDI 1.0",
+                (unsigned)hmidi->InEpSize);
+    _ClosePipes(phost, hmidi);
+    hmidi->itf_alt1 = 0xFFU;
+    _OpenPipes(phost, hmidi, hmidi->itf_alt0);
+  }
+#endif
+
+  hmidi->state = HMIDI_IDLE_STATE;
+}
+
 static USBH_StatusTypeDef SubInit(USBH_HandleTypeDef* phost, uint8_t interface, void** phmidi){
   *phmidi = (MIDI_HandleTypeDef*)USBH_malloc(sizeof(MIDI_HandleTypeDef));
   if(*phmidi == NULL){
@@ -115,16 +218,7 @@ static USBH_StatusTypeDef Init(USBH_HandleTypeDef *phost){
 };
 
 static void _DeInit(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
-  if(hmidi->OutPipe){
-    (void)USBH_ClosePipe(phost, hmidi->OutPipe);
-    (void)USBH_FreePipe(phost, hmidi->OutPipe);
-    hmidi->OutPipe = 0U;    /* Reset the Channel as Free */
-  }
-  if(hmidi->InPipe){
-    (void)USBH_ClosePipe(phost, hmidi->InPipe);
-    (void)USBH_FreePipe(phost, hmidi->InPipe);
-    hmidi->InPipe = 0U;     /* Reset the Channel as Free */
-  }
+  _ClosePipes(phost, hmidi);
   _rx_buffer = NULL; // ensure no more triggers occur
   // invalidate global handles as device is not accessible [ie. hard fault]
   _phost_handle = NULL;
@@ -151,14 +245,139 @@ static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef *phost){
   return USBH_OK;
 }
 
+// parse the Group Terminal Block descriptors fetched into device.Data
+static void _ParseGTB(MIDI_HandleTypeDef* hmidi, uint8_t* buf, uint16_t length){
+  uint16_t ptr = 0;
+  hmidi->gtb_count = 0;
+  while(ptr + 2U <= length){
+    uint8_t* d = &buf[ptr];
+    if(d[0] < 2U || ptr + d[0] > length) break; // malformed
+    if(d[0] >= USB_MIDI_GR_TRM_BLOCK_SIZE
+    && d[1] == USB_MIDI_CS_GR_TRM_BLOCK
+    && d[2] == USB_MIDI_GR_TRM_BLOCK
+    && hmidi->gtb_count < USBH_MIDI_MAX_GTB){
+      MIDI_GroupTerminalBlockTypeDef* gtb = &hmidi->gtb[hmidi->gtb_count++];
+      gtb->bGrpTrmBlkID = d[3];
+      gtb->bGrpTrmBlkType = d[4];
+      gtb->nGroupTrm = d[5];
+      gtb->nNumGroupTrm = d[6];
+      // d[7] is iBlockItem
+      gtb->bMIDIProtocol = d[8];
+      gtb->wMaxInputBandwidth = LE16(&d[9]);
+      gtb->wMaxOutputBandwidth = LE16(&d[11]);
+    }
+    ptr += d[0];
+  }
+}
+
+static USBH_StatusTypeDef _GetGTB(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint16_t length){
+  if(phost->RequestState == CMD_SEND){
+    phost->Control.setup.b.bmRequestType = USB_D2H | USB_REQ_RECIPIENT_INTERFACE | USB_REQ_TYPE_STANDARD;
+    phost->Control.setup.b.bRequest = USB_REQ_GET_DESCRIPTOR;
+    phost->Control.setup.b.wValue.w = (USB_MIDI_CS_GR_TRM_BLOCK << 8) | USB_MIDI_UMP_ALT_SETTING;
+    phost->Control.setup.b.wIndex.w = hmidi->itf_num;
+    phost->Control.setup.b.wLength.w = length;
+  }
+  return USBH_CtlReq(phost, phost->device.Data, length);
+}
+
+// switch a UMP capable device to alt setting 1 & read its Group Terminal Blocks
+// falls back to USB-MIDI 1.0 on alt setting 0 if the device refuses
+static USBH_StatusTypeDef _ClassRequest(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+  USBH_StatusTypeDef status = USBH_BUSY;
+  USBH_StatusTypeDef req_status;
+
+  switch(hmidi->req_state){
+    case HMIDI_REQ_IDLE:
+      hmidi->req_state = (hmidi->itf_alt1 != 0xFFU) ? HMIDI_REQ_SET_ALT
+                                                    : HMIDI_REQ_DONE;
+      break;
+
+    case HMIDI_REQ_SET_ALT:
+      req_status = USBH_SetInterface(phost, hmidi->itf_num, USB_MIDI_UMP_ALT_SETTING);
+      if(req_status == USBH_OK){
+        hmidi->protocol = HMIDI_PROTOCOL_UMP;
+        hmidi->req_state = HMIDI_REQ_GET_GTB_HEADER;
+      } else if(req_status != USBH_BUSY){
+        USBH_DbgLog("MIDI: UMP alt setting rejected, using MIDI 1.0");
+        _ClosePipes(phost, hmidi);
+        _OpenPipes(phost, hmidi, hmidi->itf_alt0);
+        hmidi->itf_alt1 = 0xFFU;
+        hmidi->req_state = HMIDI_REQ_DONE;
+      }
+      break;
+
+    case HMIDI_REQ_GET_GTB_HEADER:
+      req_status = _GetGTB(phost, hmidi, USB_MIDI_GR_TRM_BLOCK_HEADER_SIZE);
+      if(req_status == USBH_OK){
+        hmidi->gtb_length = LE16(&phost->device.Data[3]);
+        if(hmidi->gtb_length > USBH_MAX_DATA_BUFFER){
+          hmidi->gtb_length = USBH_MAX_DATA_BUFFER;
+        }
+        hmidi->req_state = HMIDI_REQ_GET_GTB;
+      } else if(req_status != USBH_BUSY){
+        hmidi->req_state = HMIDI_REQ_DONE; // blocks are optional info
+      }
+      break;
+
+    case HMIDI_REQ_GET_GTB:
+      req_status = _GetGTB(phost, hmidi, hmidi->gtb_length);
+      if(req_status == USBH_OK){
+        _ParseGTB(hmidi, phost->device.Data, hmidi->gtb_length);
+        hmidi->req_state = HMIDI_REQ_DONE;
+      } else if(req_status != USBH_BUSY){
+        hmidi->req_state = HMIDI_REQ_DONE;
+      }
+      break;
+
+    case HMIDI_REQ_DONE:
+      status = USBH_OK;
+      break;
+
+    default:
+      break;
+  }
+  return status;
+}
+
+static USBH_StatusTypeDef SubClassRequest(USBH_HandleTypeDef* phost, void* hmidi){
+  return _ClassRequest(phost, hmidi);
+}
+
 static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef *phost){
-  phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
+  MIDI_HandleTypeDef* hmidi = (MIDI_HandleTypeDef*)phost->pActiveClass->pData;
+  USBH_StatusTypeDef status = _ClassRequest(phost, hmidi);
+  if(status == USBH_OK){
+    phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
+  }
+  return status;
+}
+
+// wake _Process once a paced sysex stream may send again. runs from the SOF
+// interrupt, so only flags it
+static USBH_StatusTypeDef _SOFProcess(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+  if(hmidi->sx_paced && (int32_t)(phost->Timer - hmidi->sx_due) >= 0){
+    hmidi->sx_paced = 0U;
+#if (USBH_USE_OS == 1U)
+    USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+  }
+#else
+  UNUSED(phost);
+  UNUSED(hmidi);
+#endif
   return USBH_OK;
 }
 
+static USBH_StatusTypeDef SubSOFProcess(USBH_HandleTypeDef* phost, void* hmidi){
+  return _SOFProcess(phost, hmidi);
+}
+
 static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef *phost){
-  UNUSED(phost);  
-  return USBH_OK;
+  MIDI_HandleTypeDef* hmidi = (MIDI_HandleTypeDef*)phost->pActiveClass->pData;
+  if(hmidi == NULL) return USBH_OK;
+  return _SOFProcess(phost, hmidi);
 }
 
 USBH_StatusTypeDef USBH_MIDI_Stop(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
@@ -182,9 +401,7 @@ static USBH_StatusTypeDef _Process(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef
       break;
 
     case HMIDI_ERROR_STATE:
-      if(USBH_ClrFeature(phost, 0x00U) == USBH_OK){
-        hmidi->state = HMIDI_IDLE_STATE;
-      }
+      MIDI_ProcessError(phost, hmidi);
       break;
 
     default:
@@ -212,42 +429,85 @@ uint16_t USBH_MIDI_GetLastReceivedDataSize(USBH_HandleTypeDef *phost, MIDI_Handl
 
 USBH_StatusTypeDef USBH_MIDI_Transmit(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t *pbuff, uint32_t length){
   USBH_StatusTypeDef Status = USBH_BUSY;
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+  if(hmidi->sx_producer != NULL) return Status; // sysex stream owns the pipe
+#endif
   if ((hmidi->state == HMIDI_IDLE_STATE) || (hmidi->state == HMIDI_TRANSFER_DATA)){
     hmidi->pTxData = pbuff;
     hmidi->TxDataLength = length;
+    hmidi->TxWireLength = 0U;
+    hmidi->ump_tx_sysex.pkt_pos = 0U; // a new buffer starts on a packet boundary
     hmidi->state = HMIDI_TRANSFER_DATA;
     hmidi->data_tx_state = HMIDI_SEND_DATA;
+    MIDI_STAT(hmidi->stats.tx_t0 = USBH_MIDI_TIMESTAMP());
     Status = USBH_OK;
   }
   return Status;
 }
 
+// true when received UMP must be converted to MIDI 1.0 for the application
+static uint8_t _TranslateUMP(MIDI_HandleTypeDef* hmidi){
+  return (hmidi->protocol == HMIDI_PROTOCOL_UMP) && (hmidi->ump_mode == HMIDI_UMP_TRANSLATE);
+}
+
+// not USBH_Interrupt*Data for interrupt endpoints: their uint8_t length
+// can't carry a high speed packet
+static void _SubmitURB(USBH_HandleTypeDef *phost, uint8_t pipe, uint8_t type, uint8_t dir,
+                       uint8_t* buff, uint16_t length){
+  if(type == USB_EP_TYPE_INTR){
+    (void)USBH_LL_SubmitURB(phost, pipe, dir, USBH_EP_INTERRUPT, USBH_PID_DATA, buff, length, 0U);
+  } else if(dir){
+    (void)USBH_BulkReceiveData(phost, buff, length, pipe);
+  } else {
+    (void)USBH_BulkSendData(phost, buff, length, pipe, 1U);
+  }
+}
+
+// the HCD writes whole packets, so unless reception is staged through
+// ump_rx the application buffer must have room for a full IN packet
+static uint8_t _RxRoom(MIDI_HandleTypeDef* hmidi){
+  return _TranslateUMP(hmidi) || (hmidi->RxDataLength >= hmidi->InEpSize);
+}
+
+// also runs from the URB interrupt: state only leaves IDLE here, so an
+// ERROR_STATE set by the host thread (eg. for an OUT stall) is never undone
+static void _SubmitRx(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+  uint8_t* dst = hmidi->pRxData;
+  if(!_RxRoom(hmidi)){
+    hmidi->data_rx_state = HMIDI_IDLE;
+    return;
+  }
+#if (USBH_MIDI_UMP_ENABLE == 1U)
+  if(_TranslateUMP(hmidi)) dst = hmidi->ump_rx;
+#endif
+  if(hmidi->state == HMIDI_IDLE_STATE){
+    hmidi->state = HMIDI_TRANSFER_DATA;
+  }
+  hmidi->data_rx_state = HMIDI_RECEIVE_DATA;
+  _SubmitURB(phost, hmidi->InPipe, hmidi->InEpType, 1U, dst, hmidi->InEpSize);
+  hmidi->data_rx_state = HMIDI_RECEIVE_DATA_WAIT;
+}
+
 void USBH_MIDI_StartReception(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t* pbuff, uint32_t length){
+  if(!_TranslateUMP(hmidi) && length < hmidi->InEpSize){
+    USBH_ErrLog("MIDI: receive buffer of %u bytes is below the %u byte IN endpoint",
+                (unsigned)length, (unsigned)hmidi->InEpSize);
+    return;
+  }
   _rx_buffer = pbuff;
   _rx_buf_len = length;
   // submit next URB
   hmidi->pRxData = _rx_buffer;
   hmidi->RxDataLength = _rx_buf_len;
-  hmidi->state = HMIDI_TRANSFER_DATA;
-  hmidi->data_rx_state = HMIDI_RECEIVE_DATA;
-  (void)USBH_BulkReceiveData(phost,
-                             hmidi->pRxData,
-                             hmidi->InEpSize, // should be able to submit ->RxDataLength
-                             hmidi->InPipe);
-  hmidi->data_rx_state = HMIDI_RECEIVE_DATA_WAIT;
+  _SubmitRx(phost, hmidi);
 }
 
 void USBH_MIDI_Retry(USBH_HandleTypeDef* phost, MIDI_HandleTypeDef* hmidi){
   if(_rx_buffer == NULL) return; // not initialized yet
+  if(hmidi->stall_mask) return; // endpoint recovery re-arms reception
   hmidi->pRxData = _rx_buffer;
   hmidi->RxDataLength = _rx_buf_len;
-  hmidi->state = HMIDI_TRANSFER_DATA;
-  hmidi->data_rx_state = HMIDI_RECEIVE_DATA;
-  (void)USBH_BulkReceiveData(phost,
-                             hmidi->pRxData,
-                             hmidi->InEpSize, // should be able to submit ->RxDataLength
-                             hmidi->InPipe);
-  hmidi->data_rx_state = HMIDI_RECEIVE_DATA_WAIT;
+  _SubmitRx(phost, hmidi);
 }
 
 
@@ -263,23 +523,176 @@ USBH_StatusTypeDef USBH_MIDI_Receive(USBH_HandleTypeDef *phost, MIDI_HandleTypeD
   return Status;
 }
 
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+// sysex byte budget allowed by the configured pace
+static uint32_t _SysExBudget(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+  if(hmidi->sx_rate == 0U) return 0xFFFFFFFFU;
+  uint32_t ms = phost->Timer - hmidi->sx_start;
+  if(phost->device.speed == USBH_SPEED_HIGH) ms >>= 3; // timer counts microframes
+  uint64_t allowed = ((uint64_t)(ms + 1U) * hmidi->sx_rate) / 1000U;
+  if(allowed < 3U) allowed = 3U; // always allow the first packet
+  return (allowed > hmidi->sx_sent) ? (uint32_t)(allowed - hmidi->sx_sent) : 0U;
+}
+
+// phost->Timer at which _SysExBudget lets the next byte through
+static uint32_t _SysExDue(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+  uint64_t ms = (((uint64_t)hmidi->sx_sent + 1U) * 1000U + hmidi->sx_rate - 1U) / hmidi->sx_rate;
+  ms -= 1U;
+  if(phost->device.speed == USBH_SPEED_HIGH) ms <<= 3;
+  return hmidi->sx_start + (uint32_t)ms;
+}
+
+static void _SysExPacket(MIDI_HandleTypeDef* hmidi, uint8_t* dst, uint8_t cin){
+  uint8_t* p = hmidi->sx_pending;
+  uint8_t n = hmidi->sx_pending_count;
+  dst[0] = (uint8_t)((hmidi->sx_cable << 4) | cin);
+  dst[1] = p[0];
+  dst[2] = (n > 1) ? p[1] : 0;
+  dst[3] = (n > 2) ? p[2] : 0;
+  hmidi->sx_pending_count = 0;
+}
+
+// pull raw bytes from the producer & encode up to max_pkts USB-MIDI packets
+static uint32_t _SysExEncode(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t* dst, uint32_t max_pkts){
+  uint32_t budget = _SysExBudget(phost, hmidi);
+  uint32_t n = 0;
+  while(n < max_pkts && budget){
+    if(hmidi->sx_raw_pos == hmidi->sx_raw_len){
+      if(hmidi->sx_eof) break;
+      uint32_t got = hmidi->sx_producer(hmidi->sx_ctx, hmidi->sx_raw, sizeof(hmidi->sx_raw));
+      if(got > sizeof(hmidi->sx_raw)) got = sizeof(hmidi->sx_raw);
+      hmidi->sx_raw_len = (uint16_t)got;
+      hmidi->sx_raw_pos = 0;
+      if(got == 0U){
+        hmidi->sx_eof = 1;
+        break;
+      }
+    }
+    uint8_t b = hmidi->sx_raw[hmidi->sx_raw_pos++];
+    budget--;
+    hmidi->sx_sent++;
+    hmidi->sx_pending[hmidi->sx_pending_count++] = b;
+    if(b == 0xF7){ // CIN 0x5/0x6/0x7: sysex ends with 1/2/3 bytes
+      _SysExPacket(hmidi, &dst[n++ * 4U], (uint8_t)(0x4 + hmidi->sx_pending_count));
+    } else if(hmidi->sx_pending_count == 3U){ // CIN 0x4: sysex starts or continues
+      _SysExPacket(hmidi, &dst[n++ * 4U], 0x4);
+    }
+  }
+  if(hmidi->sx_eof && hmidi->sx_pending_count && n < max_pkts){ // unterminated tail
+    _SysExPacket(hmidi, &dst[n++ * 4U], (uint8_t)(0x4 + hmidi->sx_pending_count));
+  }
+  return n * 4U;
+}
+
+static uint8_t _SysExDone(MIDI_HandleTypeDef* hmidi){
+  return hmidi->sx_eof && (hmidi->sx_pending_count == 0U)
+      && (hmidi->sx_tx_pos == hmidi->sx_tx_len);
+}
+
+// stage the next chunk of the sysex stream into pTxWire
+static uint32_t _SysExChunk(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+  uint32_t len;
+#if (USBH_MIDI_UMP_ENABLE == 1U)
+  if(hmidi->protocol == HMIDI_PROTOCOL_UMP){
+    // packets the endpoint couldn't take last time are translated first
+    uint32_t max = (hmidi->OutEpSize < USB_MIDI_UMP_BUFFER_SIZE) ? hmidi->OutEpSize
+                                                                 : USB_MIDI_UMP_BUFFER_SIZE;
+    uint32_t consumed;
+    do{ // bytes held back by the translator produce no UMP yet: keep going
+      if(hmidi->sx_tx_pos == hmidi->sx_tx_len){
+        hmidi->sx_tx_len = (uint16_t)_SysExEncode(phost, hmidi, hmidi->sx_tx, 4U);
+        hmidi->sx_tx_pos = 0U;
+      }
+      len = USBH_MIDI_UMP_FromMIDI1(&hmidi->ump_tx_sysex,
+                                    &hmidi->sx_tx[hmidi->sx_tx_pos],
+                                    (uint32_t)(hmidi->sx_tx_len - hmidi->sx_tx_pos),
+                                    hmidi->ump_tx, max,
+                                    &consumed);
+      if(len == 0U && consumed == 0U && hmidi->sx_tx_pos != hmidi->sx_tx_len){
+        // the endpoint can't carry a sysex UMP: end the stream
+        USBH_ErrLog("MIDI: %u byte OUT endpoint too small for UMP", (unsigned)hmidi->OutEpSize);
+        (void)USBH_memset(&hmidi->ump_tx_sysex, 0, sizeof(hmidi->ump_tx_sysex));
+        hmidi->sx_eof = 1U;
+        hmidi->sx_pending_count = 0U;
+        hmidi->sx_tx_pos = hmidi->sx_tx_len;
+        break;
+      }
+      hmidi->sx_tx_pos = (uint16_t)(hmidi->sx_tx_pos + consumed);
+    } while(len == 0U && consumed != 0U);
+    hmidi->pTxWire = hmidi->ump_tx;
+    return len;
+  }
+#endif
+  uint32_t max = (hmidi->OutEpSize < sizeof(hmidi->sx_tx)) ? hmidi->OutEpSize
+                                                           : sizeof(hmidi->sx_tx);
+  len = _SysExEncode(phost, hmidi, hmidi->sx_tx, max / 4U);
+  hmidi->pTxWire = hmidi->sx_tx;
+  return len;
+}
+#endif
+
 static void MIDI_ProcessTransmission(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
   USBH_URBStateTypeDef URB_Status = USBH_URB_IDLE;
   switch (hmidi->data_tx_state){
     case HMIDI_SEND_DATA:
-      if (hmidi->TxDataLength > hmidi->OutEpSize){
-        (void)USBH_BulkSendData(phost,
-                                hmidi->pTxData,
-                                hmidi->OutEpSize,
-                                hmidi->OutPipe,
-                                1U);
+      if(hmidi->TxWireLength != 0U){
+        // retrying a chunk the device NAKed. it's already encoded
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+      } else if(hmidi->sx_producer != NULL){
+        hmidi->TxChunkLength = 0U;
+        hmidi->TxWireLength = (uint16_t)_SysExChunk(phost, hmidi);
+        if(hmidi->TxWireLength == 0U){
+          if(_SysExDone(hmidi)){
+            hmidi->sx_producer = NULL;
+            hmidi->data_tx_state = HMIDI_IDLE;
+            MIDI_STAT(_HistAdd(&hmidi->stats.tx_latency, USBH_MIDI_TIMESTAMP() - hmidi->stats.tx_t0));
+            USBH_MIDI_SysExTransmitCallback(phost, hmidi);
+          } else { // waiting on the pace: SOFProcess wakes us once it's due
+            hmidi->sx_due = _SysExDue(phost, hmidi);
+            hmidi->sx_paced = 1U;
+          }
+          break;
+        }
+#endif
+#if (USBH_MIDI_UMP_ENABLE == 1U)
+      } else if(_TranslateUMP(hmidi)){
+        uint32_t max = (hmidi->OutEpSize < USB_MIDI_UMP_BUFFER_SIZE) ? hmidi->OutEpSize
+                                                                     : USB_MIDI_UMP_BUFFER_SIZE;
+        uint32_t consumed = 0;
+        hmidi->pTxWire = hmidi->ump_tx;
+        hmidi->TxWireLength = (uint16_t)USBH_MIDI_UMP_FromMIDI1(&hmidi->ump_tx_sysex,
+                                                                hmidi->pTxData, hmidi->TxDataLength,
+                                                                hmidi->ump_tx, max,
+                                                                &consumed);
+        hmidi->TxChunkLength = (uint16_t)consumed;
+        if(hmidi->TxWireLength == 0U && consumed == 0U){
+          // the endpoint can't carry the next UMP: drop the rest of the buffer
+          USBH_ErrLog("MIDI: %u byte OUT endpoint too small for UMP", (unsigned)hmidi->OutEpSize);
+          (void)USBH_memset(&hmidi->ump_tx_sysex, 0, sizeof(hmidi->ump_tx_sysex));
+          hmidi->TxDataLength = 0U;
+          hmidi->data_tx_state = HMIDI_IDLE;
+          USBH_MIDI_TransmitCallback(phost, hmidi);
+          break;
+        }
+        if(hmidi->TxWireLength == 0U){ // nothing to put on the wire (eg. mid-sysex)
+          hmidi->TxDataLength -= hmidi->TxChunkLength;
+          hmidi->pTxData += hmidi->TxChunkLength;
+          if(hmidi->TxDataLength < 4U){
+            hmidi->TxDataLength = 0U;
+            hmidi->data_tx_state = HMIDI_IDLE;
+            USBH_MIDI_TransmitCallback(phost, hmidi);
+          }
+          break;
+        }
+#endif
       } else {
-        (void)USBH_BulkSendData(phost,
-                                hmidi->pTxData,
-                                (uint16_t)hmidi->TxDataLength,
-                                hmidi->OutPipe,
-                                1U);
+        hmidi->pTxWire = hmidi->pTxData;
+        hmidi->TxWireLength = (hmidi->TxDataLength > hmidi->OutEpSize) ? hmidi->OutEpSize
+                                                                       : hmidi->TxDataLength;
+        hmidi->TxChunkLength = hmidi->TxWireLength;
       }
+      _SubmitURB(phost, hmidi->OutPipe, hmidi->OutEpType, 0U,
+                 hmidi->pTxWire, hmidi->TxWireLength);
       hmidi->data_tx_state = HMIDI_SEND_DATA_WAIT;
       break;
 
@@ -287,21 +700,43 @@ static void MIDI_ProcessTransmission(USBH_HandleTypeDef *phost, MIDI_HandleTypeD
       URB_Status = USBH_LL_GetURBState(phost, hmidi->OutPipe);
       /* Check the status done for transmission */
       if (URB_Status == USBH_URB_DONE){
-        if (hmidi->TxDataLength > hmidi->OutEpSize){
-          hmidi->TxDataLength -= hmidi->OutEpSize;
-          hmidi->pTxData += hmidi->OutEpSize;
+        MIDI_STAT(hmidi->stats.tx_urbs++);
+        MIDI_STAT(hmidi->stats.tx_bytes += hmidi->TxWireLength);
+        hmidi->TxWireLength = 0U;
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+        if(hmidi->sx_producer != NULL){ // streaming: encode the next chunk
+          hmidi->data_tx_state = HMIDI_SEND_DATA;
+          break;
+        }
+#endif
+        if (hmidi->TxDataLength > hmidi->TxChunkLength){
+          hmidi->TxDataLength -= hmidi->TxChunkLength;
+          hmidi->pTxData += hmidi->TxChunkLength;
         } else {
           hmidi->TxDataLength = 0U;
         }
+        if(_TranslateUMP(hmidi) && hmidi->TxDataLength < 4U){
+          hmidi->TxDataLength = 0U; // trailing partial packet can't be translated
+        }
 
         if (hmidi->TxDataLength > 0U){
           hmidi->data_tx_state = HMIDI_SEND_DATA;
         } else {
           hmidi->data_tx_state = HMIDI_IDLE;
+          MIDI_STAT(_HistAdd(&hmidi->stats.tx_latency, USBH_MIDI_TIMESTAMP() - hmidi->stats.tx_t0));
           USBH_MIDI_TransmitCallback(phost, hmidi);
         }
       } else if (URB_Status == USBH_URB_NOTREADY){
+        MIDI_STAT(hmidi->stats.tx_naks++);
         hmidi->data_tx_state = HMIDI_SEND_DATA;
+      } else if (URB_Status == USBH_URB_STALL){
+        // TxWireLength is kept so the staged chunk goes out again after recovery
+        hmidi->stall_mask |= HMIDI_STALL_OUT;
+        hmidi->data_tx_state = HMIDI_SEND_DATA;
+        hmidi->state = HMIDI_ERROR_STATE;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
       }
       break;
 
@@ -310,23 +745,221 @@ static void MIDI_ProcessTransmission(USBH_HandleTypeDef *phost, MIDI_HandleTypeD
   }
 }
 
+// clear each halted data endpoint in turn, reset its data toggle & resume
+// whichever transfers were pending
+static void MIDI_ProcessError(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+  uint8_t ep = 0x00U;
+  uint8_t pipe = 0U;
+  uint8_t bit = 0U;
+  if(hmidi->stall_mask & HMIDI_STALL_IN){
+    ep = hmidi->InEp;
+    pipe = hmidi->InPipe;
+    bit = HMIDI_STALL_IN;
+  } else if(hmidi->stall_mask & HMIDI_STALL_OUT){
+    ep = hmidi->OutEp;
+    pipe = hmidi->OutPipe;
+    bit = HMIDI_STALL_OUT;
+  }
+
+  USBH_StatusTypeDef req_status = USBH_ClrFeature(phost, ep);
+  if(req_status == USBH_BUSY){
+    return;
+  }
+  if(bit != 0U){
+    if(req_status == USBH_OK){
+      (void)USBH_LL_SetToggle(phost, pipe, 0U);
+      hmidi->stall_mask &= (uint8_t)~bit;
+      hmidi->stall_count++;
+      if(hmidi->stall_mask != 0U){
+        return; // clear the other endpoint next
+      }
+    } else { // endpoint can't be recovered: abandon the transfers
+      USBH_ErrLog("MIDI: failed to clear halt on endpoint 0x%02x", ep);
+      hmidi->stall_mask = 0U;
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+      hmidi->sx_producer = NULL;
+#endif
+      hmidi->TxWireLength = 0U;
+      hmidi->data_tx_state = HMIDI_IDLE;
+      hmidi->data_rx_state = HMIDI_IDLE;
+    }
+  }
+  hmidi->state = (hmidi->data_tx_state != HMIDI_IDLE) ? HMIDI_TRANSFER_DATA
+                                                      : HMIDI_IDLE_STATE;
+  if(hmidi->data_rx_state == HMIDI_RECEIVE_DATA && _rx_buffer != NULL){
+    _SubmitRx(phost, hmidi);
+  }
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+// pull sysex packets out of the received chunk & hand them over incrementally
+static void _SysExFlush(USBH_HandleTypeDef* phost, MIDI_HandleTypeDef* hmidi, uint8_t complete){
+  if(hmidi->sx_rx_len || complete){
+    USBH_MIDI_SysExReceiveCallback(phost, hmidi, hmidi->sx_rx_cable,
+                                   hmidi->sx_rx, hmidi->sx_rx_len, complete);
+  }
+  hmidi->sx_rx_len = 0;
+}
+
+static uint32_t _ExtractSysEx(USBH_HandleTypeDef* phost, MIDI_HandleTypeDef* hmidi, uint8_t* pkts, uint32_t length){
+  uint32_t kept = 0;
+  for(uint32_t i=0; i + 4U <= length; i += 4U){
+    uint8_t cin = pkts[i] & 0xF;
+    uint8_t cable = pkts[i] >> 4;
+    uint8_t* b = &pkts[i+1];
+    uint8_t n = 0;
+    if(cin == 0x4) n = 3;
+    else if(cin == 0x6 || cin == 0x7) n = (uint8_t)(cin - 0x4);
+    else if(cin == 0x5 && b[0] == 0xF7) n = 1; // else single byte system common
+
+    if(n == 0){ // not sysex: keep in the receive buffer
+      if(kept != i){
+        (void)USBH_memcpy(&pkts[kept], &pkts[i], 4U);
+      }
+      kept += 4U;
+      continue;
+    }
+    if(hmidi->sx_rx_len && cable != hmidi->sx_rx_cable){
+      _SysExFlush(phost, hmidi, 0);
+    }
+    hmidi->sx_rx_cable = cable;
+    for(uint8_t k=0; k<n; k++){
+      hmidi->sx_rx[hmidi->sx_rx_len++] = b[k];
+    }
+    if(cin != 0x4){
+      _SysExFlush(phost, hmidi, 1);
+    } else if(hmidi->sx_rx_len + 3U > sizeof(hmidi->sx_rx)){
+      _SysExFlush(phost, hmidi, 0);
+    }
+  }
+  _SysExFlush(phost, hmidi, 0); // deliver what arrived in this packet
+  return kept;
+}
+#endif
+
+static uint8_t _RouteMatch(const USBH_MIDI_RouteTypeDef* r, const uint8_t* pkt){
+  uint8_t cin = pkt[0] & 0xF;
+  uint8_t status = pkt[1];
+  if(!(r->cin_mask & (1U << cin))) return 0;
+  if(r->cable != USBH_MIDI_ROUTE_ANY_CABLE && r->cable != (pkt[0] >> 4)) return 0;
+  if(r->status != USBH_MIDI_ROUTE_ANY_STATUS){
+    uint8_t s = (r->status < 0xF0) ? (status & 0xF0) : status;
+    if(s != r->status) return 0;
+  }
+  if(cin >= 0x8 && cin <= 0xE && !(r->chn_mask & (1U << (status & 0xF)))) return 0;
+  return 1;
+}
+
+static void _RingPush(USBH_MIDI_RingTypeDef* ring, const uint8_t* pkt){
+  uint16_t head = ring->head;
+  if((uint16_t)(head - ring->tail) >= ring->size){
+    ring->overflow++;
+    return;
+  }
+  (void)USBH_memcpy(&ring->buf[head & (ring->size - 1U)], pkt, sizeof(midi_package_t));
+  ring->head = head + 1U;
+}
+
+// apply the route table to freshly received packets, compacting the events
+// which stay in the receive buffer. returns the number of bytes kept.
+static uint32_t _ApplyRoutes(MIDI_HandleTypeDef* hmidi, uint8_t* pkts, uint32_t length){
+  // count first: SetRoutes zeroes it before swapping the table
+  uint8_t count = hmidi->route_count;
+  const USBH_MIDI_RouteTypeDef* routes = hmidi->routes;
+  uint32_t kept = 0;
+  for(uint32_t i=0; i + 4U <= length; i += 4U){
+    const USBH_MIDI_RouteTypeDef* r = NULL;
+    for(uint8_t k=0; k<count; k++){
+      if(_RouteMatch(&routes[k], &pkts[i])){
+        r = &routes[k];
+        break;
+      }
+    }
+    if(r == NULL){ // unrouted: keep for ReceiveCallback
+      if(kept != i){
+        (void)USBH_memcpy(&pkts[kept], &pkts[i], 4U);
+      }
+      kept += 4U;
+    } else if(r->dest != USBH_MIDI_ROUTE_DROP){
+      _RingPush(r->dest, &pkts[i]);
+    }
+  }
+  return kept;
+}
+
+// end of a receive burst: hand the collected events to the application.
+// the next URB is only submitted by USBH_MIDI_Retry from the 1ms timer
+static void _RxDone(USBH_HandleTypeDef* phost, MIDI_HandleTypeDef* hmidi){
+  uint8_t filtered = (hmidi->route_count != 0U);
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+  filtered |= hmidi->sx_rx_enable;
+#endif
+  hmidi->data_rx_state = HMIDI_IDLE;
+  int total_length = _rx_buf_len - hmidi->RxDataLength;
+#if (USBH_MIDI_STATS == 1U)
+  if(hmidi->stats.rx_armed){
+    _HistAdd(&hmidi->stats.rx_latency, USBH_MIDI_TIMESTAMP() - hmidi->stats.rx_t0);
+    hmidi->stats.rx_armed = 0;
+  }
+  hmidi->stats.rx_bursts++;
+#endif
+  if(total_length > 0 || !filtered){ // no wakeup if everything was routed away
+    USBH_MIDI_ReceiveCallback(phost, hmidi, total_length);
+  }
+}
+
 static void URB_Done(USBH_HandleTypeDef* phost, MIDI_HandleTypeDef* hmidi, uint32_t length){
+  if(USBH_LL_GetURBState(phost, hmidi->InPipe) == USBH_URB_STALL){
+    // leave the buffer position as is & re-arm from _Process after recovery
+    hmidi->stall_mask |= HMIDI_STALL_IN;
+    hmidi->data_rx_state = HMIDI_RECEIVE_DATA;
+    hmidi->state = HMIDI_ERROR_STATE;
+#if (USBH_USE_OS == 1U)
+    USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+    return;
+  }
   if(length > 0){ // increment pointers & immediately resubmit URB to get remaining data
+#if (USBH_MIDI_STATS == 1U)
+    if(!hmidi->stats.rx_armed){
+      hmidi->stats.rx_t0 = USBH_MIDI_TIMESTAMP();
+      hmidi->stats.rx_armed = 1;
+    }
+    hmidi->stats.rx_urbs++;
+#endif
+#if (USBH_MIDI_UMP_ENABLE == 1U)
+    if(_TranslateUMP(hmidi)){ // convert staged UMP into the application buffer
+      length = USBH_MIDI_UMP_ToMIDI1(&hmidi->ump_rx_sysex,
+                                     hmidi->ump_rx, length,
+                                     hmidi->pRxData, hmidi->RxDataLength,
+                                     &hmidi->ump_dropped);
+    }
+#endif
+    MIDI_STAT(hmidi->stats.rx_events += length / 4U);
+    if(!(hmidi->protocol == HMIDI_PROTOCOL_UMP && hmidi->ump_mode == HMIDI_UMP_NATIVE)){
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+      if(hmidi->sx_rx_enable){
+        length = _ExtractSysEx(phost, hmidi, hmidi->pRxData, length);
+      }
+#endif
+      if(hmidi->route_count){
+        length = _ApplyRoutes(hmidi, hmidi->pRxData, length);
+      }
+    }
     hmidi->RxDataLength -= length;
     hmidi->pRxData += length;
-    hmidi->state = HMIDI_TRANSFER_DATA;
-    hmidi->data_rx_state = HMIDI_RECEIVE_DATA;
-    (void)USBH_BulkReceiveData(phost,
-                               hmidi->pRxData,
-                               hmidi->InEpSize, // should be able to submit ->RxDataLength
-                               hmidi->InPipe);
-    hmidi->data_rx_state = HMIDI_RECEIVE_DATA_WAIT;
+    if(_RxRoom(hmidi)){
+      _SubmitRx(phost, hmidi);
+    } else { // buffer full: deliver now rather than overrun it
+      _RxDone(phost, hmidi);
+    }
   } else {
-    hmidi->data_rx_state = HMIDI_IDLE;
-    int total_length = _rx_buf_len - hmidi->RxDataLength;
-    USBH_MIDI_ReceiveCallback(phost, hmidi, total_length);
     // DONT submit URB immediately
     // instead wait for 1ms timer to resubmit
+    _RxDone(phost, hmidi);
   }
 }
 
@@ -338,6 +971,121 @@ void USBH_MIDI_URBDoneCallback(int chnum){
   }
 }
 
+HMIDI_ProtocolTypeDef USBH_MIDI_GetProtocol(MIDI_HandleTypeDef* hmidi){
+  return hmidi->protocol;
+}
+
+// choose whether the application sees raw UMP or translated MIDI 1.0 packets
+// only has effect on UMP devices. call before StartReception.
+void USBH_MIDI_SetUMPMode(MIDI_HandleTypeDef* hmidi, HMIDI_UMPModeTypeDef mode){
+  hmidi->ump_mode = mode;
+}
+
+// send native UMP words. requires a UMP device & HMIDI_UMP_NATIVE mode
+USBH_StatusTypeDef USBH_MIDI_UMP_Transmit(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint32_t *words, uint32_t count){
+  if(hmidi->protocol != HMIDI_PROTOCOL_UMP || hmidi->ump_mode != HMIDI_UMP_NATIVE){
+    return USBH_NOT_SUPPORTED;
+  }
+  return USBH_MIDI_Transmit(phost, hmidi, (uint8_t*)words, count * 4U);
+}
+
+uint8_t USBH_MIDI_GetGroupTerminalBlocks(MIDI_HandleTypeDef* hmidi, const MIDI_GroupTerminalBlockTypeDef** gtb){
+  *gtb = hmidi->gtb;
+  return hmidi->gtb_count;
+}
+
+// install a route table (kept by reference). pass count 0 to disable routing.
+// routes only apply to USB-MIDI 1.0 packets, not to native UMP reception.
+// both fields are volatile so the stores land in this order: the URB
+// interrupt sees either no routing or a table with its own count
+void USBH_MIDI_SetRoutes(MIDI_HandleTypeDef* hmidi, const USBH_MIDI_RouteTypeDef* routes, uint8_t count){
+  hmidi->route_count = 0; // disable while the table is swapped
+  hmidi->routes = routes;
+  hmidi->route_count = (routes != NULL) ? count : 0;
+}
+
+// size must be a power of 2 as positions are masked. a rejected ring is left
+// empty with size 0, so events routed to it are only counted as overflow
+USBH_StatusTypeDef USBH_MIDI_RingInit(USBH_MIDI_RingTypeDef* ring, midi_package_t* buf, uint16_t size){
+  ring->buf = NULL;
+  ring->size = 0;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->overflow = 0;
+  if(buf == NULL || size == 0U || (size & (size - 1U)) != 0U){
+    return USBH_FAIL;
+  }
+  ring->buf = buf;
+  ring->size = size;
+  return USBH_OK;
+}
+
+uint16_t USBH_MIDI_RingAvailable(USBH_MIDI_RingTypeDef* ring){
+  return (uint16_t)(ring->head - ring->tail);
+}
+
+uint16_t USBH_MIDI_RingRead(USBH_MIDI_RingTypeDef* ring, midi_package_t* dst, uint16_t count){
+  uint16_t tail = ring->tail;
+  uint16_t avail = (uint16_t)(ring->head - tail);
+  if(count > avail) count = avail;
+  for(uint16_t i=0; i<count; i++){
+    dst[i] = ring->buf[(tail + i) & (ring->size - 1U)];
+  }
+  ring->tail = tail + count;
+  return count;
+}
+
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+// stream a sysex dump pulled from producer, paced to bytes_per_sec (0 = as
+// fast as the device accepts). USBH_MIDI_SysExTransmitCallback fires at the end.
+USBH_StatusTypeDef USBH_MIDI_SysExTransmit(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t cable, USBH_MIDI_SysExProducerTypeDef producer, void* ctx, uint32_t bytes_per_sec){
+  USBH_StatusTypeDef Status = USBH_BUSY;
+  if(producer == NULL) return USBH_FAIL;
+  if(((hmidi->state == HMIDI_IDLE_STATE) || (hmidi->state == HMIDI_TRANSFER_DATA))
+  && (hmidi->data_tx_state == HMIDI_IDLE)){
+    hmidi->sx_ctx = ctx;
+    hmidi->sx_cable = cable & 0xF;
+    hmidi->sx_eof = 0;
+    hmidi->sx_pending_count = 0;
+    hmidi->sx_raw_len = 0;
+    hmidi->sx_raw_pos = 0;
+    hmidi->sx_tx_len = 0;
+    hmidi->sx_tx_pos = 0;
+    hmidi->sx_rate = bytes_per_sec;
+    hmidi->sx_start = phost->Timer;
+    hmidi->sx_sent = 0;
+    hmidi->sx_paced = 0U;
+    hmidi->TxWireLength = 0;
+    hmidi->sx_producer = producer;
+    hmidi->state = HMIDI_TRANSFER_DATA;
+    hmidi->data_tx_state = HMIDI_SEND_DATA;
+    MIDI_STAT(hmidi->stats.tx_t0 = USBH_MIDI_TIMESTAMP());
+#if (USBH_USE_OS == 1U)
+    USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+    Status = USBH_OK;
+  }
+  return Status;
+}
+
+// deliver received sysex through USBH_MIDI_SysExReceiveCallback (from the URB
+// interrupt) instead of the receive buffer
+void USBH_MIDI_SysExReceive(MIDI_HandleTypeDef* hmidi, uint8_t enable){
+  hmidi->sx_rx_len = 0;
+  hmidi->sx_rx_enable = enable;
+}
+#endif
+
+#if (USBH_MIDI_STATS == 1U)
+const USBH_MIDI_StatsTypeDef* USBH_MIDI_GetStats(MIDI_HandleTypeDef* hmidi){
+  return &hmidi->stats;
+}
+
+void USBH_MIDI_ResetStats(MIDI_HandleTypeDef* hmidi){
+  (void)USBH_memset(&hmidi->stats, 0, sizeof(hmidi->stats));
+}
+#endif
+
 __weak void USBH_MIDI_TransmitCallback(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
   UNUSED(phost);
   UNUSED(hmidi);
@@ -347,3 +1095,19 @@ __weak void USBH_MIDI_ReceiveCallback(USBH_HandleTypeDef *phost, MIDI_HandleType
   UNUSED(phost);
   UNUSED(hmidi);
 }
+
+#if (USBH_MIDI_SYSEX_ENABLE == 1U)
+__weak void USBH_MIDI_SysExTransmitCallback(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi){
+  UNUSED(phost);
+  UNUSED(hmidi);
+}
+
+__weak void USBH_MIDI_SysExReceiveCallback(USBH_HandleTypeDef *phost, MIDI_HandleTypeDef* hmidi, uint8_t cable, uint8_t* data, uint16_t length, uint8_t complete){
+  UNUSED(phost);
+  UNUSED(hmidi);
+  UNUSED(cable);
+  UNUSED(data);
+  UNUSED(length);
+  UNUSED(complete);
+}
+#endif
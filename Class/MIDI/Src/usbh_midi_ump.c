@@ -0,0 +1,310 @@
+#include "usbh_midi_ump.h"
+
+// words per packet, indexed by message type
+static const uint8_t ump_word_count[16] = {
+  1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4
+};
+
+uint8_t USBH_MIDI_UMP_WordCount(uint32_t word0){
+  return ump_word_count[word0 >> 28];
+}
+
+static uint32_t _get_word(const uint8_t* p){
+  return (uint32_t)p[0]
+       | ((uint32_t)p[1] << 8)
+       | ((uint32_t)p[2] << 16)
+       | ((uint32_t)p[3] << 24);
+}
+
+static void _put_word(uint8_t* p, uint32_t w){
+  p[0] = (uint8_t)w;
+  p[1] = (uint8_t)(w >> 8);
+  p[2] = (uint8_t)(w >> 16);
+  p[3] = (uint8_t)(w >> 24);
+}
+
+
+///////////////////////////////////
+// UMP -> USB-MIDI 1.0
+
+typedef struct{
+  uint8_t* pkts;
+  uint32_t len;
+  uint32_t max;
+  uint32_t* dropped;
+} midi1_out_t;
+
+static void _emit(midi1_out_t* o, uint8_t cable, uint8_t cin, uint8_t b0, uint8_t b1, uint8_t b2){
+  if(o->len + 4 > o->max){
+    (*o->dropped)++;
+    return;
+  }
+  uint8_t* p = &o->pkts[o->len];
+  p[0] = (uint8_t)((cable << 4) | cin);
+  p[1] = b0;
+  p[2] = b1;
+  p[3] = b2;
+  o->len += 4;
+}
+
+static void _emit_cc(midi1_out_t* o, uint8_t group, uint8_t status, uint8_t cc, uint8_t value){
+  _emit(o, group, 0xB, status, cc, value);
+}
+
+// sysex bytes are batched into 3 byte CIN 0x4 packets. the final packet
+// carries the F7 with CIN 0x5/0x6/0x7 depending on how many bytes remain.
+static void _sysex_push(midi1_out_t* o, MIDI_UMPSysExTypeDef* sx, uint8_t byte){
+  if(sx->count == 3){
+    _emit(o, sx->group, 0x4, sx->data[0], sx->data[1], sx->data[2]);
+    sx->count = 0;
+  }
+  sx->data[sx->count++] = byte;
+}
+
+static void _sysex_end(midi1_out_t* o, MIDI_UMPSysExTypeDef* sx){
+  _sysex_push(o, sx, 0xF7);
+  _emit(o, sx->group, (uint8_t)(0x4 + sx->count),
+        sx->data[0],
+        (sx->count > 1) ? sx->data[1] : 0,
+        (sx->count > 2) ? sx->data[2] : 0);
+  sx->count = 0;
+  sx->started = 0;
+}
+
+static void _from_data64(midi1_out_t* o, MIDI_UMPSysExTypeDef* sx, uint32_t w0, uint32_t w1){
+  uint8_t group = (w0 >> 24) & 0xF;
+  uint8_t status = (w0 >> 20) & 0xF;
+  uint8_t n = (w0 >> 16) & 0xF;
+  uint8_t bytes[6] = { (uint8_t)(w0 >> 8), (uint8_t)w0
+                     , (uint8_t)(w1 >> 24), (uint8_t)(w1 >> 16)
+                     , (uint8_t)(w1 >> 8), (uint8_t)w1 };
+  if(n > 6) n = 6;
+
+  if(status == UMP_SYSEX_COMPLETE || status == UMP_SYSEX_START){
+    sx->group = group;
+    sx->count = 0;
+    sx->started = 1;
+    _sysex_push(o, sx, 0xF0);
+  } else if(!sx->started){
+    return; // continuation without a start. ignore
+  }
+  for(uint8_t i=0; i<n; i++){
+    _sysex_push(o, sx, bytes[i] & 0x7F);
+  }
+  if(status == UMP_SYSEX_COMPLETE || status == UMP_SYSEX_END){
+    _sysex_end(o, sx);
+  }
+}
+
+static void _from_system(midi1_out_t* o, uint32_t w0){
+  uint8_t group = (w0 >> 24) & 0xF;
+  uint8_t status = (uint8_t)(w0 >> 16);
+  uint8_t d1 = (w0 >> 8) & 0x7F;
+  uint8_t d2 = w0 & 0x7F;
+  switch(status){
+    case 0xF1: // MTC quarter frame
+    case 0xF3: // song select
+      _emit(o, group, 0x2, status, d1, 0);
+      break;
+    case 0xF2: // song position
+      _emit(o, group, 0x3, status, d1, d2);
+      break;
+    case 0xF6: // tune request
+      _emit(o, group, 0x5, status, 0, 0);
+      break;
+    default:
+      if(status >= 0xF8){ // realtime
+        _emit(o, group, 0xF, status, 0, 0);
+      }
+      break;
+  }
+}
+
+// MIDI 2.0 channel voice messages are scaled down to 7/14 bit resolution
+static void _from_midi2_voice(midi1_out_t* o, uint32_t w0, uint32_t w1){
+  uint8_t group = (w0 >> 24) & 0xF;
+  uint8_t opcode = (w0 >> 20) & 0xF;
+  uint8_t status = (uint8_t)((w0 >> 16) & 0xFF);
+  uint8_t idx = (w0 >> 8) & 0x7F;
+  uint8_t idx2 = w0 & 0x7F;
+  uint8_t chn_status = (uint8_t)(0xB0 | (status & 0xF));
+  uint8_t v7;
+  uint16_t v14;
+
+  switch(opcode){
+    case NoteOff:
+      _emit(o, group, NoteOff, status, idx, (uint8_t)(w1 >> 25));
+      break;
+    case NoteOn:
+      v7 = (uint8_t)(w1 >> 25);
+      if(v7 == 0) v7 = 1; // velocity 0 is a note-off in MIDI 1.0
+      _emit(o, group, NoteOn, status, idx, v7);
+      break;
+    case PolyPressure:
+      _emit(o, group, PolyPressure, status, idx, (uint8_t)(w1 >> 25));
+      break;
+    case CC:
+      _emit(o, group, CC, status, idx, (uint8_t)(w1 >> 25));
+      break;
+    case ProgramChange:
+      if(w0 & 0x1){ // bank valid
+        _emit_cc(o, group, chn_status, 0, (w1 >> 8) & 0x7F);
+        _emit_cc(o, group, chn_status, 32, w1 & 0x7F);
+      }
+      _emit(o, group, ProgramChange, status, (w1 >> 24) & 0x7F, 0);
+      break;
+    case Aftertouch:
+      _emit(o, group, Aftertouch, status, (uint8_t)(w1 >> 25), 0);
+      break;
+    case PitchBend:
+      v14 = (uint16_t)(w1 >> 18);
+      _emit(o, group, PitchBend, status, v14 & 0x7F, (v14 >> 7) & 0x7F);
+      break;
+    case 0x2: // registered controller -> RPN
+    case 0x3: // assignable controller -> NRPN
+      v14 = (uint16_t)(w1 >> 18);
+      _emit_cc(o, group, chn_status, (opcode == 0x2) ? 101 : 99, idx);
+      _emit_cc(o, group, chn_status, (opcode == 0x2) ? 100 : 98, idx2);
+      _emit_cc(o, group, chn_status, 6, (v14 >> 7) & 0x7F);
+      _emit_cc(o, group, chn_status, 38, v14 & 0x7F);
+      break;
+    default: // per-note controllers & management have no MIDI 1.0 equivalent
+      break;
+  }
+}
+
+uint32_t USBH_MIDI_UMP_ToMIDI1(MIDI_UMPSysExTypeDef* sx,
+                               const uint8_t* ump, uint32_t length,
+                               uint8_t* pkts, uint32_t max_length,
+                               uint32_t* dropped){
+  midi1_out_t o = { pkts, 0, max_length, dropped };
+  uint32_t i = 0;
+  while(i + 4 <= length){
+    uint32_t w0 = _get_word(&ump[i]);
+    uint32_t words = USBH_MIDI_UMP_WordCount(w0);
+    if(i + words*4 > length) break; // truncated packet
+    uint32_t w1 = (words > 1) ? _get_word(&ump[i+4]) : 0;
+
+    switch(w0 >> 28){
+      case UMP_MT_SYSTEM:
+        _from_system(&o, w0);
+        break;
+      case UMP_MT_MIDI1_VOICE: // already MIDI 1.0, just re-wrap
+        _emit(&o, (w0 >> 24) & 0xF, (w0 >> 20) & 0xF
+                , (uint8_t)(w0 >> 16), (w0 >> 8) & 0x7F, w0 & 0x7F);
+        break;
+      case UMP_MT_DATA64:
+        _from_data64(&o, sx, w0, w1);
+        break;
+      case UMP_MT_MIDI2_VOICE:
+        _from_midi2_voice(&o, w0, w1);
+        break;
+      default: // utility, stream, flex & sysex8 are dropped
+        break;
+    }
+    i += words*4;
+  }
+  return o.len;
+}
+
+
+///////////////////////////////////
+// USB-MIDI 1.0 -> UMP
+
+static uint32_t _put_sysex(uint8_t* ump, MIDI_UMPSysExTypeDef* sx, uint8_t status){
+  uint8_t* d = sx->data;
+  _put_word(ump, ((uint32_t)UMP_MT_DATA64 << 28)
+               | ((uint32_t)sx->group << 24)
+               | ((uint32_t)status << 20)
+               | ((uint32_t)sx->count << 16)
+               | ((uint32_t)d[0] << 8)
+               | d[1]);
+  _put_word(&ump[4], ((uint32_t)d[2] << 24)
+                   | ((uint32_t)d[3] << 16)
+                   | ((uint32_t)d[4] << 8)
+                   | d[5]);
+  (void)USBH_memset(sx->data, 0, sizeof(sx->data));
+  sx->count = 0;
+  return 8;
+}
+
+// returns bytes written to ump (0 or 8)
+static uint32_t _sysex_byte(uint8_t* ump, MIDI_UMPSysExTypeDef* sx, uint8_t group, uint8_t byte){
+  if(byte == 0xF0){
+    (void)USBH_memset(sx->data, 0, sizeof(sx->data));
+    sx->group = group;
+    sx->count = 0;
+    sx->started = 1;
+    return 0;
+  }
+  if(!sx->started) return 0; // not inside a sysex
+  if(byte == 0xF7){
+    uint8_t status = (sx->started == 2) ? UMP_SYSEX_END : UMP_SYSEX_COMPLETE;
+    sx->started = 0;
+    return _put_sysex(ump, sx, status);
+  }
+  sx->data[sx->count++] = byte;
+  if(sx->count == 6){
+    uint8_t status = (sx->started == 2) ? UMP_SYSEX_CONTINUE : UMP_SYSEX_START;
+    sx->started = 2;
+    return _put_sysex(ump, sx, status);
+  }
+  return 0;
+}
+
+// true when _sysex_byte would write a UMP for byte
+static uint8_t _sysex_emits(const MIDI_UMPSysExTypeDef* sx, uint8_t byte){
+  if(!sx->started || byte == 0xF0) return 0;
+  return (byte == 0xF7) || (sx->count == 5);
+}
+
+uint32_t USBH_MIDI_UMP_FromMIDI1(MIDI_UMPSysExTypeDef* sx,
+                                 const uint8_t* pkts, uint32_t length,
+                                 uint8_t* ump, uint32_t max_length,
+                                 uint32_t* consumed){
+  uint32_t len = 0;
+  uint32_t i = 0;
+  for(; i + 4 <= length; i += 4){
+    uint8_t cin = pkts[i] & 0xF;
+    uint8_t group = pkts[i] >> 4;
+    const uint8_t* b = &pkts[i+1];
+    // CIN 0x5 is shared between sysex-end & single byte system common
+    uint8_t is_sysex = (cin == 0x4) || (cin == 0x6) || (cin == 0x7)
+                    || ((cin == 0x5) && (b[0] == 0xF7));
+
+    if(!is_sysex && len + 4 > max_length) break;
+
+    if(is_sysex){
+      // translated byte by byte, so a packet whose UMPs don't all fit is
+      // resumed at sx->pkt_pos by the next call
+      uint8_t n = (cin == 0x4) ? 3 : (uint8_t)(cin - 0x4);
+      while(sx->pkt_pos < n){
+        uint8_t byte = b[sx->pkt_pos];
+        if(len + 8 > max_length && _sysex_emits(sx, byte)) break;
+        len += _sysex_byte(&ump[len], sx, group, byte);
+        sx->pkt_pos++;
+      }
+      if(sx->pkt_pos < n) break;
+      sx->pkt_pos = 0;
+    } else if(cin >= 0x8 && cin <= 0xE){ // channel voice
+      _put_word(&ump[len], ((uint32_t)UMP_MT_MIDI1_VOICE << 28)
+                         | ((uint32_t)group << 24)
+                         | ((uint32_t)b[0] << 16)
+                         | ((uint32_t)b[1] << 8)
+                         | b[2]);
+      len += 4;
+    } else if(cin == 0x2 || cin == 0x3 || cin == 0x5 || cin == 0xF){ // system common & realtime
+      if(b[0] >= 0xF1 && b[0] != 0xF7){
+        _put_word(&ump[len], ((uint32_t)UMP_MT_SYSTEM << 28)
+                           | ((uint32_t)group << 24)
+                           | ((uint32_t)b[0] << 16)
+                           | ((uint32_t)((cin != 0x5 && cin != 0xF) ? b[1] : 0) << 8)
+                           | ((cin == 0x3) ? b[2] : 0));
+        len += 4;
+      }
+    }
+    // CIN 0x0 & 0x1 are reserved
+  }
+  *consumed = i;
+  return len;
+}
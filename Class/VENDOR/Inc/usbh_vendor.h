@@ -0,0 +1,132 @@
+#pragma once
+
+#include "usbh_core.h"
+
+// Vendor specific bulk & interrupt devices, with libusb style async transfers
+//
+// Transfers are queued per endpoint with USBH_VENDOR_Submit & complete, in
+// submission order, through their callback from USBH_Process. A host channel
+// carries one URB at a time, so the queue is what keeps an endpoint busy: the
+// next URB goes out in the same pass that retires the previous one, before
+// the callback runs, & with USBH_USE_OS every URB change wakes the host thread.
+// Callbacks may resubmit their transfer.
+//
+// Matches the devices listed with USBH_VENDOR_SetIds, otherwise any device
+// with a class 0xFF interface, so register it after more specific classes
+// (eg. CDC_VCP_Class).
+
+extern USBH_ClassTypeDef  VENDOR_Class;
+#define USBH_VENDOR_CLASS    &VENDOR_Class
+
+#define USB_VENDOR_CLASS                                        0xFFU
+#define USBH_VENDOR_ANY_PID                                     0xFFFFU
+
+// endpoints opened on the claimed interface
+#ifndef USBH_VENDOR_MAX_EP
+#define USBH_VENDOR_MAX_EP                                      4U
+#endif
+
+// transfers queued per endpoint. power of 2, at most 128
+#ifndef USBH_VENDOR_QUEUE_DEPTH
+#define USBH_VENDOR_QUEUE_DEPTH                                 8U
+#endif
+
+// bulk packets per URB, 0 for as many whole packets as the transfer (& a
+// 16 bit URB length) allows. the HCD splits larger URBs itself, which saves a
+// turnaround through USBH_Process per packet on high speed
+#ifndef USBH_VENDOR_URB_PACKETS
+#define USBH_VENDOR_URB_PACKETS                                 0U
+#endif
+
+// transfer flags
+#define VENDOR_XFER_ZLP                                         0x01U // OUT: end a full packet transfer with a ZLP
+#define VENDOR_XFER_SHORT_NOT_OK                                0x02U // IN: a short transfer is an ERROR
+
+typedef enum{
+  VENDOR_XFER_PENDING = 0U,  // queued or on the wire
+  VENDOR_XFER_COMPLETED,
+  VENDOR_XFER_TIMED_OUT,
+  VENDOR_XFER_CANCELLED,
+  VENDOR_XFER_STALL,         // the halt is cleared before the next transfer starts
+  VENDOR_XFER_ERROR,
+  VENDOR_XFER_NO_DEVICE,     // device went away with the transfer queued
+} VENDOR_XferStatusTypeDef;
+
+struct _VENDOR_Transfer;
+typedef void (*VENDOR_XferCallbackTypeDef)(USBH_HandleTypeDef* phost, struct _VENDOR_Transfer* xfer);
+
+// owned by the driver from Submit until its callback
+typedef struct _VENDOR_Transfer{
+  uint8_t*                    buffer;
+  uint32_t                    length;
+  uint32_t                    timeout;   // ms from reaching the wire, 0 = never
+  uint8_t                     flags;     // VENDOR_XFER_*
+  VENDOR_XferCallbackTypeDef  callback;
+  void*                       user_data;
+
+  // results
+  VENDOR_XferStatusTypeDef    status;
+  uint32_t                    actual;    // bytes transferred
+  uint8_t                     endpoint;
+
+  // driver private
+  uint8_t                     started;
+  volatile uint8_t            cancel;
+  uint32_t                    start;     // phost->Timer at the first URB
+} VENDOR_TransferTypeDef;
+
+typedef struct{
+  uint16_t vid;
+  uint16_t pid; // or USBH_VENDOR_ANY_PID
+} VENDOR_IdTypeDef;
+
+typedef struct{
+  uint8_t                 addr;
+  uint8_t                 type;      // USB_EP_TYPE_BULK or USB_EP_TYPE_INTR
+  uint8_t                 pipe;
+  uint16_t                size;
+  uint16_t                poll;      // interrupt endpoints: timer ticks between URBs
+  uint32_t                poll_timer;
+
+  VENDOR_TransferTypeDef* queue[USBH_VENDOR_QUEUE_DEPTH];
+  volatile uint8_t        head;      // next free slot, written by Submit
+  volatile uint8_t        tail;      // transfer being worked on
+  uint8_t                 busy;      // URB on the wire
+  uint8_t                 zlp;       // ZLP still owed for the current transfer
+  uint32_t                chunk;     // bytes in the URB on the wire
+  uint8_t                 stalled;   // waiting for CLEAR_FEATURE(ENDPOINT_HALT)
+  uint8_t                 wait;      // interrupt endpoints: URB held for the next interval
+  VENDOR_XferStatusTypeDef abort;    // how the transfer on a halting channel completes, PENDING if none
+  uint32_t                halt_timer; // phost->Timer when the pipe was closed
+
+  uint32_t                transfers; // completed
+  uint32_t                bytes;
+} VENDOR_EndpointTypeDef;
+
+typedef struct _VENDOR_Process{
+  uint8_t                 itf_num;
+  uint8_t                 ep_count;
+  uint8_t                 flushing;  // DeInit is completing the queues as NO_DEVICE
+  VENDOR_EndpointTypeDef  ep[USBH_VENDOR_MAX_EP];
+} VENDOR_HandleTypeDef;
+
+// devices to claim by VID/PID (kept by reference). call before USBH_Start
+void USBH_VENDOR_SetIds(const VENDOR_IdTypeDef* ids, uint8_t count);
+
+// address of the first endpoint of the given direction & type, 0 if none
+uint8_t USBH_VENDOR_FindEndpoint(VENDOR_HandleTypeDef* hven, uint8_t dir_in, uint8_t type);
+
+// BUSY if the endpoint's queue is full. FAIL for an unknown endpoint, while
+// the device is going away, or for an IN transfer whose length isn't a
+// multiple of the endpoint's packet size: the device may always send a full
+// packet & the HCD would write it past the buffer
+USBH_StatusTypeDef USBH_VENDOR_Submit(USBH_HandleTypeDef* phost, VENDOR_HandleTypeDef* hven,
+                                      uint8_t endpoint, VENDOR_TransferTypeDef* xfer);
+
+// the transfer completes as CANCELLED through its callback. FAIL if it isn't pending
+USBH_StatusTypeDef USBH_VENDOR_Cancel(USBH_HandleTypeDef* phost, VENDOR_HandleTypeDef* hven,
+                                      VENDOR_TransferTypeDef* xfer);
+void USBH_VENDOR_CancelAll(USBH_HandleTypeDef* phost, VENDOR_HandleTypeDef* hven, uint8_t endpoint);
+
+// transfers queued or on the wire
+uint8_t USBH_VENDOR_Pending(VENDOR_HandleTypeDef* hven, uint8_t endpoint);
@@ -0,0 +1,521 @@
+#include "usbh_vendor.h"
+
+#define VENDOR_QUEUE_MASK                    (USBH_VENDOR_QUEUE_DEPTH - 1U)
+// (micro)frames after USBH_ClosePipe by which the channel has halted: the
+// halt takes effect at the end of the transaction in progress
+#define VENDOR_HALT_FRAMES                   2U
+
+static USBH_StatusTypeDef Match(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost);
+static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef* phost);
+
+USBH_ClassTypeDef VENDOR_Class = {
+  "VENDOR",
+  USB_VENDOR_CLASS,
+  Match,
+  Init,
+  DeInit,
+  ClassRequest,
+  Process,
+  SOFProcess,
+  NULL,
+};
+
+static const VENDOR_IdTypeDef* vendor_ids = NULL;
+static uint8_t vendor_id_count = 0U;
+
+void USBH_VENDOR_SetIds(const VENDOR_IdTypeDef* ids, uint8_t count){
+  vendor_ids = ids;
+  vendor_id_count = (ids != NULL) ? count : 0U;
+}
+
+///////////////////////////////////
+// enumeration
+
+static uint8_t VENDOR_IdListed(USBH_HandleTypeDef* phost){
+  for(uint8_t i=0; i<vendor_id_count; i++){
+    if((vendor_ids[i].vid == phost->device.DevDesc.idVendor)
+    && ((vendor_ids[i].pid == USBH_VENDOR_ANY_PID) || (vendor_ids[i].pid == phost->device.DevDesc.idProduct))){
+      return 1U;
+    }
+  }
+  return 0U;
+}
+
+static uint8_t VENDOR_HasEndpoints(USBH_InterfaceDescTypeDef* itf){
+  uint8_t num_ep = itf->bNumEndpoints;
+  if(num_ep > USBH_MAX_NUM_ENDPOINTS) num_ep = USBH_MAX_NUM_ENDPOINTS;
+  for(uint8_t i=0; i<num_ep; i++){
+    uint8_t type = itf->Ep_Desc[i].bmAttributes & 0x03U;
+    if((type == USB_EP_TYPE_BULK) || (type == USB_EP_TYPE_INTR)){
+      return 1U;
+    }
+  }
+  return 0U;
+}
+
+// first class 0xFF interface with bulk or interrupt endpoints. a listed
+// device may instead offer them on any interface
+static uint8_t VENDOR_FindInterface(USBH_HandleTypeDef* phost){
+  uint8_t listed = VENDOR_IdListed(phost);
+  uint8_t fallback = 0xFFU;
+  uint8_t num_itf = phost->device.CfgDesc.bNumInterfaces;
+  if(num_itf > USBH_MAX_NUM_INTERFACES) num_itf = USBH_MAX_NUM_INTERFACES;
+
+  for(uint8_t i=0; i<num_itf; i++){
+    USBH_InterfaceDescTypeDef* itf = &phost->device.CfgDesc.Itf_Desc[i];
+    if((itf->bAlternateSetting != 0U) || !VENDOR_HasEndpoints(itf)) continue;
+    if(itf->bInterfaceClass == USB_VENDOR_CLASS){
+      return i;
+    }
+    if(listed && (fallback == 0xFFU)){
+      fallback = i;
+    }
+  }
+  return fallback;
+}
+
+static USBH_StatusTypeDef Match(USBH_HandleTypeDef* phost){
+  return (VENDOR_FindInterface(phost) != 0xFFU) ? USBH_OK : USBH_FAIL;
+}
+
+static USBH_StatusTypeDef Init(USBH_HandleTypeDef* phost){
+  uint8_t interface = VENDOR_FindInterface(phost);
+  if(interface == 0xFFU){
+    USBH_DbgLog("Cannot Find the interface for %s class.", phost->pActiveClass->Name);
+    return USBH_FAIL;
+  }
+  if(USBH_SelectInterface(phost, interface) != USBH_OK){
+    return USBH_FAIL;
+  }
+
+  VENDOR_HandleTypeDef* hven = (VENDOR_HandleTypeDef*)USBH_malloc(sizeof(VENDOR_HandleTypeDef));
+  if(!hven){
+    USBH_DbgLog("Cannot allocate memory for VENDOR Handle");
+    return USBH_FAIL;
+  }
+  (void)USBH_memset(hven, 0, sizeof(VENDOR_HandleTypeDef));
+  phost->pActiveClass->pData = (void*)hven;
+
+  USBH_InterfaceDescTypeDef* itf = &phost->device.CfgDesc.Itf_Desc[interface];
+  hven->itf_num = itf->bInterfaceNumber;
+
+  uint8_t num_ep = itf->bNumEndpoints;
+  if(num_ep > USBH_MAX_NUM_ENDPOINTS) num_ep = USBH_MAX_NUM_ENDPOINTS;
+  for(uint8_t i=0; (i<num_ep) && (hven->ep_count < USBH_VENDOR_MAX_EP); i++){
+    USBH_EpDescTypeDef* desc = &itf->Ep_Desc[i];
+    uint8_t type = desc->bmAttributes & 0x03U;
+    if((type != USB_EP_TYPE_BULK) && (type != USB_EP_TYPE_INTR)) continue;
+    if((desc->wMaxPacketSize & 0x7FFU) == 0U) continue;
+
+    VENDOR_EndpointTypeDef* ep = &hven->ep[hven->ep_count];
+    ep->addr = desc->bEndpointAddress;
+    ep->type = type;
+    ep->size = desc->wMaxPacketSize & 0x7FFU; // bits 11-12: high bandwidth packets per microframe
+    if(type == USB_EP_TYPE_INTR){
+      if(phost->device.speed == USBH_SPEED_HIGH){ // bInterval is 2^(n-1) microframes
+        uint8_t n = (desc->bInterval < 1U) ? 1U : ((desc->bInterval > 16U) ? 16U : desc->bInterval);
+        ep->poll = (uint16_t)(1U << (n - 1U));
+      } else {
+        ep->poll = (desc->bInterval < 1U) ? 1U : desc->bInterval;
+      }
+    }
+
+    ep->pipe = USBH_AllocPipe(phost, ep->addr);
+    if(ep->pipe == 0xFFU){ // out of host channels: leave the endpoint out
+      USBH_ErrLog("VENDOR: no pipe for endpoint 0x%02x", ep->addr);
+      (void)USBH_memset(ep, 0, sizeof(VENDOR_EndpointTypeDef));
+      continue;
+    }
+    (void)USBH_OpenPipe(phost, ep->pipe, ep->addr,
+                        phost->device.address, phost->device.speed, type,
+                        ep->size);
+    (void)USBH_LL_SetToggle(phost, ep->pipe, 0U);
+    hven->ep_count++;
+  }
+  return USBH_OK;
+}
+
+static void VENDOR_Flush(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep,
+                         VENDOR_XferStatusTypeDef status);
+
+static USBH_StatusTypeDef DeInit(USBH_HandleTypeDef* phost){
+  VENDOR_HandleTypeDef* hven = (VENDOR_HandleTypeDef*)phost->pActiveClass->pData;
+  if(hven){
+    hven->flushing = 1U; // callbacks can't resubmit into the queues being flushed
+    for(uint8_t i=0; i<hven->ep_count; i++){
+      VENDOR_EndpointTypeDef* ep = &hven->ep[i];
+      if(ep->pipe){
+        (void)USBH_ClosePipe(phost, ep->pipe);
+        (void)USBH_FreePipe(phost, ep->pipe);
+        ep->pipe = 0U;
+      }
+      ep->busy = 0U;
+      VENDOR_Flush(phost, ep, VENDOR_XFER_NO_DEVICE);
+    }
+    USBH_free(hven);
+    phost->pActiveClass->pData = 0U;
+  }
+  return USBH_OK;
+}
+
+static USBH_StatusTypeDef ClassRequest(USBH_HandleTypeDef* phost){
+  phost->pUser(phost, HOST_USER_CLASS_ACTIVE);
+  return USBH_OK;
+}
+
+///////////////////////////////////
+// transfer engine
+
+static VENDOR_EndpointTypeDef* VENDOR_GetEndpoint(VENDOR_HandleTypeDef* hven, uint8_t addr){
+  for(uint8_t i=0; i<hven->ep_count; i++){
+    if(hven->ep[i].addr == addr){
+      return &hven->ep[i];
+    }
+  }
+  return NULL;
+}
+
+static VENDOR_TransferTypeDef* VENDOR_Current(VENDOR_EndpointTypeDef* ep){
+  return (ep->head != ep->tail) ? ep->queue[ep->tail & VENDOR_QUEUE_MASK] : NULL;
+}
+
+static uint32_t VENDOR_Ticks(USBH_HandleTypeDef* phost, uint32_t ms){
+  return (phost->device.speed == USBH_SPEED_HIGH) ? (ms << 3) : ms; // timer counts microframes
+}
+
+static uint8_t VENDOR_Expired(USBH_HandleTypeDef* phost, VENDOR_TransferTypeDef* xfer){
+  return (xfer->timeout != 0U) && ((phost->Timer - xfer->start) >= VENDOR_Ticks(phost, xfer->timeout));
+}
+
+static void VENDOR_SubmitUrb(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep,
+                             VENDOR_TransferTypeDef* xfer){
+  uint32_t max = (ep->type == USB_EP_TYPE_INTR) ? ep->size
+                                                : (uint32_t)ep->size * USBH_VENDOR_URB_PACKETS;
+  if((max == 0U) || (max > 0xFFFFU)) max = 0xFFFFU - (0xFFFFU % ep->size); // whole packets in a URB length
+  uint32_t chunk = xfer->length - xfer->actual; // 0 sends the ZLP
+  if(chunk > max) chunk = max;
+  uint8_t* buf = xfer->buffer + xfer->actual;
+
+  ep->chunk = chunk;
+  ep->busy = 1U;
+  ep->wait = 0U;
+  if(ep->type == USB_EP_TYPE_INTR){
+    // not USBH_Interrupt*Data: their uint8_t length can't carry a high speed packet
+    ep->poll_timer = phost->Timer;
+    (void)USBH_LL_SubmitURB(phost, ep->pipe, (ep->addr & 0x80U) ? 1U : 0U, USBH_EP_INTERRUPT,
+                            USBH_PID_DATA, buf, (uint16_t)chunk, 0U);
+  } else if(ep->addr & 0x80U){
+    (void)USBH_BulkReceiveData(phost, buf, (uint16_t)chunk, ep->pipe);
+  } else {
+    (void)USBH_BulkSendData(phost, buf, (uint16_t)chunk, ep->pipe, 1U);
+  }
+}
+
+// put the head of the queue on the wire, if it's due
+static void VENDOR_Start(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep){
+  VENDOR_TransferTypeDef* xfer = VENDOR_Current(ep);
+  if((xfer == NULL) || ep->busy || ep->stalled || xfer->cancel) return;
+  if((ep->type == USB_EP_TYPE_INTR) && ((phost->Timer - ep->poll_timer) < ep->poll)){
+    ep->wait = 1U; // SOFProcess wakes us once it's due
+    return;
+  }
+  if(!xfer->started){
+    xfer->started = 1U;
+    xfer->start = phost->Timer;
+    ep->zlp = (xfer->flags & VENDOR_XFER_ZLP) && !(ep->addr & 0x80U)
+           && (xfer->length > 0U) && ((xfer->length % ep->size) == 0U);
+  }
+  VENDOR_SubmitUrb(phost, ep, xfer);
+}
+
+// complete the transfer at the tail. the next one is issued before the
+// callback so the endpoint doesn't wait on the application
+static void VENDOR_Retire(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep,
+                          VENDOR_XferStatusTypeDef status){
+  VENDOR_TransferTypeDef* xfer = VENDOR_Current(ep);
+  ep->busy = 0U;
+  ep->tail++;
+  xfer->status = status;
+  if(status == VENDOR_XFER_COMPLETED){
+    ep->transfers++;
+  }
+  ep->bytes += xfer->actual;
+  VENDOR_Start(phost, ep);
+  if(xfer->callback != NULL){
+    xfer->callback(phost, xfer);
+  }
+}
+
+static void VENDOR_Flush(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep,
+                         VENDOR_XferStatusTypeDef status){
+  while(ep->head != ep->tail){
+    VENDOR_TransferTypeDef* xfer = VENDOR_Current(ep);
+    ep->tail++;
+    xfer->status = status;
+    if(xfer->callback != NULL){
+      xfer->callback(phost, xfer);
+    }
+  }
+}
+
+// halt the URB on the wire. USBH_ClosePipe only requests the halt, so the
+// transfer keeps its buffer until VENDOR_HALT_FRAMES have passed & the HCD
+// can no longer write to it
+static void VENDOR_Abort(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep,
+                         VENDOR_XferStatusTypeDef status){
+  (void)USBH_ClosePipe(phost, ep->pipe);
+  ep->abort = status;
+  ep->halt_timer = phost->Timer;
+}
+
+// retire the aborted transfer once its channel has halted. the channel may
+// stop between a packet & its handshake, so the data toggle is resynced on
+// both sides with CLEAR_FEATURE(ENDPOINT_HALT) before the next transfer starts
+static void VENDOR_ProcessHalt(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep,
+                               VENDOR_TransferTypeDef* xfer){
+  if((phost->Timer - ep->halt_timer) < VENDOR_HALT_FRAMES){
+    return; // SOFProcess wakes us once the channel is halted
+  }
+  // keep a URB which completed before the halt took effect
+  if(USBH_LL_GetURBState(phost, ep->pipe) == USBH_URB_DONE){
+    uint32_t length = (ep->addr & 0x80U) ? USBH_LL_GetLastXferSize(phost, ep->pipe) : ep->chunk;
+    xfer->actual += (length > ep->chunk) ? ep->chunk : length;
+  }
+  VENDOR_XferStatusTypeDef status = ep->abort;
+  ep->abort = VENDOR_XFER_PENDING;
+  ep->stalled = 1U;
+  VENDOR_Retire(phost, ep, status);
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+static void VENDOR_ProcessEndpoint(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep){
+  // retire cancelled transfers that never reached the wire
+  for(uint8_t n=0; n<USBH_VENDOR_QUEUE_DEPTH; n++){
+    VENDOR_TransferTypeDef* xfer = VENDOR_Current(ep);
+    if((xfer == NULL) || ep->busy || !xfer->cancel) break;
+    VENDOR_Retire(phost, ep, VENDOR_XFER_CANCELLED);
+  }
+
+  VENDOR_TransferTypeDef* xfer = VENDOR_Current(ep);
+  if(xfer == NULL) return;
+  if(!ep->busy){
+    VENDOR_Start(phost, ep);
+    return;
+  }
+  if(ep->abort != VENDOR_XFER_PENDING){
+    VENDOR_ProcessHalt(phost, ep, xfer);
+    return;
+  }
+
+  uint32_t length;
+  switch(USBH_LL_GetURBState(phost, ep->pipe)){
+    case USBH_URB_DONE:
+      ep->busy = 0U;
+      length = (ep->addr & 0x80U) ? USBH_LL_GetLastXferSize(phost, ep->pipe) : ep->chunk;
+      if(length > ep->chunk) length = ep->chunk;
+      xfer->actual += length;
+      if((ep->addr & 0x80U) && (length < ep->chunk)){ // short packet ends an IN transfer
+        VENDOR_Retire(phost, ep, (xfer->flags & VENDOR_XFER_SHORT_NOT_OK) ? VENDOR_XFER_ERROR
+                                                                         : VENDOR_XFER_COMPLETED);
+      } else if(xfer->actual < xfer->length){
+        VENDOR_Start(phost, ep); // next chunk, once an interrupt endpoint is due
+      } else if(ep->zlp){
+        ep->zlp = 0U;
+        VENDOR_Start(phost, ep);
+      } else {
+        VENDOR_Retire(phost, ep, VENDOR_XFER_COMPLETED);
+      }
+#if (USBH_USE_OS == 1U)
+      USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      break;
+
+    case USBH_URB_STALL:
+      ep->stalled = 1U; // cleared in Process before anything else moves
+      VENDOR_Retire(phost, ep, VENDOR_XFER_STALL);
+#if (USBH_USE_OS == 1U)
+      USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      break;
+
+    case USBH_URB_ERROR:
+      VENDOR_Retire(phost, ep, VENDOR_XFER_ERROR);
+#if (USBH_USE_OS == 1U)
+      USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+      break;
+
+    case USBH_URB_NOTREADY:
+      // NAKed: the HCD halts the channel on an interrupt NAK, so the URB is
+      // issued again at the next interval. a bulk OUT goes again right away
+      if((ep->type == USB_EP_TYPE_INTR) && !xfer->cancel && !VENDOR_Expired(phost, xfer)){
+        if((phost->Timer - ep->poll_timer) >= ep->poll){
+          VENDOR_SubmitUrb(phost, ep, xfer);
+        } else {
+          ep->wait = 1U;
+        }
+        break;
+      }
+      if(!(ep->addr & 0x80U) && !xfer->cancel){
+        VENDOR_SubmitUrb(phost, ep, xfer);
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+        break;
+      }
+      /* FALLTHROUGH */
+    default:
+      if(xfer->cancel){
+        VENDOR_Abort(phost, ep, VENDOR_XFER_CANCELLED);
+      } else if(VENDOR_Expired(phost, xfer)){
+        VENDOR_Abort(phost, ep, VENDOR_XFER_TIMED_OUT);
+      }
+#if defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U)
+      else if(USBH_LL_GetURBState(phost, ep->pipe) == USBH_URB_NAK_WAIT){
+        if((phost->Timer - phost->NakTimer) > phost->NakTimeout){
+          phost->NakTimer = phost->Timer;
+          USBH_ActivatePipe(phost, ep->pipe);
+        }
+      }
+#endif /* defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U) */
+      break;
+  }
+}
+
+// clear one halted endpoint at a time, as it takes EP0
+static void VENDOR_ProcessStall(USBH_HandleTypeDef* phost, VENDOR_EndpointTypeDef* ep){
+  USBH_StatusTypeDef req_status = USBH_ClrFeature(phost, ep->addr);
+  if(req_status == USBH_BUSY){
+    return;
+  }
+  if(req_status != USBH_OK){
+    USBH_ErrLog("VENDOR: failed to clear halt on endpoint 0x%02x", ep->addr);
+  }
+  (void)USBH_LL_SetToggle(phost, ep->pipe, 0U);
+  ep->stalled = 0U;
+  VENDOR_Start(phost, ep);
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+static USBH_StatusTypeDef Process(USBH_HandleTypeDef* phost){
+  VENDOR_HandleTypeDef* hven = (VENDOR_HandleTypeDef*)phost->pActiveClass->pData;
+  for(uint8_t i=0; i<hven->ep_count; i++){
+    if(hven->ep[i].stalled){
+      VENDOR_ProcessStall(phost, &hven->ep[i]);
+      return USBH_BUSY;
+    }
+  }
+  for(uint8_t i=0; i<hven->ep_count; i++){
+    VENDOR_ProcessEndpoint(phost, &hven->ep[i]);
+  }
+  return USBH_OK;
+}
+
+// wake the host thread when a waiting interrupt endpoint is due, a transfer
+// on the wire times out or an aborted channel has halted, rather than
+// spinning on the URB state
+static USBH_StatusTypeDef SOFProcess(USBH_HandleTypeDef* phost){
+#if (USBH_USE_OS == 1U)
+  VENDOR_HandleTypeDef* hven = (VENDOR_HandleTypeDef*)phost->pActiveClass->pData;
+  if(hven == NULL) return USBH_OK;
+  for(uint8_t i=0; i<hven->ep_count; i++){
+    VENDOR_EndpointTypeDef* ep = &hven->ep[i];
+    VENDOR_TransferTypeDef* xfer = VENDOR_Current(ep);
+    if(ep->wait && ((phost->Timer - ep->poll_timer) >= ep->poll)){
+      ep->wait = 0U;
+      USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+    } else if(ep->abort != VENDOR_XFER_PENDING){
+      if((phost->Timer - ep->halt_timer) == VENDOR_HALT_FRAMES){
+        USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+      }
+    } else if(ep->busy && (xfer != NULL) && VENDOR_Expired(phost, xfer)){
+      USBH_OS_PutMessage(phost, USBH_URB_EVENT, 0U, 0U);
+    }
+  }
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+  return USBH_OK;
+}
+
+///////////////////////////////////
+// public
+
+uint8_t USBH_VENDOR_FindEndpoint(VENDOR_HandleTypeDef* hven, uint8_t dir_in, uint8_t type){
+  for(uint8_t i=0; i<hven->ep_count; i++){
+    VENDOR_EndpointTypeDef* ep = &hven->ep[i];
+    if((((ep->addr & 0x80U) != 0U) == (dir_in != 0U)) && (ep->type == type)){
+      return ep->addr;
+    }
+  }
+  return 0U;
+}
+
+USBH_StatusTypeDef USBH_VENDOR_Submit(USBH_HandleTypeDef* phost, VENDOR_HandleTypeDef* hven,
+                                      uint8_t endpoint, VENDOR_TransferTypeDef* xfer){
+  VENDOR_EndpointTypeDef* ep = VENDOR_GetEndpoint(hven, endpoint);
+  if((ep == NULL) || (xfer == NULL) || hven->flushing){
+    return USBH_FAIL;
+  }
+  // the HCD takes in whole packets, so an IN transfer needs room for a full last one
+  if((ep->addr & 0x80U) && ((xfer->length == 0U) || ((xfer->length % ep->size) != 0U))){
+    return USBH_FAIL;
+  }
+  if((uint8_t)(ep->head - ep->tail) >= USBH_VENDOR_QUEUE_DEPTH){
+    return USBH_BUSY;
+  }
+  xfer->endpoint = endpoint;
+  xfer->status = VENDOR_XFER_PENDING;
+  xfer->actual = 0U;
+  xfer->started = 0U;
+  xfer->cancel = 0U;
+  ep->queue[ep->head & VENDOR_QUEUE_MASK] = xfer;
+  ep->head++;
+
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+  return USBH_OK;
+}
+
+USBH_StatusTypeDef USBH_VENDOR_Cancel(USBH_HandleTypeDef* phost, VENDOR_HandleTypeDef* hven,
+                                      VENDOR_TransferTypeDef* xfer){
+  if((VENDOR_GetEndpoint(hven, xfer->endpoint) == NULL) || (xfer->status != VENDOR_XFER_PENDING)){
+    return USBH_FAIL;
+  }
+  xfer->cancel = 1U;
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+  return USBH_OK;
+}
+
+void USBH_VENDOR_CancelAll(USBH_HandleTypeDef* phost, VENDOR_HandleTypeDef* hven, uint8_t endpoint){
+  VENDOR_EndpointTypeDef* ep = VENDOR_GetEndpoint(hven, endpoint);
+  if(ep == NULL) return;
+  for(uint8_t i=ep->tail; i!=ep->head; i++){
+    ep->queue[i & VENDOR_QUEUE_MASK]->cancel = 1U;
+  }
+#if (USBH_USE_OS == 1U)
+  USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#else
+  UNUSED(phost);
+#endif /* (USBH_USE_OS == 1U) */
+}
+
+uint8_t USBH_VENDOR_Pending(VENDOR_HandleTypeDef* hven, uint8_t endpoint){
+  VENDOR_EndpointTypeDef* ep = VENDOR_GetEndpoint(hven, endpoint);
+  return (ep != NULL) ? (uint8_t)(ep->head - ep->tail) : 0U;
+}